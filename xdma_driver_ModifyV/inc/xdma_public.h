@@ -62,6 +62,91 @@ DEFINE_GUID(GUID_DEVINTERFACE_XDMA,
 #define IOCTL_XDMA_PERF_GET     XDMA_IOCTL(0x3)
 #define IOCTL_XDMA_ADDRMODE_GET XDMA_IOCTL(0x4)
 #define IOCTL_XDMA_ADDRMODE_SET XDMA_IOCTL(0x5)
+#define IOCTL_XDMA_COMPLETION_GET XDMA_IOCTL(0x6)
+#define IOCTL_XDMA_COMPLETION_SET XDMA_IOCTL(0x7)
+#define IOCTL_XDMA_RING_MAP     XDMA_IOCTL(0x8)
+#define IOCTL_XDMA_RING_RELEASE XDMA_IOCTL(0x9)
+#define IOCTL_XDMA_RX_MODE_GET  XDMA_IOCTL(0xA)
+#define IOCTL_XDMA_RX_MODE_SET  XDMA_IOCTL(0xB)
+
+// gather send on an AXI-ST h2c_* device: the input buffer holds the XDMA_TX_PACKET table, the output
+// buffer the data the packets are taken from (sent to the device)
+#define IOCTL_XDMA_SEND_PACKETS CTL_CODE(FILE_DEVICE_UNKNOWN, 0xC, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+
+// cyclic send on an AXI-ST h2c_* device: the input buffer holds an XDMA_TX_LOOP header followed by
+// the XDMA_TX_PACKET table of one lap, the output buffer the data. The request stays pending while
+// the engine sends the packets over and over - cancel it (or close the file) to stop.
+#define IOCTL_XDMA_SEND_LOOP    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_XDMA_LOOP_CREDIT  XDMA_IOCTL(0xE)
+#define IOCTL_XDMA_RING_STATS   XDMA_IOCTL(0xF)
+#define IOCTL_XDMA_RING_OVERRUN XDMA_IOCTL(0x10)
+
+// vectored transfers of a memory mapped h2c_* (write) or c2h_* (read) device: the input buffer holds
+// the XDMA_IO_VECTOR table, the output buffer the host data. All vectors go in one run of the
+// engine, each to or from its own card address.
+#define IOCTL_XDMA_WRITEV       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x11, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_XDMA_READV        CTL_CODE(FILE_DEVICE_UNKNOWN, 0x12, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+// strided (2D) transfers of a memory mapped h2c_* (write) or c2h_* (read) device: the input buffer
+// holds an XDMA_IO_STRIDE, the output buffer the host data. All rows go in one run of the engine.
+#define IOCTL_XDMA_WRITE_2D     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x13, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+#define IOCTL_XDMA_READ_2D      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x14, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
+// fill card memory through a memory mapped h2c_* device: the input buffer holds an XDMA_IO_FILL,
+// the output buffer the pattern (up to a page) that is repeated over the range
+#define IOCTL_XDMA_FILL         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x15, METHOD_IN_DIRECT, FILE_ANY_ACCESS)
+
+// registered buffers of a memory mapped h2c_* (written to the card) or c2h_* (read from the card)
+// device: a buffer of the process is locked and mapped for dma once (XDMA_BUFFER_REGISTRATION in,
+// ULONG handle out) and stays registered until it is unregistered (ULONG handle in) or the file is
+// closed. Transfers on it take an XDMA_REGISTERED_IO and no buffer of their own.
+#define IOCTL_XDMA_BUFFER_REGISTER   XDMA_IOCTL(0x16)
+#define IOCTL_XDMA_BUFFER_UNREGISTER XDMA_IOCTL(0x17)
+#define IOCTL_XDMA_WRITE_REGISTERED  XDMA_IOCTL(0x18)
+#define IOCTL_XDMA_READ_REGISTERED   XDMA_IOCTL(0x19)
+
+// stored dma programs of a memory mapped h2c_* or c2h_* device: the descriptors of a vector of a
+// registered buffer are built once (XDMA_REGISTERED_IO in, ULONG program out) and run again on
+// every trigger (ULONG program in), from the process or directly on a user event
+// (XDMA_PROGRAM_BINDING in). IOCTL_XDMA_PROGRAM_WAIT waits for runs to complete
+// (XDMA_PROGRAM_WAIT in, XDMA_PROGRAM_STATUS out). Deleted with IOCTL_XDMA_PROGRAM_DELETE (ULONG
+// program in) or when the file is closed.
+#define IOCTL_XDMA_PROGRAM_CREATE    XDMA_IOCTL(0x1A)
+#define IOCTL_XDMA_PROGRAM_DELETE    XDMA_IOCTL(0x1B)
+#define IOCTL_XDMA_PROGRAM_RUN       XDMA_IOCTL(0x1C)
+#define IOCTL_XDMA_PROGRAM_BIND      XDMA_IOCTL(0x1D)
+#define IOCTL_XDMA_PROGRAM_WAIT      XDMA_IOCTL(0x1E)
+
+// completion modes of a dma engine (XDMA_COMPLETION_CONFIG.mode)
+#define XDMA_COMPLETION_MODE_INTERRUPT  (0) // wait for the channel interrupt
+#define XDMA_COMPLETION_MODE_POLL       (1) // spin on the writeback buffer until completion
+#define XDMA_COMPLETION_MODE_HYBRID     (2) // spin for a while, then arm the channel interrupt
+
+// receive modes of an AXI-ST C2H engine (IOCTL_XDMA_RX_MODE_SET)
+#define XDMA_RX_MODE_RING               (0) // reads copy the data out of the driver ring
+#define XDMA_RX_MODE_POSTED             (1) // the buffers of pending reads are the ring
+#define XDMA_RX_MODE_PACKETS            (2) // reads copy whole packets out of the ring, see XDMA_RX_BATCH
+#define XDMA_RX_MODE_PACKETS_TIMESTAMPS (3) // as XDMA_RX_MODE_PACKETS with XDMA_RX_PACKET_TS entries
+
+// what an AXI-ST C2H ring does when the reader falls behind (IOCTL_XDMA_RING_OVERRUN)
+#define XDMA_RING_OVERRUN_BACKPRESSURE  (0) // the engine stops until blocks are read - the card stalls
+#define XDMA_RING_OVERRUN_DROP_OLDEST   (1) // the oldest blocks are dropped to make room for new data
+
+// flags of a block of a mapped AXI-ST C2H ring (XDMA_RING_RESULT.status)
+#define XDMA_RING_RESULT_EOP            (0x1) // the block ends a packet
+
+// flags of a packet of a batch read in XDMA_RX_MODE_PACKETS (XDMA_RX_PACKET.flags)
+#define XDMA_RX_PACKET_EOP              (0x1) // the packet ends with this entry
+#define XDMA_RX_PACKET_TRUNCATED        (0x2) // the rest of the entry did not fit the buffer, dropped
+#define XDMA_RX_PACKET_OVERFLOW         (0x4) // the packet filled the whole ring, continued in the next entry
+#define XDMA_RX_PACKET_DISCONTINUITY    (0x8) // data before this entry was dropped, it may start mid-packet
+
+// flags of a cyclic send (XDMA_TX_LOOP.flags)
+#define XDMA_TX_LOOP_CREDITS            (0x1) // slots are only sent as IOCTL_XDMA_LOOP_CREDIT grants them
+
+// XDMA_PROGRAM_BINDING.eventId of a program which no user event runs
+#define XDMA_PROGRAM_NO_EVENT           (0xFFFFFFFF)
+
 
 // structure for IOCTL_XDMA_PERF_GET
 typedef struct {
@@ -70,5 +155,170 @@ typedef struct {
     UINT64 pendingCount;
 }XDMA_PERF_DATA;
 
+// structure for IOCTL_XDMA_COMPLETION_SET
+typedef struct {
+    ULONG mode;         // XDMA_COMPLETION_MODE_*
+    ULONG maxSpinUs;    // max spin per run in hybrid mode
+}XDMA_COMPLETION_CONFIG;
+
+// structure for IOCTL_XDMA_COMPLETION_GET
+typedef struct {
+    XDMA_COMPLETION_CONFIG config;
+    UINT64 spinCompletions;         // requests found completed while spinning
+    UINT64 interruptCompletions;    // requests completed by the channel interrupt
+    UINT64 spinTimeouts;            // spins given up in favor of the interrupt
+}XDMA_COMPLETION_INFO;
+
+
+// result of a block of a mapped AXI-ST C2H ring - written by the engine
+typedef struct {
+    ULONG status;       // XDMA_RING_RESULT_*
+    ULONG length;       // bytes received into the block
+    ULONG reserved[6];
+}XDMA_RING_RESULT;
+
+// ring indices shared with the process which mapped an AXI-ST C2H ring. The blocks from consumer
+// up to (not including) producer have been received; the process consumes them in place and then
+// advances consumer, which hands them back to the engine.
+typedef struct {
+    volatile ULONG producer;    // next block to be received - written by the driver
+    ULONG reserved_0[15];       // keeps the indices in separate cache lines
+    volatile ULONG consumer;    // next block to be consumed - written by the process
+    ULONG reserved_1[15];
+}XDMA_RING_INDICES;
+
+// header of the buffer returned by a read in XDMA_RX_MODE_PACKETS. The data of the packets follows
+// the header back to back; the table of numPackets XDMA_RX_PACKET entries follows the data at
+// tableOffset (8 byte aligned).
+typedef struct {
+    ULONG numPackets;
+    ULONG tableOffset;
+}XDMA_RX_BATCH;
+
+// packet table entry of XDMA_RX_BATCH
+typedef struct {
+    ULONG length;       // bytes of the packet in the buffer
+    ULONG flags;        // XDMA_RX_PACKET_*
+}XDMA_RX_PACKET;
+
+// packet table entry of XDMA_RX_BATCH in XDMA_RX_MODE_PACKETS_TIMESTAMPS (16 byte aligned table)
+typedef struct {
+    ULONG length;
+    ULONG flags;
+    UINT64 timestampNs; // performance counter time, in ns, the driver saw the last block received
+}XDMA_RX_PACKET_TS;
+
+// packet table entry of IOCTL_XDMA_SEND_PACKETS
+typedef struct {
+    ULONG offset;       // of the packet in the data buffer
+    ULONG length;
+}XDMA_TX_PACKET;
+
+// vector table entry of IOCTL_XDMA_WRITEV and IOCTL_XDMA_READV
+typedef struct {
+    ULONG offset;       // of the piece in the data buffer
+    ULONG length;
+    UINT64 cardAddress; // where the piece goes to or comes from
+}XDMA_IO_VECTOR;
+
+// rectangle of IOCTL_XDMA_WRITE_2D and IOCTL_XDMA_READ_2D, e.g. an image tile: 'rows' rows of
+// 'rowBytes' bytes each, the pitches are the distances from the start of one row to the next
+typedef struct {
+    ULONG offset;       // of the first row in the data buffer
+    ULONG hostPitch;
+    ULONG rows;
+    ULONG rowBytes;
+    UINT64 cardAddress; // of the first row
+    UINT64 cardPitch;
+}XDMA_IO_STRIDE;
+
+// range of IOCTL_XDMA_FILL
+typedef struct {
+    UINT64 cardAddress;
+    UINT64 length;      // bytes to fill, the last copy of the pattern is cut short
+}XDMA_IO_FILL;
+
+// structure for IOCTL_XDMA_BUFFER_REGISTER (input)
+typedef struct {
+    UINT64 address;     // of the buffer in the process
+    UINT64 length;      // up to the max transfer size of the driver
+}XDMA_BUFFER_REGISTRATION;
+
+// structure for IOCTL_XDMA_WRITE_REGISTERED and IOCTL_XDMA_READ_REGISTERED (input). The offset of
+// the vector is within the registered buffer.
+typedef struct {
+    ULONG handle;       // from IOCTL_XDMA_BUFFER_REGISTER
+    ULONG reserved;
+    XDMA_IO_VECTOR vector;
+}XDMA_REGISTERED_IO;
+
+// structure for IOCTL_XDMA_PROGRAM_BIND (input). A user event runs one program at most.
+typedef struct {
+    ULONG program;
+    ULONG eventId;      // user event (0-15) which runs the program, or XDMA_PROGRAM_NO_EVENT
+}XDMA_PROGRAM_BINDING;
+
+// structure for IOCTL_XDMA_PROGRAM_WAIT (input). Returns once runs + failed of the program reach
+// 'runs' (right away for 0), or after 3 seconds.
+typedef struct {
+    ULONG program;
+    ULONG reserved;
+    UINT64 runs;
+}XDMA_PROGRAM_WAIT;
+
+// structure for IOCTL_XDMA_PROGRAM_WAIT (output)
+typedef struct {
+    UINT64 triggers;    // by the process and by the user event
+    UINT64 runs;        // completed
+    UINT64 failed;
+    UINT64 missed;      // triggers while the program was still queued or running
+}XDMA_PROGRAM_STATUS;
+
+// header of the input buffer of IOCTL_XDMA_SEND_LOOP. Each packet of the table is a slot of the
+// loop; slot numbers count on across laps, slot n is packet n % numPackets.
+typedef struct {
+    ULONG flags;        // XDMA_TX_LOOP_*
+    ULONG reserved;
+}XDMA_TX_LOOP;
+
+// structure for IOCTL_XDMA_LOOP_CREDIT (output). The input is an optional ULONG, the number of
+// slots after slotsGranted to send in XDMA_TX_LOOP_CREDITS mode - the process has updated them in
+// place. Slots up to slotsSent + numPackets may be granted.
+typedef struct {
+    UINT64 slotsSent;       // without credits only exact if polled once per 2^24 descriptors
+    UINT64 slotsGranted;    // 0 without XDMA_TX_LOOP_CREDITS
+    ULONG engineStatus;     // status register of the engine, busy bit clear if it stopped on an error
+    ULONG reserved;
+}XDMA_TX_LOOP_STATUS;
+
+// structure for IOCTL_XDMA_RING_STATS - occupancy, descriptor credits and overruns of an AXI-ST C2H
+// ring. The engine only receives into blocks it holds credits for; while it holds none the card is
+// backpressured, unless the overrun policy drops the oldest blocks instead.
+typedef struct {
+    ULONG numBlocks;
+    ULONG occupancy;        // blocks received but not consumed
+    ULONG peakOccupancy;    // most blocks received but not consumed since the ring was set up
+    ULONG creditsHeld;      // blocks the engine may still fill
+    ULONG creditsFreed;     // blocks consumed, their credits wait for the next grant
+    ULONG creditBatch;      // freed blocks collected before a grant - adapts to the consumer
+    UINT64 creditWrites;    // grants written to the engine
+    UINT64 stalls;          // times the engine ran out of credits
+    UINT64 stallNs;         // time the engine spent without credits
+    ULONG overrunPolicy;    // XDMA_RING_OVERRUN_*
+    ULONG reserved;
+    UINT64 overruns;        // times the oldest blocks were dropped
+    UINT64 droppedBlocks;
+    UINT64 droppedBytes;
+}XDMA_RING_STATS;
+
+// structure for IOCTL_XDMA_RING_MAP - addresses in the calling process
+typedef struct {
+    UINT64 data;        // numBlocks * blockSize bytes, block i at data + i * blockSize
+    UINT64 results;     // numBlocks XDMA_RING_RESULT
+    UINT64 indices;     // XDMA_RING_INDICES
+    ULONG numBlocks;
+    ULONG blockSize;
+}XDMA_RING_MAPPING;
+
 #endif/*__XDMA_WINDOWS_H__*/
 
@@ -26,6 +26,7 @@
 #include "interrupt.h"
 #include "dma_engine.h"
 #include "xdma_public.h"
+#include "xdma.h"
 
 #include "trace.h"
 #ifdef DBG
@@ -36,22 +37,22 @@
 
 // ====================== Function declarations ========================================================
 
-// ºΪɷҳ
+// 将以下函数声明为可分页代码
 #ifdef ALLOC_PRAGMA
 
 #endif
 
 /*
-WDK 10 ̬Ԥ Windows 10
-˽鲻Ҫʹ MmMapIoSpace MmMapIoSpaceEx
-Ǵ˹ Win 10 ֮ǰİ汾вáô˾档
+WDK 10 静态代码分析功能预计针对 Windows 10，
+因此建议不要使用 MmMapIoSpace，而改用 MmMapIoSpaceEx。
+但是此功能在 Win 10 之前的版本中不可用。因此请禁用此警告。
 */
 // see https://social.msdn.microsoft.com/Forums/en-US/f8a3fb63-10de-481c-b629-8b5f3d254c5e/unexpected-code-analysis-behavior?forum=wdk
 #pragma warning (disable : 30029) 
 
 // ====================== constants ========================================================
 
-// XMDA IP˵İ汾
+// XMDA IP核的版本常量
 typedef enum XDMA_IP_VERSION_T {
     v2015_4 = 1,
     v2016_1 = 2,
@@ -65,14 +66,14 @@ typedef enum XDMA_IP_VERSION_T {
 
 // ====================== static functions ========================================================
 
-// ȡ XDMA IP˰汾
+// 获取 XDMA IP核版本
 static XDMA_IP_VERSION GetVersion(IN OUT PXDMA_DEVICE xdma) {
     XDMA_IP_VERSION version = xdma->configRegs->identifier & 0x000000ffUL;
     TraceVerbose(DBG_INIT, "version is 0x%x", version);
     return version;
 }
 
-// ʹĬֵʼ XDMA_DEVICE ṹ
+// 使用默认值初始化 XDMA_DEVICE 结构
 static void DeviceDefaultInitialize(IN PXDMA_DEVICE xdma) {
     ASSERT(xdma != NULL);
 
@@ -96,19 +97,25 @@ static void DeviceDefaultInitialize(IN PXDMA_DEVICE xdma) {
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
             xdma->engines[ch][dir].enabled = FALSE;
             xdma->engines[ch][dir].poll = FALSE;
+            xdma->engines[ch][dir].completionMode = XDMA_COMPLETION_MODE_INTERRUPT;
+            xdma->engines[ch][dir].poller = NULL;
         }
     }
 
     // interrupts - nothing to do
 
+    // poller thread - started on request
+    xdma->poller.thread = NULL;
+
     // user events
     for (int i = 0; i < XDMA_MAX_USER_IRQ; i++) {
         xdma->userEvents[i].work = NULL;
         xdma->userEvents[i].userData = NULL;
+        xdma->userEvents[i].program = NULL;
     }
 }
 
-//  PCIe Դ BARS ӳ䵽ڴ
+// 遍历 PCIe 资源并将 BARS 映射到主机内存中
 static NTSTATUS MapBARs(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesTranslated) {
 
     const ULONG numResources = WdfCmResourceListGetCount(ResourcesTranslated);
@@ -150,7 +157,7 @@ static BOOLEAN IsConfigBAR(IN PXDMA_DEVICE xdma, IN UINT idx) {
     return ((interruptID == XDMA_ID) && (configID == XDMA_ID)) ? TRUE : FALSE;
 }
 
-// ȷĸ BAR  BAR
+// 确定哪个 BAR 是配置 BAR
 static UINT FindConfigBAR(IN PXDMA_DEVICE xdma) {
     for (UINT i = 0; i < xdma->numBars; ++i) {
         if (IsConfigBAR(xdma, i)) {
@@ -158,10 +165,10 @@ static UINT FindConfigBAR(IN PXDMA_DEVICE xdma) {
             return i;
         }
     }
-    return xdma->numBars; //δҵ-س
+    return xdma->numBars; //未找到-返回超过结束索引
 }
 
-// ʶ BAR
+// 识别所有 BAR
 static NTSTATUS IdentifyBars(IN PXDMA_DEVICE xdma) {
 
     // find DMA config BAR (usually BAR1, see section 'Target Bridge' in [1]) 
@@ -171,28 +178,28 @@ static NTSTATUS IdentifyBars(IN PXDMA_DEVICE xdma) {
         return STATUS_DRIVER_INTERNAL_ERROR;
     }
     /*
-    ߼:
-    д xdma->configBarIdx ֵ configBarIdx  1ʾ BAR  BAR1
-    ôͽ userBarIdx Ϊ 0ʾû BAR Ϊ BAR0
-     configBarIdx  1 userBarIdx Ϊ -1ʾû BAR ڡ
-
-    :    
-    ĳЩӲУBAR0 ͨûݴ䣬 BAR1 áˣ BAR  BAR1ζû BAR  BAR0
-    дȷûݴЧԡ
+    逻辑:
+    这行代码检查 xdma->configBarIdx 的值。如果 configBarIdx 等于 1，表示配置 BAR 是 BAR1，
+    那么就将 userBarIdx 设置为 0，表示用户 BAR 存在且为 BAR0。
+    如果 configBarIdx 不等于 1，则将 userBarIdx 设置为 -1，表示用户 BAR 不存在。
+
+    意义:    
+    在某些硬件设计中，BAR0 通常用于用户数据传输，而 BAR1 用于配置。因此，如果配置 BAR 是 BAR1，意味着用户 BAR 是 BAR0。
+    这行代码帮助驱动程序确定用户数据传输的有效性。
     */
     xdma->userBarIdx = xdma->configBarIdx == 1 ? 0 : -1;
 
     /*
-    ߼:
-    д xdma->numBars - xdma->configBarIdx ֵֵ 2
-    ʾ BAR ֮ BAR· BAR ڣô bypassBarIdx Ϊ xdma->numBars - 1
-    ʾ· BAR һ BAR
-     bypassBarIdx Ϊ -1ʾ· BAR ڡ
-
-    :
-    · BAR ֱͨݴض DMA  BAR ֮ BAR
-    ˵пܴ·ܣҪ¼· BAR 
-    д߼ȷܹȷʶ豸Դ֣رڴӵ DMA ʱ
+    逻辑:
+    这行代码检查 xdma->numBars - xdma->configBarIdx 的值。如果这个值等于 2，
+    表示在配置 BAR 之后还有两个 BAR（即，旁路 BAR 存在），那么将 bypassBarIdx 设置为 xdma->numBars - 1，
+    表示旁路 BAR 是最后一个 BAR。
+    如果不满足条件，则将 bypassBarIdx 设置为 -1，表示旁路 BAR 不存在。
+
+    意义:
+    旁路 BAR 通常用于直接数据传输或特定的 DMA 操作。如果配置 BAR 之后还有两个 BAR，
+    说明有可能存在旁路功能，因此需要记录旁路 BAR 的索引。
+    这行代码的逻辑确保驱动程序能够正确识别设备的资源布局，特别是在处理复杂的 DMA 操作时。
     */
     xdma->bypassBarIdx = xdma->numBars - xdma->configBarIdx == 2 ? xdma->numBars - 1 : -1;
 
@@ -214,7 +221,8 @@ static void GetRegisterModules(IN PXDMA_DEVICE xdma) {
 NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
                          PXDMA_DEVICE xdma,
                          WDFCMRESLIST ResourcesRaw,
-                         WDFCMRESLIST ResourcesTranslated) {
+                         WDFCMRESLIST ResourcesTranslated,
+                         size_t maxTransferSize) {
 
     NTSTATUS status = STATUS_INTERNAL_ERROR;
 
@@ -222,24 +230,37 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
 
     xdma->wdfDevice = wdfDevice;
 
-    //  PCIe BAR ӳ䵽ڴ
+    // max dma transfer length - whole pages, bounded by the size of the descriptor stores
+    if (maxTransferSize == 0) {
+        maxTransferSize = XDMA_MAX_TRANSFER_SIZE;
+    }
+    maxTransferSize = (maxTransferSize + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+    if (maxTransferSize > XDMA_MAX_TRANSFER_SIZE_LIMIT) {
+        TraceWarning(DBG_INIT, "maxTransferSize=%llu limited to %lu",
+                     (ULONGLONG)maxTransferSize, XDMA_MAX_TRANSFER_SIZE_LIMIT);
+        maxTransferSize = XDMA_MAX_TRANSFER_SIZE_LIMIT;
+    }
+    xdma->maxTransferSize = maxTransferSize;
+    TraceInfo(DBG_INIT, "maxTransferSize=%llu", (ULONGLONG)maxTransferSize);
+
+    // 将 PCIe BAR 映射到主机内存
     status = MapBARs(xdma, ResourcesTranslated);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "MapBARs() failed! %!STATUS!", status);
         return status;
     }
 
-    // ʶBAR - user(ѡ), config, bypass(ѡ)
+    // 识别BAR配置 - user(可选的), config, bypass(可选的)
     status = IdentifyBars(xdma);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "IdentifyBars() failed! %!STATUS!", status);
         return status;
     }
 
-    // ȡеģƫ
+    // 获取配置栏中的模块偏移量
     GetRegisterModules(xdma);
 
-    // ȷ XDMA IP˰汾ƥ
+    // 确认 XDMA IP核版本与该驱动程序匹配
     UINT version = GetVersion(xdma);
     if (version != v2017_1) {
         TraceWarning(DBG_INIT, "Version mismatch! Expected 2017.1 (0x%x) but got (0x%x)",
@@ -252,18 +273,19 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
         return status;
     }
 
-    // WDF DMA Enabler -  8 ֽڶ
-    WdfDeviceSetAlignmentRequirement(xdma->wdfDevice, 8 - 1); // TODO - ѡȷֵ
+    // WDF DMA Enabler - 至少 8 字节对齐
+    WdfDeviceSetAlignmentRequirement(xdma->wdfDevice, 8 - 1); // TODO - 选择正确的值
     WDF_DMA_ENABLER_CONFIG dmaConfig;
-    // 豸֧ʹ 64 λѰַĻݰɢ/ռ DMA  豸֧˫XDMA_MAX_TRANSFER_SIZE8MB
-    WDF_DMA_ENABLER_CONFIG_INIT(&dmaConfig, WdfDmaProfileScatterGather64Duplex, XDMA_MAX_TRANSFER_SIZE);
+    // 设备支持使用 64 位寻址的基于数据包的散点/收集 DMA 操作。 设备还支持双工操作。
+    // requests up to maxTransferSize are programmed as a single descriptor list (one stage)
+    WDF_DMA_ENABLER_CONFIG_INIT(&dmaConfig, WdfDmaProfileScatterGather64Duplex, xdma->maxTransferSize);
     status = WdfDmaEnablerCreate(xdma->wdfDevice, &dmaConfig, WDF_NO_OBJECT_ATTRIBUTES, &xdma->dmaEnabler);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, " WdfDmaEnablerCreate() failed: %!STATUS!", status);
         return status;
     }
 
-    // ͳʼ ӲIP
+    // 检测和初始化 硬件IP盒中引擎的配置
     status = ProbeEngines(xdma);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "ProbeEngines failed: %!STATUS!", status);
@@ -275,9 +297,21 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
 
 void XDMA_DeviceClose(PXDMA_DEVICE xdma) {
 
-    // todo - ֹͣ?
+    XDMA_PollerStop(xdma);
+
+    // release the streaming ring memory - not owned by the framework
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            XDMA_ENGINE* engine = &xdma->engines[ch][dir];
+            if ((engine->enabled == TRUE) && (engine->type == EngineType_ST) && (engine->dir == C2H)) {
+                EngineRingFree(engine);
+            }
+        }
+    }
+
+    // todo - 停止所有引擎?
 
-    //  irq vectors?
+    // 重置 irq vectors?
     if (xdma && xdma->interruptRegs) {
         xdma->interruptRegs->userVector[0] = 0;
         xdma->interruptRegs->userVector[1] = 0;
@@ -287,7 +321,7 @@ void XDMA_DeviceClose(PXDMA_DEVICE xdma) {
         xdma->interruptRegs->channelVector[1] = 0;
     }
 
-    // ȡӳκ I/O ˿ڡܽԶϿжӡ
+    // 取消映射任何 I/O 端口。框架将自动断开中断连接。
     for (UINT i = 0; i < xdma->numBars; i++) {
         if (xdma->bar[i] != NULL) {
             TraceInfo(DBG_INIT, "Unmapping BAR%d, VA:(%p) Length %ul",
@@ -41,9 +41,10 @@ typedef void(*PFN_XDMA_USER_WORK)(ULONG eventId, void* userData);
 
 /// user event interrupt context
 typedef struct XDMA_EVENT_T {
-    PFN_XDMA_USER_WORK work; // ûص
-    void* userData; // Զûݡݵص
-    WDFINTERRUPT irq; //wdfжϾ
+    PFN_XDMA_USER_WORK work; // 用户回调
+    void* userData; // 自定义用户数据。将传递到工作回调函数中
+    WDFINTERRUPT irq; //wdf中断句柄
+    XDMA_PROGRAM* volatile program; // run by the dpc before the work, see EngineProgramBind()
 } XDMA_EVENT;
 
 /// The XDMA device context
@@ -52,9 +53,9 @@ typedef struct XDMA_DEVICE_T {
     // WDF 
     WDFDEVICE wdfDevice;
 
-    // PCIe BAR 
+    // PCIe BAR 访问
     UINT numBars;
-    PVOID bar[XDMA_MAX_NUM_BARS]; // BARںַ
+    PVOID bar[XDMA_MAX_NUM_BARS]; // BAR的内核虚拟地址
     ULONG barLength[XDMA_MAX_NUM_BARS];
     ULONG configBarIdx;
     LONG userBarIdx;
@@ -63,17 +64,21 @@ typedef struct XDMA_DEVICE_T {
     volatile XDMA_IRQ_REGS *interruptRegs;
     volatile XDMA_SGDMA_COMMON_REGS * sgdmaRegs;
 
-    // DMA Engine 
+    // DMA Engine 管理
     XDMA_ENGINE engines[XDMA_MAX_NUM_CHANNELS][XDMA_NUM_DIRECTIONS];
     WDFDMAENABLER dmaEnabler;   // WDF DMA Enabler for the engine queues
+    size_t maxTransferSize;     // max length of a dma transfer, sizes the descriptor stores
 
-    // Interrupt Դ
+    // Interrupt 资源
     WDFINTERRUPT lineInterrupt;
     WDFINTERRUPT channelInterrupts[XDMA_MAX_CHAN_IRQ];
 
     // user events
     XDMA_EVENT userEvents[XDMA_MAX_USER_IRQ];
 
+    // poll mode service thread - optional
+    XDMA_POLLER poller;
+
 } XDMA_DEVICE, *PXDMA_DEVICE;
 
 // ========================= function declarations ================================================
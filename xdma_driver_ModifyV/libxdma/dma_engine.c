@@ -31,9 +31,6 @@
 // ========================= constants ============================================================
 
 #define XDMA_ENG_IRQ_NUM        (1)
-#define XDMA_DESC_MAGIC         (0xAD4B0000)
-#define XDMA_WB_COUNT_MASK      (0x00ffffffUL)
-#define XDMA_WB_ERR_MASK        (BIT_N(31))
 
 // ========================= static function declarations =========================================
 
@@ -41,11 +38,41 @@ static UINT32 EngineStatus(IN XDMA_ENGINE *engine, IN BOOLEAN clear);
 static void EngineGetAlignments(IN OUT XDMA_ENGINE *engine);
 static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine);
 static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine);
+static NTSTATUS EngineRingAllocate(IN XDMA_ENGINE* engine, IN UINT numBlocks, IN ULONG blockSize,
+                                   IN MEMORY_CACHING_TYPE cacheType);
+static void EngineRingReleaseConsumed(IN XDMA_ENGINE* engine);
+static void EngineRingGrant(IN XDMA_ENGINE* engine);
+static NTSTATUS EngineRxSetDepth(IN XDMA_ENGINE* engine, IN ULONG depth);
+static UINT EngineRxProcess(IN XDMA_ENGINE* engine);
 static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index);
 static void EngineProcessTransfer(IN XDMA_ENGINE *engine);
+static ULONG EngineServiceTransfer(IN XDMA_ENGINE *engine);
 static UINT EngineProcessRing(IN XDMA_ENGINE *engine);
-static void EngineRingAdvance(UINT* index);
+static void EngineGetDescParams(IN XDMA_ENGINE *engine, OUT XDMA_DESC_PARAMS *params);
 static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine);
+static NTSTATUS EngineCreatePipeline(IN XDMA_ENGINE* engine);
+static ULONG PipelinePopCompleted(IN OUT XDMA_PIPELINE* pipeline, IN ULONG completed,
+                                  OUT XDMA_TRANSFER** done);
+static ULONG EngineCompletedDescCount(IN XDMA_ENGINE* engine, OUT BOOLEAN* wbError);
+static void EngineClearPollWriteBack(IN XDMA_ENGINE* engine);
+static void EngineCountClear(IN XDMA_ENGINE* engine, IN size_t numBytes);
+static void EngineStartRun(IN XDMA_ENGINE* engine);
+static void EngineSubmitTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                                 IN BOOLEAN continuation);
+static void EngineRetireTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                                 IN NTSTATUS status);
+static UINT64 EngineFillStage(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                              OUT XDMA_DESC_LIST* list);
+static void EngineStartLoop(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer);
+static void EngineWaitIdle(IN XDMA_ENGINE* engine);
+static void EngineLoopHalted(IN XDMA_ENGINE* engine);
+static void EngineFreeBuffer(IN XDMA_ENGINE* engine, IN XDMA_REGISTERED_BUFFER* buffer);
+static void EngineRetireProgram(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program,
+                                IN NTSTATUS status);
+static NTSTATUS EngineCreateTransfer(IN XDMA_ENGINE* engine, IN OUT XDMA_TRANSFER* transfer,
+                                     IN WDFCOMMONBUFFER descBuffer, IN ULONG numDescriptors,
+                                     IN BOOLEAN transaction);
+static void TransferDeleteSegments(IN OUT XDMA_TRANSFER* transfer, IN WDFCOMMONBUFFER keep);
 
 // Mark these functions as pageable code
 #ifdef ALLOC_PRAGMA
@@ -61,8 +88,8 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine);
 // ======================== common engine functions ===============================================
 
 static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine) {
-    // Ϊ˻
-    SIZE_T bufferSize = (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(DMA_DESCRIPTOR);
+    // 为描述符分配主机端缓冲区
+    SIZE_T bufferSize = XDMA_DESC_SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR);
 
     NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, bufferSize,
                                             WDF_NO_OBJECT_ATTRIBUTES, &engine->descBuffer);
@@ -75,7 +102,7 @@ static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine) {
     PUCHAR descBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
     RtlZeroMemory(descBufferVA, bufferSize);
 
-    // ʼַṩӲ
+    // 将描述符缓冲区的物理起始地址提供给硬件。
     engine->sgdma->firstDescLo = descBufferLA.LowPart;
     engine->sgdma->firstDescHi = descBufferLA.HighPart;
     engine->sgdma->firstDescAdj = 0; // depends on transfer - set later in ProgramDMA
@@ -108,84 +135,100 @@ static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index)
                  engine->irqBitMask, engine->regs->intEnableMask);
 }
 
-static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
-// service an SGDMA engine
+static ULONG EngineServiceTransfer(IN XDMA_ENGINE *engine)
+// service an SGDMA engine - retire the requests whose descriptor chains have been completed.
+// returns the number of requests retired.
 {
+    XDMA_TRANSFER* done[XDMA_MAX_PIPELINE_ENTRIES];
+    ULONG numDone = 0;
     NTSTATUS status = STATUS_SUCCESS;
-    WDFREQUEST request;
-    UINT32 engineStatus;
+    BOOLEAN deferStart = FALSE;
 
     if (engine == NULL) {
         TraceError(DBG_DMA, "engine=NULL");
-        return;
+        return 0;
     }
 
     TraceInfo(DBG_DMA, "%s_%u processing transfer completion",
               DirectionToString(engine->dir), engine->channel);
 
-    request = WdfDmaTransactionGetRequest(engine->dmaTransaction);
-    if (!request) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    WdfSpinLockAcquire(pipeline->lock);
+
+    if (pipeline->numRunning == 0) {
+        WdfSpinLockRelease(pipeline->lock);
         TraceInfo(DBG_DMA, "Interrupt but no request pending?");
-        return;
+        return 0;
+    }
+    if (pipeline->stopping) { // EngineCancelTransfer() takes the run apart
+        WdfSpinLockRelease(pipeline->lock);
+        return 0;
     }
 
-    // read and clear engine status 
-    engineStatus = EngineStatus(engine, TRUE);
+    // read and clear engine status before reading the completed count. A chain completing in
+    // between sets the status again and raises another interrupt.
+    UINT32 engineStatus = EngineStatus(engine, TRUE);
+    BOOLEAN wbError = FALSE;
+    ULONG completed = EngineCompletedDescCount(engine, &wbError);
+
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO & ~XDMA_BUSY_BIT) || wbError) { // any sign of errors
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x, Descriptors Completed=%u",
+                   engineStatus, completed);
+        status = STATUS_INTERNAL_ERROR;
+        completed = MAXULONG; // fail all requests of the run
+    }
+    numDone = PipelinePopCompleted(pipeline, completed, done);
 
-    EngineStop(engine);
+    if (pipeline->numRunning == 0) { // end of the run?
+        EngineStop(engine);
+        EngineClearPollWriteBack(engine);
 
-    switch (engineStatus & XDMA_STAT_EXPECTED_ZERO) {
-    case XDMA_ENGINE_STOPPED_OK: // engine not busy and no errors?
-    {
-        BOOLEAN completed = WdfDmaTransactionDmaCompleted(engine->dmaTransaction, &status);
-        size_t bytesTransferred = WdfDmaTransactionGetBytesTransferred(engine->dmaTransaction);
+        // the continuation of a split transaction has to go next. it is queued by
+        // XDMA_EngineProgramDma() (EngineRetireTransfer() for a fill) when its fragment is retired
+        // below.
+        for (ULONG i = 0; i < numDone; ++i) {
+            deferStart |= NT_SUCCESS(status) && !done[i]->lastFragment;
+        }
+        if (!deferStart) {
+            EngineStartRun(engine);
+        }
+    }
+    WdfSpinLockRelease(pipeline->lock);
 
-        TraceInfo(DBG_DMA, "%s_%u transaction%scomplete, bytesTransferred=%llu",
-                  DirectionToString(engine->dir), engine->channel,
-                  completed ? " " : " in", bytesTransferred);
+    TraceInfo(DBG_DMA, "%s_%u retiring %u requests",
+              DirectionToString(engine->dir), engine->channel, numDone);
 
-        if (completed) {
-            status = WdfRequestUnmarkCancelable(request);
-            if (!NT_SUCCESS(status)) {
-                TraceError(DBG_DMA, "WdfRequestUnmarkCancelable failed: %!STATUS!", status);
-            }
-            status = WdfDmaTransactionRelease(engine->dmaTransaction);
-            if (!NT_SUCCESS(status)) {
-                TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", status);
-            }
-            WdfRequestCompleteWithInformation(request, status, bytesTransferred);
-        }
-        break;
+    for (ULONG i = 0; i < numDone; ++i) {
+        EngineRetireTransfer(engine, done[i], status);
     }
-    case XDMA_BUSY_BIT: // engine is still busy without sign of errors?
-        TraceError(DBG_DMA, "Engine Still Busy, Descriptors Completed=%u",
-                   engine->regs->completedDescCount);
-    default: // any sign of errors
-        TraceError(DBG_DMA, "Unexpected engine status 0x%08x", engineStatus);
-        status = WdfRequestUnmarkCancelable(request);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_DMA, "WdfRequestUnmarkCancelable failed: %!STATUS!", status);
-        }
-        status = WdfDmaTransactionRelease(engine->dmaTransaction);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", status);
+
+    if (deferStart) {
+        WdfSpinLockAcquire(pipeline->lock);
+        if (pipeline->numRunning == 0) {
+            EngineStartRun(engine);
         }
-        WdfRequestComplete(request, STATUS_INTERNAL_ERROR);
+        WdfSpinLockRelease(pipeline->lock);
     }
+    return numDone;
+}
 
-    // clear descriptor buffer
-    DMA_DESCRIPTOR* descriptorBuffer = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    size_t descBufferLength = WdfCommonBufferGetLength(engine->descBuffer);
-    RtlZeroMemory(descriptorBuffer, descBufferLength);
-
-    // clear poll writeback buffer
-    if (engine->poll) {
-        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-        size_t wbBufferLength = WdfCommonBufferGetLength(engine->pollWbBuffer);
-        RtlZeroMemory(wbBuffer, wbBufferLength);
+static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
+// engine work of the channel interrupt
+{
+    ULONG numDone = EngineServiceTransfer(engine);
+    if (numDone > 0) {
+        InterlockedExchangeAdd64(&engine->stats.interruptCompletions, numDone);
     }
 }
 
+static UINT64 EngineTimeNs(VOID) {
+    LARGE_INTEGER frequency;
+    const LARGE_INTEGER counter = KeQueryPerformanceCounter(&frequency);
+    const UINT64 seconds = counter.QuadPart / frequency.QuadPart;
+    const UINT64 remainder = counter.QuadPart % frequency.QuadPart;
+    return (seconds * 1000000000ULL) + (remainder * 1000000000ULL) / frequency.QuadPart;
+}
+
 static void DumpDescriptor(IN const DMA_DESCRIPTOR* const desc) {
 #if DBG
     TraceVerbose(DBG_DESC, "descriptor={.control=0x%08X, .numBytes=%u, srcAddr=0x%08X%08X, .dstAddr=0x%08X%08X, nextAddr=0x%08X%08X}",
@@ -198,85 +241,13 @@ static void DumpDescriptor(IN const DMA_DESCRIPTOR* const desc) {
 #endif
 }
 
-static BOOLEAN DescriptorIsAligned(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR *desc)
-// For alignment requirements see product guide [1] page 23 table 2-9
-{
-    if (engine->addressMode == AddressMode_Fixed) {
-        const UINT32 dataPathWidth = (1 << (6 + engine->parentDevice->configRegs->pcieWidth)) / 8;
-        const UINT32 addrMask = dataPathWidth - 1;
-
-        if ((desc->dstAddrLo & addrMask) != (desc->srcAddrLo & addrMask) != 0) {
-            TraceError(DBG_DESC, "misalignment detected! dataWidth=%u, src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                       dataPathWidth, desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            return FALSE;
-        }
-        // todo length alignment requirement??
-
-    } else { // AddressMode_Contiguous (i.e. incremental mode)
-        BOOLEAN dstAddrMisaligned = (desc->dstAddrLo % engine->alignAddr) != 0;
-        BOOLEAN lengthMisaligned = (desc->numBytes % engine->alignLength) != 0;
-        BOOLEAN srcAddrMisaligned = (desc->srcAddrLo % engine->alignAddr) != 0;
-
-        if (dstAddrMisaligned || lengthMisaligned || srcAddrMisaligned) {
-            TraceVerbose(DBG_DESC, "descriptor alignments: src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                         desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            TraceError(DBG_DESC, "misalignment detected! src?=%u dst?=%u length?=%u",
-                       srcAddrMisaligned, dstAddrMisaligned, lengthMisaligned);
-            return FALSE;
-        }
-    }
-    return TRUE;
-}
-
-static void OptimizeDescriptors(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR * const desc,
-                                IN const ULONG numDesc)
-    // Optimize descriptors for PCIe block fetches.
-    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
-    // by the device. This is achieved as follows:
-    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is 
-    //        specified by writing to engine->sgdma->firstDescAdj register. 
-    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
-    //        additional (adjacent) descriptors in the control->nextAdj field 
-    // There are several factors which limit the amount of descriptors which can be fetched together:
-    //      1. The PCIe Max Read Request Size
-    //      2. The physical address of the descriptors within a block must not cross a 4K address 
-    //         boundary
-    //      3. The number of descriptors remaining in the transfer
-{
-    const ULONG mrrsBytes = 1 << (engine->parentDevice->configRegs->pcieMRRS + 7);
-    const ULONG adjMax = mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
-    const ULONG adjTotal = numDesc - 1;
-    const ULONG adjTo4k = (0x1000 - (engine->sgdma->firstDescLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-    // set the number of adjacent descriptors for the first fetch
-    ULONG firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
-    engine->sgdma->firstDescAdj = adjTo4k < firstAdj ? adjTo4k : firstAdj;
-    //TraceVerbose(DBG_DMA, "first: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-    //             engine->sgdma->firstDescLo & 0xFFF, adjTo4k, adjTotal, engine->sgdma->firstDescAdj);
-
-    // set the number of adjacent descriptors for subsequent fetches
-    ULONG nextAdjMax = adjMax - 1;
-    for (UINT i = 0; i < numDesc; i++) {
-        // if not last desc then get total desc adj to next desc, else last desc has no next desc
-        const ULONG nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
-        const ULONG nextAdjTo4k = (0x1000 - (desc[i].nextLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-        ULONG nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
-        if (nextAdj > nextAdjTo4k) {
-            nextAdj = nextAdjTo4k;
-        }
-
-        desc[i].control |= (nextAdj << 8);
-        //TraceVerbose(DBG_DMA, "next: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-        //             desc[i].nextLo & 0xFFF, nextAdjTo4k, nextAdjTotal, nextAdj);
-
-        // update current max adj count for this block
-        if (nextAdjMax != 0) {
-            nextAdjMax--;
-        } else { // wrap-around
-            nextAdjMax = adjMax;
-        }
-    }
+static void EngineGetDescParams(IN XDMA_ENGINE *engine, OUT XDMA_DESC_PARAMS *params) {
+    params->type = engine->type;
+    params->addressMode = engine->addressMode;
+    params->alignAddr = engine->alignAddr;
+    params->alignLength = engine->alignLength;
+    params->dataPathWidth = engine->dataPathWidth;
+    params->adjMax = engine->descAdjMax;
 }
 
 static BOOLEAN EngineExists(PXDMA_DEVICE xdma, DirToDev dir, ULONG channel) {
@@ -319,22 +290,6 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
     // capture alignment requirements
     EngineGetAlignments(engine);
 
-    // dma󶨵Ӳ
-    status = EngineCreateDescriptorBuffer(engine);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "EngineCreateDescriptorBuffer() failed: %!STATUS!",
-                   status);
-        return status;
-    }
-
-    // allocate wdf dma transaction object
-    status = WdfDmaTransactionCreate(xdma->dmaEnabler, WDF_NO_OBJECT_ATTRIBUTES,
-                                     &engine->dmaTransaction);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
-        return status;
-    }
-
     if ((engine->type == EngineType_ST) && (engine->dir == C2H)) {
         engine->work = EngineProcessRing;
         status = EngineCreateRingBuffer(engine);
@@ -343,10 +298,31 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
             return status;
         }
 
+        KeInitializeEvent(&engine->rx.halted, NotificationEvent, TRUE);
+        status = EngineRxSetDepth(engine, 1);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "EngineRxSetDepth() failed: %!STATUS!", status);
+            return status;
+        }
+
         engine->parentDevice->sgdmaRegs->creditModeEnableW1S = BIT_N(engine->channel) << 16;
         TraceInfo(DBG_INIT, "creditModeEnable=0x%x", engine->parentDevice->sgdmaRegs->creditModeEnable);
     } else {
         engine->work = EngineProcessTransfer;
+
+        // 创建dma描述符缓冲区并将其绑定到硬件 - the ring brings its own, sized from its geometry
+        status = EngineCreateDescriptorBuffer(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "EngineCreateDescriptorBuffer() failed: %!STATUS!",
+                       status);
+            return status;
+        }
+
+        status = EngineCreatePipeline(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "EngineCreatePipeline() failed: %!STATUS!", status);
+            return status;
+        }
     }
 
     engine->enabled = TRUE;
@@ -371,8 +347,14 @@ static void EngineGetAlignments(IN OUT XDMA_ENGINE *engine) {
         engine->alignAddrBits = 64;
     }
 
+    // the descriptor builder needs these per descriptor/transfer - read them only once
+    engine->dataPathWidth = XDMA_DATA_PATH_BYTES(engine->parentDevice->configRegs->pcieWidth);
+    engine->descAdjMax = DescAdjMax(XDMA_MRRS_BYTES(engine->parentDevice->configRegs->pcieMRRS));
+
     TraceVerbose(DBG_INIT, "engine[%u][%u] alignments: bytes=%u, granularity=%u, addrBits=%u",
                  engine->channel, engine->dir, engine->alignAddr, engine->alignLength, engine->alignAddrBits);
+    TraceVerbose(DBG_INIT, "engine[%u][%u] dataPathWidth=%u, descAdjMax=%u",
+                 engine->channel, engine->dir, engine->dataPathWidth, engine->descAdjMax);
 
 }
 
@@ -415,447 +397,2896 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
     WDF_REQUEST_PARAMETERS params;
     WDF_REQUEST_PARAMETERS_INIT(&params);
     WdfRequestGetParameters(request, &params);
-    LONGLONG deviceOffset = (Direction == WdfDmaDirectionWriteToDevice) ?
-        (SIZE_T)params.Parameters.Write.DeviceOffset :
-        (SIZE_T)params.Parameters.Read.DeviceOffset;
 
-    // get virtual and physical pointers to descriptor buffer
-    XDMA_ENGINE * engine = (XDMA_ENGINE*)context;
-    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    XDMA_TRANSFER* transfer = (XDMA_TRANSFER*)context;
+    XDMA_ENGINE* engine = transfer->engine;
+
+    // a gather send (IOCTL_XDMA_SEND_PACKETS), a vectored (IOCTL_XDMA_WRITEV/READV) or a strided
+    // transfer (IOCTL_XDMA_WRITE_2D/READ_2D) carries the data in its output buffer, a fill
+    // (IOCTL_XDMA_FILL) its pattern
+    const BOOLEAN fill = transfer->fill.numBytes != 0;
+    const BOOLEAN table = (transfer->packets != NULL) || (transfer->vectors != NULL) ||
+                          (transfer->stride != NULL) || fill;
+    LONGLONG deviceOffset = 0;
+    size_t requestLength = params.Parameters.DeviceIoControl.OutputBufferLength;
+    if (!table) {
+        deviceOffset = (Direction == WdfDmaDirectionWriteToDevice) ?
+            (SIZE_T)params.Parameters.Write.DeviceOffset :
+            (SIZE_T)params.Parameters.Read.DeviceOffset;
+        requestLength = (Direction == WdfDmaDirectionWriteToDevice) ?
+            params.Parameters.Write.Length : params.Parameters.Read.Length;
+    }
 
     // offset into the transaction (if it is split)
-    deviceOffset += WdfDmaTransactionGetBytesTransferred(Transaction);
+    const size_t bytesTransferred = WdfDmaTransactionGetBytesTransferred(Transaction);
+    deviceOffset += bytesTransferred;
+    transfer->lastFragment = (bytesTransferred + WdfDmaTransactionGetCurrentDmaTransferLength(Transaction)) >= requestLength;
 
     TraceVerbose(DBG_DMA, "device addr=%lld, num descriptors=%d",
                  deviceOffset, SgList->NumberOfElements);
 
-    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
-        descriptor[i].control = XDMA_DESC_MAGIC;
-        descriptor[i].numBytes = SgList->Elements[i].Length;
-        ULONG hostAddrLo = SgList->Elements[i].Address.LowPart;
-        LONG hostAddrHi = SgList->Elements[i].Address.HighPart;
-        if (Direction == WdfDmaDirectionWriteToDevice) {
-            // source is host memory
-            descriptor[i].srcAddrLo = hostAddrLo;
-            descriptor[i].srcAddrHi = hostAddrHi;
-            descriptor[i].dstAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-        } else {
-            // destination is host memory
-            descriptor[i].srcAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-            descriptor[i].dstAddrLo = hostAddrLo;
-            descriptor[i].dstAddrHi = hostAddrHi;
-        }
-
-        // next descriptor bus address 
-        descBufferLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-
-        // non-last descriptor(s)? 
-        if ((i + 1) < SgList->NumberOfElements) {
-            descriptor[i].nextLo = descBufferLA.LowPart;
-            descriptor[i].nextHi = descBufferLA.HighPart;
-        } else { // last descriptor
-            descriptor[i].nextLo = 0;
-            descriptor[i].nextHi = 0;
-            // stop engine and request an interrupt from the engine
-            descriptor[i].control |= (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
-            if (engine->type == EngineType_ST) {
-                descriptor[i].control |= XDMA_DESC_EOP_BIT;
-                TraceVerbose(DBG_DMA, "descriptor[i].control=0x%08x", descriptor[i].control);
-            }
-        }
-        if (engine->addressMode == AddressMode_Contiguous) { // incremental address mode
-            deviceOffset += SgList->Elements[i].Length;
-        }
-
-        if (FALSE == DescriptorIsAligned(engine, &(descriptor[i]))) {
-            TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
-        }
+    XDMA_DESC_PARAMS descParams;
+    EngineGetDescParams(engine, &descParams);
+
+    // build one descriptor list across the segments of the descriptor store of the transfer,
+    // stop engine and request an interrupt from the engine at its end
+    XDMA_DESC_LIST list;
+    ULONG numAppended;
+    UINT64 stageBytes = 0;
+    if (transfer->packets != NULL) { // end of packet on the last descriptor of every packet
+        ASSERTMSG("gather send split into several transfers", transfer->lastFragment);
+        // a loop neither stops nor interrupts, its end is linked back to its start below
+        numAppended = DescStoreBuildPackets(&transfer->store, &descParams, SgList->Elements,
+                                            SgList->NumberOfElements, transfer->packets,
+                                            transfer->numPackets,
+                                            transfer->loop ? XDMA_DESC_EOP_BIT :
+                                            (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT | XDMA_DESC_EOP_BIT),
+                                            &list, transfer->loop ? engine->loop.slotEnds : NULL);
+        ASSERTMSG("descriptor store too small for packet list", numAppended == transfer->numPackets);
+        numAppended = SgList->NumberOfElements;
+    } else if (transfer->vectors != NULL) { // card address per vector instead of the file offset
+        ASSERTMSG("vectored transfer split into several transfers", transfer->lastFragment);
+        numAppended = DescStoreBuildVectors(&transfer->store, &descParams,
+                                            (Direction == WdfDmaDirectionWriteToDevice) ? H2C : C2H,
+                                            SgList->Elements, SgList->NumberOfElements,
+                                            transfer->vectors, transfer->numPackets,
+                                            XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT, &list);
+        ASSERTMSG("descriptor store too small for vector list", numAppended == transfer->numPackets);
+        numAppended = SgList->NumberOfElements;
+    } else if (transfer->stride != NULL) { // card address per row
+        ASSERTMSG("strided transfer split into several transfers", transfer->lastFragment);
+        numAppended = DescStoreBuildStrided(&transfer->store, &descParams,
+                                            (Direction == WdfDmaDirectionWriteToDevice) ? H2C : C2H,
+                                            SgList->Elements, SgList->NumberOfElements,
+                                            transfer->stride,
+                                            XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT, &list);
+        ASSERTMSG("descriptor store too small for row list", numAppended == transfer->numPackets);
+        numAppended = SgList->NumberOfElements;
+    } else if (fill) { // every descriptor sources the pattern, the card address moves on
+        ASSERTMSG("fill pattern split into several transfers", transfer->lastFragment);
+        ASSERTMSG("fill pattern exceeds a page",
+                  SgList->NumberOfElements <= ARRAYSIZE(transfer->fill.pattern));
+        numAppended = min(SgList->NumberOfElements, ARRAYSIZE(transfer->fill.pattern));
+        RtlCopyMemory(transfer->fill.pattern, SgList->Elements,
+                      numAppended * sizeof(SCATTER_GATHER_ELEMENT));
+        transfer->fill.numElements = numAppended;
+        transfer->fill.remaining = transfer->fill.numBytes;
+        stageBytes = EngineFillStage(engine, transfer, &list);
+    } else {
+        numAppended = DescStoreBuildSg(&transfer->store, &descParams,
+                                       (Direction == WdfDmaDirectionWriteToDevice) ? H2C : C2H,
+                                       SgList->Elements, SgList->NumberOfElements, deviceOffset,
+                                       (engine->type == EngineType_ST) ?
+                                       (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT | XDMA_DESC_EOP_BIT) :
+                                       (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT), &list);
+        ASSERTMSG("descriptor store too small for scatter gather list", numAppended == SgList->NumberOfElements);
+    }
+    InterlockedExchangeAdd64(&engine->stats.sgElements, numAppended);
+    InterlockedExchangeAdd64(&engine->stats.descriptors, list.count);
+    TraceVerbose(DBG_DMA, "%u scatter gather elements coalesced into %u descriptors in %u segments",
+                 numAppended, list.count, list.segments);
+    if (list.misaligned) {
+        TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned (%u descriptors)", list.misaligned);
     }
 
-    OptimizeDescriptors(engine, descriptor, SgList->NumberOfElements);
+    transfer->firstAdj = list.firstAdj;
+    transfer->numDescriptors = list.count;
+    transfer->numBytes = fill ? (size_t)stageBytes : table ? transfer->packetBytes :
+        WdfDmaTransactionGetCurrentDmaTransferLength(Transaction);
+    transfer->lastDesc = list.last;
 
-    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
-        DumpDescriptor(&(descriptor[i]));
+    for (ULONG i = 0; i < list.count; i++) {
+        DumpDescriptor(&(transfer->segmentVA[i / transfer->store.segmentCapacity]
+                                            [i % transfer->store.segmentCapacity]));
     }
 
-    if (engine->poll) {
-        engine->numDescriptors = SgList->NumberOfElements;
+    if (transfer->loop) { // the engine is kept idle for the loop, see EngineLoopAcquire()
+        DescLink(list.last, transfer->segmentLA[0], list.firstAdj);
+        EngineStartLoop(engine, transfer);
+        return TRUE;
     }
 
-    MemoryBarrier();
-
-    // start the engine
-    EngineStart(engine);
-
-    MemoryBarrier();
+    // queue the chain - the engine is started right away if it is idle
+    EngineSubmitTransfer(engine, transfer, bytesTransferred != 0);
 
     return TRUE;
 }
 
-// ڼͳʼ FPGA Ĵ棨Engineа H2C  C2H ַ档
-NTSTATUS ProbeEngines(IN PXDMA_DEVICE xdma) {
-    PAGED_CODE();
-
-    ULONG engineIndex = 0;
-
-    // iterate over H2C (FPGA performs PCIe reads towards FPGA),
-    // then C2H (FPGA performs PCIe writes from FPGA)
-    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
-        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+// ========================= transfer pipeline ====================================================
 
-            // Ƿ
-            if (EngineExists(xdma, dir, ch)) 
-            {
-                XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
-                NTSTATUS status = EngineCreate(xdma, engine, dir, ch, engineIndex);
-                if (!NT_SUCCESS(status)) {
-                    TraceError(DBG_INIT, "EngineCreate failed! %!STATUS!", status);
-                    return status;
-                }
-                engineIndex++;
-                TraceInfo(DBG_INIT, "%s_%u engine created (AXI-%s)",
-                          DirectionToString(dir), ch, engine->type == EngineType_ST ? "ST" : "MM");
-            } 
-            else 
-            {     
-                // 治
-                TraceInfo(DBG_INIT, "Skipping non-existing engine %s_%u",
-                          DirectionToString(dir), ch);
-            }
-        }
+static void PipelineInsert(IN OUT XDMA_PIPELINE* pipeline, IN ULONG pos, IN XDMA_TRANSFER* transfer) {
+    for (ULONG i = pipeline->numRunning + pipeline->numQueued; i > pos; --i) {
+        pipeline->order[i] = pipeline->order[i - 1];
     }
-    return STATUS_SUCCESS;
+    pipeline->order[pos] = transfer;
 }
 
-void EngineStart(IN XDMA_ENGINE *engine) {
-    engine->regs->controlW1S = XDMA_CTRL_RUN_BIT;
-    TraceInfo(DBG_DMA, "%s_%u engine started (control=0x%08x)",
-              DirectionToString(engine->dir), engine->channel, engine->regs->control);
-}
-
-void EngineStop(IN XDMA_ENGINE *engine) {
-    engine->regs->controlW1C = XDMA_CTRL_RUN_BIT;
-    TraceInfo(DBG_DMA, "%s_%u engine stopped (control=0x%08x)",
-              DirectionToString(engine->dir), engine->channel, engine->regs->control);
+static void PipelineRemove(IN OUT XDMA_PIPELINE* pipeline, IN ULONG pos) {
+    const ULONG count = pipeline->numRunning + pipeline->numQueued;
+    for (ULONG i = pos; i + 1 < count; ++i) {
+        pipeline->order[i] = pipeline->order[i + 1];
+    }
 }
 
-void EngineEnableInterrupt(IN XDMA_ENGINE* engine) {
-    if (!engine) {
-        TraceError(DBG_IRQ, "engine ptr is NULL!");
-        return;
-
+static ULONG PipelinePopCompleted(IN OUT XDMA_PIPELINE* pipeline, IN ULONG completed,
+                                  OUT XDMA_TRANSFER** done)
+// take the running transfers whose chains are covered by the completed descriptor count - lock held
+{
+    ULONG numDone = 0;
+    while ((pipeline->numRunning > 0) && (pipeline->order[0]->descEnd <= completed)) {
+        done[numDone] = pipeline->order[0];
+        done[numDone]->state = TransferState_Acquired;
+        numDone++;
+        PipelineRemove(pipeline, 0);
+        pipeline->numRunning--;
     }
-    engine->parentDevice->interruptRegs->channelIntEnableW1S = engine->irqBitMask;
-    TraceInfo(DBG_IRQ, "%s_%u enabled interrupt", DirectionToString(engine->dir), engine->channel);
+    return numDone;
 }
 
-void EngineDisableInterrupt(IN XDMA_ENGINE* engine) {
-    if (!engine) {
-        TraceError(DBG_IRQ, "engine ptr is NULL");
-        return;
+static ULONG EngineCompletedDescCount(IN XDMA_ENGINE* engine, OUT BOOLEAN* wbError) {
+    *wbError = FALSE;
+    if (engine->poll) {
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+        ULONG completed = wbBuffer->completedDescCount;
+        *wbError = (completed & XDMA_WB_ERR_MASK) != 0;
+        return completed & XDMA_WB_COUNT_MASK;
     }
-    engine->parentDevice->interruptRegs->channelIntEnableW1C = engine->irqBitMask;
-    TraceInfo(DBG_IRQ, "%s_%u disabled interrupt", DirectionToString(engine->dir), engine->channel);
+    return engine->regs->completedDescCount;
 }
 
-char* DirectionToString(const DirToDev dir) {
-    return dir == H2C ? "H2C" : "C2H";
+static void EngineCountClear(IN XDMA_ENGINE* engine, IN size_t numBytes) {
+    InterlockedIncrement64(&engine->stats.clears);
+    InterlockedExchangeAdd64(&engine->stats.clearedBytes, (LONG64)numBytes);
+    TraceVerbose(DBG_DMA, "%s_%u cleared %llu bytes", DirectionToString(engine->dir),
+                 engine->channel, numBytes);
 }
 
-// ========================= streaming engine ============================================
-
-static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine) {
-
-    // create dma result buffer
-    size_t resultBufferSize = (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(DMA_RESULT);
-    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, resultBufferSize,
-                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.results);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
-        return status;
+static void EngineClearPollWriteBack(IN XDMA_ENGINE* engine) {
+    if (engine->poll) {
+        // the engine only writes the completed descriptor count
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+        wbBuffer->completedDescCount = 0;
+        engine->numDescriptors = 0;
+        EngineCountClear(engine, sizeof(wbBuffer->completedDescCount));
     }
-    PUCHAR resultBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    RtlZeroMemory(resultBufferVA, resultBufferSize);
-
-    TraceVerbose(DBG_INIT, "engine[%u][%u] dma result buffer @ pa=0x%08llx",
-                 engine->channel, engine->dir,
-                 WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results).QuadPart);
+}
 
-    // create dma data buffer
-    PHYSICAL_ADDRESS low, high, skip;
-    low.QuadPart = 0;
-    high.QuadPart = 0xFFFFFFFFFFFFFFFF;
-    skip.QuadPart = PAGE_SIZE;
-    PMDL mdl = MmAllocatePagesForMdlEx(low, high, skip, XDMA_RING_NUM_BLOCKS * XDMA_RING_BLOCK_SIZE, MmNonCached, NormalPagePriority);
-    if (!mdl) {
-        TraceError(DBG_INIT, "MmAllocatePagesForMdlEx failed!");
-        return STATUS_INTERNAL_ERROR;
+static void EngineStartRun(IN XDMA_ENGINE* engine)
+// Link the queued descriptor chains into a single run and start the engine - lock held.
+// Chains are only linked while the engine is stopped. Appending to a live run would race with
+// the descriptor fetch of the engine, which may already have seen the stop bit.
+{
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    ULONG numDescriptors = 0;
+    UINT64 numBytes = 0;
+
+    ASSERT(pipeline->numRunning == 0);
+    while (pipeline->numQueued > 0) {
+        XDMA_TRANSFER* transfer = pipeline->order[pipeline->numRunning];
+        if (pipeline->numRunning > 0) {
+            XDMA_TRANSFER* prev = pipeline->order[pipeline->numRunning - 1];
+            DescLink(prev->lastDesc, transfer->segmentLA[0], transfer->firstAdj);
+        }
+        numDescriptors += transfer->numDescriptors;
+        numBytes += transfer->numBytes;
+        transfer->descEnd = numDescriptors;
+        transfer->state = TransferState_Running;
+        pipeline->numRunning++;
+        pipeline->numQueued--;
+
+        // the next fragment of a split transaction is not known yet
+        if (!transfer->lastFragment) {
+            break;
+        }
     }
-
-    PVOID rxBufferVa = MmMapLockedPagesSpecifyCache(mdl, KernelMode, MmNonCached, NULL, FALSE, NormalPagePriority);
-    if (!rxBufferVa) {
-        TraceError(DBG_INIT, "MmMapLockedPagesSpecifyCache failed!");
-        return STATUS_INTERNAL_ERROR;
+    if (pipeline->numRunning == 0) {
+        return;
     }
 
-    TraceInfo(DBG_INIT, "mdl VA=%p, byteCount=%u, next=%p", rxBufferVa, MmGetMdlByteCount(mdl), mdl->Next);
+    XDMA_TRANSFER* first = pipeline->order[0];
+    engine->sgdma->firstDescLo = (UINT32)LIMIT_TO_32(first->segmentLA[0]);
+    engine->sgdma->firstDescHi = (UINT32)LIMIT_TO_32(first->segmentLA[0] >> 32);
+    engine->sgdma->firstDescAdj = first->firstAdj;
 
-    // MDL ring
-    for (UINT i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        engine->ring.mdl[i] = IoAllocateMdl((PUCHAR)rxBufferVa + (i * XDMA_RING_BLOCK_SIZE), XDMA_RING_BLOCK_SIZE, TRUE, FALSE, NULL);
-        if (!engine->ring.mdl[i]) {
-            TraceError(DBG_INIT, "IoAllocateMdl failed!");
-            return STATUS_INTERNAL_ERROR;
-        }
+    if (engine->poll) {
+        engine->numDescriptors = numDescriptors;
+        pipeline->runBytes = numBytes;
+        pipeline->runStartNs = EngineTimeNs();
     }
+    pipeline->numRuns++;
 
-    for (UINT i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        TraceVerbose(DBG_INIT, "sub-mdl VA=%p, byteCount=%u, next=%p",
-                     MmGetMdlVirtualAddress(engine->ring.mdl[i]),
-                     MmGetMdlByteCount(engine->ring.mdl[i]),
-                     engine->ring.mdl[i]->Next);
+    XDMA_POLLER* poller = engine->poller;
+    if (poller != NULL) { // end an idle wait of the poller thread
+        KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
     }
 
-    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.lock);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
-        return status;
-    }
+    TraceVerbose(DBG_DMA, "%s_%u starting run of %u requests, %u descriptors",
+                 DirectionToString(engine->dir), engine->channel, pipeline->numRunning,
+                 numDescriptors);
 
-    KeInitializeEvent(&engine->ring.completionSignal, NotificationEvent, FALSE);
+    MemoryBarrier();
 
-    return status;
-}
+    // start the engine
+    EngineStart(engine);
 
-static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
+    MemoryBarrier();
+}
 
-    UINT32 engineStatus = EngineStatus(engine, TRUE);
-    if (engineStatus & XDMA_ALIGN_MISMATCH_BIT & XDMA_MAGIC_STOPPED_BIT & XDMA_FETCH_STOPPED_BIT
-        & XDMA_STAT_READ_ERROR & XDMA_STAT_DESCRIPTOR_ERROR) {
-        TraceError(DBG_DMA, "Engine error during transfer! 0x%08x", engineStatus);
-    }
-    UINT eopCount = 0;
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+static void EngineSubmitTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                                 IN BOOLEAN continuation) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
 
-    WdfSpinLockAcquire(engine->ring.lock);
-    UINT tail = engine->ring.tail;
-    UINT head = engine->ring.head;
-    WdfSpinLockRelease(engine->ring.lock);
+    WdfSpinLockAcquire(pipeline->lock);
 
-    TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
-              DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
-              engine->sgdma->descCredits);
+    // the continuation of a split transaction goes ahead of all other queued requests
+    ULONG pos = pipeline->numRunning + (continuation ? 0 : pipeline->numQueued);
+    PipelineInsert(pipeline, pos, transfer);
+    transfer->state = TransferState_Queued;
+    pipeline->numQueued++;
 
-    for (; results[tail].status; EngineRingAdvance(&tail)) {
+    if (pipeline->numRunning == 0) {
+        EngineStartRun(engine);
+    }
+    WdfSpinLockRelease(pipeline->lock);
+}
 
-        if (results[tail].status & XDMA_RESULT_EOP_BIT) {
-            eopCount++;
+static void EngineCompleteRequest(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                                  IN NTSTATUS status)
+// release the dma transaction, free the transfer and complete its request
+{
+    WDFREQUEST request = transfer->request;
+    size_t bytesTransferred = ((transfer->packets != NULL) || (transfer->vectors != NULL) ||
+                               (transfer->stride != NULL)) ? transfer->packetBytes :
+        (transfer->fill.numBytes != 0) ? (size_t)transfer->fill.numBytes :
+        WdfDmaTransactionGetBytesTransferred(transfer->dmaTransaction);
+
+    XDMA_REGISTERED_BUFFER* registered = transfer->registered;
+    if (registered != NULL) { // no transaction - the buffer stays mapped for the next transfer
+        if (engine->dir == C2H) {
+            KeFlushIoBuffers(registered->mdl, TRUE, TRUE);
+        }
+        transfer->registered = NULL;
+        EngineReleaseBuffer(engine, registered);
+    } else {
+        NTSTATUS releaseStatus = WdfDmaTransactionRelease(transfer->dmaTransaction);
+        if (!NT_SUCCESS(releaseStatus)) {
+            TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", releaseStatus);
         }
-
-        results[tail].status = 0; // mark current dma result as processed
     }
 
-    TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
-              DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
-              engine->sgdma->descCredits);
-
-    WdfSpinLockAcquire(engine->ring.lock);
-    engine->ring.tail = tail;
-    WdfSpinLockRelease(engine->ring.lock);
-
-    // If any packets are completed, start the Io Read queue 
-    // also start the queue on an overflow since we need to tell the client that an overflow happened
-    if (eopCount > 0) {
-        TraceVerbose(DBG_DMA, "starting engine queue");
-        KeSetEvent(&engine->ring.completionSignal, IO_NO_INCREMENT, FALSE);
+    // clear the descriptors of the last program only - the rest of the segment is untouched and
+    // XDMA_EngineProgramDma() overwrites every field of the descriptors it uses
+    const size_t descBytes = transfer->numDescriptors * sizeof(DMA_DESCRIPTOR);
+    const ULONG capacity = transfer->store.segmentCapacity;
+    for (ULONG s = 0; s * capacity < transfer->numDescriptors; ++s) {
+        const ULONG count = min(transfer->numDescriptors - s * capacity, capacity);
+        RtlZeroMemory(transfer->segmentVA[s], count * sizeof(DMA_DESCRIPTOR));
     }
+    transfer->numDescriptors = 0;
+    EngineCountClear(engine, descBytes);
 
+    EngineReleaseTransfer(engine, transfer);
 
-    // clear poll writeback buffer
-    if (engine->poll) {
-        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-        size_t wbBufferLength = WdfCommonBufferGetLength(engine->pollWbBuffer);
-        RtlZeroMemory(wbBuffer, wbBufferLength);
-        engine->numDescriptors = 0;
-    }
-
-    return eopCount;
+    TraceInfo(DBG_DMA, "%s_%u request 0x%p complete, bytesTransferred=%llu, %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, request, bytesTransferred, status);
+    WdfRequestCompleteWithInformation(request, status, NT_SUCCESS(status) ? bytesTransferred : 0);
 }
 
-static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
-
-    // get virtual and physical pointers to descriptor buffer
-    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
-
-    // get physical address to dma result buffer
-    PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results);
-
-    // fill descriptors 
-    for (ULONG i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        descriptor[i].control = (XDMA_DESC_MAGIC | XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
-        descriptor[i].numBytes = XDMA_RING_BLOCK_SIZE;
+static UINT64 EngineFillStage(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                              OUT XDMA_DESC_LIST* list)
+// build the next stage of a fill into the descriptor store of the transfer, returns its length
+{
+    XDMA_FILL* fill = &transfer->fill;
+    XDMA_DESC_PARAMS descParams;
+    EngineGetDescParams(engine, &descParams);
+
+    const UINT64 numBytes = DescStoreBuildFill(&transfer->store, &descParams, fill->pattern,
+                                               fill->numElements, fill->deviceAddr,
+                                               fill->remaining,
+                                               XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT, list);
+    ASSERTMSG("descriptor store too small for a copy of the fill pattern", numBytes > 0);
+    fill->deviceAddr += numBytes;
+    fill->remaining -= numBytes;
+    transfer->lastFragment = fill->remaining == 0;
+    return numBytes;
+}
 
-        // source address are unused, will be overwritten by hardware with dma result
-        descriptor[i].srcAddrLo = resultBufferLA.LowPart;
-        descriptor[i].srcAddrHi = resultBufferLA.HighPart;
-        resultBufferLA.QuadPart += sizeof(DMA_RESULT);
+static void EngineRetireTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer,
+                                 IN NTSTATUS status) {
+    if (transfer->program != NULL) { // no request - the chain is kept for the next run
+        EngineRetireProgram(engine, transfer->program, status);
+        return;
+    }
+    if (NT_SUCCESS(status) && (transfer->fill.remaining > 0)) { // queue the next stage of a fill
+        XDMA_DESC_LIST list;
+        const UINT64 numBytes = EngineFillStage(engine, transfer, &list);
+        InterlockedExchangeAdd64(&engine->stats.descriptors, list.count);
+        TraceVerbose(DBG_DMA, "%s_%u fill stage of %llu bytes in %u descriptors, %llu bytes left",
+                     DirectionToString(engine->dir), engine->channel, numBytes, list.count,
+                     transfer->fill.remaining);
+        transfer->firstAdj = list.firstAdj;
+        transfer->numDescriptors = list.count;
+        transfer->numBytes = (size_t)numBytes;
+        transfer->lastDesc = list.last;
+        EngineSubmitTransfer(engine, transfer, TRUE);
+        return;
+    }
+    if (NT_SUCCESS(status) && (transfer->registered == NULL)) {
+        BOOLEAN completed = WdfDmaTransactionDmaCompleted(transfer->dmaTransaction, &status);
+        if (!completed) { // next fragment has been submitted by XDMA_EngineProgramDma()
+            TraceVerbose(DBG_DMA, "%s_%u transaction incomplete, bytesTransferred=%llu",
+                         DirectionToString(engine->dir), engine->channel,
+                         WdfDmaTransactionGetBytesTransferred(transfer->dmaTransaction));
+            return;
+        }
+    }
+    EngineCompleteTransfer(engine, transfer, status);
+}
 
-        // destination is host memory
-        PHYSICAL_ADDRESS dst = MmGetPhysicalAddress(MmGetMdlVirtualAddress(engine->ring.mdl[i]));
-        descriptor[i].dstAddrLo = dst.LowPart;
-        descriptor[i].dstAddrHi = dst.HighPart;
+static void TransferAcquire(IN OUT XDMA_TRANSFER* transfer, IN WDFREQUEST request)
+// hand a free transfer to a request - pipeline lock held
+{
+    transfer->state = TransferState_Acquired;
+    transfer->request = request;
+    transfer->cancelPending = FALSE;
+    transfer->status = STATUS_SUCCESS;
+    transfer->packets = NULL;
+    transfer->vectors = NULL;
+    transfer->stride = NULL;
+    transfer->fill.numBytes = 0;
+    transfer->fill.remaining = 0;
+    transfer->numPackets = 0;
+    transfer->packetBytes = 0;
+    transfer->loop = FALSE;
+    transfer->registered = NULL;
+}
 
-        // next descriptor bus address 
-        nextDescLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-        descriptor[i].nextLo = nextDescLA.LowPart;
-        descriptor[i].nextHi = nextDescLA.HighPart;
+XDMA_TRANSFER* EngineAcquireTransfer(IN XDMA_ENGINE* engine, IN WDFREQUEST request) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    XDMA_TRANSFER* transfer = NULL;
 
-        if (FALSE == DescriptorIsAligned(engine, descriptor)) {
-            TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
+    WdfSpinLockAcquire(pipeline->lock);
+    for (ULONG i = 0; (i < pipeline->depth) && (engine->loop.transfer == NULL); ++i) {
+        if (pipeline->transfers[i].state == TransferState_Free) {
+            transfer = &pipeline->transfers[i];
+            TransferAcquire(transfer, request);
+            break;
         }
     }
+    WdfSpinLockRelease(pipeline->lock);
+    return transfer;
+}
 
-    // make the discriptor list circular
-    nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
-    DMA_DESCRIPTOR* last = &descriptor[XDMA_RING_NUM_BLOCKS - 1];
-    last->nextLo = nextDescLA.LowPart;
-    last->nextHi = nextDescLA.HighPart;
-
-    // Optimize for PCIe fetches
-    OptimizeDescriptors(engine, descriptor, XDMA_RING_NUM_BLOCKS);
+VOID EngineReleaseTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer) {
+    XDMA_SEND_LOOP* loop = &engine->loop;
+    ULONG* slotEnds = NULL;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    transfer->state = TransferState_Free;
+    transfer->request = NULL;
+    if (transfer->loop) { // the engine is free for other requests again
+        slotEnds = loop->slotEnds;
+        loop->slotEnds = NULL;
+        loop->numSlots = 0;
+        loop->transfer = NULL;
+        transfer->loop = FALSE;
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
 
-    // Print to log
-    TraceVerbose(DBG_DMA, "first desc @ 0x%08x%08x",
-                 engine->sgdma->firstDescHi, engine->sgdma->firstDescLo);
-    for (ULONG i = 0; i < XDMA_RING_NUM_BLOCKS; i++) {
-        DumpDescriptor(&(descriptor[i]));
+    if (slotEnds != NULL) {
+        ExFreePoolWithTag(slotEnds, XDMA_POOL_TAG);
     }
-    TraceVerbose(DBG_DMA, "last desc points to 0x%08x%08x", last->nextHi, last->nextLo);
+}
 
-    if (engine->poll) {
-        engine->numDescriptors = 0;
+VOID EngineCompleteTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer, IN NTSTATUS status) {
+    NTSTATUS unmarkStatus = WdfRequestUnmarkCancelable(transfer->request);
+    if (unmarkStatus == STATUS_CANCELLED) {
+        WdfSpinLockAcquire(engine->pipeline.lock);
+        if (!transfer->cancelPending) { // cancel routine has not run yet - it completes the request
+            transfer->status = status;
+            transfer->state = TransferState_Done;
+            WdfSpinLockRelease(engine->pipeline.lock);
+            return;
+        }
+        WdfSpinLockRelease(engine->pipeline.lock);
+    } else if (!NT_SUCCESS(unmarkStatus)) {
+        TraceError(DBG_DMA, "WdfRequestUnmarkCancelable failed: %!STATUS!", unmarkStatus);
     }
+    EngineCompleteRequest(engine, transfer, status);
+}
 
-    // set initial descriptor credits for throtteling
-    engine->sgdma->descCredits = XDMA_RING_NUM_BLOCKS - 1;
-    TraceInfo(DBG_DMA, "%s_%u set %u initial descriptor credits",
+VOID EngineCancelTransfer(IN XDMA_ENGINE* engine, IN WDFREQUEST request) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    XDMA_TRANSFER* done[XDMA_MAX_PIPELINE_ENTRIES];
+    XDMA_TRANSFER* aborted[XDMA_MAX_PIPELINE_ENTRIES];
+    ULONG numDone = 0;
+    ULONG numAborted = 0;
+    BOOLEAN deferStart = FALSE;
+    XDMA_TRANSFER* transfer = NULL;
+    NTSTATUS status = STATUS_CANCELLED;
+
+    WdfSpinLockAcquire(pipeline->lock);
+    for (ULONG i = 0; i < pipeline->depth; ++i) {
+        if ((pipeline->transfers[i].state != TransferState_Free) &&
+            (pipeline->transfers[i].request == request)) {
+            transfer = &pipeline->transfers[i];
+            break;
+        }
+    }
+    if (transfer == NULL) {
+        WdfSpinLockRelease(pipeline->lock);
+        TraceError(DBG_DMA, "request 0x%p not found in %s_%u pipeline",
+                   request, DirectionToString(engine->dir), engine->channel);
+        return;
+    }
+    if (transfer->loop && (transfer->state == TransferState_Running)) { // the way to stop a loop
+        EngineStop(engine);
+        transfer->state = TransferState_Acquired;
+        WdfSpinLockRelease(pipeline->lock);
+        EngineLoopHalted(engine);
+        EngineCompleteRequest(engine, transfer, STATUS_CANCELLED);
+        return;
+    }
+
+    switch (transfer->state) {
+    case TransferState_Queued: // not handed to the engine yet
+        for (ULONG i = pipeline->numRunning; i < pipeline->numRunning + pipeline->numQueued; ++i) {
+            if (pipeline->order[i] == transfer) {
+                PipelineRemove(pipeline, i);
+                pipeline->numQueued--;
+                break;
+            }
+        }
+        transfer->state = TransferState_Acquired;
+        break;
+    case TransferState_Done: // completion has been handed over to us
+        transfer->state = TransferState_Acquired;
+        status = transfer->status;
+        break;
+    case TransferState_Running:
+    {
+        if (pipeline->stopping) { // another cancel takes the run apart, it picks this one up
+            transfer->cancelPending = TRUE;
+            WdfSpinLockRelease(pipeline->lock);
+            TraceInfo(DBG_DMA, "request 0x%p is cancelled with its run", request);
+            return;
+        }
+
+        // stop the run and take it apart. completed chains are retired, the remaining memory
+        // mapped chains are requeued and restarted from scratch. A partially sent stream can not
+        // be repeated, so the remaining AXI-ST requests are aborted. The engine comes to a halt
+        // without the lock, the run is left alone meanwhile.
+        EngineStop(engine);
+        pipeline->stopping = TRUE;
+        WdfSpinLockRelease(pipeline->lock);
+        EngineWaitIdle(engine);
+        WdfSpinLockAcquire(pipeline->lock);
+        pipeline->stopping = FALSE;
+
+        BOOLEAN wbError = FALSE;
+        ULONG completed = EngineCompletedDescCount(engine, &wbError);
+        if (!wbError) {
+            numDone = PipelinePopCompleted(pipeline, completed, done);
+        }
+
+        // the cancelled chain may have completed meanwhile. It is not retired - retiring would
+        // queue its continuation (or the next fill stage) and complete the request under us.
+        for (ULONG j = 0; j < numDone; ++j) {
+            if (done[j] == transfer) {
+                for (--numDone; j < numDone; ++j) {
+                    done[j] = done[j + 1];
+                }
+                break;
+            }
+        }
+
+        // requests cancelled while the engine was coming to a halt go along with this one
+        ULONG i = 0;
+        while (i < pipeline->numRunning) {
+            XDMA_TRANSFER* victim = pipeline->order[i];
+            if ((victim == transfer) || victim->cancelPending || (engine->type == EngineType_ST)) {
+                PipelineRemove(pipeline, i);
+                pipeline->numRunning--;
+                victim->state = TransferState_Acquired;
+                if (victim != transfer) {
+                    aborted[numAborted++] = victim;
+                }
+            } else {
+                DescUnlink(victim->lastDesc);
+                victim->state = TransferState_Queued;
+                ++i;
+            }
+        }
+        pipeline->numQueued += pipeline->numRunning;
+        pipeline->numRunning = 0;
+        EngineClearPollWriteBack(engine);
+
+        for (ULONG j = 0; j < numDone; ++j) {
+            deferStart |= !done[j]->lastFragment;
+        }
+        if (!deferStart) {
+            EngineStartRun(engine);
+        }
+        break;
+    }
+    default: // TransferState_Acquired - owned by the I/O callback or the completion path
+        transfer->cancelPending = TRUE;
+        WdfSpinLockRelease(pipeline->lock);
+        TraceInfo(DBG_DMA, "request 0x%p is being completed", request);
+        return;
+    }
+    WdfSpinLockRelease(pipeline->lock);
+
+    for (ULONG i = 0; i < numDone; ++i) {
+        EngineRetireTransfer(engine, done[i], STATUS_SUCCESS);
+    }
+    for (ULONG i = 0; i < numAborted; ++i) {
+        EngineCompleteTransfer(engine, aborted[i],
+                               aborted[i]->cancelPending ? STATUS_CANCELLED : STATUS_REQUEST_ABORTED);
+    }
+    if (deferStart) {
+        WdfSpinLockAcquire(pipeline->lock);
+        if (pipeline->numRunning == 0) {
+            EngineStartRun(engine);
+        }
+        WdfSpinLockRelease(pipeline->lock);
+    }
+
+    EngineCompleteRequest(engine, transfer, status);
+}
+
+// ========================= registered buffers ====================================================
+
+static VOID EngineBufferMapped(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp,
+                               IN PSCATTER_GATHER_LIST ScatterGather, IN PVOID Context)
+// called by GetScatterGatherList() once the buffer is mapped
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Irp);
+
+    XDMA_REGISTERED_BUFFER* buffer = (XDMA_REGISTERED_BUFFER*)Context;
+    buffer->sgList = ScatterGather;
+    KeSetEvent(&buffer->mapped, IO_NO_INCREMENT, FALSE);
+}
+
+static void EngineFreeBuffer(IN XDMA_ENGINE* engine, IN XDMA_REGISTERED_BUFFER* buffer)
+// unmap and unlock a buffer and free its slot - no references left
+{
+    if (buffer->sgList != NULL) {
+        KIRQL irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        buffer->adapter->DmaOperations->PutScatterGatherList(buffer->adapter, buffer->sgList,
+                                                             engine->dir == H2C);
+        KeLowerIrql(irql);
+        buffer->sgList = NULL;
+    }
+    if (buffer->mdl != NULL) {
+        if (buffer->mdl->MdlFlags & MDL_PAGES_LOCKED) {
+            MmUnlockPages(buffer->mdl);
+        }
+        IoFreeMdl(buffer->mdl);
+        buffer->mdl = NULL;
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    buffer->owner = NULL;
+    WdfSpinLockRelease(engine->pipeline.lock);
+}
+
+NTSTATUS EngineRegisterBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN UINT64 address,
+                              IN size_t length, OUT ULONG* handle) {
+    XDMA_DEVICE* xdma = engine->parentDevice;
+    XDMA_REGISTERED_BUFFER* buffer = NULL;
+    NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+    // the buffer is mapped as a whole and goes to the engine a vector at a time, so it is limited
+    // like a single transfer
+    if ((length == 0) || (length > xdma->maxTransferSize) || (address + length < address)) {
+        TraceError(DBG_IO, "%s_%u buffer of %llu bytes at 0x%llx invalid",
+                   DirectionToString(engine->dir), engine->channel, (ULONG64)length, address);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    for (ULONG i = 0; i < XDMA_MAX_REGISTERED_BUFFERS; ++i) {
+        if (engine->registered[i].owner == NULL) {
+            buffer = &engine->registered[i];
+            buffer->owner = owner;
+            buffer->active = FALSE;
+            buffer->references = 0;
+            *handle = i + 1; // 0 is never a valid handle
+            break;
+        }
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+    if (buffer == NULL) {
+        TraceError(DBG_IO, "%s_%u all %u buffer slots in use", DirectionToString(engine->dir),
+                   engine->channel, XDMA_MAX_REGISTERED_BUFFERS);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    buffer->length = (ULONG)length;
+    buffer->sgList = NULL;
+
+    // lock the pages of the calling process, the engine reads an H2C buffer and writes a C2H one
+    buffer->mdl = IoAllocateMdl((PVOID)(ULONG_PTR)address, (ULONG)length, FALSE, FALSE, NULL);
+    if (buffer->mdl == NULL) {
+        TraceError(DBG_IO, "IoAllocateMdl failed!");
+        goto ErrExit;
+    }
+    __try {
+        MmProbeAndLockPages(buffer->mdl, UserMode,
+                            (engine->dir == H2C) ? IoReadAccess : IoWriteAccess);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+        TraceError(DBG_IO, "MmProbeAndLockPages failed: 0x%08x", status);
+        goto ErrExit;
+    }
+
+    // map them for the device once - the logical addresses are kept until the buffer is freed
+    buffer->adapter = WdfDmaEnablerWdmGetDmaAdapter(xdma->dmaEnabler, (engine->dir == H2C) ?
+                                                    WdfDmaDirectionWriteToDevice :
+                                                    WdfDmaDirectionReadFromDevice);
+    KeInitializeEvent(&buffer->mapped, NotificationEvent, FALSE);
+    KIRQL irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    status = buffer->adapter->DmaOperations->GetScatterGatherList(
+        buffer->adapter, WdfDeviceWdmGetDeviceObject(xdma->wdfDevice), buffer->mdl,
+        MmGetMdlVirtualAddress(buffer->mdl), buffer->length, EngineBufferMapped, buffer,
+        engine->dir == H2C);
+    KeLowerIrql(irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "GetScatterGatherList failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    KeWaitForSingleObject(&buffer->mapped, Executive, KernelMode, FALSE, NULL);
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    buffer->references = 1;
+    buffer->active = TRUE;
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    TraceInfo(DBG_IO, "%s_%u buffer %u registered (%llu bytes in %u elements)",
+              DirectionToString(engine->dir), engine->channel, *handle, (ULONG64)length,
+              buffer->sgList->NumberOfElements);
+    return STATUS_SUCCESS;
+
+ErrExit:
+    EngineFreeBuffer(engine, buffer);
+    return status;
+}
+
+static XDMA_REGISTERED_BUFFER* EngineDeactivateBuffer(IN XDMA_ENGINE* engine, IN PVOID owner,
+                                                      IN ULONG index)
+// take a registered buffer out of use for new transfers - pipeline lock held. Returns the buffer
+// if this dropped its last reference.
+{
+    XDMA_REGISTERED_BUFFER* buffer = &engine->registered[index];
+    if ((buffer->owner != owner) || !buffer->active) {
+        return NULL;
+    }
+    buffer->active = FALSE;
+    return (--buffer->references == 0) ? buffer : NULL;
+}
+
+NTSTATUS EngineUnregisterBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG handle) {
+    if ((handle == 0) || (handle > XDMA_MAX_REGISTERED_BUFFERS)) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    XDMA_REGISTERED_BUFFER* buffer = &engine->registered[handle - 1];
+    const BOOLEAN valid = (buffer->owner == owner) && buffer->active;
+    XDMA_REGISTERED_BUFFER* unused = EngineDeactivateBuffer(engine, owner, handle - 1);
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (!valid) {
+        return STATUS_INVALID_HANDLE;
+    }
+    if (unused != NULL) { // otherwise the last transfer on it frees it
+        EngineFreeBuffer(engine, unused);
+    }
+    TraceInfo(DBG_IO, "%s_%u buffer %u unregistered", DirectionToString(engine->dir),
+              engine->channel, handle);
+    return STATUS_SUCCESS;
+}
+
+VOID EngineUnregisterBuffers(IN XDMA_ENGINE* engine, IN PVOID owner) {
+    for (ULONG i = 0; i < XDMA_MAX_REGISTERED_BUFFERS; ++i) {
+        WdfSpinLockAcquire(engine->pipeline.lock);
+        XDMA_REGISTERED_BUFFER* unused = EngineDeactivateBuffer(engine, owner, i);
+        WdfSpinLockRelease(engine->pipeline.lock);
+        if (unused != NULL) {
+            EngineFreeBuffer(engine, unused);
+        }
+    }
+}
+
+NTSTATUS EngineReferenceBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG handle,
+                               OUT XDMA_REGISTERED_BUFFER** buffer) {
+    NTSTATUS status = STATUS_INVALID_HANDLE;
+    *buffer = NULL;
+    if ((handle == 0) || (handle > XDMA_MAX_REGISTERED_BUFFERS)) {
+        return status;
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    XDMA_REGISTERED_BUFFER* registered = &engine->registered[handle - 1];
+    if ((registered->owner == owner) && registered->active) {
+        registered->references++;
+        *buffer = registered;
+        status = STATUS_SUCCESS;
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+    return status;
+}
+
+VOID EngineReleaseBuffer(IN XDMA_ENGINE* engine, IN XDMA_REGISTERED_BUFFER* buffer) {
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    const BOOLEAN unused = (--buffer->references == 0);
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (unused) { // unregistered while the transfer ran
+        EngineFreeBuffer(engine, buffer);
+    }
+}
+
+static void EngineBuildRegistered(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer)
+// build the descriptors of the vector of a transfer on a registered buffer from its mapping
+{
+    PSCATTER_GATHER_LIST sgList = transfer->registered->sgList;
+
+    XDMA_DESC_PARAMS descParams;
+    EngineGetDescParams(engine, &descParams);
+
+    XDMA_DESC_LIST list;
+    ULONG numAppended = DescStoreBuildVectors(&transfer->store, &descParams, engine->dir,
+                                              sgList->Elements, sgList->NumberOfElements,
+                                              transfer->vectors, transfer->numPackets,
+                                              XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT, &list);
+    ASSERTMSG("descriptor store too small for registered buffer vector",
+              numAppended == transfer->numPackets);
+    UNREFERENCED_PARAMETER(numAppended);
+    InterlockedExchangeAdd64(&engine->stats.descriptors, list.count);
+    TraceVerbose(DBG_DMA, "%s_%u registered buffer vector of %llu bytes in %u descriptors",
+                 DirectionToString(engine->dir), engine->channel, (ULONG64)transfer->packetBytes,
+                 list.count);
+    if (list.misaligned) {
+        TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned (%u descriptors)", list.misaligned);
+    }
+
+    transfer->firstAdj = list.firstAdj;
+    transfer->numDescriptors = list.count;
+    transfer->numBytes = transfer->packetBytes;
+    transfer->lastDesc = list.last;
+    transfer->lastFragment = TRUE;
+}
+
+VOID EngineProgramRegistered(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer) {
+    // the mapping is reused, so the caches are flushed for every transfer (a no-op on x86/x64,
+    // where dma is cache coherent)
+    if (engine->dir == H2C) {
+        KeFlushIoBuffers(transfer->registered->mdl, FALSE, TRUE);
+    }
+
+    EngineBuildRegistered(engine, transfer);
+    EngineSubmitTransfer(engine, transfer, FALSE);
+}
+
+// ========================= stored programs ======================================================
+
+static XDMA_PROGRAM* EngineFindProgram(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id)
+// the active program of an owner - pipeline lock held
+{
+    if ((id == 0) || (id > XDMA_MAX_PROGRAMS)) {
+        return NULL;
+    }
+    XDMA_PROGRAM* program = &engine->programs[id - 1];
+    return ((program->owner == owner) && program->active) ? program : NULL;
+}
+
+static void EngineFreeProgram(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program)
+// give the buffer and the slot of a deleted program back - it is idle
+{
+    XDMA_REGISTERED_BUFFER* buffer = program->transfer.registered;
+    program->transfer.registered = NULL;
+    EngineReleaseBuffer(engine, buffer);
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    program->owner = NULL;
+    WdfSpinLockRelease(engine->pipeline.lock);
+}
+
+NTSTATUS EngineProgramCreate(IN XDMA_ENGINE* engine, IN PVOID owner,
+                             IN XDMA_REGISTERED_BUFFER* buffer, IN const XDMA_IO_VECTOR* vector,
+                             OUT ULONG* id) {
+    XDMA_PROGRAM* program = NULL;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    for (ULONG i = 0; i < XDMA_MAX_PROGRAMS; ++i) {
+        if (engine->programs[i].owner == NULL) {
+            program = &engine->programs[i];
+            program->owner = owner;
+            program->active = FALSE;
+            *id = i + 1; // 0 is never a valid id
+            break;
+        }
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+    if (program == NULL) {
+        TraceError(DBG_IO, "%s_%u all %u program slots in use", DirectionToString(engine->dir),
+                   engine->channel, XDMA_MAX_PROGRAMS);
+        EngineReleaseBuffer(engine, buffer);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // the descriptor store of a slot fits the vector - at most one descriptor per page touched. It
+    // is kept for the next program in the slot unless that one needs more. A program runs from the
+    // kept scatter gather list of the buffer, it has no dma transaction.
+    XDMA_TRANSFER* transfer = &program->transfer;
+    const ULONG numDescriptors = (ULONG)min(
+        ADDRESS_AND_SIZE_TO_SPAN_PAGES((PUCHAR)MmGetMdlVirtualAddress(buffer->mdl) + vector->offset,
+                                       vector->length) + 2,
+        XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize) * XDMA_DESC_SEGMENT_CAPACITY);
+    if (program->allocated &&
+        (transfer->store.numSegments * transfer->store.segmentCapacity < numDescriptors)) {
+        TransferDeleteSegments(transfer, NULL);
+        program->allocated = FALSE;
+    }
+    if (!program->allocated) {
+        status = EngineCreateTransfer(engine, transfer, NULL, numDescriptors, FALSE);
+        if (!NT_SUCCESS(status)) {
+            WdfSpinLockAcquire(engine->pipeline.lock);
+            program->owner = NULL;
+            WdfSpinLockRelease(engine->pipeline.lock);
+            EngineReleaseBuffer(engine, buffer);
+            return status;
+        }
+        program->allocated = TRUE;
+    }
+    RtlCopyMemory(&program->vector, vector, sizeof(program->vector));
+    transfer->state = TransferState_Free;
+    transfer->request = NULL;
+    transfer->vectors = &program->vector;
+    transfer->numPackets = 1;
+    transfer->packetBytes = vector->length;
+    transfer->registered = buffer;
+    transfer->program = program;
+    EngineBuildRegistered(engine, transfer);
+
+    RtlZeroMemory(&program->status, sizeof(program->status));
+    program->eventId = XDMA_PROGRAM_NO_EVENT;
+    KeInitializeEvent(&program->completion, NotificationEvent, FALSE);
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    program->active = TRUE;
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    TraceInfo(DBG_IO, "%s_%u program %u: %u bytes at offset %u of a buffer, %u descriptors",
+              DirectionToString(engine->dir), engine->channel, *id, vector->length,
+              vector->offset, transfer->numDescriptors);
+    return STATUS_SUCCESS;
+}
+
+static void EngineProgramUnbind(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program)
+// the user event of a program no longer runs it - pipeline lock held
+{
+    if (program->eventId != XDMA_PROGRAM_NO_EVENT) {
+        InterlockedCompareExchangePointer(
+            (PVOID volatile*)&engine->parentDevice->userEvents[program->eventId].program, NULL,
+            program);
+        program->eventId = XDMA_PROGRAM_NO_EVENT;
+    }
+}
+
+static XDMA_PROGRAM* EngineDeactivateProgram(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id)
+// take a program out of use - pipeline lock held. Returns the program if it is idle and may be
+// freed, otherwise its run frees it (see EngineRetireProgram()).
+{
+    XDMA_PROGRAM* program = EngineFindProgram(engine, owner, id);
+    if (program == NULL) {
+        return NULL;
+    }
+    program->active = FALSE;
+    EngineProgramUnbind(engine, program);
+    KeSetEvent(&program->completion, IO_NO_INCREMENT, FALSE); // waiters give up
+    return (program->transfer.state == TransferState_Free) ? program : NULL;
+}
+
+NTSTATUS EngineProgramDelete(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id) {
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    const BOOLEAN valid = EngineFindProgram(engine, owner, id) != NULL;
+    XDMA_PROGRAM* idle = EngineDeactivateProgram(engine, owner, id);
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (!valid) {
+        return STATUS_INVALID_HANDLE;
+    }
+    if (idle != NULL) {
+        EngineFreeProgram(engine, idle);
+    }
+    TraceInfo(DBG_IO, "%s_%u program %u deleted", DirectionToString(engine->dir), engine->channel,
+              id);
+    return STATUS_SUCCESS;
+}
+
+VOID EngineProgramDeleteAll(IN XDMA_ENGINE* engine, IN PVOID owner) {
+    for (ULONG i = 0; i < XDMA_MAX_PROGRAMS; ++i) {
+        WdfSpinLockAcquire(engine->pipeline.lock);
+        XDMA_PROGRAM* idle = EngineDeactivateProgram(engine, owner, i + 1);
+        WdfSpinLockRelease(engine->pipeline.lock);
+        if (idle != NULL) {
+            EngineFreeProgram(engine, idle);
+        }
+    }
+}
+
+static NTSTATUS EngineProgramStart(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program,
+                                   IN PVOID owner, IN ULONG eventId)
+// queue the chain of a program. It runs right away if the engine is idle: the engine is pointed at
+// its first descriptor and started, nothing is built. owner is NULL for a user event.
+{
+    XDMA_TRANSFER* transfer = &program->transfer;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    if (!program->active || ((owner != NULL) && (program->owner != owner)) ||
+        ((owner == NULL) && (program->eventId != eventId))) { // deleted or rebound meanwhile
+        WdfSpinLockRelease(engine->pipeline.lock);
+        return STATUS_INVALID_HANDLE;
+    }
+    program->status.triggers++;
+    if (transfer->state != TransferState_Free) {
+        program->status.missed++;
+        WdfSpinLockRelease(engine->pipeline.lock);
+        return STATUS_DEVICE_BUSY;
+    }
+    transfer->state = TransferState_Acquired;
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (engine->dir == H2C) {
+        KeFlushIoBuffers(transfer->registered->mdl, FALSE, TRUE);
+    }
+    EngineSubmitTransfer(engine, transfer, FALSE);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS EngineProgramRun(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id) {
+    if ((owner == NULL) || (id == 0) || (id > XDMA_MAX_PROGRAMS)) {
+        return STATUS_INVALID_HANDLE;
+    }
+    return EngineProgramStart(engine, &engine->programs[id - 1], owner, XDMA_PROGRAM_NO_EVENT);
+}
+
+NTSTATUS EngineProgramBind(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id, IN ULONG eventId) {
+    NTSTATUS status = STATUS_SUCCESS;
+    if ((eventId != XDMA_PROGRAM_NO_EVENT) && (eventId >= XDMA_MAX_USER_IRQ)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    // a run started by the dpc completes by itself only with the channel interrupt or the poller
+    // thread - nobody would poll for it otherwise
+    const BOOLEAN serviced = !engine->poll ||
+        ((engine->completionMode == XDMA_COMPLETION_MODE_POLL) && (engine->poller != NULL));
+    if ((eventId != XDMA_PROGRAM_NO_EVENT) && !serviced) {
+        TraceError(DBG_IO, "%s_%u user events run programs only in interrupt mode or with the poll thread",
+                   DirectionToString(engine->dir), engine->channel);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    XDMA_PROGRAM* program = EngineFindProgram(engine, owner, id);
+    if (program == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else if (eventId != program->eventId) {
+        EngineProgramUnbind(engine, program);
+        // the events are shared by all engines, so their slots are claimed without the lock
+        if ((eventId != XDMA_PROGRAM_NO_EVENT) &&
+            (InterlockedCompareExchangePointer(
+                (PVOID volatile*)&engine->parentDevice->userEvents[eventId].program, program,
+                NULL) != NULL)) {
+            status = STATUS_DEVICE_BUSY;
+        } else {
+            program->eventId = eventId;
+        }
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (NT_SUCCESS(status)) {
+        TraceInfo(DBG_IO, "%s_%u program %u bound to event %d", DirectionToString(engine->dir),
+                  engine->channel, id, (LONG)eventId);
+    }
+    return status;
+}
+
+VOID EngineProgramEvent(IN XDMA_PROGRAM* program, IN ULONG eventId) {
+    XDMA_ENGINE* engine = program->transfer.engine;
+    NTSTATUS status = EngineProgramStart(engine, program, NULL, eventId);
+    TraceVerbose(DBG_DMA, "%s_%u event_%u starting program %u: %!STATUS!",
+                 DirectionToString(engine->dir), engine->channel, eventId,
+                 (ULONG)(program - engine->programs) + 1, status);
+}
+
+static void EngineRetireProgram(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program,
+                                IN NTSTATUS status)
+// a run of a program has completed - make its chain the end of a run again for the next one
+{
+    XDMA_TRANSFER* transfer = &program->transfer;
+    DescUnlink(transfer->lastDesc);
+    if (engine->dir == C2H) {
+        KeFlushIoBuffers(transfer->registered->mdl, TRUE, TRUE);
+    }
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    transfer->state = TransferState_Free;
+    if (NT_SUCCESS(status)) {
+        program->status.runs++;
+    } else {
+        program->status.failed++;
+    }
+    const BOOLEAN deleted = !program->active;
+    WdfSpinLockRelease(engine->pipeline.lock);
+    KeSetEvent(&program->completion, IO_NO_INCREMENT, FALSE);
+
+    TraceVerbose(DBG_DMA, "%s_%u program %u run complete: %!STATUS!",
+                 DirectionToString(engine->dir), engine->channel,
+                 (ULONG)(program - engine->programs) + 1, status);
+    if (deleted) {
+        EngineFreeProgram(engine, program);
+    }
+}
+
+NTSTATUS EngineProgramWait(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id, IN UINT64 runs,
+                           IN LARGE_INTEGER timeout, OUT XDMA_PROGRAM_STATUS* counters) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    for (;;) {
+        WdfSpinLockAcquire(pipeline->lock);
+        XDMA_PROGRAM* program = EngineFindProgram(engine, owner, id);
+        if (program == NULL) {
+            WdfSpinLockRelease(pipeline->lock);
+            return STATUS_INVALID_HANDLE;
+        }
+        // clear the completion signal before looking at the counters, so that a signal in between
+        // is not lost
+        KeClearEvent(&program->completion);
+        *counters = program->status;
+        const BOOLEAN idle = program->transfer.state == TransferState_Free;
+        WdfSpinLockRelease(pipeline->lock);
+
+        if (counters->runs + counters->failed >= runs) {
+            return STATUS_SUCCESS;
+        }
+        if ((engine->completionMode == XDMA_COMPLETION_MODE_POLL) && (engine->poller == NULL) &&
+            !idle) { // poll mode - poll for completion
+            NTSTATUS pollStatus = EnginePollTransfer(engine);
+            if (!NT_SUCCESS(pollStatus)) {
+                return pollStatus;
+            }
+            continue;
+        }
+        // the slot stays in place, even if the program is deleted while we wait
+        NTSTATUS waitStatus = KeWaitForSingleObject(&program->completion, Executive, KernelMode,
+                                                    FALSE, &timeout);
+        if (waitStatus == STATUS_TIMEOUT) {
+            return STATUS_IO_TIMEOUT;
+        }
+    }
+}
+
+// ========================= cyclic send ===========================================================
+
+static void EngineStartLoop(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer)
+// start the circle of a cyclic send on the idle engine
+{
+    XDMA_SEND_LOOP* loop = &engine->loop;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    ASSERT(engine->pipeline.numRunning == 0);
+
+    engine->sgdma->firstDescLo = (UINT32)LIMIT_TO_32(transfer->segmentLA[0]);
+    engine->sgdma->firstDescHi = (UINT32)LIMIT_TO_32(transfer->segmentLA[0] >> 32);
+    engine->sgdma->firstDescAdj = transfer->firstAdj;
+
+    // in credit mode the engine waits for the credits of the first slots
+    if (loop->credits) {
+        engine->parentDevice->sgdmaRegs->creditModeEnableW1S = BIT_N(engine->channel);
+    } else {
+        engine->parentDevice->sgdmaRegs->creditModeEnableW1C = BIT_N(engine->channel);
+    }
+    loop->lastCount = 0;
+    loop->descDone = 0;
+    loop->slotsGranted = 0;
+    transfer->state = TransferState_Running;
+    EngineClearPollWriteBack(engine);
+
+    TraceInfo(DBG_DMA, "%s_%u starting loop of %u slots, %u descriptors per lap%s",
+              DirectionToString(engine->dir), engine->channel, loop->numSlots,
+              transfer->numDescriptors, loop->credits ? ", credit mode" : "");
+
+    MemoryBarrier();
+
+    // start the engine
+    EngineStart(engine);
+
+    MemoryBarrier();
+    WdfSpinLockRelease(engine->pipeline.lock);
+}
+
+static void EngineLoopHalted(IN XDMA_ENGINE* engine)
+// the engine sending the loop has been stopped under the pipeline lock - let it come to a halt
+// before the loop request is completed. Called without the lock.
+{
+    EngineWaitIdle(engine);
+    if (engine->loop.credits) {
+        engine->parentDevice->sgdmaRegs->creditModeEnableW1C = BIT_N(engine->channel);
+    }
+    EngineClearPollWriteBack(engine);
+
+    TraceInfo(DBG_DMA, "%s_%u loop stopped after %llu descriptors",
+              DirectionToString(engine->dir), engine->channel, engine->loop.descDone);
+}
+
+NTSTATUS EngineLoopAcquire(IN XDMA_ENGINE* engine, IN WDFREQUEST request, IN ULONG numSlots,
+                           IN BOOLEAN credits, OUT XDMA_TRANSFER** transfer) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    XDMA_SEND_LOOP* loop = &engine->loop;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    *transfer = NULL;
+    ULONG* slotEnds = (ULONG*)ExAllocatePoolWithTag(NonPagedPoolNx, numSlots * sizeof(ULONG),
+                                                    XDMA_POOL_TAG);
+    if (slotEnds == NULL) {
+        TraceError(DBG_DMA, "ExAllocatePoolWithTag failed!");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // the loop takes the engine for itself - no requests in flight, none accepted until it stops
+    WdfSpinLockAcquire(pipeline->lock);
+    for (ULONG i = 0; i < pipeline->depth; ++i) {
+        if (pipeline->transfers[i].state != TransferState_Free) {
+            status = STATUS_DEVICE_BUSY;
+        }
+    }
+    if (NT_SUCCESS(status)) {
+        *transfer = &pipeline->transfers[0];
+        TransferAcquire(*transfer, request);
+        (*transfer)->loop = TRUE;
+        loop->transfer = *transfer;
+        loop->credits = credits;
+        loop->slotEnds = slotEnds;
+        loop->numSlots = numSlots;
+        slotEnds = NULL;
+    }
+    WdfSpinLockRelease(pipeline->lock);
+
+    if (slotEnds != NULL) {
+        ExFreePoolWithTag(slotEnds, XDMA_POOL_TAG);
+    }
+    return status;
+}
+
+VOID EngineLoopStarted(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer) {
+    BOOLEAN cancelled = FALSE;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    if (transfer->cancelPending && (transfer->state == TransferState_Running)) {
+        EngineStop(engine);
+        transfer->state = TransferState_Acquired;
+        cancelled = TRUE;
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (cancelled) {
+        EngineLoopHalted(engine);
+        EngineCompleteTransfer(engine, transfer, STATUS_CANCELLED);
+    }
+}
+
+NTSTATUS EngineLoopCredit(IN XDMA_ENGINE* engine, IN ULONG numSlots,
+                          OUT XDMA_TX_LOOP_STATUS* loopStatus) {
+    XDMA_SEND_LOOP* loop = &engine->loop;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    if ((loop->transfer == NULL) || (loop->transfer->state != TransferState_Running)) {
+        WdfSpinLockRelease(engine->pipeline.lock);
+        TraceError(DBG_DMA, "%s_%u no loop running", DirectionToString(engine->dir),
+                   engine->channel);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    // the completed count of the engine wraps at 2^24 - count on from the last look
+    BOOLEAN wbError = FALSE;
+    const ULONG count = EngineCompletedDescCount(engine, &wbError) & XDMA_WB_COUNT_MASK;
+    loop->descDone += (count - loop->lastCount) & XDMA_WB_COUNT_MASK;
+    loop->lastCount = count;
+    const UINT64 slotsSent = LoopSlotsDone(loop->slotEnds, loop->numSlots, loop->descDone);
+    if (wbError) {
+        TraceError(DBG_DMA, "%s_%u error on writeback", DirectionToString(engine->dir),
+                   engine->channel);
+    }
+
+    if ((numSlots > 0) && !loop->credits) {
+        status = STATUS_INVALID_DEVICE_REQUEST;
+    } else if (loop->slotsGranted + numSlots > slotsSent + loop->numSlots) {
+        // the slot of the previous lap in the same place has not been sent yet
+        status = STATUS_INVALID_PARAMETER;
+    } else if (numSlots > 0) {
+        UINT64 credits =
+            LoopSlotStart(loop->slotEnds, loop->numSlots, loop->slotsGranted + numSlots) -
+            LoopSlotStart(loop->slotEnds, loop->numSlots, loop->slotsGranted);
+        loop->slotsGranted += numSlots;
+
+        // the process updated the slots before - a write adds at most what fits the credit register
+        MemoryBarrier();
+        while (credits > 0) {
+            const UINT32 grant = (UINT32)min(credits, XDMA_DESC_CREDITS_MAX);
+            engine->sgdma->descCredits = grant;
+            credits -= grant;
+        }
+    }
+
+    loopStatus->slotsSent = slotsSent;
+    loopStatus->slotsGranted = loop->slotsGranted;
+    loopStatus->engineStatus = engine->regs->status;
+    loopStatus->reserved = 0;
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u loop sent=%llu, granted=%llu: %!STATUS!",
+                 DirectionToString(engine->dir), engine->channel, loopStatus->slotsSent,
+                 loopStatus->slotsGranted, status);
+    return status;
+}
+
+VOID EngineLoopStop(IN XDMA_ENGINE* engine, IN PVOID owner) {
+    XDMA_TRANSFER* transfer = NULL;
+
+    WdfSpinLockAcquire(engine->pipeline.lock);
+    XDMA_SEND_LOOP* loop = &engine->loop;
+    if ((loop->transfer != NULL) && (loop->transfer->state == TransferState_Running) &&
+        ((PVOID)WdfRequestGetFileObject(loop->transfer->request) == owner)) {
+        transfer = loop->transfer;
+        EngineStop(engine);
+        transfer->state = TransferState_Acquired;
+    }
+    WdfSpinLockRelease(engine->pipeline.lock);
+
+    if (transfer != NULL) {
+        EngineLoopHalted(engine);
+        EngineCompleteTransfer(engine, transfer, STATUS_CANCELLED);
+    }
+}
+
+static NTSTATUS TransferAddSegments(IN XDMA_ENGINE* engine, IN OUT XDMA_TRANSFER* transfer,
+                                    IN ULONG numSegments)
+// grow the descriptor store of a transfer to numSegments segments - PASSIVE_LEVEL. A segment is
+// published once it is set up, a list may be built in the store meanwhile.
+{
+    ASSERT(numSegments <= XDMA_MAX_DESC_SEGMENTS);
+    for (ULONG s = transfer->store.numSegments; s < numSegments; ++s) {
+        WDFCOMMONBUFFER segment;
+        NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler,
+                                                transfer->store.segmentCapacity * sizeof(DMA_DESCRIPTOR),
+                                                WDF_NO_OBJECT_ATTRIBUTES, &segment);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+            return status;
+        }
+        RtlZeroMemory(WdfCommonBufferGetAlignedVirtualAddress(segment),
+                      WdfCommonBufferGetLength(segment));
+        transfer->segments[s] = segment;
+        transfer->segmentVA[s] = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(segment);
+        transfer->segmentLA[s] = WdfCommonBufferGetAlignedLogicalAddress(segment).QuadPart;
+        MemoryBarrier();
+        transfer->store.numSegments = s + 1;
+    }
+    return STATUS_SUCCESS;
+}
+
+static void TransferDeleteSegments(IN OUT XDMA_TRANSFER* transfer, IN WDFCOMMONBUFFER keep)
+// delete the descriptor store of a transfer, except a given segment (the engine descriptor buffer)
+{
+    for (ULONG s = 0; s < XDMA_MAX_DESC_SEGMENTS; ++s) {
+        if ((transfer->segments[s] != NULL) && (transfer->segments[s] != keep)) {
+            WdfObjectDelete(transfer->segments[s]);
+        }
+        transfer->segments[s] = NULL;
+        transfer->segmentVA[s] = NULL;
+        transfer->segmentLA[s] = 0;
+    }
+    transfer->store.numSegments = 0;
+}
+
+static NTSTATUS EngineCreateTransfer(IN XDMA_ENGINE* engine, IN OUT XDMA_TRANSFER* transfer,
+                                     IN WDFCOMMONBUFFER descBuffer, IN ULONG numDescriptors,
+                                     IN BOOLEAN transaction)
+// set up a transfer with a descriptor store for numDescriptors: segments of the default capacity,
+// a single smaller one if that does. The first segment may be given (the engine descriptor
+// buffer). A program on a registered buffer needs no dma transaction.
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    const ULONG capacity = min(numDescriptors, XDMA_DESC_SEGMENT_CAPACITY);
+
+    transfer->engine = engine;
+    transfer->state = TransferState_Free;
+
+    ASSERT((descBuffer == NULL) || (capacity == XDMA_DESC_SEGMENT_CAPACITY));
+    transfer->store.numSegments = 0;
+    transfer->store.segmentCapacity = capacity;
+    transfer->store.desc = transfer->segmentVA;
+    transfer->store.descLA = transfer->segmentLA;
+    if (descBuffer != NULL) {
+        transfer->segments[0] = descBuffer;
+        transfer->segmentVA[0] = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(descBuffer);
+        transfer->segmentLA[0] = WdfCommonBufferGetAlignedLogicalAddress(descBuffer).QuadPart;
+        transfer->store.numSegments = 1;
+    }
+    status = TransferAddSegments(engine, transfer, (numDescriptors + capacity - 1) / capacity);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+
+    // allocate wdf dma transaction object
+    if (transaction) {
+        status = WdfDmaTransactionCreate(engine->parentDevice->dmaEnabler, WDF_NO_OBJECT_ATTRIBUTES,
+                                         &transfer->dmaTransaction);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
+            goto ErrExit;
+        }
+    }
+    return status;
+
+ErrExit:
+    // the segments created here go with the failure - a retry starts over
+    TransferDeleteSegments(transfer, descBuffer);
+    return status;
+}
+
+static NTSTATUS EngineCreatePipeline(IN XDMA_ENGINE* engine) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+
+    NTSTATUS status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &pipeline->lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &pipeline->growLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfWaitLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the first transfer uses the engine descriptor buffer. A segment holds the list of a transfer
+    // of the default max size, more are added once a longer request comes (EngineGrowStores())
+    pipeline->numSegments = 1;
+    pipeline->segmentsWanted = 1;
+    status = EngineCreateTransfer(engine, &pipeline->transfers[0], engine->descBuffer,
+                                  pipeline->numSegments * XDMA_DESC_SEGMENT_CAPACITY, TRUE);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    pipeline->depth = 1;
+    return status;
+}
+
+BOOLEAN EngineStoreTooSmall(IN XDMA_ENGINE* engine, IN ULONG64 numDescriptors) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    const ULONG64 numSegments =
+        (numDescriptors + XDMA_DESC_SEGMENT_CAPACITY - 1) / XDMA_DESC_SEGMENT_CAPACITY;
+
+    ASSERT(numSegments <= XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize));
+    WdfSpinLockAcquire(pipeline->lock);
+    const BOOLEAN tooSmall = numSegments > pipeline->numSegments;
+    if (tooSmall && (numSegments > pipeline->segmentsWanted)) {
+        pipeline->segmentsWanted = (ULONG)numSegments;
+    }
+    WdfSpinLockRelease(pipeline->lock);
+    return tooSmall;
+}
+
+NTSTATUS EngineGrowStores(IN XDMA_ENGINE* engine) {
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(pipeline->growLock, NULL);
+    WdfSpinLockAcquire(pipeline->lock);
+    const ULONG numSegments = pipeline->segmentsWanted;
+    WdfSpinLockRelease(pipeline->lock);
+
+    // every transfer gets the segments - any of them may take the next request. Those added
+    // before a failure are kept, the next attempt goes on from there.
+    if (numSegments > pipeline->numSegments) {
+        for (ULONG i = 0; (i < XDMA_MAX_QUEUE_DEPTH) && NT_SUCCESS(status); ++i) {
+            if (pipeline->transfers[i].segments[0] != NULL) {
+                status = TransferAddSegments(engine, &pipeline->transfers[i], numSegments);
+            }
+        }
+        if (NT_SUCCESS(status)) {
+            WdfSpinLockAcquire(pipeline->lock);
+            pipeline->numSegments = numSegments;
+            WdfSpinLockRelease(pipeline->lock);
+        }
+        TraceInfo(DBG_DMA, "%s_%u descriptor stores grown to %u segments: %!STATUS!",
+                  DirectionToString(engine->dir), engine->channel, numSegments, status);
+    }
+    WdfWaitLockRelease(pipeline->growLock);
+    return status;
+}
+
+NTSTATUS XDMA_EngineSetQueueDepth(XDMA_ENGINE* engine, ULONG depth) {
+
+    EXPECT(engine != NULL);
+
+    if ((depth == 0) || (depth > XDMA_MAX_QUEUE_DEPTH)) {
+        TraceError(DBG_INIT, "invalid queue depth %u (1-%u)", depth, XDMA_MAX_QUEUE_DEPTH);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (engine->enabled != TRUE) {
+        return STATUS_SUCCESS;
+    }
+
+    // the AXI-ST C2H ring has no request pipeline - the depth limits the buffers posted to it
+    if (engine->work != EngineProcessTransfer) {
+        return EngineRxSetDepth(engine, depth);
+    }
+
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    for (ULONG i = 1; i < depth; ++i) {
+        if ((pipeline->transfers[i].segments[0] == NULL) ||
+            (pipeline->transfers[i].dmaTransaction == NULL)) {
+            NTSTATUS status = EngineCreateTransfer(engine, &pipeline->transfers[i], NULL,
+                                                   pipeline->numSegments * XDMA_DESC_SEGMENT_CAPACITY,
+                                                   TRUE);
+            if (!NT_SUCCESS(status)) {
+                return status;
+            }
+        }
+    }
+    pipeline->depth = depth;
+
+    TraceInfo(DBG_INIT, "%s_%u queue depth=%u",
+              DirectionToString(engine->dir), engine->channel, depth);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS XDMA_EngineSetRingGeometry(XDMA_ENGINE* engine, ULONG numBlocks, ULONG blockSize,
+                                    ULONG memory) {
+
+    EXPECT(engine != NULL);
+
+    // only the AXI-ST C2H engines have a ring - the geometry of the others is not looked at
+    if ((engine->enabled != TRUE) || (engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        return STATUS_SUCCESS;
+    }
+
+    if ((numBlocks < XDMA_RING_MIN_BLOCKS) || (numBlocks > XDMA_RING_MAX_BLOCKS)) {
+        TraceError(DBG_INIT, "invalid ring block count %u (%u-%u)",
+                   numBlocks, XDMA_RING_MIN_BLOCKS, XDMA_RING_MAX_BLOCKS);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if ((blockSize < XDMA_RING_MIN_BLOCK_SIZE) || (blockSize > XDMA_RING_MAX_BLOCK_SIZE)
+        || (blockSize % PAGE_SIZE != 0)) {
+        TraceError(DBG_INIT, "invalid ring block size %u (%u-%u, multiple of %u)",
+                   blockSize, XDMA_RING_MIN_BLOCK_SIZE, XDMA_RING_MAX_BLOCK_SIZE, PAGE_SIZE);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (memory > XDMA_RING_MEMORY_WRITECOMBINED) {
+        TraceError(DBG_INIT, "invalid ring memory type %u", memory);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    MEMORY_CACHING_TYPE cacheType = MmNonCached;
+    if (memory == XDMA_RING_MEMORY_WRITECOMBINED) {
+        cacheType = MmWriteCombined;
+    } else if (memory == XDMA_RING_MEMORY_CACHED) {
+#if defined(_M_AMD64) || defined(_M_IX86)
+        cacheType = MmCached; // PCIe writes of the engine snoop the processor caches
+#else
+        TraceWarning(DBG_INIT, "%s_%u cached ring memory needs dma snooping, using non-cached",
+                     DirectionToString(engine->dir), engine->channel);
+#endif
+    }
+    if ((engine->ring.numBlocks == numBlocks) && (engine->ring.blockSize == blockSize)
+        && (engine->ring.cacheType == cacheType)) {
+        return STATUS_SUCCESS;
+    }
+
+    EngineRingFree(engine);
+    return EngineRingAllocate(engine, numBlocks, blockSize, cacheType);
+}
+
+// 用于检查和初始化 FPGA 的传输引擎（Engine），其中包括 H2C 和 C2H 两种方向的引擎。
+NTSTATUS ProbeEngines(IN PXDMA_DEVICE xdma) {
+    PAGED_CODE();
+
+    ULONG engineIndex = 0;
+
+    // iterate over H2C (FPGA performs PCIe reads towards FPGA),
+    // then C2H (FPGA performs PCIe writes from FPGA)
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+
+            // 检查引擎是否存在
+            if (EngineExists(xdma, dir, ch)) 
+            {
+                XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
+                NTSTATUS status = EngineCreate(xdma, engine, dir, ch, engineIndex);
+                if (!NT_SUCCESS(status)) {
+                    TraceError(DBG_INIT, "EngineCreate failed! %!STATUS!", status);
+                    return status;
+                }
+                engineIndex++;
+                TraceInfo(DBG_INIT, "%s_%u engine created (AXI-%s)",
+                          DirectionToString(dir), ch, engine->type == EngineType_ST ? "ST" : "MM");
+            } 
+            else 
+            {     
+                // 引擎不存在
+                TraceInfo(DBG_INIT, "Skipping non-existing engine %s_%u",
+                          DirectionToString(dir), ch);
+            }
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+void EngineStart(IN XDMA_ENGINE *engine) {
+    engine->regs->controlW1S = XDMA_CTRL_RUN_BIT;
+    TraceInfo(DBG_DMA, "%s_%u engine started (control=0x%08x)",
+              DirectionToString(engine->dir), engine->channel, engine->regs->control);
+}
+
+void EngineStop(IN XDMA_ENGINE *engine) {
+    engine->regs->controlW1C = XDMA_CTRL_RUN_BIT;
+    TraceInfo(DBG_DMA, "%s_%u engine stopped (control=0x%08x)",
+              DirectionToString(engine->dir), engine->channel, engine->regs->control);
+}
+
+static void EngineWaitIdle(IN XDMA_ENGINE* engine)
+// wait up to 1ms for a stopped engine to finish the descriptor in flight - no lock held
+{
+    for (UINT i = 0; (i < 1000) && (engine->regs->status & XDMA_BUSY_BIT); ++i) {
+        KeStallExecutionProcessor(1);
+    }
+}
+
+void EngineEnableInterrupt(IN XDMA_ENGINE* engine) {
+    if (!engine) {
+        TraceError(DBG_IRQ, "engine ptr is NULL!");
+        return;
+
+    }
+    engine->parentDevice->interruptRegs->channelIntEnableW1S = engine->irqBitMask;
+    TraceInfo(DBG_IRQ, "%s_%u enabled interrupt", DirectionToString(engine->dir), engine->channel);
+}
+
+void EngineDisableInterrupt(IN XDMA_ENGINE* engine) {
+    if (!engine) {
+        TraceError(DBG_IRQ, "engine ptr is NULL");
+        return;
+    }
+    engine->parentDevice->interruptRegs->channelIntEnableW1C = engine->irqBitMask;
+    TraceInfo(DBG_IRQ, "%s_%u disabled interrupt", DirectionToString(engine->dir), engine->channel);
+}
+
+char* DirectionToString(const DirToDev dir) {
+    return dir == H2C ? "H2C" : "C2H";
+}
+
+// ========================= streaming engine ============================================
+
+void EngineRingFree(IN XDMA_ENGINE* engine) {
+    XDMA_RING* ring = &engine->ring;
+
+    if (ring->mdl != NULL) {
+        for (UINT i = 0; i < ring->numBlocks; ++i) {
+            if (ring->mdl[i] != NULL) {
+                MmFreeContiguousMemorySpecifyCache(MmGetMdlVirtualAddress(ring->mdl[i]),
+                                                   ring->blockSize, ring->cacheType);
+                IoFreeMdl(ring->mdl[i]);
+            }
+        }
+        ExFreePoolWithTag(ring->mdl, XDMA_POOL_TAG);
+        ring->mdl = NULL;
+    }
+    if (ring->arrivalNs != NULL) {
+        ExFreePoolWithTag(ring->arrivalNs, XDMA_POOL_TAG);
+        ring->arrivalNs = NULL;
+    }
+    if (ring->map.indices != NULL) {
+        IoFreeMdl(ring->map.indicesMdl);
+        ExFreePoolWithTag(ring->map.indices, XDMA_POOL_TAG);
+        ring->map.indices = NULL;
+        ring->map.indicesMdl = NULL;
+    }
+    if (ring->descBuffer != NULL) {
+        WdfObjectDelete(ring->descBuffer);
+        ring->descBuffer = NULL;
+    }
+    if (ring->results != NULL) {
+        WdfObjectDelete(ring->results);
+        ring->results = NULL;
+    }
+    ring->numBlocks = 0;
+}
+
+static NTSTATUS EngineRingAllocate(IN XDMA_ENGINE* engine, IN UINT numBlocks, IN ULONG blockSize,
+                                   IN MEMORY_CACHING_TYPE cacheType) {
+    XDMA_RING* ring = &engine->ring;
+
+    // create dma result buffer
+    size_t resultBufferSize = numBlocks * sizeof(DMA_RESULT);
+    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, resultBufferSize,
+                                            WDF_NO_OBJECT_ATTRIBUTES, &ring->results);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    RtlZeroMemory(WdfCommonBufferGetAlignedVirtualAddress(ring->results), resultBufferSize);
+
+    TraceVerbose(DBG_INIT, "engine[%u][%u] dma result buffer @ pa=0x%08llx",
+                 engine->channel, engine->dir,
+                 WdfCommonBufferGetAlignedLogicalAddress(ring->results).QuadPart);
+
+    // create descriptor buffer - one physically contiguous circle, see DescChainOptimize()
+    size_t descBufferSize = numBlocks * sizeof(DMA_DESCRIPTOR);
+    status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, descBufferSize,
+                                   WDF_NO_OBJECT_ATTRIBUTES, &ring->descBuffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    RtlZeroMemory(WdfCommonBufferGetAlignedVirtualAddress(ring->descBuffer), descBufferSize);
+
+    // create dma data buffer - each block is physically contiguous and takes a single descriptor
+    ring->mdl = (PMDL*)ExAllocatePoolWithTag(NonPagedPoolNx, numBlocks * sizeof(PMDL), XDMA_POOL_TAG);
+    if (!ring->mdl) {
+        TraceError(DBG_INIT, "ExAllocatePoolWithTag failed!");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    RtlZeroMemory(ring->mdl, numBlocks * sizeof(PMDL));
+
+    // block timestamps - only written while XDMA_RX_MODE_PACKETS_TIMESTAMPS is selected
+    ring->arrivalNs = (UINT64*)ExAllocatePoolWithTag(NonPagedPoolNx, numBlocks * sizeof(UINT64),
+                                                     XDMA_POOL_TAG);
+    if (!ring->arrivalNs) {
+        TraceError(DBG_INIT, "ExAllocatePoolWithTag failed!");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    RtlZeroMemory(ring->arrivalNs, numBlocks * sizeof(UINT64));
+    ring->numBlocks = numBlocks;
+    ring->blockSize = blockSize;
+    ring->cacheType = cacheType;
+    ring->streamCopy = (cacheType == MmWriteCombined) && RingStreamingCopySupported();
+
+    PHYSICAL_ADDRESS low, high, boundary;
+    low.QuadPart = 0;
+    high.QuadPart = 0xFFFFFFFFFFFFFFFF;
+    boundary.QuadPart = 0;
+    for (UINT i = 0; i < numBlocks; ++i) {
+        PVOID blockVA = MmAllocateContiguousMemorySpecifyCache(blockSize, low, high, boundary,
+                                                               cacheType);
+        if (!blockVA) {
+            TraceError(DBG_INIT, "MmAllocateContiguousMemorySpecifyCache failed! (block %u)", i);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto ErrExit;
+        }
+        ring->mdl[i] = IoAllocateMdl(blockVA, blockSize, FALSE, FALSE, NULL);
+        if (!ring->mdl[i]) {
+            TraceError(DBG_INIT, "IoAllocateMdl failed!");
+            MmFreeContiguousMemorySpecifyCache(blockVA, blockSize, cacheType);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto ErrExit;
+        }
+        MmBuildMdlForNonPagedPool(ring->mdl[i]);
+    }
+
+    TraceInfo(DBG_INIT, "%s_%u ring of %u blocks x %uB, cache type %u%s",
+              DirectionToString(engine->dir), engine->channel, numBlocks, blockSize, cacheType,
+              ring->streamCopy ? ", streaming loads" : "");
+    return STATUS_SUCCESS;
+
+ErrExit:
+    EngineRingFree(engine);
+    return status;
+}
+
+static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine) {
+
+    NTSTATUS status = EngineRingAllocate(engine, XDMA_RING_NUM_BLOCKS, XDMA_RING_BLOCK_SIZE,
+                                         MmNonCached);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    KeInitializeEvent(&engine->ring.completionSignal, NotificationEvent, FALSE);
+
+    return status;
+}
+
+static UINT32 EngineRingCompletedCount(IN XDMA_ENGINE* engine)
+// the completed descriptor count of the ring engine - one read of the writeback or the register.
+// The ring does not clear the writeback, which counts on from the last value the engine wrote.
+{
+    if (engine->poll) {
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+        const ULONG completed = wbBuffer->completedDescCount;
+        if (completed & XDMA_WB_ERR_MASK) {
+            TraceError(DBG_DMA, "%s_%u error on writeback %u",
+                       DirectionToString(engine->dir), engine->channel, completed);
+        }
+        if (completed & XDMA_WB_COUNT_MASK) {
+            return completed & XDMA_WB_COUNT_MASK;
+        }
+        // 0 is a writeback cleared by the selection of the poll mode - or the count wrapped
+        if (engine->ring.completedCount < XDMA_WB_COUNT_MASK - engine->ring.numBlocks) {
+            return engine->ring.completedCount; // nothing new
+        }
+    }
+    return engine->regs->completedDescCount & XDMA_WB_COUNT_MASK;
+}
+
+static UINT EngineRingDropOldest(IN XDMA_ENGINE* engine, IN UINT tail, IN UINT occupancy)
+// drop-oldest overrun policy: drop the oldest blocks so that the engine keeps enough credits to
+// go on receiving - lowWater + 1 freed or held credits make RingCreditsTake() grant. Skipped while
+// a read copies blocks out, the read frees blocks anyway. Returns the occupancy afterwards.
+{
+    XDMA_RING* ring = &engine->ring;
+    const UINT headroom = ring->credits.lowWater + 1;
+    if (occupancy + headroom <= ring->numBlocks - 1) {
+        return occupancy;
+    }
+    if (InterlockedCompareExchange(&ring->owner, XDMA_RING_OWNER_DROP, XDMA_RING_OWNER_NONE)
+        != XDMA_RING_OWNER_NONE) {
+        return occupancy;
+    }
+
+    // the head may have moved since the look of the caller
+    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+    UINT head = ring->head;
+    occupancy = (tail + ring->numBlocks - head) % ring->numBlocks;
+    if (occupancy + headroom > ring->numBlocks - 1) {
+        UINT64 numBytes = 0;
+        const UINT32 dropped = RingDropBlocks(results, ring->numBlocks, &head, tail,
+                                              occupancy + headroom - (ring->numBlocks - 1),
+                                              &numBytes);
+        RingWriteRelease(&ring->head, head);
+        RingCreditsFreed(&ring->credits, dropped);
+        ring->gap = TRUE;
+        occupancy -= dropped;
+
+        InterlockedIncrement64(&engine->stats.overruns);
+        InterlockedExchangeAdd64(&engine->stats.droppedBlocks, dropped);
+        InterlockedExchangeAdd64(&engine->stats.droppedBytes, (LONG64)numBytes);
+        TraceWarning(DBG_DMA, "%s_%u ring overrun - dropped %u blocks (%lluB)",
+                     DirectionToString(engine->dir), engine->channel, dropped, numBytes);
+    }
+    InterlockedExchange(&ring->owner, XDMA_RING_OWNER_NONE);
+    return occupancy;
+}
+
+static UINT EngineRingReceive(IN XDMA_ENGINE* engine, IN UINT32 completed)
+// take the blocks up to the completed descriptor count - the producer side of the ring. returns
+// the number of packets which ended.
+{
+    XDMA_RING* ring = &engine->ring;
+    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+
+    // the engine only fills blocks it holds credits for, at most all but one
+    UINT numReceived = RingCompletedBlocks(&ring->completedCount, completed);
+    if (numReceived > ring->numBlocks - 1) {
+        TraceError(DBG_DMA, "%s_%u completed descriptor count %u is %u blocks ahead of the ring",
+                   DirectionToString(engine->dir), engine->channel, completed, numReceived);
+        numReceived = ring->numBlocks - 1;
+    }
+
+    // the tail is only written here
+    UINT tail = ring->tail;
+    const UINT eopCount = RingProcessResults(results, ring->numBlocks, &tail, numReceived);
+
+    // one read of the clock per look - the stamps go out with the tail
+    if (ring->timestamps && (numReceived > 0)) {
+        const UINT64 now = EngineTimeNs();
+        UINT index = ring->tail;
+        for (UINT i = 0; i < numReceived; ++i) {
+            ring->arrivalNs[index] = now;
+            RingAdvance(&index, ring->numBlocks);
+        }
+    }
+
+    RingWriteRelease(&ring->tail, tail);
+    RingCreditsReceived(&ring->credits, numReceived);
+
+    // the tail is out before the look at the mapping: EngineRingMap() either finds the new tail or
+    // is seen active here
+    MemoryBarrier();
+    if (ring->map.active) {
+        WdfSpinLockAcquire(ring->lock);
+        if (ring->map.active) {
+            ring->map.indices->producer = ring->tail;
+        }
+        WdfSpinLockRelease(ring->lock);
+    }
+
+    UINT occupancy = (tail + ring->numBlocks - RingReadAcquire(&ring->head)) % ring->numBlocks;
+    if (occupancy > ring->peakOccupancy) {
+        ring->peakOccupancy = occupancy;
+    }
+    // a mapped ring is consumed in place, its blocks cannot be taken away
+    if ((ring->overrunPolicy == XDMA_RING_OVERRUN_DROP_OLDEST) && !ring->map.active) {
+        occupancy = EngineRingDropOldest(engine, tail, occupancy);
+    }
+    const UINT head = RingReadAcquire(&ring->head);
+    UINT32 held, freed;
+    RingCreditsGet(&ring->credits, &held, &freed);
+    if ((held == 0) && (InterlockedCompareExchange64(&ring->dryFromNs, EngineTimeNs(), 0) == 0)) {
+        InterlockedIncrement64(&engine->stats.creditStalls); // backpressure until a grant
+    }
+
+    TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
+              DirectionToString(engine->dir), engine->channel, head, tail, eopCount, held);
+
+    // grant the credits of the blocks consumed since the last look
+    EngineRingReleaseConsumed(engine);
+
+    // If any packets are completed, start the Io Read queue 
+    // also start the queue on an overflow since we need to tell the client that an overflow happened
+    // (the ring is full without the end of a packet, or blocks were dropped)
+    if ((eopCount > 0) || (occupancy == ring->numBlocks - 1) || ring->gap) {
+        TraceVerbose(DBG_DMA, "starting engine queue");
+        KeSetEvent(&engine->ring.completionSignal, IO_NO_INCREMENT, FALSE);
+    }
+
+    return eopCount;
+}
+
+static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
+
+    UINT32 engineStatus = EngineStatus(engine, TRUE);
+    if (engineStatus & XDMA_ALIGN_MISMATCH_BIT & XDMA_MAGIC_STOPPED_BIT & XDMA_FETCH_STOPPED_BIT
+        & XDMA_STAT_READ_ERROR & XDMA_STAT_DESCRIPTOR_ERROR) {
+        TraceError(DBG_DMA, "Engine error during transfer! 0x%08x", engineStatus);
+    }
+
+    // the slots point to posted user buffers - there is nothing to read from the ring
+    if (engine->rx.enabled) {
+        UINT numDone = EngineRxProcess(engine);
+        EngineClearPollWriteBack(engine);
+        return numDone;
+    }
+
+    return EngineRingReceive(engine, EngineRingCompletedCount(engine));
+}
+
+static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
+
+    XDMA_RING* ring = &engine->ring;
+
+    // get virtual and physical pointers to descriptor buffer
+    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(ring->descBuffer);
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(ring->descBuffer);
+
+    // get physical address to dma result buffer
+    PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(ring->results);
+
+    XDMA_DESC_PARAMS descParams;
+    EngineGetDescParams(engine, &descParams);
+
+    XDMA_DESC_CHAIN chain;
+    DescChainInit(&chain, &descParams, descriptor, descBufferLA.QuadPart, ring->numBlocks);
+
+    // fill descriptors
+    for (ULONG i = 0; i < ring->numBlocks; ++i) {
+        // destination is host memory
+        PHYSICAL_ADDRESS dst = MmGetPhysicalAddress(MmGetMdlVirtualAddress(ring->mdl[i]));
+
+        // source address are unused, will be overwritten by hardware with dma result
+        DescChainAppend(&chain, C2H, dst.QuadPart, resultBufferLA.QuadPart + i * sizeof(DMA_RESULT),
+                        ring->blockSize, XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    }
+    if (chain.misaligned) {
+        TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned (%u descriptors)", chain.misaligned);
+    }
+
+    // make the discriptor list circular
+    DescChainMakeCircular(&chain);
+    DMA_DESCRIPTOR* last = &descriptor[ring->numBlocks - 1];
+
+    // Optimize for PCIe fetches and bind the ring to the hardware
+    engine->sgdma->firstDescLo = descBufferLA.LowPart;
+    engine->sgdma->firstDescHi = descBufferLA.HighPart;
+    engine->sgdma->firstDescAdj = DescChainOptimize(&chain);
+
+    // Print to log
+    TraceVerbose(DBG_DMA, "first desc @ 0x%08x%08x",
+                 engine->sgdma->firstDescHi, engine->sgdma->firstDescLo);
+    for (ULONG i = 0; i < ring->numBlocks; i++) {
+        DumpDescriptor(&(descriptor[i]));
+    }
+    TraceVerbose(DBG_DMA, "last desc points to 0x%08x%08x", last->nextHi, last->nextLo);
+
+    // the engine counts the completed descriptors from 0 again
+    ring->completedCount = 0;
+    EngineClearPollWriteBack(engine);
+
+    // set initial descriptor credits for throtteling
+    engine->sgdma->descCredits = RingCreditsInit(&ring->credits, ring->numBlocks);
+    ring->dryFromNs = 0;
+    ring->peakOccupancy = 0;
+    TraceInfo(DBG_DMA, "%s_%u set %u initial descriptor credits",
               DirectionToString(engine->dir), engine->channel, engine->sgdma->descCredits);
 
-    MemoryBarrier();
+    MemoryBarrier();
+
+    // start the engine
+    EngineStart(engine);
+
+    MemoryBarrier();
+}
+
+static void EngineClearDmaResults(IN XDMA_ENGINE *engine) {
+    TraceVerbose(DBG_DMA, "clearing DMA results...");
+    DMA_RESULT * results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+    for (UINT i = 0; i < engine->ring.numBlocks; ++i) {
+        results[i].status = 0;
+        results[i].length = 0;
+    }
+}
+
+void EngineRingSetup(IN XDMA_ENGINE *engine) {
+    engine->ring.head = 0;
+    engine->ring.tail = 0;
+    engine->ring.gap = FALSE;
+    KeClearEvent(&engine->ring.completionSignal);
+    EngineRingProgramDma(engine);
+}
+
+void EngineRingTeardown(IN XDMA_ENGINE *engine) {
+    EngineStop(engine);
+    EngineClearDmaResults(engine);
+    engine->ring.head = 0;
+    engine->ring.tail = 0;
+    RtlZeroMemory(&engine->ring.credits, sizeof(engine->ring.credits)); // nothing left to grant
+}
+
+typedef struct ENGINE_RING_COPY_CONTEXT_T {
+    XDMA_ENGINE* engine;
+    WDFMEMORY outputMem;
+    PUCHAR output;              // buffer of outputMem - streaming copies only
+    size_t outputSize;
+} ENGINE_RING_COPY_CONTEXT;
+
+static NTSTATUS EngineRingCopyBlock(IN PVOID ctx, IN size_t offset, IN UINT block,
+                                    IN size_t numBytes) {
+    ENGINE_RING_COPY_CONTEXT* copyContext = (ENGINE_RING_COPY_CONTEXT*)ctx;
+    PVOID rxBufferVa = MmGetMdlVirtualAddress(copyContext->engine->ring.mdl[block]);
+
+    // write-combined blocks - a load per cache line instead of one per word
+    if (copyContext->output != NULL) {
+        if ((offset > copyContext->outputSize) || (numBytes > copyContext->outputSize - offset)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+        RingCopyStreaming(copyContext->output + offset, rxBufferVa, numBytes);
+        return STATUS_SUCCESS;
+    }
+
+    // copy to user
+    return WdfMemoryCopyFromBuffer(copyContext->outputMem, offset, rxBufferVa, numBytes);
+}
+
+static NTSTATUS EngineRingStoreBatch(IN PVOID ctx, IN size_t offset, IN const VOID* src,
+                                     IN size_t numBytes) {
+    ENGINE_RING_COPY_CONTEXT* copyContext = (ENGINE_RING_COPY_CONTEXT*)ctx;
+    return WdfMemoryCopyFromBuffer(copyContext->outputMem, offset, (PVOID)src, numBytes);
+}
+
+NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem, 
+                                   size_t length, LARGE_INTEGER timeout, size_t* bytesRead ) {
+    NTSTATUS status = 0;
+    if (engine->ring.map.owner != NULL) {
+        TraceError(DBG_DMA, "%s_%u ring is mapped - consume the blocks in place",
+                   DirectionToString(engine->dir), engine->channel);
+        *bytesRead = 0;
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    const BOOLEAN packetMode = engine->ring.packetMode;
+    const UINT64* timestamps = engine->ring.timestamps ? engine->ring.arrivalNs : NULL;
+    // the table is aligned to its entries
+    const size_t minLength = timestamps ? 2 * sizeof(XDMA_RX_PACKET_TS)
+                                        : sizeof(XDMA_RX_BATCH) + sizeof(XDMA_RX_PACKET);
+    if (packetMode && (length < minLength)) {
+        TraceError(DBG_DMA, "%s_%u packet batch needs at least %llu bytes",
+                   DirectionToString(engine->dir), engine->channel, minLength);
+        *bytesRead = 0;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    XDMA_POLLER* poller = engine->poller;
+    if (engine->poll && (poller == NULL)) { // poll mode - poll for completion
+        status = EnginePollRing(engine);
+        if (!NT_SUCCESS(status)) {
+            goto ErrorExit;
+        }
+    } else { // interrupt mode or poller thread - wait for completion signal
+        if (poller != NULL) {
+            KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
+        }
+        status = KeWaitForSingleObject(&engine->ring.completionSignal, Executive, KernelMode, FALSE, &timeout);
+        if (status == STATUS_TIMEOUT) {
+            goto ErrorExit;
+        }
+    }
+
+    // the consumer side of the ring - the head is only written here and by a drop of the oldest
+    // blocks, which is skipped while the reader owns the ring
+    XDMA_RING* ring = &engine->ring;
+    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+    while (InterlockedCompareExchange(&ring->owner, XDMA_RING_OWNER_READER, XDMA_RING_OWNER_NONE)
+           != XDMA_RING_OWNER_NONE) {
+        YieldProcessor(); // a drop only holds the ring for a few microseconds
+    }
+    UINT32 numDescProcessed = 0;
+    UINT head = ring->head;
+    const UINT tail = RingReadAcquire(&ring->tail);
+
+    // blocks were dropped - a byte stream cannot mark the gap, the read fails instead
+    UINT32 firstFlags = 0;
+    if (ring->gap) {
+        if (!packetMode) {
+            ring->gap = FALSE;
+            InterlockedExchange(&ring->owner, XDMA_RING_OWNER_NONE);
+            TraceWarning(DBG_DMA, "%s_%u ring overrun - data was dropped before this read",
+                         DirectionToString(engine->dir), engine->channel);
+            *bytesRead = 0;
+            status = STATUS_DATA_OVERRUN;
+            goto ErrorExit;
+        }
+        firstFlags = XDMA_RING_PACKET_DISCONTINUITY;
+    }
+
+    TraceVerbose(DBG_DMA, "%s_%u head=%u, tail=%u", DirectionToString(engine->dir),
+                 engine->channel, head, tail);
+
+    ENGINE_RING_COPY_CONTEXT copyContext = { engine, outputMem, NULL, 0 };
+    if (ring->streamCopy) {
+        copyContext.output = (PUCHAR)WdfMemoryGetBuffer(outputMem, &copyContext.outputSize);
+    }
+    UINT32 numPackets = 0;
+    BOOLEAN more = FALSE;
+    if (packetMode) {
+        status = RingCopyPackets(results, engine->ring.numBlocks, &head, tail, length, firstFlags,
+                                 timestamps, EngineRingCopyBlock, EngineRingStoreBatch, &copyContext, bytesRead,
+                                 &numPackets, &numDescProcessed, &more);
+    } else {
+        status = RingCopyBlocks(results, engine->ring.numBlocks, &head, tail, length,
+                                EngineRingCopyBlock, &copyContext, bytesRead, &numDescProcessed);
+    }
+    if (!NT_SUCCESS(status)) {
+        InterlockedExchange(&ring->owner, XDMA_RING_OWNER_NONE);
+        TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        goto ErrorExit;
+    }
+    if (numPackets > 0) {
+        ring->gap = FALSE; // reported with the first packet
+    }
+
+    // the credits go back in batches - here only if the engine is about to run dry, otherwise with
+    // the next look of the dpc or the poller thread
+    RingWriteRelease(&ring->head, head);
+    RingCreditsFreed(&ring->credits, numDescProcessed);
+    InterlockedExchange(&ring->owner, XDMA_RING_OWNER_NONE);
+    EngineRingGrant(engine);
+
+    // wait for the next block (packet) unless one is left. The dpc publishes the tail before it
+    // signals, so a block received meanwhile shows up in the tail once the signal is cleared.
+    if (packetMode ? !more : (head == tail)) {
+        KeClearEvent(&ring->completionSignal);
+        MemoryBarrier();
+        if (RingReadAcquire(&ring->tail) != tail) {
+            KeSetEvent(&ring->completionSignal, IO_NO_INCREMENT, FALSE);
+        }
+    }
+
+    if (packetMode) {
+        TraceVerbose(DBG_DMA, "%s_%u read %u packets", DirectionToString(engine->dir),
+                     engine->channel, numPackets);
+    }
+
+    TraceVerbose(DBG_DMA, "%s_%u read %lluB available,  head=%u, tail=%u",
+                 DirectionToString(engine->dir), engine->channel, *bytesRead, head, tail);
+
+ErrorExit:
+    return status;
+}
+
+VOID EngineRingGetStats(IN XDMA_ENGINE* engine, OUT XDMA_RING_STATS* stats) {
+    XDMA_RING* ring = &engine->ring;
+
+    // a snapshot - the producer and the consumer go on meanwhile
+    RtlZeroMemory(stats, sizeof(*stats));
+    const UINT head = RingReadAcquire(&ring->head);
+    const UINT tail = RingReadAcquire(&ring->tail);
+    stats->numBlocks = ring->numBlocks;
+    stats->occupancy = (tail + ring->numBlocks - head) % ring->numBlocks;
+    stats->peakOccupancy = ring->peakOccupancy;
+    UINT32 held, freed;
+    RingCreditsGet(&ring->credits, &held, &freed);
+    stats->creditsHeld = held;
+    stats->creditsFreed = freed;
+    stats->creditBatch = ring->credits.batch;
+    stats->stallNs = engine->stats.creditStallNs;
+    const UINT64 dryFromNs = (UINT64)ring->dryFromNs;
+    if (dryFromNs != 0) { // still without credits
+        stats->stallNs += EngineTimeNs() - dryFromNs;
+    }
+    stats->creditWrites = engine->stats.creditWrites;
+    stats->stalls = engine->stats.creditStalls;
+    stats->overrunPolicy = ring->overrunPolicy;
+    stats->overruns = engine->stats.overruns;
+    stats->droppedBlocks = engine->stats.droppedBlocks;
+    stats->droppedBytes = engine->stats.droppedBytes;
+}
+
+NTSTATUS EngineRingSetOverrun(IN XDMA_ENGINE* engine, IN ULONG policy) {
+    XDMA_RING* ring = &engine->ring;
+    if ((policy != XDMA_RING_OVERRUN_BACKPRESSURE) && (policy != XDMA_RING_OVERRUN_DROP_OLDEST)) {
+        TraceError(DBG_IO, "invalid ring overrun policy %u", policy);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfSpinLockAcquire(ring->lock);
+    const ULONG previous = ring->overrunPolicy;
+    ring->overrunPolicy = policy;
+    // EngineRingMap() takes the owner before it looks at the policy - one of the two sees the other
+    MemoryBarrier();
+    if ((policy == XDMA_RING_OVERRUN_DROP_OLDEST) && (ring->map.owner != NULL)) {
+        ring->overrunPolicy = previous;
+        WdfSpinLockRelease(ring->lock);
+        TraceError(DBG_IO, "%s_%u ring is mapped - its blocks cannot be dropped",
+                   DirectionToString(engine->dir), engine->channel);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    WdfSpinLockRelease(ring->lock);
+
+    TraceInfo(DBG_IO, "%s_%u ring overrun policy %u", DirectionToString(engine->dir),
+              engine->channel, policy);
+    return STATUS_SUCCESS;
+}
+
+//========================= mapped ring ===========================================================
+
+static void EngineRingGrant(IN XDMA_ENGINE* engine)
+// write the freed credits of the ring to the engine once RingCreditsTake() says so. Called by the
+// producer and the consumer side - each write of the register adds its credits.
+{
+    XDMA_RING* ring = &engine->ring;
+    const UINT32 grant = RingCreditsTake(&ring->credits);
+    if (grant == 0) {
+        return;
+    }
+
+    // a ring holds at most XDMA_RING_MAX_BLOCKS - 1 credits, a single write of the register
+    ASSERT(grant <= XDMA_DESC_CREDITS_MAX);
+    engine->sgdma->descCredits = grant;
+    InterlockedIncrement64(&engine->stats.creditWrites);
+    const LONG64 dryFromNs = InterlockedExchange64(&ring->dryFromNs, 0);
+    if (dryFromNs != 0) {
+        InterlockedExchangeAdd64(&engine->stats.creditStallNs,
+                                 (LONG64)(EngineTimeNs() - (UINT64)dryFromNs));
+    }
+}
+
+static void EngineRingReleaseConsumed(IN XDMA_ENGINE* engine)
+// grant the credits of the blocks consumed since the last look - read, or consumed in place by the
+// process which mapped the ring
+{
+    XDMA_RING* ring = &engine->ring;
+    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+
+    // the consumer side of a mapped ring is run by the dpc and IOCTL_XDMA_RING_RELEASE - the lock
+    // makes it a single one again
+    if (ring->map.active) {
+        WdfSpinLockAcquire(ring->lock);
+        if (ring->map.active) {
+            UINT head = ring->head;
+            const UINT32 released = RingReleaseBlocks(results, ring->numBlocks, &head,
+                                                      RingReadAcquire(&ring->tail),
+                                                      ring->map.indices->consumer);
+            if (released) {
+                RingWriteRelease(&ring->head, head);
+                RingCreditsFreed(&ring->credits, released);
+            }
+        }
+        WdfSpinLockRelease(ring->lock);
+    }
+    EngineRingGrant(engine);
+}
+
+static PVOID EngineRingMapUser(IN PMDL mdl, IN MEMORY_CACHING_TYPE cacheType) {
+    __try {
+        return MmMapLockedPagesSpecifyCache(mdl, UserMode, cacheType, NULL, FALSE,
+                                            NormalPagePriority | MdlMappingNoExecute);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        TraceError(DBG_IO, "MmMapLockedPagesSpecifyCache failed: 0x%08x", GetExceptionCode());
+        return NULL;
+    }
+}
+
+static void EngineRingFreeMap(IN XDMA_RING_MAP* map) {
+    // remove the views of the process first
+    if (map->indicesUser != NULL) {
+        MmUnmapLockedPages(map->indicesUser, map->indicesMdl);
+    }
+    if (map->dataUser != NULL) {
+        MmUnmapLockedPages(map->dataUser, map->dataMdl);
+    }
+    if (map->resultsUser != NULL) {
+        MmUnmapLockedPages(map->resultsUser, map->resultsMdl);
+    }
+    map->indicesUser = map->dataUser = map->resultsUser = NULL;
+
+    // the indices stay, a waiting EngineRingRelease() may still look at them
+    if (map->dataMdl != NULL) {
+        IoFreeMdl(map->dataMdl);
+    }
+    if (map->resultsMdl != NULL) {
+        IoFreeMdl(map->resultsMdl);
+    }
+    map->dataMdl = map->resultsMdl = NULL;
+}
+
+NTSTATUS EngineRingMap(IN XDMA_ENGINE* engine, IN PVOID owner, OUT XDMA_RING_MAPPING* mapping) {
+    XDMA_RING* ring = &engine->ring;
+    XDMA_RING_MAP* map = &ring->map;
+    NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+
+    if (InterlockedCompareExchangePointer(&map->owner, owner, NULL) != NULL) {
+        TraceError(DBG_IO, "%s_%u ring is already mapped", DirectionToString(engine->dir),
+                   engine->channel);
+        return STATUS_DEVICE_BUSY;
+    }
+    if (engine->rx.enabled) { // the blocks are not in use - the data goes to posted buffers
+        TraceError(DBG_IO, "%s_%u ring receives into posted buffers", DirectionToString(engine->dir),
+                   engine->channel);
+        InterlockedExchangePointer(&map->owner, NULL);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    if (ring->overrunPolicy == XDMA_RING_OVERRUN_DROP_OLDEST) { // see EngineRingSetOverrun()
+        TraceError(DBG_IO, "%s_%u ring drops its oldest blocks on overruns",
+                   DirectionToString(engine->dir), engine->channel);
+        InterlockedExchangePointer(&map->owner, NULL);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    // the ring indices - a page of their own, so that no other kernel memory becomes visible
+    if (map->indices == NULL) {
+        map->indices = (XDMA_RING_INDICES*)ExAllocatePoolWithTag(NonPagedPoolNx, PAGE_SIZE,
+                                                                 XDMA_POOL_TAG);
+        if (!map->indices) {
+            TraceError(DBG_IO, "ExAllocatePoolWithTag failed!");
+            goto ErrExit;
+        }
+        RtlZeroMemory(map->indices, PAGE_SIZE);
+        map->indicesMdl = IoAllocateMdl(map->indices, PAGE_SIZE, FALSE, FALSE, NULL);
+        if (!map->indicesMdl) {
+            ExFreePoolWithTag(map->indices, XDMA_POOL_TAG);
+            map->indices = NULL;
+            goto ErrExit;
+        }
+        MmBuildMdlForNonPagedPool(map->indicesMdl);
+    }
+
+    // the dma results
+    PVOID resultsVA = WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+    map->resultsMdl = IoAllocateMdl(resultsVA, ring->numBlocks * sizeof(DMA_RESULT), FALSE, FALSE,
+                                    NULL);
+    if (!map->resultsMdl) {
+        goto ErrExit;
+    }
+    MmBuildMdlForNonPagedPool(map->resultsMdl);
+
+    // the blocks, one after the other. The MDL only collects the pages of the block MDLs, it never
+    // gets a system address.
+    const ULONG pagesPerBlock = ring->blockSize / PAGE_SIZE;
+    map->dataMdl = IoAllocateMdl(NULL, ring->numBlocks * ring->blockSize, FALSE, FALSE, NULL);
+    if (!map->dataMdl) {
+        goto ErrExit;
+    }
+    PPFN_NUMBER pages = MmGetMdlPfnArray(map->dataMdl);
+    for (UINT i = 0; i < ring->numBlocks; ++i) {
+        RtlCopyMemory(pages + i * pagesPerBlock, MmGetMdlPfnArray(ring->mdl[i]),
+                      pagesPerBlock * sizeof(PFN_NUMBER));
+    }
+    map->dataMdl->MdlFlags |= MDL_PAGES_LOCKED; // nonpaged memory of the ring
+
+    // same caching as the kernel side of the memory
+    map->indicesUser = EngineRingMapUser(map->indicesMdl, MmCached);
+    map->resultsUser = EngineRingMapUser(map->resultsMdl, MmCached);
+    map->dataUser = EngineRingMapUser(map->dataMdl, ring->cacheType); // same type as the kernel view
+    if (!map->indicesUser || !map->resultsUser || !map->dataUser) {
+        goto ErrExit;
+    }
+    map->process = PsGetCurrentProcess();
+
+    // from now on the blocks are consumed through the indices
+    WdfSpinLockAcquire(ring->lock);
+    map->indices->producer = ring->tail;
+    map->indices->consumer = ring->head;
+    map->active = TRUE;
+    WdfSpinLockRelease(ring->lock);
+
+    mapping->data = (UINT64)map->dataUser;
+    mapping->results = (UINT64)map->resultsUser;
+    mapping->indices = (UINT64)map->indicesUser;
+    mapping->numBlocks = ring->numBlocks;
+    mapping->blockSize = ring->blockSize;
+
+    TraceInfo(DBG_IO, "%s_%u ring mapped at %p (%u blocks x %uB)", DirectionToString(engine->dir),
+              engine->channel, map->dataUser, ring->numBlocks, ring->blockSize);
+    return STATUS_SUCCESS;
+
+ErrExit:
+    EngineRingFreeMap(map);
+    InterlockedExchangePointer(&map->owner, NULL);
+    return status;
+}
+
+VOID EngineRingUnmap(IN XDMA_ENGINE* engine, IN PVOID owner) {
+    XDMA_RING* ring = &engine->ring;
+    XDMA_RING_MAP* map = &ring->map;
+
+    if (map->owner != owner) {
+        return;
+    }
+
+    // stop returning credits from the consumer index
+    WdfSpinLockAcquire(ring->lock);
+    map->active = FALSE;
+    WdfSpinLockRelease(ring->lock);
+
+    // the views belong to the address space of the process which created them
+    KAPC_STATE apcState;
+    const BOOLEAN attach = (PsGetCurrentProcess() != map->process);
+    if (attach) {
+        KeStackAttachProcess(map->process, &apcState);
+    }
+    EngineRingFreeMap(map);
+    if (attach) {
+        KeUnstackDetachProcess(&apcState);
+    }
+
+    map->process = NULL;
+    InterlockedExchangePointer(&map->owner, NULL);
+    TraceInfo(DBG_IO, "%s_%u ring unmapped", DirectionToString(engine->dir), engine->channel);
+}
+
+NTSTATUS EngineRingRelease(IN XDMA_ENGINE* engine, IN LARGE_INTEGER timeout) {
+    XDMA_RING* ring = &engine->ring;
+    XDMA_RING_INDICES* indices = ring->map.indices;
+    if (!ring->map.active) {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    EngineRingReleaseConsumed(engine);
+
+    // nothing to wait for if blocks beyond the consumer have been received already. Check again
+    // after clearing the completion signal, so that a signal in between is not lost.
+    KeClearEvent(&ring->completionSignal);
+    if (indices->producer != indices->consumer) {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS status;
+    XDMA_POLLER* poller = engine->poller;
+    if (engine->poll && (poller == NULL)) { // poll mode - poll for completion
+        status = EnginePollRing(engine);
+    } else { // interrupt mode or poller thread - wait for completion signal
+        if (poller != NULL) {
+            KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
+        }
+        status = KeWaitForSingleObject(&ring->completionSignal, Executive, KernelMode, FALSE,
+                                       &timeout);
+    }
+
+    TraceVerbose(DBG_DMA, "%s_%u producer=%u, consumer=%u, credits=%u",
+                 DirectionToString(engine->dir), engine->channel, indices->producer,
+                 indices->consumer, engine->sgdma->descCredits);
+    return status;
+}
+
+//========================= posted receive ========================================================
+
+static NTSTATUS EngineRxSetDepth(IN XDMA_ENGINE* engine, IN ULONG depth) {
+    XDMA_RX_QUEUE* rx = &engine->rx;
 
-    // start the engine
+    for (ULONG i = 0; i < depth; ++i) {
+        XDMA_RX_POST* post = &rx->posts[i];
+        if (post->dmaTransaction == NULL) {
+            post->engine = engine;
+            post->state = TransferState_Free;
+            NTSTATUS status = WdfDmaTransactionCreate(engine->parentDevice->dmaEnabler,
+                                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                                      &post->dmaTransaction);
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
+                return status;
+            }
+        }
+    }
+    rx->depth = depth;
+    return STATUS_SUCCESS;
+}
+
+static void RxRemove(IN OUT XDMA_RX_QUEUE* rx, IN ULONG pos) {
+    const ULONG count = rx->numRunning + rx->numQueued;
+    for (ULONG i = pos; i + 1 < count; ++i) {
+        rx->order[i] = rx->order[i + 1];
+    }
+}
+
+static void EngineRxStart(IN XDMA_ENGINE* engine)
+// program the ring descriptors as empty slots and start the engine without credits - ring lock held
+{
+    XDMA_RING* ring = &engine->ring;
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(ring->descBuffer);
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(ring->descBuffer);
+    PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(ring->results);
+
+    XDMA_DESC_PARAMS descParams;
+    EngineGetDescParams(engine, &descParams);
+
+    // the slots get their buffers as requests are posted. No adjacent fetches (see
+    // DescChainOptimize()): a slot is rewritten while the engine runs, so the engine must not fetch
+    // it before its credit has been granted.
+    XDMA_DESC_CHAIN chain;
+    DescChainInit(&chain, &descParams, descriptor, descBufferLA.QuadPart, ring->numBlocks);
+    for (UINT i = 0; i < ring->numBlocks; ++i) {
+        DescChainAppend(&chain, C2H, 0, resultBufferLA.QuadPart + i * sizeof(DMA_RESULT), 0,
+                        XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    }
+    DescChainMakeCircular(&chain);
+
+    ring->head = 0;
+    ring->tail = 0;
+    engine->rx.next = 0;
+    engine->rx.freeSlots = ring->numBlocks;
+
+    engine->sgdma->firstDescLo = descBufferLA.LowPart;
+    engine->sgdma->firstDescHi = descBufferLA.HighPart;
+    engine->sgdma->firstDescAdj = 0;
+    if (engine->poll) {
+        engine->numDescriptors = 0;
+    }
+
+    MemoryBarrier();
     EngineStart(engine);
+    MemoryBarrier();
+}
+
+static void EngineRxFill(IN XDMA_ENGINE* engine)
+// hand free slots to the queued posts in order and grant their credits - ring lock held
+{
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.descBuffer);
+    UINT32 credits = 0;
+
+    if (rx->stopping) { // the circle is restarted with the queued posts (EngineRxAbort())
+        return;
+    }
+    while (rx->numQueued > 0) {
+        XDMA_RX_POST* post = rx->order[rx->numRunning];
+        const UINT numSlots = RingPostSg(descriptor, engine->ring.numBlocks, &rx->next, rx->freeSlots,
+                                         post->sgList->Elements, post->sgList->NumberOfElements,
+                                         XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        if (numSlots == 0) { // waits for the slots of older posts
+            break;
+        }
+        InterlockedExchangeAdd64(&engine->stats.sgElements, post->sgList->NumberOfElements);
+        InterlockedExchangeAdd64(&engine->stats.descriptors, numSlots);
+
+        post->numSlots = numSlots;
+        post->state = TransferState_Running;
+        rx->freeSlots -= numSlots;
+        rx->numRunning++;
+        rx->numQueued--;
+        credits += numSlots;
+    }
 
+    // descriptors before credits. A write adds at most what fits the credit register.
     MemoryBarrier();
+    while (credits > 0) {
+        const UINT32 grant = min(credits, XDMA_DESC_CREDITS_MAX);
+        engine->sgdma->descCredits = grant;
+        credits -= grant;
+    }
 }
 
-static void EngineClearDmaResults(IN XDMA_ENGINE *engine) {
-    TraceVerbose(DBG_DMA, "clearing DMA results...");
-    DMA_RESULT * results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    for (UINT i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        results[i].status = 0;
-        results[i].length = 0;
+static ULONG EngineRxCollect(IN XDMA_ENGINE* engine, OUT XDMA_RX_POST** done)
+// take the running posts whose slots have all been written - ring lock held
+{
+    XDMA_RING* ring = &engine->ring;
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(ring->results);
+    ULONG numDone = 0;
+    UINT tail = ring->tail;
+
+    while (rx->numRunning > 0) {
+        XDMA_RX_POST* post = rx->order[0];
+        BOOLEAN eop;
+        const UINT collected = RingCollectResults(results, ring->numBlocks, &tail,
+                                                  post->numSlots - post->slotsDone,
+                                                  &post->numBytes, &eop);
+        if (collected == 0) {
+            break;
+        }
+        post->slotsDone += collected;
+        post->eop = eop;
+        rx->freeSlots += collected;
+        if (post->slotsDone < post->numSlots) { // the rest of the buffer is still being received
+            break;
+        }
+
+        RxRemove(rx, 0);
+        rx->numRunning--;
+        post->state = TransferState_Acquired;
+        done[numDone++] = post;
     }
+    ring->tail = tail;
+    return numDone;
 }
 
-static void EngineRingAdvance(UINT* index) {
-    if (*index == XDMA_RING_NUM_BLOCKS - 1) { // wrap-around
-        *index = 0;
-    } else { // normal increment
-        ++(*index);
+static UINT EngineRxProcess(IN XDMA_ENGINE* engine)
+// complete the posts the engine has filled and pass their slots on. returns the posts completed.
+{
+    XDMA_RX_POST* done[XDMA_MAX_QUEUE_DEPTH];
+
+    WdfSpinLockAcquire(engine->ring.lock);
+    if (engine->rx.stopping) { // EngineRxAbort() collects the filled posts
+        WdfSpinLockRelease(engine->ring.lock);
+        return 0;
+    }
+    const ULONG numDone = EngineRxCollect(engine, done);
+    EngineRxFill(engine);
+    WdfSpinLockRelease(engine->ring.lock);
+
+    for (ULONG i = 0; i < numDone; ++i) {
+        EngineRxComplete(engine, done[i], STATUS_SUCCESS);
     }
+    return numDone;
 }
 
-void EngineRingSetup(IN XDMA_ENGINE *engine) {
-    engine->ring.head = 0;
-    engine->ring.tail = 0;
-    KeClearEvent(&engine->ring.completionSignal);
-    EngineRingProgramDma(engine);
+static void EngineRxCompleteRequest(IN XDMA_ENGINE* engine, IN XDMA_RX_POST* post,
+                                    IN NTSTATUS status)
+// release the dma transaction, free the post and complete its request
+{
+    WDFREQUEST request = post->request;
+    const size_t numBytes = NT_SUCCESS(status) ? post->numBytes : 0;
+
+    NTSTATUS releaseStatus = WdfDmaTransactionRelease(post->dmaTransaction);
+    if (!NT_SUCCESS(releaseStatus)) {
+        TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", releaseStatus);
+    }
+
+    // a buffer which does not end a packet is completed like a message which does not fit: the
+    // rest of the packet follows in the next buffer
+    if ((status == STATUS_SUCCESS) && !post->eop) {
+        status = STATUS_BUFFER_OVERFLOW;
+    }
+
+    EngineRxRelease(engine, post);
+
+    TraceInfo(DBG_DMA, "%s_%u posted request 0x%p complete, bytesReceived=%llu, %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, request, numBytes, status);
+    WdfRequestCompleteWithInformation(request, status, numBytes);
 }
 
-void EngineRingTeardown(IN XDMA_ENGINE *engine) {
-    EngineStop(engine);
-    EngineClearDmaResults(engine);
-    engine->ring.head = 0;
-    engine->ring.tail = 0;
+BOOLEAN XDMA_EngineProgramRxPost(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Device,
+                                 IN WDFCONTEXT context, IN WDF_DMA_DIRECTION Direction,
+                                 IN PSCATTER_GATHER_LIST SgList)
+// queue the mapped buffer of a posted read request - it gets ring slots as soon as they are free
+{
+    UNREFERENCED_PARAMETER(Transaction);
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(Direction);
+
+    XDMA_RX_POST* post = (XDMA_RX_POST*)context;
+    XDMA_ENGINE* engine = post->engine;
+    XDMA_RX_QUEUE* rx = &engine->rx;
+
+    WdfSpinLockAcquire(engine->ring.lock);
+    post->sgList = SgList;
+    post->numSlots = 0;
+    post->slotsDone = 0;
+    post->numBytes = 0;
+    post->eop = FALSE;
+    post->state = TransferState_Queued;
+    rx->order[rx->numRunning + rx->numQueued] = post;
+    rx->numQueued++;
+    EngineRxFill(engine);
+    WdfSpinLockRelease(engine->ring.lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u posted %u scatter gather elements, free slots=%u",
+                 DirectionToString(engine->dir), engine->channel, SgList->NumberOfElements,
+                 rx->freeSlots);
+
+    if (engine->poller != NULL) {
+        KeSetEvent(&engine->poller->kick, IO_NO_INCREMENT, FALSE);
+    }
+    return TRUE;
 }
 
-NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem, 
-                                   size_t length, LARGE_INTEGER timeout, size_t* bytesRead ) {
-    NTSTATUS status = 0;
-    if (engine->poll) { // poll mode - poll for completion
-        status = EnginePollRing(engine);
-        if (!NT_SUCCESS(status)) {
-            goto ErrorExit;
-        }
-    } else { // interrupt mode - wait for completion signal
-        status = KeWaitForSingleObject(&engine->ring.completionSignal, Executive, KernelMode, FALSE, &timeout);
-        if (status == STATUS_TIMEOUT) {
-            goto ErrorExit;
+XDMA_RX_POST* EngineRxAcquire(IN XDMA_ENGINE* engine, IN WDFREQUEST request) {
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    XDMA_RX_POST* post = NULL;
+
+    WdfSpinLockAcquire(engine->ring.lock);
+    for (ULONG i = 0; i < rx->depth; ++i) {
+        if (rx->posts[i].state == TransferState_Free) {
+            post = &rx->posts[i];
+            post->state = TransferState_Acquired;
+            post->request = request;
+            post->cancelPending = FALSE;
+            post->status = STATUS_SUCCESS;
+            break;
         }
     }
+    WdfSpinLockRelease(engine->ring.lock);
+    return post;
+}
 
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    size_t offset = 0;
-    UINT32 numDescProcessed = 0;
-    size_t numBytesRemaining = length;
+VOID EngineRxRelease(IN XDMA_ENGINE* engine, IN XDMA_RX_POST* post) {
     WdfSpinLockAcquire(engine->ring.lock);
-    UINT head = engine->ring.head;
-    UINT tail = engine->ring.tail;
+    post->state = TransferState_Free;
+    post->request = NULL;
+    post->sgList = NULL;
     WdfSpinLockRelease(engine->ring.lock);
+}
+
+VOID EngineRxComplete(IN XDMA_ENGINE* engine, IN XDMA_RX_POST* post, IN NTSTATUS status) {
+    NTSTATUS unmarkStatus = WdfRequestUnmarkCancelable(post->request);
+    if (unmarkStatus == STATUS_CANCELLED) {
+        WdfSpinLockAcquire(engine->ring.lock);
+        if (!post->cancelPending) { // cancel routine has not run yet - it completes the request
+            post->status = status;
+            post->state = TransferState_Done;
+            WdfSpinLockRelease(engine->ring.lock);
+            return;
+        }
+        WdfSpinLockRelease(engine->ring.lock);
+    } else if (!NT_SUCCESS(unmarkStatus)) {
+        TraceError(DBG_DMA, "WdfRequestUnmarkCancelable failed: %!STATUS!", unmarkStatus);
+    }
+    EngineRxCompleteRequest(engine, post, status);
+}
+
+static ULONG EngineRxAbort(IN XDMA_ENGINE* engine, OUT XDMA_RX_POST** done,
+                           OUT XDMA_RX_POST** aborted, OUT ULONG* numAborted)
+// stop the engine and take all running posts back: the filled ones go to done, the others to
+// aborted. Queued posts move to the front. Returns the number of done posts - ring lock held,
+// it is dropped while the engine comes to a halt.
+{
+    XDMA_RX_QUEUE* rx = &engine->rx;
 
-    TraceVerbose(DBG_DMA, "%s_%u head=%u, tail=%u, credits=%u",
-                 DirectionToString(engine->dir), engine->channel, head, tail, engine->sgdma->descCredits);
+    EngineStop(engine);
+    rx->stopping = TRUE;
+    KeClearEvent(&rx->halted);
+    WdfSpinLockRelease(engine->ring.lock);
+    EngineWaitIdle(engine);
+    WdfSpinLockAcquire(engine->ring.lock);
+    rx->stopping = FALSE;
+    KeSetEvent(&rx->halted, IO_NO_INCREMENT, FALSE);
+
+    const ULONG numDone = EngineRxCollect(engine, done);
+    *numAborted = rx->numRunning;
+    for (ULONG i = 0; i < rx->numRunning; ++i) {
+        aborted[i] = rx->order[i];
+        aborted[i]->state = TransferState_Acquired;
+    }
+    for (ULONG i = 0; i < rx->numQueued; ++i) {
+        rx->order[i] = rx->order[rx->numRunning + i];
+    }
+    rx->numRunning = 0;
 
-    while ((head != tail) && numBytesRemaining) {
+    EngineClearDmaResults(engine);
+    EngineClearPollWriteBack(engine);
+    return numDone;
+}
 
-        // get dma ring buffer address and bytes transferred
-        PVOID rxBufferVa = MmGetMdlVirtualAddress(engine->ring.mdl[head]);
-        size_t numBytesReceived = results[head].length;
+VOID EngineRxCancel(IN XDMA_ENGINE* engine, IN WDFREQUEST request) {
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    XDMA_RX_POST* done[XDMA_MAX_QUEUE_DEPTH];
+    XDMA_RX_POST* aborted[XDMA_MAX_QUEUE_DEPTH];
+    ULONG numDone = 0;
+    ULONG numAborted = 0;
+    XDMA_RX_POST* post = NULL;
+    NTSTATUS status = STATUS_CANCELLED;
 
-        // limit buffer size
-        if (numBytesReceived > numBytesRemaining) {
-            numBytesReceived = numBytesRemaining;
-        } else if (numBytesReceived == 0) {
-            KeClearEvent(&engine->ring.completionSignal);
+    WdfSpinLockAcquire(engine->ring.lock);
+    for (ULONG i = 0; i < rx->depth; ++i) {
+        if ((rx->posts[i].state != TransferState_Free) && (rx->posts[i].request == request)) {
+            post = &rx->posts[i];
             break;
         }
+    }
+    if (post == NULL) {
+        WdfSpinLockRelease(engine->ring.lock);
+        TraceError(DBG_DMA, "request 0x%p not posted to %s_%u",
+                   request, DirectionToString(engine->dir), engine->channel);
+        return;
+    }
 
-        // copy to user
-        status = WdfMemoryCopyFromBuffer(outputMem, offset, rxBufferVa, numBytesReceived);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
-            goto ErrorExit;
+    switch (post->state) {
+    case TransferState_Queued: // no slots yet
+        for (ULONG i = rx->numRunning; i < rx->numRunning + rx->numQueued; ++i) {
+            if (rx->order[i] == post) {
+                RxRemove(rx, i);
+                rx->numQueued--;
+                break;
+            }
         }
+        post->state = TransferState_Acquired;
+        break;
+    case TransferState_Done: // completion has been handed over to us
+        post->state = TransferState_Acquired;
+        status = post->status;
+        break;
+    case TransferState_Running:
+        if (rx->stopping) { // another cancel takes the circle apart, this post is aborted with it
+            post->cancelPending = TRUE;
+            WdfSpinLockRelease(engine->ring.lock);
+            TraceInfo(DBG_DMA, "request 0x%p is cancelled with its circle", request);
+            return;
+        }
+        // the slots of all running posts are handed out in one circle. Take it apart and restart
+        // with the queued posts - a partially received stream can not be repeated, so the other
+        // posts being filled are aborted.
+        numDone = EngineRxAbort(engine, done, aborted, &numAborted);
+        EngineRxStart(engine);
+        EngineRxFill(engine);
+        break;
+    default: // TransferState_Acquired - owned by the I/O callback or the completion path
+        post->cancelPending = TRUE;
+        WdfSpinLockRelease(engine->ring.lock);
+        TraceInfo(DBG_DMA, "request 0x%p is being completed", request);
+        return;
+    }
+    WdfSpinLockRelease(engine->ring.lock);
 
-        numDescProcessed++;
-        offset += numBytesReceived;
-        numBytesRemaining -= numBytesReceived;
-
-        results[head].length = 0;
-        EngineRingAdvance(&head);
+    for (ULONG i = 0; i < numDone; ++i) {
+        if (done[i] == post) { // filled before the engine stopped
+            status = STATUS_SUCCESS;
+        } else {
+            EngineRxComplete(engine, done[i], STATUS_SUCCESS);
+        }
+    }
+    for (ULONG i = 0; i < numAborted; ++i) {
+        if (aborted[i] != post) {
+            EngineRxComplete(engine, aborted[i],
+                             aborted[i]->cancelPending ? STATUS_CANCELLED : STATUS_REQUEST_ABORTED);
+        }
     }
 
-    if (results[head].length == 0) {
-        KeClearEvent(&engine->ring.completionSignal);
+    EngineRxCompleteRequest(engine, post, status);
+}
+
+VOID EngineRxStop(IN XDMA_ENGINE* engine) {
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    XDMA_RX_POST* done[XDMA_MAX_QUEUE_DEPTH];
+    XDMA_RX_POST* aborted[XDMA_MAX_QUEUE_DEPTH];
+    ULONG numAborted = 0;
+
+    engine->ring.packetMode = FALSE;
+    engine->ring.timestamps = FALSE;
+    if (!rx->enabled) {
+        return;
     }
 
     WdfSpinLockAcquire(engine->ring.lock);
-    engine->ring.head = head;
-    engine->sgdma->descCredits = numDescProcessed;
+    while (rx->stopping) { // a cancel takes the circle apart - wait for it to finish
+        WdfSpinLockRelease(engine->ring.lock);
+        KeWaitForSingleObject(&rx->halted, Executive, KernelMode, FALSE, NULL);
+        WdfSpinLockAcquire(engine->ring.lock);
+    }
+    const ULONG numDone = EngineRxAbort(engine, done, aborted, &numAborted);
+    for (ULONG i = 0; i < rx->numQueued; ++i) {
+        aborted[numAborted++] = rx->order[i];
+        rx->order[i]->state = TransferState_Acquired;
+    }
+    rx->numQueued = 0;
+    rx->enabled = FALSE;
     WdfSpinLockRelease(engine->ring.lock);
 
-    *bytesRead = length - numBytesRemaining;
+    for (ULONG i = 0; i < numDone; ++i) {
+        EngineRxComplete(engine, done[i], STATUS_SUCCESS);
+    }
+    for (ULONG i = 0; i < numAborted; ++i) {
+        EngineRxComplete(engine, aborted[i], STATUS_CANCELLED);
+    }
+    TraceInfo(DBG_DMA, "%s_%u posted receive stopped, %u buffers cancelled",
+              DirectionToString(engine->dir), engine->channel, numAborted);
+}
+
+NTSTATUS EngineRxSetMode(IN XDMA_ENGINE* engine, IN ULONG mode) {
+    XDMA_RING* ring = &engine->ring;
+    XDMA_RX_QUEUE* rx = &engine->rx;
+    NTSTATUS status = STATUS_SUCCESS;
 
-    TraceVerbose(DBG_DMA, "%s_%u read %lluB available,  head=%u, tail=%u, credits=%u",
-                 DirectionToString(engine->dir), engine->channel, *bytesRead, head, tail,
-                 engine->sgdma->descCredits);
+    if (mode > XDMA_RX_MODE_PACKETS_TIMESTAMPS) {
+        TraceError(DBG_DMA, "invalid receive mode %u", mode);
+        return STATUS_INVALID_PARAMETER;
+    }
+    const BOOLEAN posted = (mode == XDMA_RX_MODE_POSTED);
+    const BOOLEAN timestamps = (mode == XDMA_RX_MODE_PACKETS_TIMESTAMPS);
+    const BOOLEAN packets = (mode == XDMA_RX_MODE_PACKETS) || timestamps;
+
+    // posted buffers are completed by the interrupt or the poller thread - nobody else polls
+    if (posted && engine->poll && (engine->poller == NULL)) {
+        TraceError(DBG_DMA, "%s_%u posted receive needs interrupts or the poller thread",
+                   DirectionToString(engine->dir), engine->channel);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
 
-ErrorExit:
+    WdfSpinLockAcquire(ring->lock);
+    if (posted == rx->enabled) {
+        // takes effect with the next read - blocks received before carry a stamp of 0
+        if (timestamps && !ring->timestamps) {
+            RtlZeroMemory(ring->arrivalNs, ring->numBlocks * sizeof(UINT64));
+        }
+        ring->timestamps = timestamps;
+        ring->packetMode = packets;
+    } else if (ring->map.owner != NULL) { // the blocks of a mapped ring are consumed in place
+        status = STATUS_INVALID_DEVICE_STATE;
+    } else {
+        for (ULONG i = 0; i < rx->depth; ++i) {
+            if (rx->posts[i].state != TransferState_Free) {
+                status = STATUS_DEVICE_BUSY;
+            }
+        }
+        if (NT_SUCCESS(status)) {
+            EngineRingTeardown(engine);
+            rx->enabled = posted;
+            ring->packetMode = packets;
+            ring->timestamps = timestamps;
+            if (posted) {
+                EngineRxStart(engine);
+            } else {
+                EngineRingSetup(engine);
+            }
+        }
+    }
+    WdfSpinLockRelease(ring->lock);
+
+    TraceInfo(DBG_DMA, "%s_%u receive mode=%u: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, mode, status);
     return status;
 }
 
@@ -883,29 +3314,79 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine) {
     return status;
 }
 
-NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine) {
-
+NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine)
+// poll mode: spin until all runs of the pipeline have completed.
+// hybrid mode: spin on each run as long as its completion time estimate suggests, then leave the
+// remaining runs to the channel interrupt.
+{
     XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-    const ULONG expected = engine->numDescriptors;
-    volatile ULONG actual = 0;
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    const BOOLEAN hybrid = engine->completionMode == XDMA_COMPLETION_MODE_HYBRID;
 
-    do {
-        actual = writeback_data->completedDescCount;
+    if (engine->poller != NULL) { // the poller thread completes the requests
+        return STATUS_SUCCESS;
+    }
+    if (hybrid) { // completions are picked up here until the spin is given up
+        EngineDisableInterrupt(engine);
+    }
 
-        if (actual & XDMA_WB_ERR_MASK) {
-            TraceError(DBG_DMA, "error on writeback %u", actual);
-            return STATUS_INTERNAL_ERROR;
+    for (;;) {
+        WdfSpinLockAcquire(pipeline->lock);
+        const BOOLEAN idle = pipeline->numRunning == 0;
+        const ULONG run = pipeline->numRuns;
+        const ULONG expected = engine->numDescriptors;
+        const UINT64 runBytes = pipeline->runBytes;
+        const UINT64 runStartNs = pipeline->runStartNs;
+        WdfSpinLockRelease(pipeline->lock);
+        if (idle) {
+            break;
+        }
+
+        UINT64 deadline = MAXULONGLONG;
+        if (hybrid) {
+            const UINT64 budget = SpinBudgetNs(&engine->spin, runBytes);
+            if (budget == 0) { // expected to take longer than the max spin
+                EngineEnableInterrupt(engine);
+                return STATUS_SUCCESS;
+            }
+            deadline = runStartNs + budget;
         }
-        actual &= XDMA_WB_COUNT_MASK;
 
-        if (actual > expected) {
-            actual = expected | XDMA_WB_ERR_MASK;
+        // wait for the end of the current run
+        volatile ULONG actual = 0;
+        for (ULONG spins = 1; ; ++spins) {
+            actual = writeback_data->completedDescCount;
+
+            if (actual & XDMA_WB_ERR_MASK) {
+                TraceError(DBG_DMA, "error on writeback %u", actual);
+                EngineServiceTransfer(engine); // fails the requests of the run
+                return STATUS_INTERNAL_ERROR;
+            }
+            actual &= XDMA_WB_COUNT_MASK;
+            if ((actual >= expected) || (pipeline->numRuns != run)) {
+                break;
+            }
+
+            if (hybrid && ((spins % XDMA_SPIN_CHECK_INTERVAL) == 0)) {
+                const UINT64 now = EngineTimeNs();
+                if (now > deadline) { // give up - the run takes at least this long
+                    SpinEstimateUpdate(&engine->spin, runBytes, now - runStartNs, FALSE);
+                    InterlockedIncrement64(&engine->stats.spinTimeouts);
+                    EngineEnableInterrupt(engine);
+                    return STATUS_SUCCESS;
+                }
+            }
+            YieldProcessor();
         }
-    } while (expected != actual);
 
-    TraceVerbose(DBG_DMA, "%u descriptors completed", actual);
+        TraceVerbose(DBG_DMA, "%u descriptors completed", actual);
 
-    EngineProcessTransfer(engine);
+        if (actual >= expected) {
+            SpinEstimateUpdate(&engine->spin, runBytes, EngineTimeNs() - runStartNs, TRUE);
+        }
+        ULONG numDone = EngineServiceTransfer(engine);
+        InterlockedExchangeAdd64(&engine->stats.spinCompletions, numDone);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -916,15 +3397,13 @@ NTSTATUS EnginePollRing(IN XDMA_ENGINE* engine) {
     volatile UINT eopCount = 0;
     UINT tryCount = 0;
     do {
-        completed = writeback_data->completedDescCount;
-
-
-        if (completed & XDMA_WB_ERR_MASK) {
-            TraceError(DBG_DMA, "error on writeback %u", completed);
+        if (writeback_data->completedDescCount & XDMA_WB_ERR_MASK) {
+            TraceError(DBG_DMA, "error on writeback %u", writeback_data->completedDescCount);
             return STATUS_INTERNAL_ERROR;
         }
-        if (completed) {
-            eopCount = EngineProcessRing(engine);
+        completed = EngineRingCompletedCount(engine);
+        if (completed != engine->ring.completedCount) {
+            eopCount = EngineRingReceive(engine, completed);
             TraceVerbose(DBG_DMA, "complete=%u, eop=%u", completed, eopCount);
         }
         tryCount++;
@@ -939,6 +3418,175 @@ NTSTATUS EnginePollRing(IN XDMA_ENGINE* engine) {
     return STATUS_SUCCESS;
 }
 
+static BOOLEAN PollerServiceTransfer(IN XDMA_ENGINE* engine)
+// one look at the writeback of a pipeline engine. returns TRUE while requests are in flight.
+{
+    XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+
+    WdfSpinLockAcquire(pipeline->lock);
+    const BOOLEAN idle = pipeline->numRunning == 0;
+    const ULONG expected = engine->numDescriptors;
+    WdfSpinLockRelease(pipeline->lock);
+    if (idle) {
+        return FALSE;
+    }
+
+    const ULONG completed = wbBuffer->completedDescCount;
+    if ((completed & XDMA_WB_ERR_MASK) || ((completed & XDMA_WB_COUNT_MASK) >= expected)) {
+        ULONG numDone = EngineServiceTransfer(engine); // fails the requests of the run on error
+        InterlockedExchangeAdd64(&engine->stats.spinCompletions, numDone);
+    }
+    return TRUE;
+}
+
+static BOOLEAN PollerServiceRing(IN XDMA_ENGINE* engine)
+// one look at the writeback of an AXI-ST C2H ring. returns TRUE if blocks have been received.
+{
+    if (engine->rx.enabled) { // posted receive clears the writeback
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+        const ULONG completed = wbBuffer->completedDescCount;
+        if (completed == 0) {
+            return FALSE;
+        }
+        if (completed & XDMA_WB_ERR_MASK) {
+            TraceError(DBG_DMA, "%s_%u error on writeback %u",
+                       DirectionToString(engine->dir), engine->channel, completed);
+        }
+        EngineProcessRing(engine);
+        return TRUE;
+    }
+
+    const UINT32 completed = EngineRingCompletedCount(engine);
+    if (completed == engine->ring.completedCount) {
+        // a full ring receives nothing until the blocks consumed are handed back
+        EngineRingReleaseConsumed(engine);
+        return FALSE;
+    }
+    EngineRingReceive(engine, completed); // signals the readers
+    return TRUE;
+}
+
+static VOID PollerThread(IN PVOID context)
+// round-robin over the engines in poll mode. keeps spinning while there is work, waits for a kick
+// (or the idle timeout) once there was none for idleSpinNs.
+{
+    PXDMA_DEVICE xdma = (PXDMA_DEVICE)context;
+    XDMA_POLLER* poller = &xdma->poller;
+    UINT64 idleSinceNs = 0;
+
+    if (poller->affinity != 0) {
+        KeSetSystemAffinityThreadEx(poller->affinity);
+    }
+    TraceInfo(DBG_DMA, "poller thread running, affinity=0x%llx", (ULONGLONG)poller->affinity);
+
+    while (!poller->stop) {
+        BOOLEAN busy = FALSE;
+        for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+            for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+                XDMA_ENGINE* engine = &xdma->engines[ch][dir];
+                if (!engine->enabled || (engine->poller != poller)) {
+                    continue;
+                }
+                busy |= (engine->work == EngineProcessTransfer) ? PollerServiceTransfer(engine) :
+                                                                  PollerServiceRing(engine);
+            }
+        }
+        poller->rounds++;
+
+        if (busy) {
+            idleSinceNs = 0;
+        } else if (idleSinceNs == 0) {
+            idleSinceNs = EngineTimeNs();
+        } else if (EngineTimeNs() - idleSinceNs > poller->idleSpinNs) {
+            LARGE_INTEGER timeout;
+            timeout.QuadPart = -poller->idleWait; // relative
+            poller->idleWaits++;
+            KeWaitForSingleObject(&poller->kick, Executive, KernelMode, FALSE,
+                                  (poller->idleWait != 0) ? &timeout : NULL);
+            idleSinceNs = 0;
+            continue;
+        }
+        YieldProcessor();
+    }
+
+    TraceInfo(DBG_DMA, "poller thread exiting after %llu rounds, %llu idle waits",
+              poller->rounds, poller->idleWaits);
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS XDMA_PollerStart(PXDMA_DEVICE xdma, KAFFINITY affinity, ULONG idleSpinUs, ULONG idleWaitUs) {
+
+    EXPECT(xdma != NULL);
+    XDMA_POLLER* poller = &xdma->poller;
+    if (poller->thread != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    KeInitializeEvent(&poller->kick, SynchronizationEvent, FALSE);
+    poller->stop = 0;
+    poller->affinity = affinity;
+    poller->idleSpinNs = (UINT64)idleSpinUs * 1000ULL;
+    poller->idleWait = (LONGLONG)idleWaitUs * 10; // 100ns units
+    poller->rounds = 0;
+    poller->idleWaits = 0;
+
+    HANDLE threadHandle;
+    NTSTATUS status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL, NULL, NULL,
+                                           PollerThread, xdma);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "PsCreateSystemThread failed: %!STATUS!", status);
+        return status;
+    }
+    status = ObReferenceObjectByHandle(threadHandle, THREAD_ALL_ACCESS, *PsThreadType, KernelMode,
+                                       (PVOID*)&poller->thread, NULL);
+    ZwClose(threadHandle);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "ObReferenceObjectByHandle failed: %!STATUS!", status);
+        poller->thread = NULL;
+        InterlockedExchange(&poller->stop, 1); // let the thread end on its own
+        KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
+        return status;
+    }
+
+    // take over the engines which are in poll mode already
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            XDMA_ENGINE* engine = &xdma->engines[ch][dir];
+            if (engine->enabled && (engine->completionMode == XDMA_COMPLETION_MODE_POLL)) {
+                engine->poller = poller;
+            }
+        }
+    }
+    KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
+
+    TraceInfo(DBG_INIT, "poller thread started, affinity=0x%llx, idleSpinUs=%u, idleWaitUs=%u",
+              (ULONGLONG)affinity, idleSpinUs, idleWaitUs);
+    return STATUS_SUCCESS;
+}
+
+void XDMA_PollerStop(PXDMA_DEVICE xdma) {
+
+    EXPECT(xdma != NULL);
+    XDMA_POLLER* poller = &xdma->poller;
+    if (poller->thread == NULL) {
+        return;
+    }
+
+    // hand the engines back to their issuers before the thread goes away
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            xdma->engines[ch][dir].poller = NULL;
+        }
+    }
+
+    InterlockedExchange(&poller->stop, 1);
+    KeSetEvent(&poller->kick, IO_NO_INCREMENT, FALSE);
+    KeWaitForSingleObject(poller->thread, Executive, KernelMode, FALSE, NULL);
+    ObDereferenceObject(poller->thread);
+    poller->thread = NULL;
+}
+
 //========================= performance counters interface ========================================
 
 void EngineStartPerf(IN XDMA_ENGINE* engine) {
@@ -963,20 +3611,74 @@ void EngineGetPerf(IN XDMA_ENGINE* engine, OUT XDMA_PERF_DATA* perfData) {
     perfData->pendingCount = ((UINT64)engine->regs->perfPndHi << 32) + engine->regs->perfPndHi;
 }
 
-void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode) {
+static void EngineApplyCompletionMode(IN XDMA_ENGINE* engine, IN ULONG mode, IN ULONG maxSpinUs) {
+    XDMA_POLLER* poller = &engine->parentDevice->poller;
+
+    if (mode == XDMA_COMPLETION_MODE_INTERRUPT) {
+        engine->regs->controlW1C = XDMA_CTRL_POLL_MODE;
+        engine->regs->controlW1S = XDMA_CTRL_IE_ALL;
+    } else if (mode == XDMA_COMPLETION_MODE_POLL) {
+        engine->regs->controlW1S = XDMA_CTRL_POLL_MODE;
+        engine->regs->controlW1C = XDMA_CTRL_IE_ALL;
+    } else { // hybrid - writeback for spinning, engine interrupts for when the spin is given up
+        engine->regs->controlW1S = XDMA_CTRL_POLL_MODE;
+        engine->regs->controlW1S = XDMA_CTRL_IE_ALL;
+    }
+
+    engine->poll = (mode != XDMA_COMPLETION_MODE_INTERRUPT);
+    engine->completionMode = mode;
+    engine->poller = ((mode == XDMA_COMPLETION_MODE_POLL) && (poller->thread != NULL)) ? poller : NULL;
+    SpinEstimateInit(&engine->spin, (UINT64)maxSpinUs * 1000ULL);
+    if (engine->poll) { // no stale count from a previous poll mode period
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+        wbBuffer->completedDescCount = 0;
+    }
+}
+
+NTSTATUS XDMA_EngineSetCompletionMode(XDMA_ENGINE* engine, ULONG mode, ULONG maxSpinUs) {
 
     EXPECT(engine != NULL);
 
-    if (engine->enabled == TRUE) {
-        if (pollMode) {
-            //EngineDisableInterrupt(engine);
-            engine->regs->controlW1S = XDMA_CTRL_POLL_MODE;
-            engine->regs->controlW1C = XDMA_CTRL_IE_ALL;
-        } else {
-            engine->regs->controlW1C = XDMA_CTRL_POLL_MODE;
-            engine->regs->controlW1S = XDMA_CTRL_IE_ALL;
-            //EngineEnableInterrupt(engine);
+    if (mode > XDMA_COMPLETION_MODE_HYBRID) {
+        TraceError(DBG_DMA, "invalid completion mode %u", mode);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (engine->enabled != TRUE) {
+        return STATUS_SUCCESS;
+    }
+
+    // the AXI-ST C2H ring waits on its completion event - there is no run to spin on
+    if (engine->work != EngineProcessTransfer) {
+        if (mode == XDMA_COMPLETION_MODE_HYBRID) {
+            return STATUS_NOT_SUPPORTED;
         }
-        engine->poll = pollMode;
+        // posted buffers are completed by the interrupt or the poller thread - nobody else polls
+        if (engine->rx.enabled && (mode == XDMA_COMPLETION_MODE_POLL) &&
+            (engine->parentDevice->poller.thread == NULL)) {
+            return STATUS_INVALID_DEVICE_STATE;
+        }
+        EngineApplyCompletionMode(engine, mode, maxSpinUs);
+        return STATUS_SUCCESS;
+    }
+
+    // the completion path of a run in flight depends on the mode
+    XDMA_PIPELINE* pipeline = &engine->pipeline;
+    NTSTATUS status = STATUS_SUCCESS;
+    WdfSpinLockAcquire(pipeline->lock);
+    if (pipeline->numRunning + pipeline->numQueued > 0) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        EngineApplyCompletionMode(engine, mode, maxSpinUs);
     }
-}
\ No newline at end of file
+    WdfSpinLockRelease(pipeline->lock);
+
+    TraceInfo(DBG_DMA, "%s_%u completion mode=%u, maxSpinUs=%u: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, mode, maxSpinUs, status);
+    return status;
+}
+
+
+void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode) {
+    XDMA_EngineSetCompletionMode(engine, pollMode ? XDMA_COMPLETION_MODE_POLL :
+                                 XDMA_COMPLETION_MODE_INTERRUPT, XDMA_DEFAULT_SPIN_US);
+}
@@ -20,6 +20,7 @@
 #include <ntintsafe.h>
 #include <wdf.h>
 #include "reg.h"
+#include "xdma_core.h"
 #include "xdma_public.h"
 
 // ========================= constants ============================================================
@@ -27,9 +28,34 @@
 #define XDMA_MAX_NUM_CHANNELS   (4)
 #define XDMA_NUM_DIRECTIONS     (2)
 #define XDMA_MAX_CHAN_IRQ       (XDMA_NUM_DIRECTIONS * XDMA_MAX_NUM_CHANNELS)
-#define XDMA_RING_NUM_BLOCKS    (258U)
-#define XDMA_RING_BLOCK_SIZE    (PAGE_SIZE)
-#define XDMA_MAX_TRANSFER_SIZE  (8UL * 1024UL * 1024UL)
+#define XDMA_RING_NUM_BLOCKS    (258U)         // default number of blocks of the AXI-ST C2H ring
+#define XDMA_RING_BLOCK_SIZE    (PAGE_SIZE)    // default size of a ring block
+#define XDMA_RING_MIN_BLOCKS    (2U)
+#define XDMA_RING_MAX_BLOCKS    (1024U)        // initial credits (blocks - 1) fit XDMA_DESC_CREDITS_MAX
+#define XDMA_RING_MIN_BLOCK_SIZE (PAGE_SIZE)
+#define XDMA_RING_MAX_BLOCK_SIZE (1024UL * 1024UL)
+#define XDMA_RING_MEMORY_NONCACHED (0)         // ring blocks are non-cached memory (default)
+#define XDMA_RING_MEMORY_CACHED    (1)         // cached - only where dma snoops the caches (x86/x64)
+#define XDMA_RING_MEMORY_WRITECOMBINED (2)     // write-combined - copied with streaming loads
+#define XDMA_RING_OWNER_NONE    (0)            // XDMA_RING.owner - nobody consumes
+#define XDMA_RING_OWNER_READER  (1)            // a read copies blocks out
+#define XDMA_RING_OWNER_DROP    (2)            // the producer drops the oldest blocks
+#define XDMA_POOL_TAG           ('amdX')
+#define XDMA_MAX_TRANSFER_SIZE  (8UL * 1024UL * 1024UL)     // default max length of a dma transfer
+#define XDMA_MAX_TRANSFER_SIZE_LIMIT (256UL * 1024UL * 1024UL) // upper bound for MAX_TRANSFER_SIZE
+#define XDMA_DESC_SEGMENT_CAPACITY (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) // descriptors per segment
+#define XDMA_DESC_SEGMENTS(maxTransferSize) \
+    (((maxTransferSize) / PAGE_SIZE + 2 + XDMA_DESC_SEGMENT_CAPACITY - 1) / XDMA_DESC_SEGMENT_CAPACITY)
+#define XDMA_MAX_DESC_SEGMENTS  XDMA_DESC_SEGMENTS(XDMA_MAX_TRANSFER_SIZE_LIMIT)
+#define XDMA_MAX_QUEUE_DEPTH    (16)
+#define XDMA_DEFAULT_QUEUE_DEPTH (4)
+#define XDMA_MAX_REGISTERED_BUFFERS (64) // registered buffers per engine
+#define XDMA_MAX_PROGRAMS       (8)    // stored dma programs per engine
+#define XDMA_MAX_PIPELINE_ENTRIES (XDMA_MAX_QUEUE_DEPTH + XDMA_MAX_PROGRAMS) // requests and programs
+#define XDMA_DEFAULT_SPIN_US    (50)   // default max spin per run in hybrid completion mode
+#define XDMA_SPIN_CHECK_INTERVAL (64)  // writeback polls between reads of the clock
+#define XDMA_DEFAULT_POLLER_IDLE_SPIN_US  (100)  // poller thread spin without work before waiting
+#define XDMA_DEFAULT_POLLER_IDLE_WAIT_US  (1000) // poller thread idle wait between rounds
 
 // ========================= forward declarations =================================================
 
@@ -39,44 +65,229 @@ struct XDMA_ENGINE_T;
 
 // ========================= type declarations ====================================================
 
-/// Direction of the DMA transfer/engine
-typedef enum DirToDev_t {
-    H2C = 0, // Host-to-Card - write to device
-    C2H = 1  // Card-to-Host - read from device
-} DirToDev;
-
-/// Ring buffer abstraction for streaming DMA
+/// Mapping of a ring into the process which consumes it in place (see EngineRingMap())
+typedef struct XDMA_RING_MAP_T {
+    PVOID owner;                    // file object which created the mapping, NULL = not mapped
+    PEPROCESS process;
+    BOOLEAN active;                 // set once the mapping is complete - blocks are consumed in place
+    XDMA_RING_INDICES* indices;     // kept until the ring is freed, once allocated
+    PMDL indicesMdl;
+    PMDL dataMdl;                   // pages of all blocks
+    PMDL resultsMdl;
+    PVOID indicesUser;              // addresses in the process
+    PVOID dataUser;
+    PVOID resultsUser;
+} XDMA_RING_MAP;
+
+/// Ring buffer abstraction for streaming DMA.
+/// The blocks are passed between a single producer, the dpc or poller thread which scans the dma
+/// results (EngineProcessRing()), and a single consumer, the reader (EngineRingCopyBytesToMemory())
+/// without a lock: each of them only writes its own index (RingWriteRelease()) and reads the other
+/// one (RingReadAcquire()). The lock serializes the setup and mode changes, the mapped ring and
+/// posted receive. With the drop-oldest overrun policy the producer also consumes: the owner flag
+/// then keeps a read and a drop from running at the same time.
 typedef struct XDMA_RING_T {
-    WDFCOMMONBUFFER results;
-    PMDL mdl[XDMA_RING_NUM_BLOCKS]; // memory descriptor list - host side
+    UINT numBlocks;
+    ULONG blockSize;                // bytes per block, a multiple of PAGE_SIZE
+    WDFCOMMONBUFFER results;        // a DMA_RESULT per block
+    WDFCOMMONBUFFER descBuffer;     // a descriptor per block, linked into a circle
+    PMDL* mdl;                      // memory descriptor list of each block - host side
+    MEMORY_CACHING_TYPE cacheType;  // of the blocks, see XDMA_RING_MEMORY_*
+    BOOLEAN streamCopy;             // reads copy the blocks with RingCopyStreaming()
     CHAR dmaTransferContext[DMA_TRANSFER_CONTEXT_SIZE_V1];
-    UINT head;
-    UINT tail;
-    WDFSPINLOCK lock;
+    DECLSPEC_CACHEALIGN volatile UINT head; // next block to consume - written by the consumer
+    DECLSPEC_CACHEALIGN volatile UINT tail; // next block to receive - written by the producer
+    UINT32 completedCount;          // completed descriptor count of the engine at the tail - producer
+    UINT peakOccupancy;             // most blocks received but not consumed since the setup
+    DECLSPEC_CACHEALIGN WDFSPINLOCK lock;
     KEVENT completionSignal;
+    BOOLEAN packetMode;             // reads return packet batches (XDMA_RX_MODE_PACKETS)
+    BOOLEAN timestamps;             // the producer stamps the blocks it receives, the batches
+                                    // carry the stamps (XDMA_RX_MODE_PACKETS_TIMESTAMPS)
+    UINT64* arrivalNs;              // time each block was seen received, see EngineRingReceive()
+    XDMA_RING_MAP map;
+    XDMA_RING_CREDITS credits;      // descriptor credits of the blocks - not used by posted receive
+    volatile LONG64 dryFromNs;      // the engine ran out of credits at this time, 0 = it holds some
+    volatile ULONG overrunPolicy;   // XDMA_RING_OVERRUN_*
+    volatile LONG owner;            // XDMA_RING_OWNER_* - who consumes blocks right now
+    BOOLEAN gap;                    // blocks were dropped, the next read reports it - owner only
 }XDMA_RING, *PXDMA_RING;
 
+/// Life cycle of a request slot of the transfer pipeline
+typedef enum XDMA_TRANSFER_STATE_T {
+    TransferState_Free,
+    TransferState_Acquired,     // owned by the I/O callback or the completion path
+    TransferState_Queued,       // descriptor chain built, waiting for the next hardware run
+    TransferState_Running,      // descriptor chain linked into the current hardware run
+    TransferState_Done,         // finished, completion handed over to the cancel routine
+} XDMA_TRANSFER_STATE;
+
+/// A user buffer locked and mapped for dma once, for any number of transfers until it is
+/// unregistered (see EngineRegisterBuffer()). Slots are claimed and freed under the pipeline lock.
+typedef struct XDMA_REGISTERED_BUFFER_T {
+    PVOID owner;                    // file object which registered it, NULL = free slot
+    BOOLEAN active;                 // registered - new transfers may reference it
+    LONG references;                // transfers in flight, plus one while active
+    ULONG length;
+    PMDL mdl;                       // locked pages of the buffer
+    PDMA_ADAPTER adapter;           // which built sgList
+    PSCATTER_GATHER_LIST sgList;    // logical addresses, kept until the last reference is gone
+    KEVENT mapped;                  // sgList has been built
+} XDMA_REGISTERED_BUFFER;
+
+/// Card memory fill of a transfer (IOCTL_XDMA_FILL). It runs in stages of as many copies of the
+/// pattern as the descriptor store of the transfer holds.
+typedef struct XDMA_FILL_T {
+    SCATTER_GATHER_ELEMENT pattern[2]; // physical pieces of the pattern, at most a page
+    ULONG numElements;
+    UINT64 deviceAddr;          // card address of the next stage
+    UINT64 remaining;           // bytes after the current stage
+    UINT64 numBytes;            // length of the fill, 0 if the transfer is no fill
+} XDMA_FILL;
+
+/// A request in flight on a memory mapped (or AXI-ST H2C) engine
+typedef struct XDMA_TRANSFER_T {
+    struct XDMA_ENGINE_T* engine;
+    WDFREQUEST request;
+    WDFDMATRANSACTION dmaTransaction;
+    WDFCOMMONBUFFER segments[XDMA_MAX_DESC_SEGMENTS]; // descriptor store of this transfer
+    DMA_DESCRIPTOR* segmentVA[XDMA_MAX_DESC_SEGMENTS];
+    UINT64 segmentLA[XDMA_MAX_DESC_SEGMENTS];
+    XDMA_DESC_STORE store;
+    XDMA_TRANSFER_STATE state;
+    ULONG numDescriptors;       // descriptors of the current chain
+    size_t numBytes;            // bytes of the current chain
+    DMA_DESCRIPTOR* lastDesc;   // last descriptor of the current chain
+    UINT32 firstAdj;            // adjacent descriptors of the first fetch of the chain
+    ULONG descEnd;              // completed descriptor count of the run once this chain is done
+    BOOLEAN lastFragment;       // this chain completes the dma transaction
+    BOOLEAN cancelPending;      // the cancel routine ran while the transfer was being completed
+    NTSTATUS status;            // final status while in TransferState_Done
+    const XDMA_DESC_PACKET* packets; // packet table of a gather send, NULL for reads and writes
+    const XDMA_DESC_VECTOR* vectors; // vector table of a vectored transfer, NULL otherwise
+    const XDMA_DESC_STRIDE* stride;  // rows of a strided transfer, NULL otherwise
+    ULONG numPackets;           // entries of either table, or rows
+    size_t packetBytes;         // total length of the packets, vectors or rows
+    BOOLEAN loop;               // the packets are sent over and over, see XDMA_SEND_LOOP
+    XDMA_FILL fill;
+    XDMA_REGISTERED_BUFFER* registered; // the vector is within this buffer, the request has no
+                                        // dma transaction (see EngineProgramRegistered())
+    struct XDMA_PROGRAM_T* program; // the chain of a stored program - no request
+} XDMA_TRANSFER;
+
+/// A descriptor chain over a registered buffer, built once and run again on every trigger
+/// (IOCTL_XDMA_PROGRAM_*). Its transfer is Free while the program is idle and goes through the
+/// pipeline like a request otherwise. Slots are claimed and freed under the pipeline lock, they
+/// stay in place, so a user event may still look at a deleted program.
+typedef struct XDMA_PROGRAM_T {
+    PVOID owner;                // file object which created it, NULL = free slot
+    BOOLEAN active;             // may be triggered
+    BOOLEAN allocated;          // transfer has its descriptor store
+    XDMA_TRANSFER transfer;
+    XDMA_DESC_VECTOR vector;
+    ULONG eventId;              // user event which runs it, XDMA_PROGRAM_NO_EVENT if none
+    XDMA_PROGRAM_STATUS status; // counters
+    KEVENT completion;          // a run has completed
+} XDMA_PROGRAM;
+
+/// Requests in flight on an engine.
+/// All queued chains are linked into a single hardware run when the engine is idle, so the engine
+/// only stops once per run instead of once per request. Runs complete in order.
+typedef struct XDMA_PIPELINE_T {
+    XDMA_TRANSFER transfers[XDMA_MAX_QUEUE_DEPTH];
+    ULONG depth;                // number of usable transfers (max requests in flight)
+    XDMA_TRANSFER* order[XDMA_MAX_PIPELINE_ENTRIES]; // running transfers in run order, then
+                                                     // queued ones - requests and programs
+    ULONG numRunning;
+    ULONG numQueued;
+    volatile ULONG numRuns;     // number of runs started, lets pollers detect a restart
+    UINT64 runBytes;            // bytes of the current run
+    UINT64 runStartNs;          // start time of the current run
+    BOOLEAN stopping;           // a cancel waits for the engine to halt, the run is left alone
+    ULONG numSegments;          // descriptor store segments every transfer has
+    ULONG segmentsWanted;       // segments asked for by requests, see EngineGrowStores()
+    WDFWAITLOCK growLock;       // serializes EngineGrowStores()
+    WDFSPINLOCK lock;
+} XDMA_PIPELINE;
+
+/// A user buffer posted as receive descriptors of an AXI-ST C2H ring (see EngineRxPost())
+typedef struct XDMA_RX_POST_T {
+    struct XDMA_ENGINE_T* engine;
+    WDFREQUEST request;
+    WDFDMATRANSACTION dmaTransaction;
+    XDMA_TRANSFER_STATE state;  // Queued = waiting for free slots, Running = slots handed out
+    PSCATTER_GATHER_LIST sgList;// mapped buffer, valid until the dma transaction is released
+    UINT numSlots;              // ring slots (descriptors) of the buffer
+    UINT slotsDone;             // slots written by the engine
+    size_t numBytes;            // bytes received so far
+    BOOLEAN eop;                // the last slot written ended a packet
+    BOOLEAN cancelPending;      // the cancel routine ran while the post was being completed
+    NTSTATUS status;            // final status while in TransferState_Done
+} XDMA_RX_POST;
+
+/// Posted receive mode of an AXI-ST C2H engine: the ring descriptors point to the buffers of read
+/// requests instead of the ring blocks, so the data lands in user memory without a copy. Buffers
+/// are filled and completed in the order they were posted. Protected by the ring lock.
+typedef struct XDMA_RX_QUEUE_T {
+    BOOLEAN enabled;
+    ULONG depth;                // max buffers posted at a time
+    XDMA_RX_POST posts[XDMA_MAX_QUEUE_DEPTH];
+    XDMA_RX_POST* order[XDMA_MAX_QUEUE_DEPTH]; // running posts in slot order, then queued ones
+    ULONG numRunning;
+    ULONG numQueued;
+    UINT next;                  // slot of the next posted descriptor
+    UINT freeSlots;             // slots not handed to the engine
+    BOOLEAN stopping;           // EngineRxAbort() waits for the engine to halt, no slots move
+    KEVENT halted;              // set while no EngineRxAbort() is stopping the engine
+} XDMA_RX_QUEUE;
+
+/// Cyclic send of an AXI-ST H2C engine (IOCTL_XDMA_SEND_LOOP): the packet list of a transfer is
+/// linked into a circle which the engine sends over and over without the CPU until the request is
+/// cancelled. The packets are the slots of the loop. Nothing else runs on the engine meanwhile.
+/// Protected by the pipeline lock.
+typedef struct XDMA_SEND_LOOP_T {
+    XDMA_TRANSFER* transfer;    // transfer of the loop request, NULL = no loop
+    BOOLEAN credits;            // slots are only sent as their credits are granted
+    ULONG* slotEnds;            // descriptors of a lap up to the end of each slot
+    ULONG numSlots;
+    ULONG lastCount;            // completed descriptor count at the last look
+    UINT64 descDone;            // descriptors sent since the start
+    UINT64 slotsGranted;        // slots whose credits have been granted (credit mode)
+} XDMA_SEND_LOOP;
+
+/// Software counters of an engine
+typedef struct XDMA_ENGINE_STATS_T {
+    volatile LONG64 clears;         // descriptor/writeback reinitializations on completion
+    volatile LONG64 clearedBytes;   // bytes touched by these reinitializations
+    volatile LONG64 sgElements;     // scatter gather elements programmed
+    volatile LONG64 descriptors;    // descriptors these elements were coalesced into
+    volatile LONG64 spinCompletions;        // requests found completed while polling
+    volatile LONG64 interruptCompletions;   // requests completed by the channel interrupt
+    volatile LONG64 spinTimeouts;           // hybrid mode spins given up for the interrupt
+    volatile LONG64 creditWrites;           // descriptor credit grants of the AXI-ST C2H ring
+    volatile LONG64 creditStalls;           // times the ring engine ran out of credits
+    volatile LONG64 creditStallNs;          // time the ring engine spent without credits
+    volatile LONG64 overruns;               // times the ring dropped its oldest blocks
+    volatile LONG64 droppedBlocks;
+    volatile LONG64 droppedBytes;
+} XDMA_ENGINE_STATS;
+
+/// Driver-owned thread servicing the writeback of all engines in poll mode, so that requests in
+/// poll mode do not spin in the thread which issued them (see XDMA_PollerStart())
+typedef struct XDMA_POLLER_T {
+    PKTHREAD thread;
+    KEVENT kick;                // new work for the poller - ends an idle wait
+    volatile LONG stop;
+    KAFFINITY affinity;         // processors the thread may run on, 0 = any
+    UINT64 idleSpinNs;          // keep spinning this long after the last work
+    LONGLONG idleWait;          // timeout of an idle wait in 100ns units, 0 = wait for a kick
+    volatile LONG64 rounds;     // service rounds over all engines
+    volatile LONG64 idleWaits;  // waits after idleSpinNs without work
+} XDMA_POLLER;
+
 /// engine specific work to perform after dma transfer completion is detected
 typedef VOID(*PFN_XDMA_ENGINE_WORK)(IN struct XDMA_ENGINE_T *engine);
 
-/// Engine address mode. 
-/// Determines how the DMA engine interprets the device address (destination address on H2C and 
-/// source address on C2H).
-/// When AddressMode_Contiguous is chosen, the device address only needs to be set for the first 
-/// descriptor and the engine assumes that all subsequent descriptors device addresses follow
-/// sequentially. 
-/// When AddressMode_Fixed is selected, the device addresses of each descriptor must be explicitly
-/// set.
-typedef enum AddressMode_T {
-    AddressMode_Contiguous,  // incremental
-    AddressMode_Fixed,       // non-incremental
-} AddressMode;
-
-typedef enum EngineType_t {
-    EngineType_MM,      // Memory Mapped
-    EngineType_ST,      // Streaming
-} EngineType;
-
 /// DMA engine abstraction
 typedef struct XDMA_ENGINE_T {
 
@@ -91,64 +302,36 @@ typedef struct XDMA_ENGINE_T {
     UINT32 alignAddr;
     UINT32 alignLength;
     UINT32 alignAddrBits;
+    UINT32 dataPathWidth;       // bytes per data beat, captured from the config block
+    UINT32 descAdjMax;          // max adjacent descriptors per fetch, captured from the PCIe MRRS
     DWORD channel;
     DirToDev dir;               // data flow direction (H2C or C2H)
     BOOLEAN enabled;
     EngineType type;            // MemoryMapped or Streaming
     AddressMode addressMode;    // incremental (contiguous) or non-incremental (fixed)
 
-    // dma
+    // dma传输相关
     WDFCOMMONBUFFER descBuffer;
-    WDFDMATRANSACTION dmaTransaction;
+    XDMA_PIPELINE pipeline;     // requests in flight - not used by the AXI-ST C2H ring
     PFN_XDMA_ENGINE_WORK work; // engine work for interrupt processing
 
     // specific to streaming interface
     XDMA_RING ring;
+    XDMA_RX_QUEUE rx;           // user buffers posted to the ring - AXI-ST C2H only
+    XDMA_SEND_LOOP loop;        // cyclic send - AXI-ST H2C only
+    XDMA_REGISTERED_BUFFER registered[XDMA_MAX_REGISTERED_BUFFERS]; // AXI-MM only
+    XDMA_PROGRAM programs[XDMA_MAX_PROGRAMS]; // AXI-MM only
 
-    // ضѯģʽ
+    // 特定于轮询模式
     ULONG poll;
-    WDFCOMMONBUFFER pollWbBuffer; // ڱѯģʽдݵĻ
-    ULONG numDescriptors; // ͳѯģʽ´
-} XDMA_ENGINE;
+    WDFCOMMONBUFFER pollWbBuffer; // 用于保存轮询模式描述符回写数据的缓冲区
+    ULONG numDescriptors; // 统计轮询模式下传输的描述符数量
+    ULONG completionMode;       // XDMA_COMPLETION_MODE_* - poll is set for polling and hybrid
+    XDMA_POLLER* poller;        // poller thread servicing this engine, NULL = the issuer polls
+    XDMA_SPIN_ESTIMATE spin;    // spin budget of the hybrid completion mode
 
-#pragma pack(1)
-
-/// \brief Descriptor for a single contiguous memory block transfer.
-///
-/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the 
-/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
-/// bytes in the 32-bit words must be in little-endian byte ordering.
-typedef struct xdma_descriptor_t {
-    UINT32 control;
-    UINT32 numBytes;  // transfer length in bytes
-    UINT32 srcAddrLo; // source address (low 32-bit)
-    UINT32 srcAddrHi; // source address (high 32-bit)
-    UINT32 dstAddrLo; // destination address (low 32-bit)
-    UINT32 dstAddrHi; // destination address (high 32-bit)
-                      // next descriptor in the single-linked list of descriptors, 
-                      // this is the bus address of the next descriptor in the root complex memory.
-    UINT32 nextLo;    // next desc address (low 32-bit)
-    UINT32 nextHi;    // next desc address (high 32-bit)
-} DMA_DESCRIPTOR;
-
-/// Result buffer of the streaming DMA operation. 
-/// The XDMA IP core writes the result of the DMA transfer to the host memory
-typedef struct {
-    UINT32 status;
-    UINT32 length;
-    UINT32 reserved_1[6]; // padding
-} DMA_RESULT;
-
-/// \brief Structure for polled mode descriptor writeback
-///
-/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
-/// poll to detect transfer completion
-typedef struct {
-    UINT32 completedDescCount;
-    UINT32 reserved_1[7];
-} XDMA_POLL_WB;
-
-#pragma pack()
+    XDMA_ENGINE_STATS stats;
+} XDMA_ENGINE;
 
 // ========================= function declarations ================================================
 
@@ -171,7 +354,47 @@ VOID EngineRingSetup(IN XDMA_ENGINE *engine);
 /// Reset the streaming ring buffer and stop the cyclic DMA transfer
 VOID EngineRingTeardown(IN XDMA_ENGINE *engine);
 
-/// Poll the write-back buffer for DMA transfer completion
+/// Release the block memory of the streaming ring buffer
+VOID EngineRingFree(IN XDMA_ENGINE *engine);
+
+/// Reserve a transfer of the engine pipeline for a request. Returns NULL if all are in use.
+XDMA_TRANSFER* EngineAcquireTransfer(IN XDMA_ENGINE* engine, IN WDFREQUEST request);
+
+/// Return a transfer which has not been executed (or whose dma transaction has been released)
+VOID EngineReleaseTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer);
+
+/// Release the dma transaction of an executed (cancelable) transfer and complete its request
+VOID EngineCompleteTransfer(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer, IN NTSTATUS status);
+
+/// Cancel routine helper - complete a request of the engine pipeline with STATUS_CANCELLED
+VOID EngineCancelTransfer(IN XDMA_ENGINE* engine, IN WDFREQUEST request);
+
+/// The descriptor stores of the transfers start with one segment. Returns TRUE if they can not
+/// hold a list of numDescriptors yet - the size is remembered for EngineGrowStores().
+BOOLEAN EngineStoreTooSmall(IN XDMA_ENGINE* engine, IN ULONG64 numDescriptors);
+
+/// Grow the descriptor stores of all transfers to the largest size asked for, at PASSIVE_LEVEL
+NTSTATUS EngineGrowStores(IN XDMA_ENGINE* engine);
+
+/// Reserve a transfer for the cyclic send of a request with numSlots packets. The engine must be
+/// idle - STATUS_DEVICE_BUSY while requests are in flight or another loop runs.
+NTSTATUS EngineLoopAcquire(IN XDMA_ENGINE* engine, IN WDFREQUEST request, IN ULONG numSlots,
+                           IN BOOLEAN credits, OUT XDMA_TRANSFER** transfer);
+
+/// Called once the dma transaction of a cyclic send has been executed: completes the request if it
+/// was cancelled while the loop was being started
+VOID EngineLoopStarted(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer);
+
+/// Grant the credits of the next numSlots slots of a cyclic send in credit mode (0 = none) and get
+/// the progress of the loop
+NTSTATUS EngineLoopCredit(IN XDMA_ENGINE* engine, IN ULONG numSlots,
+                          OUT XDMA_TX_LOOP_STATUS* loopStatus);
+
+/// Stop the cyclic send of the file object owner, if any, and complete its request with
+/// STATUS_CANCELLED
+VOID EngineLoopStop(IN XDMA_ENGINE* engine, IN PVOID owner);
+
+/// Poll the write-back buffer until all requests in the engine pipeline have completed
 NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine);
 
 /// Poll the write-back buffer for DMA transfer completion
@@ -193,6 +416,97 @@ VOID EngineGetPerf(IN XDMA_ENGINE* engine, OUT XDMA_PERF_DATA* perfData);
 /// Stringify the Engine direction (H2C/C2H)
 char* DirectionToString(DirToDev dir);
 
-/// Copy data from the ring buffer directly into a WDFMEMORY object
+/// Copy data from the ring buffer directly into a WDFMEMORY object - in packet mode as a batch of
+/// whole packets and their table (see RingCopyPackets())
 NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem,
-                                     size_t length, LARGE_INTEGER timeout, size_t* bytesRead);
\ No newline at end of file
+                                     size_t length, LARGE_INTEGER timeout, size_t* bytesRead);
+
+/// Map the ring data, the dma results and the ring indices into the current process, which then
+/// consumes the blocks in place instead of reading them. Must be called in the context of the
+/// process. Only one file object can map a ring at a time.
+NTSTATUS EngineRingMap(IN XDMA_ENGINE *engine, IN PVOID owner, OUT XDMA_RING_MAPPING* mapping);
+
+/// Remove the mapping of the ring created by owner, if any
+VOID EngineRingUnmap(IN XDMA_ENGINE *engine, IN PVOID owner);
+
+/// Get the occupancy and the descriptor credit counters of the ring
+VOID EngineRingGetStats(IN XDMA_ENGINE *engine, OUT XDMA_RING_STATS* stats);
+
+/// Select what the AXI-ST C2H ring does when the reader falls behind (XDMA_RING_OVERRUN_*): stop
+/// the engine until blocks are read, or drop the oldest blocks. Dropping is refused while the ring
+/// is mapped. The policy returns to XDMA_RING_OVERRUN_BACKPRESSURE when the file is cleaned up.
+NTSTATUS EngineRingSetOverrun(IN XDMA_ENGINE *engine, IN ULONG policy);
+
+/// Select how the AXI-ST C2H ring receives: into its own blocks, which reads copy out as a byte
+/// stream or as packet batches, or into the buffers of posted read requests (XDMA_RX_MODE_*). The
+/// mode returns to XDMA_RX_MODE_RING when the file is cleaned up.
+NTSTATUS EngineRxSetMode(IN XDMA_ENGINE *engine, IN ULONG mode);
+
+/// Reserve a post of the engine for a read request. Returns NULL if all are in use.
+XDMA_RX_POST* EngineRxAcquire(IN XDMA_ENGINE* engine, IN WDFREQUEST request);
+
+/// Return a post which has not been executed
+VOID EngineRxRelease(IN XDMA_ENGINE* engine, IN XDMA_RX_POST* post);
+
+/// Release the dma transaction of an executed (cancelable) post and complete its request
+VOID EngineRxComplete(IN XDMA_ENGINE* engine, IN XDMA_RX_POST* post, IN NTSTATUS status);
+
+/// Cancel routine helper - complete a posted read request with STATUS_CANCELLED
+VOID EngineRxCancel(IN XDMA_ENGINE* engine, IN WDFREQUEST request);
+
+/// Stop the engine, complete all posted read requests with STATUS_CANCELLED and return to
+/// XDMA_RX_MODE_RING, at PASSIVE_LEVEL
+VOID EngineRxStop(IN XDMA_ENGINE* engine);
+
+/// Hand the blocks consumed in place back to the engine and wait until blocks beyond the consumer
+/// index of the mapped ring have been received
+NTSTATUS EngineRingRelease(IN XDMA_ENGINE *engine, IN LARGE_INTEGER timeout);
+
+/// Lock a user buffer of the calling process and map it for dma in the direction of the engine,
+/// once for all transfers on it. Must be called in the context of that process at PASSIVE_LEVEL.
+/// handle receives the handle of the registration.
+NTSTATUS EngineRegisterBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN UINT64 address,
+                              IN size_t length, OUT ULONG* handle);
+
+/// Unregister a buffer. It is unmapped and unlocked once its last transfer has completed.
+NTSTATUS EngineUnregisterBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG handle);
+
+/// Unregister all buffers of an owner (file cleanup)
+VOID EngineUnregisterBuffers(IN XDMA_ENGINE* engine, IN PVOID owner);
+
+/// Reference a registered buffer of an owner for a transfer
+NTSTATUS EngineReferenceBuffer(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG handle,
+                               OUT XDMA_REGISTERED_BUFFER** buffer);
+
+/// Drop a reference taken by EngineReferenceBuffer()
+VOID EngineReleaseBuffer(IN XDMA_ENGINE* engine, IN XDMA_REGISTERED_BUFFER* buffer);
+
+/// Build the descriptors of a transfer on a registered buffer from its mapping and queue them.
+/// The request has been marked cancelable; the transfer holds a reference of the buffer.
+VOID EngineProgramRegistered(IN XDMA_ENGINE* engine, IN XDMA_TRANSFER* transfer);
+
+/// Build a stored program for a vector of a registered buffer of an owner, at PASSIVE_LEVEL.
+/// The program takes over the reference of the buffer (see EngineReferenceBuffer()) and drops it
+/// when it is deleted, also if the creation fails. id receives its id.
+NTSTATUS EngineProgramCreate(IN XDMA_ENGINE* engine, IN PVOID owner,
+                             IN XDMA_REGISTERED_BUFFER* buffer, IN const XDMA_IO_VECTOR* vector,
+                             OUT ULONG* id);
+
+/// Delete a program. A run in flight completes first.
+NTSTATUS EngineProgramDelete(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id);
+
+/// Delete all programs of an owner (file cleanup)
+VOID EngineProgramDeleteAll(IN XDMA_ENGINE* engine, IN PVOID owner);
+
+/// Run a program once more. Fails with STATUS_DEVICE_BUSY while it is queued or running.
+NTSTATUS EngineProgramRun(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id);
+
+/// Let a user event run a program (XDMA_PROGRAM_NO_EVENT: no longer)
+NTSTATUS EngineProgramBind(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id, IN ULONG eventId);
+
+/// Run the program bound to a user event - called by the user interrupt dpc
+VOID EngineProgramEvent(IN XDMA_PROGRAM* program, IN ULONG eventId);
+
+/// Wait until a program has completed a number of runs and return its counters
+NTSTATUS EngineProgramWait(IN XDMA_ENGINE* engine, IN PVOID owner, IN ULONG id, IN UINT64 runs,
+                           IN LARGE_INTEGER timeout, OUT XDMA_PROGRAM_STATUS* counters);
\ No newline at end of file
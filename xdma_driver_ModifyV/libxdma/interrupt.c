@@ -298,7 +298,7 @@ static NTSTATUS CountInterruptResources(IN WDFCMRESLIST ResourcesTranslated,
             return STATUS_DEVICE_CONFIGURATION_ERROR;
         }
 
-        // ԴһжԴ
+        // 表明该资源是一个中断资源
         if (resource->Type == CmResourceTypeInterrupt) {
             (*numInterruptResources)++;
         }
@@ -306,7 +306,7 @@ static NTSTATUS CountInterruptResources(IN WDFCMRESLIST ResourcesTranslated,
     return STATUS_SUCCESS;
 }
 
-// ====================== line/msi жϻص ===================================
+// ====================== line/msi 中断回调函数 ===================================
 
 NTSTATUS EvtInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
     UNREFERENCED_PARAMETER(device);
@@ -331,7 +331,7 @@ NTSTATUS EvtInterruptDisable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
 }
 
 BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
-// жϷ - handle line interrupts
+// 中断服务例程 - handle line interrupts
 {
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
     UINT32 chIrq = 0;
@@ -374,7 +374,7 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
 }
 
 VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
-// ӳжϷ
+// 延迟中断服务处理程序
 {
     UNREFERENCED_PARAMETER(device);
     PIRQ_CONTEXT irq = GetIrqContext(interrupt);
@@ -397,6 +397,10 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
         XDMA_EVENT* userEvent = &irq->xdma->userEvents[i];
         if (irq->userIrqPending & BIT_N(i)) {
+            XDMA_PROGRAM* program = userEvent->program;
+            if (program != NULL) { // start the dma before anything else
+                EngineProgramEvent(program, i);
+            }
             if (userEvent->work != NULL) {
                 userEvent->work(i, userEvent->userData);
             }
@@ -423,7 +427,7 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     return;
 }
 
-// ====================== MSI-X жϻص ======================================
+// ====================== MSI-X 中断回调函数 ======================================
 
 NTSTATUS EvtChannelInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
     UNREFERENCED_PARAMETER(device);
@@ -444,7 +448,7 @@ NTSTATUS EvtChannelInterruptDisable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE devi
 }
 
 BOOLEAN EvtChannelInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
-// жϷ -  msi/msi-x ж
+// 中断服务例程 - 仅处理 msi/msi-x 中断
 {
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
 
@@ -459,7 +463,7 @@ BOOLEAN EvtChannelInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
 }
 
 VOID EvtChannelInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
-// ӳжϷ
+// 延迟中断服务处理程序
 {
     UNREFERENCED_PARAMETER(device);
     PIRQ_CONTEXT irq = GetIrqContext(interrupt);
@@ -512,6 +516,12 @@ VOID EvtUserInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     XDMA_EVENT* userEvent = &irq->xdma->userEvents[irq->eventId];
     EXPECT(userEvent != NULL);
 
+    // start the dma before anything else
+    XDMA_PROGRAM* program = userEvent->program;
+    if (program != NULL) {
+        EngineProgramEvent(program, irq->eventId);
+    }
+
     // message id and event id are same
     if (userEvent->work != NULL) {
         TraceInfo(DBG_IRQ, "event_%d executing work handler", irq->eventId);
@@ -524,7 +534,7 @@ VOID EvtUserInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     WdfInterruptReleaseLock(interrupt);
 }
 
-// ====================== ڲ API ʵ ==============================================
+// ====================== 内部 API 实现 ==============================================
 
 NTSTATUS SetupInterrupts(IN PXDMA_DEVICE xdma,
                          IN WDFCMRESLIST ResourcesRaw,
@@ -557,7 +567,7 @@ NTSTATUS SetupInterrupts(IN PXDMA_DEVICE xdma,
     return status;
 }
 
-// ==============================  API ʵ =======================================
+// ============================== 公共 API 实现 =======================================
 
 NTSTATUS XDMA_UserIsrRegister(PXDMA_DEVICE xdma, ULONG eventId, PFN_XDMA_USER_WORK handler,
                               void* userData) {
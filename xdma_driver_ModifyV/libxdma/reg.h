@@ -87,8 +87,22 @@
 #define XDMA_DESC_STOP_BIT                  (BIT_N(0))
 #define XDMA_DESC_COMPLETED_BIT             (BIT_N(1))
 #define XDMA_DESC_EOP_BIT                   (BIT_N(4))
+#define XDMA_DESC_ADJ_SHIFT                 (8)
+#define XDMA_DESC_ADJ_MASK                  (0x3FUL << XDMA_DESC_ADJ_SHIFT)
+#define XDMA_DESC_MAGIC                     (0xAD4B0000UL)
+#define XDMA_DESC_MAGIC_MASK                (0xFFFF0000UL)
 
+// the SGDMA descriptor credits register takes 10 bits - a write adds at most this many credits
+#define XDMA_DESC_CREDITS_MAX               (0x3FFUL)
+
+// bits of the streaming C2H dma result status field
 #define XDMA_RESULT_EOP_BIT                 (BIT_N(0))
+#define XDMA_RESULT_MAGIC                   (0x52B40000UL)
+#define XDMA_RESULT_MAGIC_MASK              (0xFFFF0000UL)
+
+// bits of the poll mode writeback
+#define XDMA_WB_COUNT_MASK                  (0x00ffffffUL)
+#define XDMA_WB_ERR_MASK                    (BIT_N(31))
 
 // Engine performance control register bits
 #define XDMA_PERF_RUN                       BIT_N(0)
@@ -134,7 +148,7 @@ typedef struct {
 
 } XDMA_ENGINE_REGS;
 
-/// IRQĴ (0x2000)
+/// IRQ块寄存器 (0x2000)
 typedef struct {
     UINT32 identifier;
     UINT32 userIntEnable;
@@ -157,7 +171,7 @@ typedef struct {
 
 } XDMA_IRQ_REGS;
 
-/// ÿĴ (0x3000)
+/// 配置块寄存器 (0x3000)
 typedef struct {
     UINT32 identifier;
     UINT32 busDev;
@@ -199,6 +213,41 @@ typedef struct {
     UINT32 creditModeEnableW1C; // 0x28
 } XDMA_SGDMA_COMMON_REGS, *PXDMA_SGDMA_COMMON_REGS;
 
+/// \brief Descriptor for a single contiguous memory block transfer.
+///
+/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the 
+/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
+/// bytes in the 32-bit words must be in little-endian byte ordering.
+typedef struct xdma_descriptor_t {
+    UINT32 control;
+    UINT32 numBytes;  // transfer length in bytes
+    UINT32 srcAddrLo; // source address (low 32-bit)
+    UINT32 srcAddrHi; // source address (high 32-bit)
+    UINT32 dstAddrLo; // destination address (low 32-bit)
+    UINT32 dstAddrHi; // destination address (high 32-bit)
+                      // next descriptor in the single-linked list of descriptors, 
+                      // this is the bus address of the next descriptor in the root complex memory.
+    UINT32 nextLo;    // next desc address (low 32-bit)
+    UINT32 nextHi;    // next desc address (high 32-bit)
+} DMA_DESCRIPTOR;
+
+/// Result buffer of the streaming DMA operation. 
+/// The XDMA IP core writes the result of the DMA transfer to the host memory
+typedef struct {
+    UINT32 status;
+    UINT32 length;
+    UINT32 reserved_1[6]; // padding
+} DMA_RESULT;
+
+/// \brief Structure for polled mode descriptor writeback
+///
+/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
+/// poll to detect transfer completion
+typedef struct {
+    UINT32 completedDescCount;
+    UINT32 reserved_1[7];
+} XDMA_POLL_WB;
+
 #pragma pack()
 
 
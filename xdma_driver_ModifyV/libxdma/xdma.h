@@ -37,12 +37,15 @@
  * \param xdma          [IN]        The XDMA device context
  * \param ResourcesRaw  [IN]        List of PCIe resources assigned to this device
  * \param ResourcesTranslated [IN]  List of PCIe resources assigned to this device
+ * \param maxTransferSize [IN]      Max length of a single dma transfer in bytes, 0 for the default
+ *                                  (XDMA_MAX_TRANSFER_SIZE). Longer requests are split into stages.
  * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions. 
  */
 NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
                          PXDMA_DEVICE xdma,
                          WDFCMRESLIST ResourcesRaw,
-                         WDFCMRESLIST ResourcesTranslated);
+                         WDFCMRESLIST ResourcesTranslated,
+                         size_t maxTransferSize);
 
 /**
  * \brief Close and cleanup the XDMA device.
@@ -84,17 +87,89 @@ NTSTATUS XDMA_UserIsrDisable(PXDMA_DEVICE xdma, ULONG eventId);
  * \brief OS callback function for programming the XDMA engine
  * \param Transaction    [IN]        The WDFDMATRANSACTION handle
  * \param Device         [IN]        The WDFDEVICE handle
- * \param Context        [IN]        The XDMA engine context
+ * \param Context        [IN]        The XDMA_TRANSFER of the engine pipeline
  * \param Direction      [IN]        Data transaction direction. H2C=WdfDmaDirectionToDevice. C2H=WdfDmaDirectionFromDevice
  * \param SgList         [IN]        The Scatter-Gather list describing the Host-side memory.
  * \return TRUE on success, else FALSE
  */
 EVT_WDF_PROGRAM_DMA XDMA_EngineProgramDma;
 
+/**
+ * \brief OS callback function for posting the buffer of a read request to an AXI-ST C2H engine in
+ *        posted receive mode. The buffer takes a ring slot (descriptor) per scatter gather element
+ *        and is completed once the engine has written all of them.
+ * \param Transaction    [IN]        The WDFDMATRANSACTION handle
+ * \param Device         [IN]        The WDFDEVICE handle
+ * \param Context        [IN]        The XDMA_RX_POST of the engine
+ * \param Direction      [IN]        Data transaction direction, always WdfDmaDirectionFromDevice
+ * \param SgList         [IN]        The Scatter-Gather list describing the Host-side memory.
+ * \return TRUE on success, else FALSE
+ */
+EVT_WDF_PROGRAM_DMA XDMA_EngineProgramRxPost;
+
 /**
  * \brief Select between polling and interrupts as a mechanism for determining dma transfer 
  *        completion on a per DMA engine basis.
  * \param engine        [IN]        The DMA engine context
  * \param pollMode      [IN]        true = use polling, false = use interrupts
  */
-void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
\ No newline at end of file
+void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
+
+/**
+ * \brief Select the dma transfer completion mechanism of a DMA engine: interrupts, polling or
+ *        hybrid. In hybrid mode the writeback is polled for as long as the completion of the
+ *        current run is expected to take (based on its length and recent completion times, at
+ *        most maxSpinUs), then the channel interrupt is armed.
+ *        The channel interrupt mask is left to the caller. Fails with STATUS_DEVICE_BUSY while
+ *        requests are in flight. AXI-ST C2H engines support interrupts and polling only.
+ * \param engine        [IN]        The DMA engine context
+ * \param mode          [IN]        XDMA_COMPLETION_MODE_INTERRUPT, _POLL or _HYBRID
+ * \param maxSpinUs     [IN]        Max spin per run in hybrid mode in microseconds
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions.
+ */
+NTSTATUS XDMA_EngineSetCompletionMode(XDMA_ENGINE* engine, ULONG mode, ULONG maxSpinUs);
+
+/**
+ * \brief Start a driver-owned thread which services all engines in poll mode round-robin. Requests
+ *        and AXI-ST C2H rings of these engines are completed by this thread instead of spinning in
+ *        the thread that issued them. Engines switched to poll mode later are serviced as well.
+ * \param xdma          [IN]        The XDMA device context
+ * \param affinity      [IN]        Processors the thread may run on, 0 = any
+ * \param idleSpinUs    [IN]        Keep spinning this long after the last work before waiting
+ * \param idleWaitUs    [IN]        Timeout of an idle wait, 0 = wait until new work is submitted
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions.
+ */
+NTSTATUS XDMA_PollerStart(PXDMA_DEVICE xdma, KAFFINITY affinity, ULONG idleSpinUs, ULONG idleWaitUs);
+
+/**
+ * \brief Stop the poller thread. Does nothing if it is not running. Called by XDMA_DeviceClose().
+ * \param xdma          [IN]        The XDMA device context
+ */
+void XDMA_PollerStop(PXDMA_DEVICE xdma);
+
+/**
+ * \brief Set the number of requests which may be in flight on a DMA engine. Each request gets its
+ *        own descriptor segment, queued requests are linked into a single run of the engine.
+ *        Must be called before the engine queue is created. On AXI-ST C2H engines the depth
+ *        limits the read buffers posted at a time in posted receive mode.
+ * \param engine        [IN]        The DMA engine context
+ * \param depth         [IN]        Max number of requests in flight (1-XDMA_MAX_QUEUE_DEPTH)
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions.
+ */
+NTSTATUS XDMA_EngineSetQueueDepth(XDMA_ENGINE* engine, ULONG depth);
+
+/**
+ * \brief Set the geometry of the AXI-ST C2H ring: the number of blocks and the size of each block,
+ *        and the memory type of the blocks.
+ *        Each block takes a descriptor and a DMA_RESULT, the ring holds numBlocks * blockSize bytes.
+ *        Must be called before the engine queue is created. Has no effect on other engines.
+ * \param engine        [IN]        The DMA engine context
+ * \param numBlocks     [IN]        Number of blocks (XDMA_RING_MIN_BLOCKS-XDMA_RING_MAX_BLOCKS)
+ * \param blockSize     [IN]        Bytes per block, a multiple of PAGE_SIZE
+ *                                  (XDMA_RING_MIN_BLOCK_SIZE-XDMA_RING_MAX_BLOCK_SIZE)
+ * \param memory        [IN]        XDMA_RING_MEMORY_*. Cached memory falls back to non-cached on
+ *                                  platforms where dma does not snoop the processor caches.
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions.
+ */
+NTSTATUS XDMA_EngineSetRingGeometry(XDMA_ENGINE* engine, ULONG numBlocks, ULONG blockSize,
+                                    ULONG memory);
\ No newline at end of file
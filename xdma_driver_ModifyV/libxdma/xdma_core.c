@@ -0,0 +1,953 @@
+/*
+* XDMA Descriptor and Ring Core
+* =============================
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include "xdma_core.h"
+
+// streaming loads need SSE4.1, which the x64 kernel may use without saving the extended state
+#if defined(_M_AMD64) || defined(__x86_64__)
+#define XDMA_STREAMING_LOADS
+#include <smmintrin.h>
+#endif
+
+// ========================= descriptor functions =================================================
+
+UINT32 DescAdjMax(IN UINT32 mrrsBytes) {
+    const UINT32 adjMax = mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
+
+    // a 4KB MRRS would allow 127 adjacent descriptors, but the adj fields are only 6 bits wide
+    return adjMax < XDMA_DESC_ADJ_MAX ? adjMax : XDMA_DESC_ADJ_MAX;
+}
+
+BOOLEAN DescriptorIsAligned(IN const XDMA_DESC_PARAMS* params, IN UINT64 hostAddr,
+                            IN UINT64 deviceAddr, IN UINT32 numBytes)
+// For alignment requirements see product guide [1] page 23 table 2-9
+{
+    if (params->addressMode == AddressMode_Fixed) {
+        const UINT64 addrMask = params->dataPathWidth - 1;
+
+        // todo length alignment requirement??
+        return (hostAddr & addrMask) == (deviceAddr & addrMask);
+
+    } else { // AddressMode_Contiguous (i.e. incremental mode)
+        const UINT64 addrMask = params->alignAddr - 1;
+        const UINT32 lengthMask = params->alignLength - 1;
+
+        // AXI-ST engines have no device address (C2H ring descriptors carry the result address)
+        if (params->type == EngineType_ST) {
+            deviceAddr = 0;
+        }
+        return ((hostAddr | deviceAddr) & addrMask) == 0 && (numBytes & lengthMask) == 0;
+    }
+}
+
+void DescChainInit(OUT XDMA_DESC_CHAIN* chain, IN const XDMA_DESC_PARAMS* params,
+                   IN DMA_DESCRIPTOR* desc, IN UINT64 descLA, IN ULONG capacity) {
+    chain->params = params;
+    chain->desc = desc;
+    chain->descLA = descLA;
+    chain->capacity = capacity;
+    chain->count = 0;
+    chain->misaligned = 0;
+}
+
+BOOLEAN DescChainAppend(IN OUT XDMA_DESC_CHAIN* chain, IN DirToDev dir, IN UINT64 hostAddr,
+                        IN UINT64 deviceAddr, IN UINT32 numBytes, IN UINT32 control) {
+    if (chain->count >= chain->capacity) {
+        return FALSE;
+    }
+
+    DMA_DESCRIPTOR* desc = &chain->desc[chain->count];
+    const UINT64 srcAddr = (dir == H2C) ? hostAddr : deviceAddr;
+    const UINT64 dstAddr = (dir == H2C) ? deviceAddr : hostAddr;
+    const UINT64 nextLA = chain->descLA + (chain->count + 1) * sizeof(DMA_DESCRIPTOR);
+
+    desc->control = XDMA_DESC_MAGIC | control;
+    desc->numBytes = numBytes;
+    desc->srcAddrLo = (UINT32)LIMIT_TO_32(srcAddr);
+    desc->srcAddrHi = (UINT32)LIMIT_TO_32(srcAddr >> 32);
+    desc->dstAddrLo = (UINT32)LIMIT_TO_32(dstAddr);
+    desc->dstAddrHi = (UINT32)LIMIT_TO_32(dstAddr >> 32);
+
+    // link to the next slot, fixed up by DescChainClose()/DescChainMakeCircular() for the last one
+    desc->nextLo = (UINT32)LIMIT_TO_32(nextLA);
+    desc->nextHi = (UINT32)LIMIT_TO_32(nextLA >> 32);
+
+    if (!DescriptorIsAligned(chain->params, hostAddr, deviceAddr, numBytes)) {
+        chain->misaligned++;
+    }
+
+    chain->count++;
+    return TRUE;
+}
+
+ULONG DescChainAppendSg(IN OUT XDMA_DESC_CHAIN* chain, IN DirToDev dir,
+                        IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                        IN UINT64 deviceAddr) {
+    const BOOLEAN incrementDeviceAddr = chain->params->addressMode == AddressMode_Contiguous;
+    const UINT64 maxBytes = XDMA_DESC_MAX_BYTES & ~(UINT64)(chain->params->alignLength - 1);
+    ULONG i = 0;
+
+    while (i < numElements) {
+        const UINT64 hostAddr = (UINT64)elements[i].Address.QuadPart;
+        UINT64 numBytes = elements[i].Length;
+        ULONG next = i + 1;
+
+        // merge the following elements as long as they continue this one in host memory. only the
+        // start address and total length of a descriptor are subject to the alignment rules.
+        while ((next < numElements) &&
+               ((UINT64)elements[next].Address.QuadPart == hostAddr + numBytes) &&
+               (numBytes + elements[next].Length <= maxBytes)) {
+            numBytes += elements[next].Length;
+            next++;
+        }
+
+        if (!DescChainAppend(chain, dir, hostAddr, deviceAddr, (UINT32)numBytes, 0)) {
+            break;
+        }
+        if (incrementDeviceAddr) {
+            deviceAddr += numBytes;
+        }
+        i = next;
+    }
+    return i;
+}
+
+void DescChainClose(IN OUT XDMA_DESC_CHAIN* chain, IN UINT32 lastControl) {
+    if (chain->count == 0) {
+        return;
+    }
+    DMA_DESCRIPTOR* last = &chain->desc[chain->count - 1];
+    last->nextLo = 0;
+    last->nextHi = 0;
+    last->control |= lastControl;
+}
+
+void DescChainMakeCircular(IN OUT XDMA_DESC_CHAIN* chain) {
+    if (chain->count == 0) {
+        return;
+    }
+    DMA_DESCRIPTOR* last = &chain->desc[chain->count - 1];
+    last->nextLo = (UINT32)LIMIT_TO_32(chain->descLA);
+    last->nextHi = (UINT32)LIMIT_TO_32(chain->descLA >> 32);
+}
+
+UINT32 DescChainOptimize(IN OUT XDMA_DESC_CHAIN* chain)
+    // Optimize descriptors for PCIe block fetches.
+    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
+    // by the device. This is achieved as follows:
+    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is
+    //        specified by writing to engine->sgdma->firstDescAdj register.
+    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
+    //        additional (adjacent) descriptors in the control->nextAdj field
+    // There are several factors which limit the amount of descriptors which can be fetched together:
+    //      1. The PCIe Max Read Request Size
+    //      2. The physical address of the descriptors within a block must not cross a 4K address
+    //         boundary
+    //      3. The number of descriptors remaining in the transfer
+    // The last descriptor of a circular chain (see DescChainMakeCircular()) starts the next lap with
+    // the same fetch as the first one.
+{
+    DMA_DESCRIPTOR* const desc = chain->desc;
+    const ULONG numDesc = chain->count;
+    if (numDesc == 0) {
+        return 0;
+    }
+
+    const ULONG adjMax = chain->params->adjMax;
+    const ULONG adjTotal = numDesc - 1;
+    const ULONG adjTo4k = (0x1000 - (ULONG)(chain->descLA & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
+
+    // the number of adjacent descriptors for the first fetch
+    ULONG firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
+    if (firstAdj > adjTo4k) {
+        firstAdj = adjTo4k;
+    }
+
+    // set the number of adjacent descriptors for subsequent fetches
+    ULONG nextAdjMax = adjMax - 1;
+    for (ULONG i = 0; i < numDesc; i++) {
+        // if not last desc then get total desc adj to next desc, else last desc has no next desc
+        const ULONG nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
+        const ULONG nextAdjTo4k = (0x1000 - (desc[i].nextLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
+
+        ULONG nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
+        if (nextAdj > nextAdjTo4k) {
+            nextAdj = nextAdjTo4k;
+        }
+        if ((i == adjTotal) && ((((UINT64)desc[i].nextHi << 32) | desc[i].nextLo) == chain->descLA)) {
+            nextAdj = firstAdj;
+        }
+
+        desc[i].control = (desc[i].control & ~XDMA_DESC_ADJ_MASK) | (nextAdj << XDMA_DESC_ADJ_SHIFT);
+
+        // update current max adj count for this block
+        if (nextAdjMax != 0) {
+            nextAdjMax--;
+        } else { // wrap-around
+            nextAdjMax = adjMax;
+        }
+    }
+    return firstAdj;
+}
+
+void DescLink(IN OUT DMA_DESCRIPTOR* last, IN UINT64 nextDescLA, IN UINT32 nextAdj) {
+    // the last descriptor of a chain always ends a fetch block, so the engine takes the next fetch
+    // address and size from it
+    last->nextLo = (UINT32)LIMIT_TO_32(nextDescLA);
+    last->nextHi = (UINT32)LIMIT_TO_32(nextDescLA >> 32);
+    last->control = (last->control & ~(XDMA_DESC_ADJ_MASK | XDMA_DESC_STOP_BIT)) |
+        (nextAdj << XDMA_DESC_ADJ_SHIFT);
+}
+
+void DescUnlink(IN OUT DMA_DESCRIPTOR* last) {
+    last->nextLo = 0;
+    last->nextHi = 0;
+    last->control = (last->control & ~XDMA_DESC_ADJ_MASK) | XDMA_DESC_STOP_BIT;
+}
+
+static void DescListInit(OUT XDMA_DESC_LIST* list) {
+    list->count = 0;
+    list->segments = 0;
+    list->misaligned = 0;
+    list->firstAdj = 0;
+    list->last = NULL;
+}
+
+// close the chain of a segment and append it to the list
+static void DescListAddChain(IN OUT XDMA_DESC_LIST* list, IN OUT XDMA_DESC_CHAIN* chain,
+                             IN UINT32 lastControl) {
+    DescChainClose(chain, lastControl);
+    const UINT32 firstAdj = DescChainOptimize(chain);
+    if (list->last != NULL) {
+        DescLink(list->last, chain->descLA, firstAdj);
+    } else {
+        list->firstAdj = firstAdj;
+    }
+
+    list->last = &chain->desc[chain->count - 1];
+    list->count += chain->count;
+    list->misaligned += chain->misaligned;
+    list->segments++;
+}
+
+ULONG DescStoreBuildSg(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                       IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                       IN ULONG numElements, IN UINT64 deviceAddr, IN UINT32 lastControl,
+                       OUT XDMA_DESC_LIST* list) {
+    ULONG i = 0;
+
+    DescListInit(list);
+
+    for (ULONG s = 0; (s < store->numSegments) && (i < numElements); s++) {
+        XDMA_DESC_CHAIN chain;
+        DescChainInit(&chain, params, store->desc[s], store->descLA[s], store->segmentCapacity);
+        const ULONG appended = DescChainAppendSg(&chain, dir, &elements[i], numElements - i,
+                                                 deviceAddr);
+        if (appended == 0) {
+            break;
+        }
+        i += appended;
+
+        // the device address only needs to be tracked if the list continues in the next segment
+        if ((i < numElements) && (params->addressMode == AddressMode_Contiguous)) {
+            for (ULONG k = i - appended; k < i; k++) {
+                deviceAddr += elements[k].Length;
+            }
+        }
+
+        DescListAddChain(list, &chain, (i == numElements) ? lastControl : 0);
+    }
+    return i;
+}
+
+static ULONG DescStoreBuildRanges(IN const XDMA_DESC_STORE* store,
+                                  IN const XDMA_DESC_PARAMS* params, IN DirToDev dir,
+                                  IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                                  IN const XDMA_DESC_PACKET* packets,
+                                  IN const XDMA_DESC_VECTOR* vectors,
+                                  IN const XDMA_DESC_STRIDE* stride, IN ULONG numRanges,
+                                  IN UINT32 lastControl, OUT XDMA_DESC_LIST* list,
+                                  OUT ULONG* packetEnds)
+// a descriptor per physically contiguous piece of each range of the buffer - the packets of a
+// gather send, which end with the end-of-packet flag, or the vectors of a vectored transfer or the
+// rows of a strided one, which give the card address of each piece
+{
+    const UINT64 maxBytes = XDMA_DESC_MAX_BYTES & ~(UINT64)(params->alignLength - 1);
+    ULONG p = 0;
+
+    DescListInit(list);
+    if (store->numSegments == 0) {
+        return 0;
+    }
+
+    XDMA_DESC_CHAIN chain;
+    ULONG segment = 0;
+    DescChainInit(&chain, params, store->desc[0], store->descLA[0], store->segmentCapacity);
+
+    ULONG first = 0;            // element of the packet start
+    UINT64 firstOffset = 0;     // buffer offset of that element
+    for (; p < numRanges; ++p) {
+        const UINT64 start = packets ? packets[p].offset : vectors ? vectors[p].offset :
+                             stride->offset + (UINT64)p * stride->hostPitch;
+        const UINT32 length = packets ? packets[p].length : vectors ? vectors[p].length :
+                              stride->rowBytes;
+        const UINT64 end = start + length;
+
+        // packets usually follow each other - search on from the element of the previous one
+        if (start < firstOffset) {
+            first = 0;
+            firstOffset = 0;
+        }
+        while ((first < numElements) && (start >= firstOffset + elements[first].Length)) {
+            firstOffset += elements[first].Length;
+            first++;
+        }
+
+        // a descriptor per element of the packet at most - all of them must fit into the store
+        ULONG last = first;
+        UINT64 lastOffset = firstOffset;
+        while ((last < numElements) && (end > lastOffset + elements[last].Length)) {
+            lastOffset += elements[last].Length;
+            last++;
+        }
+        if ((length == 0) || (last >= numElements)) {
+            break;
+        }
+        const ULONG numFree = (chain.capacity - chain.count) +
+                           (store->numSegments - 1 - segment) * store->segmentCapacity;
+        if (last - first + 1 > numFree) {
+            break;
+        }
+
+        ULONG e = first;
+        UINT64 elementOffset = firstOffset;
+        UINT64 offset = start;
+        while (offset < end) {
+            // the rest of the packet in this element, merged with the following elements as long
+            // as they continue it in host memory
+            const UINT64 hostAddr = (UINT64)elements[e].Address.QuadPart + (offset - elementOffset);
+            UINT64 deviceAddr = vectors ? vectors[p].deviceAddr :
+                                stride ? stride->deviceAddr + p * stride->devicePitch : 0;
+            if (!packets && (params->addressMode == AddressMode_Contiguous)) {
+                deviceAddr += offset - start;
+            }
+            UINT64 numBytes = 0;
+            while ((offset < end) && (e < numElements) &&
+                   ((numBytes == 0) ||
+                    ((UINT64)elements[e].Address.QuadPart == hostAddr + numBytes))) {
+                const UINT64 elementEnd = elementOffset + elements[e].Length;
+                const UINT64 chunk = (end < elementEnd ? end : elementEnd) - offset;
+                if ((numBytes > 0) && (numBytes + chunk > maxBytes)) {
+                    break;
+                }
+                numBytes += chunk;
+                offset += chunk;
+                if (offset == elementEnd) {
+                    elementOffset = elementEnd;
+                    e++;
+                }
+            }
+
+            if (chain.count == chain.capacity) { // continue in the next segment
+                DescListAddChain(list, &chain, 0);
+                segment++;
+                DescChainInit(&chain, params, store->desc[segment], store->descLA[segment],
+                              store->segmentCapacity);
+            }
+            DescChainAppend(&chain, dir, hostAddr, deviceAddr, (UINT32)numBytes,
+                            (packets && (offset == end)) ? XDMA_DESC_EOP_BIT : 0);
+        }
+        if (packetEnds != NULL) {
+            packetEnds[p] = list->count + chain.count;
+        }
+
+        first = e < numElements ? e : first;
+        firstOffset = e < numElements ? elementOffset : firstOffset;
+    }
+
+    if (chain.count > 0) {
+        DescListAddChain(list, &chain, lastControl);
+    }
+    return p;
+}
+
+ULONG DescStoreBuildPackets(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                            IN const XDMA_DESC_PACKET* packets, IN ULONG numPackets,
+                            IN UINT32 lastControl, OUT XDMA_DESC_LIST* list,
+                            OUT ULONG* packetEnds) {
+    return DescStoreBuildRanges(store, params, H2C, elements, numElements, packets, NULL, NULL,
+                                numPackets, lastControl, list, packetEnds);
+}
+
+ULONG DescStoreBuildVectors(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                            IN ULONG numElements, IN const XDMA_DESC_VECTOR* vectors,
+                            IN ULONG numVectors, IN UINT32 lastControl,
+                            OUT XDMA_DESC_LIST* list) {
+    return DescStoreBuildRanges(store, params, dir, elements, numElements, NULL, vectors, NULL,
+                                numVectors, lastControl, list, NULL);
+}
+
+ULONG DescStoreBuildStrided(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                            IN ULONG numElements, IN const XDMA_DESC_STRIDE* stride,
+                            IN UINT32 lastControl, OUT XDMA_DESC_LIST* list) {
+    // densely packed rows on both sides are one range - a descriptor per page, not per row
+    const UINT64 numBytes = (UINT64)stride->rows * stride->rowBytes;
+    if ((stride->rows > 1) && (stride->hostPitch == stride->rowBytes) &&
+        (stride->devicePitch == stride->rowBytes) && (numBytes <= 0xFFFFFFFFULL)) {
+        XDMA_DESC_STRIDE merged = *stride;
+        merged.rows = 1;
+        merged.rowBytes = (UINT32)numBytes;
+        return DescStoreBuildRanges(store, params, dir, elements, numElements, NULL, NULL,
+                                    &merged, 1, lastControl, list, NULL) ? stride->rows : 0;
+    }
+    return DescStoreBuildRanges(store, params, dir, elements, numElements, NULL, NULL, stride,
+                                stride->rows, lastControl, list, NULL);
+}
+
+UINT64 DescStoreBuildFill(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                          IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                          IN UINT64 deviceAddr, IN UINT64 numBytes, IN UINT32 lastControl,
+                          OUT XDMA_DESC_LIST* list) {
+    UINT64 covered = 0;
+
+    DescListInit(list);
+    if ((store->numSegments == 0) || (numElements == 0)) {
+        return 0;
+    }
+
+    XDMA_DESC_CHAIN chain;
+    ULONG segment = 0;
+    DescChainInit(&chain, params, store->desc[0], store->descLA[0], store->segmentCapacity);
+
+    while (covered < numBytes) {
+        // a descriptor per element of the copy - all of them must fit into the store
+        const ULONG numFree = (chain.capacity - chain.count) +
+                              (store->numSegments - 1 - segment) * store->segmentCapacity;
+        if (numElements > numFree) {
+            break;
+        }
+        for (ULONG e = 0; (e < numElements) && (covered < numBytes); ++e) {
+            const UINT64 rest = numBytes - covered;
+            const UINT32 length = (rest < elements[e].Length) ? (UINT32)rest : elements[e].Length;
+            if (chain.count == chain.capacity) { // continue in the next segment
+                DescListAddChain(list, &chain, 0);
+                segment++;
+                DescChainInit(&chain, params, store->desc[segment], store->descLA[segment],
+                              store->segmentCapacity);
+            }
+            DescChainAppend(&chain, H2C, (UINT64)elements[e].Address.QuadPart,
+                            (params->addressMode == AddressMode_Contiguous) ? deviceAddr + covered :
+                            deviceAddr, length, 0);
+            covered += length;
+        }
+    }
+
+    if (chain.count > 0) {
+        DescListAddChain(list, &chain, lastControl);
+    }
+    return covered;
+}
+
+// ========================= cyclic send ===========================================================
+
+UINT64 LoopSlotStart(IN const ULONG* slotEnds, IN ULONG numSlots, IN UINT64 slot) {
+    const UINT64 lap = slot / numSlots;
+    const ULONG index = (ULONG)(slot % numSlots);
+    return lap * slotEnds[numSlots - 1] + (index > 0 ? slotEnds[index - 1] : 0);
+}
+
+UINT64 LoopSlotsDone(IN const ULONG* slotEnds, IN ULONG numSlots, IN UINT64 descDone) {
+    const UINT64 lapDescriptors = slotEnds[numSlots - 1];
+    const ULONG rest = (ULONG)(descDone % lapDescriptors);
+
+    // slots of the current lap whose last descriptor has been sent - slotEnds is ascending
+    ULONG low = 0;
+    ULONG high = numSlots;
+    while (low < high) {
+        const ULONG mid = low + (high - low) / 2;
+        if (slotEnds[mid] <= rest) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (descDone / lapDescriptors) * numSlots + low;
+}
+
+// ========================= completion spin budget ===============================================
+
+static UINT64 SpinKB(IN UINT64 numBytes) {
+    const UINT64 kb = (numBytes + 1023) / 1024;
+    return kb ? kb : 1;
+}
+
+void SpinEstimateInit(OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 maxSpinNs) {
+    est->maxSpinNs = maxSpinNs;
+    est->nsPerKB8 = 0;
+    est->skipped = 0;
+}
+
+UINT64 SpinBudgetNs(IN OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 numBytes) {
+    if (est->maxSpinNs == 0) {
+        return 0;
+    }
+
+    const UINT64 expected = (est->nsPerKB8 * SpinKB(numBytes)) / 8;
+    if (expected > est->maxSpinNs) {
+        if (++est->skipped < XDMA_SPIN_PROBE_INTERVAL) {
+            return 0;
+        }
+        est->skipped = 0;
+        return est->maxSpinNs; // probe
+    }
+
+    const UINT64 budget = expected + expected / 2 + XDMA_SPIN_MIN_NS;
+    return budget < est->maxSpinNs ? budget : est->maxSpinNs;
+}
+
+void SpinEstimateUpdate(IN OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 numBytes, IN UINT64 elapsedNs,
+                        IN BOOLEAN completed) {
+    const UINT64 sample8 = (elapsedNs * (completed ? 8 : 16)) / SpinKB(numBytes);
+
+    if (est->nsPerKB8 == 0) { // first sample
+        est->nsPerKB8 = sample8;
+    } else { // avg += (sample - avg) / 8
+        est->nsPerKB8 = est->nsPerKB8 - est->nsPerKB8 / 8 + sample8 / 8;
+    }
+}
+
+// ========================= ring functions =======================================================
+
+UINT32 RingCompletedBlocks(IN OUT UINT32* last, IN UINT32 completed) {
+    const UINT32 numCompleted = (completed - *last) & XDMA_WB_COUNT_MASK;
+    *last = completed & XDMA_WB_COUNT_MASK;
+    return numCompleted;
+}
+
+UINT RingProcessResults(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* tail,
+                        IN UINT numReceived) {
+    UINT eopCount = 0;
+    UINT index = *tail;
+    UINT ahead = index;
+    UINT numAhead = 0;
+
+    // the results are in dma coherent memory - have the first misses in flight together
+    for (; (numAhead < numReceived) && (numAhead < XDMA_RING_PREFETCH_RESULTS); numAhead++) {
+        PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &results[ahead]);
+        RingAdvance(&ahead, numBlocks);
+    }
+
+    for (UINT i = 0; i < numReceived; i++) {
+        if (numAhead < numReceived) {
+            PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, &results[ahead]);
+            RingAdvance(&ahead, numBlocks);
+            numAhead++;
+        }
+
+        // the engine writes the result before it counts the descriptor
+        ASSERT((results[index].status & XDMA_RESULT_MAGIC_MASK) == XDMA_RESULT_MAGIC);
+        if (results[index].status & XDMA_RESULT_EOP_BIT) {
+            eopCount++;
+        }
+
+        // mark current dma result as processed - the flags stay for a consumer of the mapped ring
+        results[index].status &= ~XDMA_RESULT_MAGIC_MASK;
+        RingAdvance(&index, numBlocks);
+    }
+
+    *tail = index;
+    return eopCount;
+}
+
+NTSTATUS RingCopyBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                        IN UINT tail, IN size_t length, IN PFN_XDMA_RING_COPY copy, IN PVOID ctx,
+                        OUT size_t* bytesCopied, OUT UINT32* blocksConsumed) {
+    UINT index = *head;
+    size_t offset = 0;
+    UINT32 numBlocksProcessed = 0;
+
+    while ((index != tail) && (offset < length)) {
+
+        // limit to the space left in the destination
+        size_t numBytesReceived = results[index].length;
+        if (numBytesReceived == 0) {
+            break;
+        } else if (numBytesReceived > length - offset) {
+            numBytesReceived = length - offset;
+        }
+
+        NTSTATUS status = copy(ctx, offset, index, numBytesReceived);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        numBlocksProcessed++;
+        offset += numBytesReceived;
+
+        results[index].status = 0;
+        results[index].length = 0;
+        RingAdvance(&index, numBlocks);
+    }
+
+    *head = index;
+    *bytesCopied = offset;
+    *blocksConsumed = numBlocksProcessed;
+    return STATUS_SUCCESS;
+}
+
+// blocks of the packet starting at 'index' among the 'available' received blocks: up to its
+// end-of-packet block, or all of them if none ends it
+static UINT RingPacketBlocks(IN const DMA_RESULT* results, IN UINT numBlocks, IN UINT index,
+                             IN UINT available, OUT size_t* numBytes, OUT BOOLEAN* eop) {
+    UINT count = 0;
+    *numBytes = 0;
+    *eop = FALSE;
+    while ((count < available) && !*eop) {
+        *numBytes += results[index].length;
+        *eop = (results[index].status & XDMA_RESULT_EOP_BIT) != 0;
+        count++;
+        RingAdvance(&index, numBlocks);
+    }
+    return count;
+}
+
+NTSTATUS RingCopyPackets(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                         IN UINT tail, IN size_t length, IN UINT32 firstFlags,
+                         IN const UINT64* timestamps, IN PFN_XDMA_RING_COPY copy,
+                         IN PFN_XDMA_RING_STORE store, IN PVOID ctx, OUT size_t* bytesWritten,
+                         OUT UINT32* numPackets, OUT UINT32* blocksConsumed, OUT BOOLEAN* more) {
+    // both entry types start alike and are powers of two, which the table is aligned to
+    const size_t entrySize = timestamps ? sizeof(XDMA_RING_PACKET_TS) : sizeof(XDMA_RING_PACKET);
+    const size_t dataOffset = sizeof(XDMA_RING_BATCH);
+    if (length < ((dataOffset + entrySize - 1) & ~(entrySize - 1)) + entrySize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    // pick the packets which fit - the table goes behind the data, so its place is known only then
+    UINT index = *head;
+    UINT available = (tail + numBlocks - *head) % numBlocks;
+    UINT32 count = 0;
+    UINT32 numBlocksTaken = 0;
+    size_t dataBytes = 0;
+    size_t lastBytes = 0;       // of the last entry, less than its blocks hold if truncated
+    BOOLEAN truncated = FALSE;
+    *more = FALSE;
+    while ((available > 0) && !truncated) {
+        size_t packetBytes;
+        BOOLEAN eop;
+        const UINT packetBlocks = RingPacketBlocks(results, numBlocks, index, available,
+                                                   &packetBytes, &eop);
+        if (!eop && (packetBlocks < numBlocks - 1)) {
+            break; // the engine can still end it
+        }
+
+        const size_t tableOffset = (dataOffset + dataBytes + packetBytes + entrySize - 1)
+                                   & ~(entrySize - 1);
+        if (tableOffset + (count + 1) * entrySize > length) {
+            if (count > 0) {
+                *more = TRUE;
+                break;
+            }
+            packetBytes = ((length - entrySize) & ~(entrySize - 1)) - dataOffset;
+            truncated = TRUE;
+        }
+
+        count++;
+        numBlocksTaken += packetBlocks;
+        dataBytes += packetBytes;
+        lastBytes = packetBytes;
+        available -= packetBlocks;
+        for (UINT i = 0; i < packetBlocks; ++i) {
+            RingAdvance(&index, numBlocks);
+        }
+    }
+    const size_t tableOffset = (dataOffset + dataBytes + entrySize - 1) & ~(entrySize - 1);
+
+    // copy the data and write the table
+    NTSTATUS status = STATUS_SUCCESS;
+    index = *head;
+    available = numBlocksTaken;
+    size_t offset = dataOffset;
+    for (UINT32 n = 0; (n < count) && NT_SUCCESS(status); ++n) {
+        XDMA_RING_PACKET_TS entry;
+        size_t packetBytes;
+        BOOLEAN eop;
+        const UINT packetBlocks = RingPacketBlocks(results, numBlocks, index, available,
+                                                   &packetBytes, &eop);
+        size_t left = (n == count - 1) ? lastBytes : packetBytes;
+        entry.length = (UINT32)left;
+        entry.flags = eop ? XDMA_RING_PACKET_EOP : XDMA_RING_PACKET_OVERFLOW;
+        if ((n == count - 1) && truncated) {
+            entry.flags |= XDMA_RING_PACKET_TRUNCATED;
+        }
+        if (n == 0) {
+            entry.flags |= firstFlags;
+        }
+
+        for (UINT i = 0; i < packetBlocks; ++i) {
+            const size_t numBytes = results[index].length < left ? results[index].length : left;
+            if ((numBytes > 0) && NT_SUCCESS(status)) {
+                status = copy(ctx, offset, index, numBytes);
+            }
+            if (timestamps != NULL) {
+                entry.timestamp = timestamps[index]; // ends up with the last block
+            }
+            offset += numBytes;
+            left -= numBytes;
+            RingAdvance(&index, numBlocks);
+        }
+        available -= packetBlocks;
+
+        if (NT_SUCCESS(status)) {
+            status = store(ctx, tableOffset + n * entrySize, &entry, entrySize);
+        }
+    }
+    if (NT_SUCCESS(status)) {
+        XDMA_RING_BATCH batch;
+        batch.numPackets = count;
+        batch.tableOffset = (UINT32)tableOffset;
+        status = store(ctx, 0, &batch, sizeof(batch));
+    }
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // hand the blocks back
+    index = *head;
+    for (UINT32 i = 0; i < numBlocksTaken; ++i) {
+        results[index].status = 0;
+        results[index].length = 0;
+        RingAdvance(&index, numBlocks);
+    }
+
+    *head = index;
+    *bytesWritten = tableOffset + count * entrySize;
+    *numPackets = count;
+    *blocksConsumed = numBlocksTaken;
+    return STATUS_SUCCESS;
+}
+
+UINT32 RingReleaseBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                         IN UINT tail, IN UINT consumer) {
+    // the consumer index comes from the process - it may only move across received blocks
+    const UINT received = (tail + numBlocks - *head) % numBlocks;
+    if ((consumer >= numBlocks) || ((consumer + numBlocks - *head) % numBlocks > received)) {
+        return 0;
+    }
+
+    UINT32 numBlocksReleased = 0;
+    for (UINT index = *head; index != consumer; RingAdvance(&index, numBlocks)) {
+        results[index].status = 0;
+        results[index].length = 0;
+        numBlocksReleased++;
+    }
+
+    *head = consumer;
+    return numBlocksReleased;
+}
+
+UINT32 RingDropBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                      IN UINT tail, IN UINT32 minBlocks, IN OUT UINT64* numBytes) {
+    const UINT received = (tail + numBlocks - *head) % numBlocks;
+    if (minBlocks > received) {
+        minBlocks = received;
+    }
+    if (minBlocks == 0) {
+        return 0;
+    }
+
+    // the rest of the packet, if its end has been received
+    UINT32 numDropped = minBlocks;
+    UINT index = (*head + minBlocks - 1) % numBlocks;
+    for (UINT32 n = minBlocks; !(results[index].status & XDMA_RESULT_EOP_BIT) && (n < received); ) {
+        RingAdvance(&index, numBlocks);
+        n++;
+        if (results[index].status & XDMA_RESULT_EOP_BIT) {
+            numDropped = n;
+        }
+    }
+
+    index = *head;
+    for (UINT32 i = 0; i < numDropped; ++i) {
+        *numBytes += results[index].length;
+        results[index].status = 0;
+        results[index].length = 0;
+        RingAdvance(&index, numBlocks);
+    }
+    *head = index;
+    return numDropped;
+}
+
+BOOLEAN RingStreamingCopySupported(void) {
+#ifdef XDMA_STREAMING_LOADS
+    return ExIsProcessorFeaturePresent(PF_SSE4_1_INSTRUCTIONS_AVAILABLE) ? TRUE : FALSE;
+#else
+    return FALSE;
+#endif
+}
+
+XDMA_TARGET_SSE41 void RingCopyStreaming(OUT VOID* dst, IN const VOID* src, IN size_t numBytes) {
+#ifdef XDMA_STREAMING_LOADS
+    __m128i* from = (__m128i*)src;
+    UCHAR* to = (UCHAR*)dst;
+
+    // the streaming load buffers must not hand out lines read before the engine wrote the block
+    _mm_mfence();
+
+    // a cache line per round - the four loads are served by one fill of the buffer
+    for (; numBytes >= 64; numBytes -= 64, from += 4, to += 64) {
+        const __m128i x0 = _mm_stream_load_si128(from);
+        const __m128i x1 = _mm_stream_load_si128(from + 1);
+        const __m128i x2 = _mm_stream_load_si128(from + 2);
+        const __m128i x3 = _mm_stream_load_si128(from + 3);
+        _mm_storeu_si128((__m128i*)to, x0);
+        _mm_storeu_si128((__m128i*)(to + 16), x1);
+        _mm_storeu_si128((__m128i*)(to + 32), x2);
+        _mm_storeu_si128((__m128i*)(to + 48), x3);
+    }
+    for (; numBytes >= 16; numBytes -= 16, from++, to += 16) {
+        _mm_storeu_si128((__m128i*)to, _mm_stream_load_si128(from));
+    }
+    if (numBytes > 0) {
+        RtlCopyMemory(to, from, numBytes);
+    }
+#else
+    RtlCopyMemory(dst, src, numBytes);
+#endif
+}
+
+// ========================= posted receive functions =============================================
+
+UINT RingPostSg(IN OUT DMA_DESCRIPTOR* desc, IN UINT numSlots, IN OUT UINT* next, IN UINT freeSlots,
+                IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements, IN UINT32 control) {
+    // whole pages per slot, so that a split element does not break the engine alignment
+    const UINT32 maxSlotBytes = XDMA_DESC_MAX_BYTES & ~(PAGE_SIZE - 1);
+
+    UINT slotsNeeded = 0;
+    for (ULONG i = 0; i < numElements; ++i) {
+        slotsNeeded += (elements[i].Length + maxSlotBytes - 1) / maxSlotBytes;
+    }
+    if ((slotsNeeded == 0) || (slotsNeeded > freeSlots)) {
+        return 0;
+    }
+
+    UINT index = *next;
+    for (ULONG i = 0; i < numElements; ++i) {
+        UINT64 addr = (UINT64)elements[i].Address.QuadPart;
+        UINT32 remaining = elements[i].Length;
+        while (remaining > 0) {
+            const UINT32 numBytes = remaining < maxSlotBytes ? remaining : maxSlotBytes;
+
+            // C2H: the destination is host memory, the source address points to the dma result
+            DMA_DESCRIPTOR* slot = &desc[index];
+            slot->dstAddrLo = (UINT32)LIMIT_TO_32(addr);
+            slot->dstAddrHi = (UINT32)LIMIT_TO_32(addr >> 32);
+            slot->numBytes = numBytes;
+            slot->control = XDMA_DESC_MAGIC | control;
+
+            addr += numBytes;
+            remaining -= numBytes;
+            RingAdvance(&index, numSlots);
+        }
+    }
+
+    *next = index;
+    return slotsNeeded;
+}
+
+UINT RingCollectResults(IN OUT DMA_RESULT* results, IN UINT numSlots, IN OUT UINT* tail,
+                        IN UINT maxSlots, IN OUT size_t* numBytes, OUT BOOLEAN* eop) {
+    UINT index = *tail;
+    UINT numCollected = 0;
+
+    *eop = FALSE;
+    while ((numCollected < maxSlots) &&
+           ((results[index].status & XDMA_RESULT_MAGIC_MASK) == XDMA_RESULT_MAGIC)) {
+        *numBytes += results[index].length;
+        *eop = (results[index].status & XDMA_RESULT_EOP_BIT) != 0;
+
+        results[index].status = 0;
+        results[index].length = 0;
+        numCollected++;
+        RingAdvance(&index, numSlots);
+    }
+
+    *tail = index;
+    return numCollected;
+}
+
+// ========================= ring credits =========================================================
+
+UINT32 RingCreditsInit(OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks) {
+    credits->numBlocks = numBlocks;
+    credits->maxBatch = (numBlocks - 1) / 4 ? (numBlocks - 1) / 4 : 1;
+    credits->lowWater = (numBlocks - 1) / 8;
+    credits->batch = 1;
+    credits->granted = (LONG)(numBlocks - 1); // a full ring would look empty (head == tail)
+    credits->received = 0;
+    credits->consumed = 0;
+    return numBlocks - 1;
+}
+
+void RingCreditsReceived(IN OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks) {
+    RingWriteRelease(&credits->received, credits->received + numBlocks);
+}
+
+void RingCreditsFreed(IN OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks) {
+    RingWriteRelease(&credits->consumed, credits->consumed + numBlocks);
+}
+
+static void RingCreditsCount(IN const XDMA_RING_CREDITS* credits, IN UINT32 granted,
+                             OUT UINT32* held, OUT UINT32* freed) {
+    const INT32 engine = (INT32)(granted - RingReadAcquire(&credits->received));
+    const INT32 waiting = (INT32)(RingReadAcquire(&credits->consumed) + credits->numBlocks - 1
+                                  - granted);
+
+    // a count read before a newer grant may lag behind it
+    *held = engine > 0 ? (UINT32)engine : 0;
+    *freed = waiting > 0 ? (UINT32)waiting : 0;
+}
+
+void RingCreditsGet(IN const XDMA_RING_CREDITS* credits, OUT UINT32* held, OUT UINT32* freed) {
+    RingCreditsCount(credits, (UINT32)ReadLongAcquire(&credits->granted), held, freed);
+}
+
+UINT32 RingCreditsTake(IN OUT XDMA_RING_CREDITS* credits) {
+    MemoryBarrier();
+    for (;;) {
+        const LONG granted = ReadLongAcquire(&credits->granted);
+        UINT32 held, freed;
+        RingCreditsCount(credits, (UINT32)granted, &held, &freed);
+        if (freed == 0) {
+            return 0;
+        }
+
+        const UINT32 batch = ReadULongNoFence((volatile ULONG*)&credits->batch);
+        if ((held > credits->lowWater) && (freed < batch)) {
+            return 0;
+        }
+        if (InterlockedCompareExchange(&credits->granted, (LONG)((UINT32)granted + freed), granted)
+            != granted) {
+            continue; // granted by the other side meanwhile
+        }
+
+        if (held == 0) { // the batch kept the engine waiting - halve it
+            WriteULongNoFence((volatile ULONG*)&credits->batch, batch / 2 ? batch / 2 : 1);
+        } else if ((held > credits->lowWater) && (batch < credits->maxBatch)) {
+            // the engine kept up - try a larger batch
+            WriteULongNoFence((volatile ULONG*)&credits->batch, batch + 1);
+        }
+        return freed;
+    }
+}
@@ -0,0 +1,431 @@
+/*
+* XDMA Descriptor and Ring Core
+* =============================
+*
+* OS-independent part of libxdma: construction of SGDMA descriptor chains, PCIe fetch optimization
+* and the accounting of the AXI-ST C2H ring. Nothing in here touches registers, WDF objects or
+* memory managers - the callers in dma_engine.c pass in virtual/bus addresses of the buffers and
+* the engine properties captured at initialization, and write the results to the hardware.
+*
+* This allows the hot paths to be compiled outside of the WDK (XDMA_PORTABLE, see sim/Makefile)
+* and measured against the behavioral model.
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_platform.h"
+#include "reg.h"
+
+// ========================= constants ============================================================
+
+/// Bytes per data beat for a given config block pcieWidth encoding (0=64bit, 1=128bit, ...)
+#define XDMA_DATA_PATH_BYTES(pcieWidth)     ((1UL << (6 + (pcieWidth))) / 8)
+
+/// PCIe max read request size in bytes for a given config block pcieMRRS encoding (0=128B, ...)
+#define XDMA_MRRS_BYTES(pcieMRRS)           (1UL << ((pcieMRRS) + 7))
+
+/// Largest adjacent descriptor count which fits into the firstDescAdj register/nextAdj field
+#define XDMA_DESC_ADJ_MAX                   (XDMA_DESC_ADJ_MASK >> XDMA_DESC_ADJ_SHIFT)
+
+/// Largest transfer length of a single descriptor (28 bit length field, see [1] table 2-9)
+#define XDMA_DESC_MAX_BYTES                 (0x0FFFFFFFUL)
+
+/// Shortest spin of the hybrid completion mode - covers the fixed latency of a run
+#define XDMA_SPIN_MIN_NS                    (2000ULL)
+
+/// Runs not expected to complete within the max spin go to the interrupt directly, except for
+/// every XDMA_SPIN_PROBE_INTERVAL-th one which spins to re-learn the completion time
+#define XDMA_SPIN_PROBE_INTERVAL            (64UL)
+
+/// Dma results of the ring prefetched ahead of the one being processed
+#define XDMA_RING_PREFETCH_RESULTS          (8U)
+
+/// Flags of a packet table entry (XDMA_RING_PACKET.flags) - same values as XDMA_RX_PACKET_*
+#define XDMA_RING_PACKET_EOP                (0x1UL) // the packet ends with this entry
+#define XDMA_RING_PACKET_TRUNCATED          (0x2UL) // the rest of the entry did not fit, dropped
+#define XDMA_RING_PACKET_OVERFLOW           (0x4UL) // piece of a packet which filled the whole ring
+#define XDMA_RING_PACKET_DISCONTINUITY      (0x8UL) // blocks before this entry were dropped
+
+// ========================= type declarations ====================================================
+
+/// Direction of the DMA transfer/engine
+typedef enum DirToDev_t {
+    H2C = 0, // Host-to-Card - write to device
+    C2H = 1  // Card-to-Host - read from device
+} DirToDev;
+
+/// Engine address mode.
+/// Determines how the DMA engine interprets the device address (destination address on H2C and
+/// source address on C2H).
+/// When AddressMode_Contiguous is chosen, the device address only needs to be set for the first
+/// descriptor and the engine assumes that all subsequent descriptors device addresses follow
+/// sequentially.
+/// When AddressMode_Fixed is selected, the device addresses of each descriptor must be explicitly
+/// set.
+typedef enum AddressMode_T {
+    AddressMode_Contiguous,  // incremental
+    AddressMode_Fixed,       // non-incremental
+} AddressMode;
+
+typedef enum EngineType_t {
+    EngineType_MM,      // Memory Mapped
+    EngineType_ST,      // Streaming
+} EngineType;
+
+/// Engine properties which govern descriptor construction.
+/// Captured once at engine creation, so that building descriptors needs no register reads.
+typedef struct XDMA_DESC_PARAMS_T {
+    EngineType type;
+    AddressMode addressMode;
+    UINT32 alignAddr;       // required address alignment in bytes (power of 2)
+    UINT32 alignLength;     // required length granularity in bytes (power of 2)
+    UINT32 dataPathWidth;   // bytes per data beat, relevant for the fixed address mode
+    UINT32 adjMax;          // max adjacent descriptors per fetch as limited by the PCIe MRRS
+} XDMA_DESC_PARAMS;
+
+/// A chain of descriptors under construction in a (common) buffer
+typedef struct XDMA_DESC_CHAIN_T {
+    const XDMA_DESC_PARAMS* params;
+    DMA_DESCRIPTOR* desc;   // virtual address of the first descriptor
+    UINT64 descLA;          // bus address of the first descriptor
+    ULONG capacity;         // max number of descriptors in the chain
+    ULONG count;            // number of descriptors appended so far
+    ULONG misaligned;       // number of descriptors violating the engine alignment requirements
+} XDMA_DESC_CHAIN;
+
+/// Descriptor memory made of equally sized segments (e.g. separate common buffers). A list which
+/// does not fit into one segment continues in the next one.
+typedef struct XDMA_DESC_STORE_T {
+    ULONG numSegments;
+    ULONG segmentCapacity;      // descriptors per segment
+    DMA_DESCRIPTOR** desc;      // virtual address of each segment
+    const UINT64* descLA;       // bus address of each segment
+} XDMA_DESC_STORE;
+
+/// A descriptor list built in a store
+typedef struct XDMA_DESC_LIST_T {
+    ULONG count;                // number of descriptors
+    ULONG segments;             // number of segments used
+    ULONG misaligned;           // number of descriptors violating the engine alignment requirements
+    UINT32 firstAdj;            // value for the firstDescAdj register
+    DMA_DESCRIPTOR* last;       // last descriptor of the list
+} XDMA_DESC_LIST;
+
+/// A packet of a gather send: 'length' bytes at 'offset' of the buffer - same layout as
+/// XDMA_TX_PACKET
+typedef struct XDMA_DESC_PACKET_T {
+    UINT32 offset;
+    UINT32 length;
+} XDMA_DESC_PACKET;
+
+/// A piece of a vectored transfer: 'length' bytes at 'offset' of the buffer to or from card
+/// address 'deviceAddr' - same layout as XDMA_IO_VECTOR
+typedef struct XDMA_DESC_VECTOR_T {
+    UINT32 offset;
+    UINT32 length;
+    UINT64 deviceAddr;
+} XDMA_DESC_VECTOR;
+
+/// The rows of a strided (2D) transfer: 'rows' rows of 'rowBytes' bytes, the first one at 'offset'
+/// of the buffer and at card address 'deviceAddr', each further one 'hostPitch' bytes on in the
+/// buffer and 'devicePitch' bytes on in card memory - same layout as XDMA_IO_STRIDE
+typedef struct XDMA_DESC_STRIDE_T {
+    UINT32 offset;
+    UINT32 hostPitch;
+    UINT32 rows;
+    UINT32 rowBytes;
+    UINT64 deviceAddr;
+    UINT64 devicePitch;
+} XDMA_DESC_STRIDE;
+
+/// Completion time estimate of an engine for the hybrid (spin, then interrupt) completion mode.
+/// Updated without locking by whoever waits - a lost sample does no harm.
+typedef struct XDMA_SPIN_ESTIMATE_T {
+    UINT64 maxSpinNs;       // upper bound of a spin
+    UINT64 nsPerKB8;        // moving average of the completion time per KB of a run, times 8
+    ULONG skipped;          // runs handed to the interrupt without spinning since the last probe
+} XDMA_SPIN_ESTIMATE;
+
+/// Descriptor credit accounting of the AXI-ST C2H ring. Consumers free blocks as they go, the
+/// credits are granted to the engine in batches (see RingCreditsTake()). The batch grows while the
+/// engine keeps enough credits and shrinks when it runs dry, so that the credit register is written
+/// rarely without stalling the stream.
+/// Shared without a lock: the counts run freely and wrap around. The producer of the ring (which
+/// scans the dma results) only writes 'received', its consumer only 'consumed'; either side may
+/// grant. Each count is on a cache line of its own.
+typedef struct XDMA_RING_CREDITS_T {
+    UINT32 numBlocks;
+    UINT32 maxBatch;
+    UINT32 lowWater;                // grant right away once the engine holds this few credits
+    volatile UINT32 batch;          // freed blocks collected before a grant - a hint, not ordered
+    DECLSPEC_CACHEALIGN volatile LONG granted; // credits granted, including the initial ones
+    DECLSPEC_CACHEALIGN volatile UINT received; // blocks received - written by the producer
+    DECLSPEC_CACHEALIGN volatile UINT consumed; // blocks consumed - written by the consumer
+} XDMA_RING_CREDITS;
+
+/// Copy numBytes of the ring block 'block' to 'offset' of the consumer's destination
+typedef NTSTATUS(*PFN_XDMA_RING_COPY)(IN PVOID ctx, IN size_t offset, IN UINT block,
+                                      IN size_t numBytes);
+
+/// Store numBytes from src at 'offset' of the consumer's destination
+typedef NTSTATUS(*PFN_XDMA_RING_STORE)(IN PVOID ctx, IN size_t offset, IN const VOID* src,
+                                       IN size_t numBytes);
+
+/// Header of a packet batch (see RingCopyPackets()) - same layout as XDMA_RX_BATCH
+typedef struct XDMA_RING_BATCH_T {
+    UINT32 numPackets;
+    UINT32 tableOffset;     // of the packet table, the data starts right after the header
+} XDMA_RING_BATCH;
+
+/// Packet table entry of a batch - same layout as XDMA_RX_PACKET
+typedef struct XDMA_RING_PACKET_T {
+    UINT32 length;          // bytes of the packet in the batch
+    UINT32 flags;           // XDMA_RING_PACKET_*
+} XDMA_RING_PACKET;
+
+/// Packet table entry of a batch with timestamps - same layout as XDMA_RX_PACKET_TS
+typedef struct XDMA_RING_PACKET_TS_T {
+    UINT32 length;
+    UINT32 flags;
+    UINT64 timestamp;       // of the last block of the entry
+} XDMA_RING_PACKET_TS;
+
+// ========================= function declarations ================================================
+
+/// Max number of adjacent descriptors per fetch for a given max read request size
+UINT32 DescAdjMax(IN UINT32 mrrsBytes);
+
+/// Check a transfer element against the engine alignment requirements
+BOOLEAN DescriptorIsAligned(IN const XDMA_DESC_PARAMS* params, IN UINT64 hostAddr,
+                            IN UINT64 deviceAddr, IN UINT32 numBytes);
+
+/// Start an empty chain at the given descriptor buffer location
+void DescChainInit(OUT XDMA_DESC_CHAIN* chain, IN const XDMA_DESC_PARAMS* params,
+                   IN DMA_DESCRIPTOR* desc, IN UINT64 descLA, IN ULONG capacity);
+
+/// Append a descriptor. The descriptor points to the next slot of the buffer until the chain is
+/// closed. Returns FALSE if the chain is full.
+BOOLEAN DescChainAppend(IN OUT XDMA_DESC_CHAIN* chain, IN DirToDev dir, IN UINT64 hostAddr,
+                        IN UINT64 deviceAddr, IN UINT32 numBytes, IN UINT32 control);
+
+/// Append the scatter gather elements, starting at device address deviceAddr. Physically
+/// contiguous elements are coalesced into a single descriptor of up to XDMA_DESC_MAX_BYTES
+/// (rounded down to the length granularity of the engine).
+/// Returns the number of elements appended.
+ULONG DescChainAppendSg(IN OUT XDMA_DESC_CHAIN* chain, IN DirToDev dir,
+                        IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                        IN UINT64 deviceAddr);
+
+/// Terminate the chain: clear the next pointer of the last descriptor and set lastControl on it
+void DescChainClose(IN OUT XDMA_DESC_CHAIN* chain, IN UINT32 lastControl);
+
+/// Terminate the chain by linking the last descriptor back to the first one
+void DescChainMakeCircular(IN OUT XDMA_DESC_CHAIN* chain);
+
+/// Set the nextAdj fields for PCIe block fetches. Returns the value for the firstDescAdj register.
+UINT32 DescChainOptimize(IN OUT XDMA_DESC_CHAIN* chain);
+
+/// Continue a closed chain, whose last descriptor is 'last', with the chain at nextDescLA instead of
+/// stopping. nextAdj is the first fetch adjacent count of that chain (see DescChainOptimize()).
+void DescLink(IN OUT DMA_DESCRIPTOR* last, IN UINT64 nextDescLA, IN UINT32 nextAdj);
+
+/// Undo DescLink(): make 'last' the end of its chain again
+void DescUnlink(IN OUT DMA_DESCRIPTOR* last);
+
+/// Build a single descriptor list for a scatter gather list in a store, starting at device address
+/// deviceAddr. Each segment is closed and optimized as a chain of its own and linked to the next
+/// one, lastControl is set on the last descriptor of the list.
+/// Returns the number of elements appended (less than numElements if the store is full).
+ULONG DescStoreBuildSg(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                       IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                       IN ULONG numElements, IN UINT64 deviceAddr, IN UINT32 lastControl,
+                       OUT XDMA_DESC_LIST* list);
+
+/// Build a single AXI-ST H2C descriptor list for a list of packets within the buffer described by a
+/// scatter gather list. Each packet takes one descriptor per physically contiguous piece, its last
+/// one carries the end-of-packet flag; lastControl is set on the last descriptor of the list.
+/// If packetEnds is not NULL, it receives the number of descriptors of the list up to the end of
+/// each packet appended.
+/// Returns the number of packets appended (less than numPackets if the store is full or a packet is
+/// empty or exceeds the buffer).
+ULONG DescStoreBuildPackets(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                            IN const XDMA_DESC_PACKET* packets, IN ULONG numPackets,
+                            IN UINT32 lastControl, OUT XDMA_DESC_LIST* list,
+                            OUT ULONG* packetEnds);
+
+/// Build a single AXI-MM descriptor list for the vectors of a vectored transfer within the buffer
+/// described by a scatter gather list. Each vector takes one descriptor per physically contiguous
+/// piece, at the card address of the vector plus the offset of the piece (the card address itself
+/// in AddressMode_Fixed); lastControl is set on the last descriptor of the list.
+/// Returns the number of vectors appended (less than numVectors if the store is full or a vector is
+/// empty or exceeds the buffer).
+ULONG DescStoreBuildVectors(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                            IN ULONG numElements, IN const XDMA_DESC_VECTOR* vectors,
+                            IN ULONG numVectors, IN UINT32 lastControl,
+                            OUT XDMA_DESC_LIST* list);
+
+/// Build a single AXI-MM descriptor list for the rows of a strided transfer within the buffer
+/// described by a scatter gather list, like DescStoreBuildVectors() with a vector per row. Rows that
+/// follow each other both in the buffer and in card memory (both pitches equal the row length) are
+/// merged into one range.
+/// Returns the number of rows appended (less than stride->rows if the store is full or a row
+/// exceeds the buffer).
+ULONG DescStoreBuildStrided(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                            IN DirToDev dir, IN const SCATTER_GATHER_ELEMENT* elements,
+                            IN ULONG numElements, IN const XDMA_DESC_STRIDE* stride,
+                            IN UINT32 lastControl, OUT XDMA_DESC_LIST* list);
+
+/// Build a single AXI-MM H2C descriptor list that fills numBytes of card memory from deviceAddr with
+/// copies of the pattern described by a scatter gather list. All copies source the same pattern
+/// memory, a descriptor per element and copy; the last copy is cut short at numBytes. Only whole
+/// copies are appended, so a fill that does not fit into the store continues with the pattern in
+/// phase in a list built at deviceAddr plus the bytes covered.
+/// Returns the number of bytes of card memory covered (less than numBytes if the store is full).
+UINT64 DescStoreBuildFill(IN const XDMA_DESC_STORE* store, IN const XDMA_DESC_PARAMS* params,
+                          IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements,
+                          IN UINT64 deviceAddr, IN UINT64 numBytes, IN UINT32 lastControl,
+                          OUT XDMA_DESC_LIST* list);
+
+/// Descriptors a cyclic send (a packet list linked into a circle, see DescStoreBuildPackets()) has
+/// to send before it starts slot 'slot', counting slots across laps. slotEnds holds the packet ends
+/// of the list (ascending, the last one is the length of a lap).
+UINT64 LoopSlotStart(IN const ULONG* slotEnds, IN ULONG numSlots, IN UINT64 slot);
+
+/// Slots of a cyclic send completely sent after descDone descriptors, counting across laps
+UINT64 LoopSlotsDone(IN const ULONG* slotEnds, IN ULONG numSlots, IN UINT64 descDone);
+
+/// Start without completion time samples, spinning up to maxSpinNs
+void SpinEstimateInit(OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 maxSpinNs);
+
+/// How long to spin for the completion of a run of numBytes: the expected completion time with
+/// some margin, capped at the max spin. 0 if the run is expected to take longer than the max spin,
+/// i.e. the interrupt should be armed right away.
+UINT64 SpinBudgetNs(IN OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 numBytes);
+
+/// Add the completion time of a run found while spinning. If the spin was given up (completed is
+/// FALSE) elapsedNs is only a lower bound, which is weighted up so that the estimate can outgrow the
+/// max spin.
+void SpinEstimateUpdate(IN OUT XDMA_SPIN_ESTIMATE* est, IN UINT64 numBytes, IN UINT64 elapsedNs,
+                        IN BOOLEAN completed);
+
+/// Read a ring position published by the other side of the ring. Acquire: the blocks and results
+/// it covers are seen as the other side left them.
+static FORCEINLINE UINT RingReadAcquire(IN const volatile UINT* position) {
+    return (UINT)ReadULongAcquire((const volatile ULONG*)position);
+}
+
+/// Publish a ring position to the other side of the ring. Release: the blocks and results it covers
+/// are left behind before the other side sees the position.
+static FORCEINLINE void RingWriteRelease(OUT volatile UINT* position, IN UINT value) {
+    WriteULongRelease((volatile ULONG*)position, (ULONG)value);
+}
+
+/// Advance a ring index by one block with wrap-around
+static FORCEINLINE void RingAdvance(IN OUT UINT* index, IN UINT numBlocks) {
+    if (*index == numBlocks - 1) { // wrap-around
+        *index = 0;
+    } else { // normal increment
+        ++(*index);
+    }
+}
+
+/// Blocks completed by the engine since the completed descriptor count *last, which is advanced to
+/// completed. The count wraps at XDMA_WB_COUNT_MASK.
+UINT32 RingCompletedBlocks(IN OUT UINT32* last, IN UINT32 completed);
+
+/// Mark the dma results of the next numReceived blocks from *tail - the blocks the completed
+/// descriptor count advanced by, see RingCompletedBlocks() - as processed and advance *tail past
+/// them. Only these results are read, prefetched ahead; their status is only checked by debug
+/// builds. The length and the end-of-packet flag of the results are kept until the blocks are
+/// consumed. Returns the number of results carrying the end-of-packet flag.
+UINT RingProcessResults(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* tail,
+                        IN UINT numReceived);
+
+/// Hand the received blocks between *head and tail to the copy callback, up to length bytes.
+/// On success *head is advanced past the consumed blocks, *bytesCopied and *blocksConsumed (the
+/// descriptor credits to return) are set. On failure of the copy callback its status is returned
+/// and the outputs are left untouched.
+NTSTATUS RingCopyBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                        IN UINT tail, IN size_t length, IN PFN_XDMA_RING_COPY copy, IN PVOID ctx,
+                        OUT size_t* bytesCopied, OUT UINT32* blocksConsumed);
+
+/// Copy whole packets out of the received blocks between *head and tail as a batch of up to length
+/// bytes: an XDMA_RING_BATCH header, the data of the packets back to back, then the packet table
+/// (aligned to its entries). A packet which has not ended yet is left in the ring, unless it fills
+/// the whole ring - then its blocks are returned as a piece flagged XDMA_RING_PACKET_OVERFLOW. The
+/// first entry of a batch is truncated to the length if necessary, a later one which does not fit
+/// is left for the next batch (*more is set).
+/// On success *head is advanced past the consumed blocks, *bytesWritten, *numPackets and
+/// *blocksConsumed (the descriptor credits to return) are set. On failure of a callback its status
+/// is returned and the ring is left untouched. STATUS_BUFFER_TOO_SMALL if length cannot hold a
+/// header and one (aligned) table entry. firstFlags are added to the flags of the first entry.
+/// With timestamps (one per block) the entries are XDMA_RING_PACKET_TS, each with the timestamp of
+/// its last block, otherwise XDMA_RING_PACKET.
+NTSTATUS RingCopyPackets(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                         IN UINT tail, IN size_t length, IN UINT32 firstFlags,
+                         IN const UINT64* timestamps, IN PFN_XDMA_RING_COPY copy,
+                         IN PFN_XDMA_RING_STORE store, IN PVOID ctx, OUT size_t* bytesWritten,
+                         OUT UINT32* numPackets, OUT UINT32* blocksConsumed, OUT BOOLEAN* more);
+
+/// Release the blocks a consumer of the mapped ring has processed in place: all blocks from *head up
+/// to the consumer index. Their results are cleared and *head is set to consumer.
+/// Returns the number of blocks released (the descriptor credits to return), 0 if the consumer index
+/// is outside of the received blocks.
+UINT32 RingReleaseBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                         IN UINT tail, IN UINT consumer);
+
+/// Drop the oldest received blocks (drop-oldest overrun policy): minBlocks from *head on, and on up
+/// to the end of the packet the last of them belongs to if it has been received, so that the ring
+/// starts with a packet again. Their results are cleared, the bytes they held are added to
+/// *numBytes and *head is advanced past them. Returns the number of blocks dropped (the descriptor
+/// credits to return).
+UINT32 RingDropBlocks(IN OUT DMA_RESULT* results, IN UINT numBlocks, IN OUT UINT* head,
+                      IN UINT tail, IN UINT32 minBlocks, IN OUT UINT64* numBytes);
+
+/// TRUE if the processor can run RingCopyStreaming() with streaming loads (SSE4.1 on x64)
+BOOLEAN RingStreamingCopySupported(void);
+
+/// Copy numBytes of a ring block to dst with streaming loads, which read write-combined memory a
+/// cache line at a time instead of a load at a time. src must be 16 byte aligned. x64 callers must
+/// check RingStreamingCopySupported() first, other builds get a plain copy.
+void RingCopyStreaming(OUT VOID* dst, IN const VOID* src, IN size_t numBytes);
+
+/// Point the slots of a circular chain (see DescChainMakeCircular()) from *next on at the scatter
+/// gather elements of a receive buffer posted by a user (AXI-ST C2H). The link and the dma result
+/// address of each slot are kept, elements longer than a descriptor take several slots. Nothing is
+/// written if the buffer takes more than freeSlots slots.
+/// Returns the number of slots used (the descriptor credits to grant), *next is advanced past them.
+UINT RingPostSg(IN OUT DMA_DESCRIPTOR* desc, IN UINT numSlots, IN OUT UINT* next, IN UINT freeSlots,
+                IN const SCATTER_GATHER_ELEMENT* elements, IN ULONG numElements, IN UINT32 control);
+
+/// Collect the dma results of up to maxSlots posted slots the engine has written since *tail.
+/// Their lengths are added to *numBytes, *eop is set to the end-of-packet flag of the last one.
+/// The results are cleared and *tail is advanced past them. Returns the number of slots collected.
+UINT RingCollectResults(IN OUT DMA_RESULT* results, IN UINT numSlots, IN OUT UINT* tail,
+                        IN UINT maxSlots, IN OUT size_t* numBytes, OUT BOOLEAN* eop);
+
+/// Start the credit accounting of a ring of numBlocks blocks. Returns the initial credits to grant.
+UINT32 RingCreditsInit(OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks);
+
+/// Account numBlocks blocks received by the engine, i.e. credits it has used up - producer only
+void RingCreditsReceived(IN OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks);
+
+/// Account numBlocks blocks consumed, i.e. credits which may be granted again - consumer only
+void RingCreditsFreed(IN OUT XDMA_RING_CREDITS* credits, IN UINT32 numBlocks);
+
+/// Decide whether to grant the freed credits now: once a batch has been collected, or right away
+/// when the engine is about to run dry. Either side may call it after accounting its blocks; a full
+/// barrier orders its own count before the look at the other one, so that the last freed credits
+/// are never left behind by both. Returns the credits to write to the engine, 0 to keep collecting.
+UINT32 RingCreditsTake(IN OUT XDMA_RING_CREDITS* credits);
+
+/// Credits held by the engine and consumed blocks waiting for a grant, as far as the caller sees
+void RingCreditsGet(IN const XDMA_RING_CREDITS* credits, OUT UINT32* held, OUT UINT32* freed);
@@ -0,0 +1,123 @@
+/*
+* XDMA Platform Abstraction
+* =========================
+*
+* Minimal set of types and primitives shared by the OS-independent parts of libxdma (see
+* xdma_core.h). In the driver build this simply pulls in the WDK headers. When XDMA_PORTABLE is
+* defined (host-side build, see sim/Makefile) equivalent definitions are provided on top of the C
+* standard library, so that the core can be compiled and benchmarked on a plain Linux box.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#ifndef XDMA_PORTABLE
+
+#include <ntddk.h>
+#include <wdf.h>
+
+#define XDMA_TARGET_SSE41               // the compiler emits SSE4.1 intrinsics without a switch
+
+#else // XDMA_PORTABLE
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ========================= type declarations ====================================================
+
+typedef void                VOID;
+typedef void*               PVOID;
+typedef char                CHAR;
+typedef unsigned char       UCHAR, *PUCHAR;
+typedef uint8_t             UINT8;
+typedef uint16_t            UINT16;
+typedef uint32_t            UINT32;
+typedef uint64_t            UINT64;
+typedef int32_t             INT32;
+typedef unsigned int        UINT;
+typedef uint32_t            ULONG, DWORD;
+typedef int32_t             LONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef size_t              SIZE_T;
+typedef uint8_t             BOOLEAN;
+typedef int32_t             NTSTATUS;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, PHYSICAL_ADDRESS;
+
+typedef struct _SCATTER_GATHER_ELEMENT {
+    PHYSICAL_ADDRESS Address;
+    ULONG Length;
+    uintptr_t Reserved;
+} SCATTER_GATHER_ELEMENT;
+
+typedef struct _SCATTER_GATHER_LIST {
+    ULONG NumberOfElements;
+    SCATTER_GATHER_ELEMENT Elements[];
+} SCATTER_GATHER_LIST, *PSCATTER_GATHER_LIST;
+
+// ========================= constants ============================================================
+
+#ifndef TRUE
+#define TRUE                    (1)
+#define FALSE                   (0)
+#endif
+
+#define IN
+#define OUT
+
+#define PAGE_SIZE               (0x1000UL)
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_INTERNAL_ERROR           ((NTSTATUS)0xC00000E5L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define NT_SUCCESS(status)              (((NTSTATUS)(status)) >= 0)
+
+// ========================= primitives ===========================================================
+
+#define FORCEINLINE                     inline __attribute__((always_inline))
+#define UNREFERENCED_PARAMETER(p)       ((void)(p))
+#define ASSERT(exp)                     assert(exp)
+#define ASSERTMSG(msg, exp)             assert((msg) && (exp))
+#define MemoryBarrier()                 __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define DECLSPEC_CACHEALIGN             __attribute__((aligned(64)))
+#define ReadULongAcquire(src)           __atomic_load_n((src), __ATOMIC_ACQUIRE)
+#define ReadLongAcquire(src)            __atomic_load_n((src), __ATOMIC_ACQUIRE)
+#define ReadULongNoFence(src)           __atomic_load_n((src), __ATOMIC_RELAXED)
+#define WriteULongNoFence(dst, value)   __atomic_store_n((dst), (value), __ATOMIC_RELAXED)
+#define PF_TEMPORAL_LEVEL_1             (1)
+#define PreFetchCacheLine(level, addr)  __builtin_prefetch((addr), 0, 3)
+#define WriteULongRelease(dst, value)   __atomic_store_n((dst), (value), __ATOMIC_RELEASE)
+
+static inline LONG InterlockedCompareExchange(volatile LONG* dst, LONG exchange, LONG comparand) {
+    __atomic_compare_exchange_n(dst, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+#define RtlZeroMemory(dst, len)         __builtin_memset((dst), 0, (len))
+#define RtlCopyMemory(dst, src, len)    __builtin_memcpy((dst), (src), (len))
+#define XDMA_TARGET_SSE41               __attribute__((target("sse4.1")))
+
+#define PF_SSE4_1_INSTRUCTIONS_AVAILABLE (37)
+
+static inline BOOLEAN ExIsProcessorFeaturePresent(ULONG feature) {
+#if defined(__x86_64__)
+    return (feature == PF_SSE4_1_INSTRUCTIONS_AVAILABLE) && __builtin_cpu_supports("sse4.1");
+#else
+    UNREFERENCED_PARAMETER(feature);
+    return FALSE;
+#endif
+}
+
+#endif // XDMA_PORTABLE
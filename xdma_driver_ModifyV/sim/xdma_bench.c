@@ -0,0 +1,2602 @@
+/*
+* XDMA Core Microbenchmark
+* ===============================
+*
+* Measures the OS-independent hot paths of libxdma (xdma_core.c) on the host:
+*   - descriptor chain construction for scatter gather lists of 1 to 2050 elements
+*   - coalescing of physically contiguous scatter gather elements (checked only)
+*   - linking of queued chains into a single engine run (request pipeline, checked only)
+*   - gather of a packet table into one AXI-ST H2C descriptor list (gather send, checked only)
+*   - a packet table sent in a circle, free running and slot by slot with credits (checked only)
+*   - consumption of AXI-ST C2H ring blocks (result scan and copy out)
+*   - copy out of ring blocks with memcpy against streaming loads
+*   - batched descriptor credit return of the AXI-ST C2H ring against a grant per read
+*   - lock-free handoff of the ring indices between a dpc and a reader thread against a spin lock
+*   - packet batches read from the AXI-ST C2H ring (checked only)
+*   - receive into posted user buffers (slot posting and result collection, checked only)
+*
+* Every descriptor chain is also executed once by the behavioral model, so a broken chain (bad
+* links, fetch blocks crossing 4K or exceeding the MRRS) shows up as a failed check instead of a
+* fast but meaningless number.
+*
+* Usage: xdma_bench [descriptors per data point]
+*/
+
+// ========================= include dependencies =================================================
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xdma_core.h"
+#include "xdma_model.h"
+
+// ========================= constants ============================================================
+
+#define BENCH_MAX_SG_ELEMENTS       (8UL * 1024UL * 1024UL / PAGE_SIZE + 2) // XDMA_MAX_TRANSFER_SIZE
+#define BENCH_RING_NUM_BLOCKS       (258U)                                  // XDMA_RING_NUM_BLOCKS
+#define BENCH_RING_BLOCK_SIZE       (PAGE_SIZE)                             // XDMA_RING_BLOCK_SIZE
+#define BENCH_RING_MAX_BLOCKS       (1024U)                                 // XDMA_RING_MAX_BLOCKS
+#define BENCH_RING_LAPS             (4U)
+#define BENCH_BATCH_PACKETS         (3000U)
+#define BENCH_RX_DEPTH              (4U)                                    // XDMA_DEFAULT_QUEUE_DEPTH
+#define BENCH_RX_BUFFERS            (200U)
+#define BENCH_DEFAULT_WORK          (2000000UL)
+
+#define ENGINE_REG(dir, ch, field)  ((UINT32)((dir) * BLOCK_OFFSET + (ch) * ENGINE_OFFSET + \
+                                     offsetof(XDMA_ENGINE_REGS, field)))
+#define SGDMA_REG(dir, ch, field)   ((UINT32)(SGDMA_BLOCK_OFFSET + (dir) * BLOCK_OFFSET + \
+                                     (ch) * ENGINE_OFFSET + offsetof(XDMA_SGDMA_REGS, field)))
+#define SGDMA_COMMON_REG(field)     ((UINT32)(SGDMA_COMMON_BLOCK_OFFSET + \
+                                     offsetof(XDMA_SGDMA_COMMON_REGS, field)))
+
+// ========================= helpers ==============================================================
+
+static UINT64 NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+}
+
+static void* AllocPages(size_t numBytes) {
+    const size_t size = (numBytes + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    void* p = aligned_alloc(PAGE_SIZE, size);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+static void ParamsFromModel(const XDMA_MODEL_CONFIG* config, XDMA_DESC_PARAMS* params) {
+    params->type = config->streaming ? EngineType_ST : EngineType_MM;
+    params->addressMode = AddressMode_Contiguous;
+    params->alignAddr = (config->alignments >> 16) & 0xFF;
+    params->alignLength = (config->alignments >> 8) & 0xFF;
+    params->dataPathWidth = XDMA_DATA_PATH_BYTES(config->pcieWidth);
+    params->adjMax = DescAdjMax(XDMA_MRRS_BYTES(config->pcieMRRS));
+}
+
+// Program and start an engine of the model the way dma_engine.c does it
+static void StartChain(XDMA_MODEL* model, UINT32 dir, const XDMA_DESC_CHAIN* chain,
+                       UINT32 firstAdj) {
+    XDMA_ModelWrite32(model, SGDMA_REG(dir, 0, firstDescLo), (UINT32)LIMIT_TO_32(chain->descLA));
+    XDMA_ModelWrite32(model, SGDMA_REG(dir, 0, firstDescHi), (UINT32)(chain->descLA >> 32));
+    XDMA_ModelWrite32(model, SGDMA_REG(dir, 0, firstDescAdj), firstAdj);
+    XDMA_ModelWrite32(model, ENGINE_REG(dir, 0, controlW1S), XDMA_CTRL_RUN_BIT);
+}
+
+static void StopEngine(XDMA_MODEL* model, UINT32 dir) {
+    XDMA_ModelWrite32(model, ENGINE_REG(dir, 0, controlW1C), XDMA_CTRL_RUN_BIT);
+    XDMA_ModelRead32(model, ENGINE_REG(dir, 0, statusRC));
+}
+
+// ========================= descriptor construction ==============================================
+
+static int BenchDescriptors(UINT64 work) {
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = BENCH_MAX_SG_ELEMENTS * PAGE_SIZE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    // one page per element, handed out in reverse order so that no two elements are contiguous
+    UINT8* pages = AllocPages(BENCH_MAX_SG_ELEMENTS * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT* elements = calloc(BENCH_MAX_SG_ELEMENTS, sizeof(SCATTER_GATHER_ELEMENT));
+    DMA_DESCRIPTOR* descBuffer = AllocPages(BENCH_MAX_SG_ELEMENTS * sizeof(DMA_DESCRIPTOR));
+    for (ULONG i = 0; i < BENCH_MAX_SG_ELEMENTS; i++) {
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages +
+                                       (BENCH_MAX_SG_ELEMENTS - 1 - i) * PAGE_SIZE);
+        elements[i].Length = PAGE_SIZE;
+    }
+
+    static const ULONG sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 2050 };
+    int failures = 0;
+
+    printf("descriptor construction (H2C AXI-MM, MRRS=%luB, adjMax=%u)\n",
+           XDMA_MRRS_BYTES(config.pcieMRRS), params.adjMax);
+    printf("%10s %12s %12s %10s %8s\n", "elements", "ns/desc", "descriptors", "fetches", "check");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const ULONG numElements = sizes[s];
+        const UINT64 iterations = work / numElements ? work / numElements : 1;
+        XDMA_DESC_CHAIN chain;
+        UINT32 firstAdj = 0;
+
+        const UINT64 start = NowNs();
+        for (UINT64 it = 0; it < iterations; it++) {
+            DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer,
+                          BENCH_MAX_SG_ELEMENTS);
+            DescChainAppendSg(&chain, H2C, elements, numElements, 0);
+            DescChainClose(&chain, XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+            firstAdj = DescChainOptimize(&chain);
+        }
+        const UINT64 elapsed = NowNs() - start;
+
+        // execute the last chain on the model
+        XDMA_MODEL_STATS before, after;
+        XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+        StartChain(model, XDMA_MODEL_H2C, &chain, firstAdj);
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, numElements + 1);
+        XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+        StopEngine(model, XDMA_MODEL_H2C);
+
+        const UINT64 processed = after.descriptors - before.descriptors;
+        const BOOLEAN ok = (processed == chain.count) && (after.errors == before.errors) &&
+            (chain.count == numElements) && (chain.misaligned == 0);
+        failures += !ok;
+
+        printf("%10lu %12.2f %12lu %10lu %8s\n", (unsigned long)numElements,
+               (double)elapsed / (double)(iterations * chain.count), (unsigned long)chain.count,
+               (unsigned long)(after.descFetches - before.descFetches), ok ? "ok" : "FAIL");
+    }
+
+    free(descBuffer);
+    free(elements);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return failures;
+}
+
+// ========================= scatter gather coalescing ============================================
+
+// Lists of BENCH_MAX_SG_ELEMENTS pages made of contiguous runs, the runs in reverse order
+static int CheckCoalesce(void) {
+    static const ULONG runLengths[] = { 1, 2, 16, 512, BENCH_MAX_SG_ELEMENTS };
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = BENCH_MAX_SG_ELEMENTS * PAGE_SIZE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    UINT8* pages = AllocPages(BENCH_MAX_SG_ELEMENTS * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT* elements = calloc(BENCH_MAX_SG_ELEMENTS, sizeof(SCATTER_GATHER_ELEMENT));
+    DMA_DESCRIPTOR* descBuffer = AllocPages(BENCH_MAX_SG_ELEMENTS * sizeof(DMA_DESCRIPTOR));
+    int failures = 0;
+
+    printf("\nscatter gather coalescing (H2C AXI-MM, %lu elements)\n",
+           (unsigned long)BENCH_MAX_SG_ELEMENTS);
+    printf("%10s %12s %10s %8s\n", "run", "descriptors", "fetches", "check");
+
+    for (size_t r = 0; r < sizeof(runLengths) / sizeof(runLengths[0]); r++) {
+        const ULONG runLength = runLengths[r];
+        const ULONG numRuns = (BENCH_MAX_SG_ELEMENTS + runLength - 1) / runLength;
+        for (ULONG i = 0; i < BENCH_MAX_SG_ELEMENTS; i++) {
+            const ULONG runEnd = (i / runLength + 1) * runLength;
+            const ULONG runStart = BENCH_MAX_SG_ELEMENTS -
+                (runEnd < BENCH_MAX_SG_ELEMENTS ? runEnd : BENCH_MAX_SG_ELEMENTS);
+            elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages +
+                                           ((UINT64)runStart + i % runLength) * PAGE_SIZE);
+            elements[i].Length = PAGE_SIZE;
+        }
+
+        XDMA_DESC_CHAIN chain;
+        DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer,
+                      BENCH_MAX_SG_ELEMENTS);
+        const ULONG appended = DescChainAppendSg(&chain, H2C, elements, BENCH_MAX_SG_ELEMENTS, 0);
+        DescChainClose(&chain, XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        const UINT32 firstAdj = DescChainOptimize(&chain);
+
+        XDMA_MODEL_STATS before, after;
+        XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+        StartChain(model, XDMA_MODEL_H2C, &chain, firstAdj);
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, chain.count + 1);
+        XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+        StopEngine(model, XDMA_MODEL_H2C);
+
+        const BOOLEAN ok = (appended == BENCH_MAX_SG_ELEMENTS) && (chain.count == numRuns) &&
+            (after.descriptors - before.descriptors == chain.count) &&
+            (after.bytes - before.bytes == (UINT64)BENCH_MAX_SG_ELEMENTS * PAGE_SIZE) &&
+            (after.errors == before.errors);
+        failures += !ok;
+
+        printf("%10lu %12lu %10lu %8s\n", (unsigned long)runLength, (unsigned long)chain.count,
+               (unsigned long)(after.descFetches - before.descFetches), ok ? "ok" : "FAIL");
+    }
+
+    free(descBuffer);
+    free(elements);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return failures;
+}
+
+// ========================= pipelined runs =======================================================
+
+// Link chains in separate segments into one run like EngineStartRun() does and execute it
+static int CheckLinkedRun(void) {
+    static const ULONG sizes[] = { 3, 64, 257, 1, 2050 };
+    enum { NUM_CHAINS = sizeof(sizes) / sizeof(sizes[0]) };
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = BENCH_MAX_SG_ELEMENTS * PAGE_SIZE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    UINT8* pages = AllocPages(BENCH_MAX_SG_ELEMENTS * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT* elements = calloc(BENCH_MAX_SG_ELEMENTS, sizeof(SCATTER_GATHER_ELEMENT));
+    for (ULONG i = 0; i < BENCH_MAX_SG_ELEMENTS; i++) { // reverse order - no coalescing
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages +
+                                       (BENCH_MAX_SG_ELEMENTS - 1 - i) * PAGE_SIZE);
+        elements[i].Length = PAGE_SIZE;
+    }
+
+    XDMA_DESC_CHAIN chains[NUM_CHAINS];
+    UINT32 firstAdj[NUM_CHAINS];
+    ULONG total = 0;
+    for (ULONG c = 0; c < NUM_CHAINS; c++) {
+        DMA_DESCRIPTOR* segment = AllocPages(BENCH_MAX_SG_ELEMENTS * sizeof(DMA_DESCRIPTOR));
+        DescChainInit(&chains[c], &params, segment, (UINT64)(uintptr_t)segment,
+                      BENCH_MAX_SG_ELEMENTS);
+        DescChainAppendSg(&chains[c], H2C, elements, sizes[c], 0);
+        DescChainClose(&chains[c], XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        firstAdj[c] = DescChainOptimize(&chains[c]);
+        total += chains[c].count;
+    }
+    for (ULONG c = 0; c + 1 < NUM_CHAINS; c++) {
+        DescLink(&chains[c].desc[chains[c].count - 1], chains[c + 1].descLA, firstAdj[c + 1]);
+    }
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    StartChain(model, XDMA_MODEL_H2C, &chains[0], firstAdj[0]);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, total + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0, completedDescCount));
+    StopEngine(model, XDMA_MODEL_H2C);
+
+    const BOOLEAN ok = (after.descriptors - before.descriptors == total) && (completed == total) &&
+        (after.errors == before.errors);
+
+    printf("\nlinked run (H2C AXI-MM, %u chains)\n", (unsigned)NUM_CHAINS);
+    printf("%12s %10s %10s %8s\n", "descriptors", "completed", "fetches", "check");
+    printf("%12lu %10u %10lu %8s\n", (unsigned long)total, completed,
+           (unsigned long)(after.descFetches - before.descFetches), ok ? "ok" : "FAIL");
+
+    for (ULONG c = 0; c < NUM_CHAINS; c++) {
+        free(chains[c].desc);
+    }
+    free(elements);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+// ========================= descriptor store =====================================================
+
+// Build one list across the segments of a store like XDMA_EngineProgramDma() does and execute it
+static int CheckStore(void) {
+    enum { NUM_SEGMENTS = 4, SEGMENT_CAPACITY = 100, NUM_ELEMENTS = 350 };
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = NUM_ELEMENTS * PAGE_SIZE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    UINT8* pages = AllocPages(NUM_ELEMENTS * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT elements[NUM_ELEMENTS];
+    for (ULONG i = 0; i < NUM_ELEMENTS; i++) { // reverse order - no coalescing
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages +
+                                       (NUM_ELEMENTS - 1 - i) * PAGE_SIZE);
+        elements[i].Length = PAGE_SIZE;
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+
+    XDMA_DESC_LIST list;
+    const ULONG appended = DescStoreBuildSg(&store, &params, H2C, elements, NUM_ELEMENTS, 0,
+                                            XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT, &list);
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0, completedDescCount));
+    StopEngine(model, XDMA_MODEL_H2C);
+
+    const BOOLEAN ok = (appended == NUM_ELEMENTS) && (list.count == NUM_ELEMENTS) &&
+        (list.segments == NUM_SEGMENTS) && (completed == list.count) &&
+        (after.descriptors - before.descriptors == list.count) && (after.errors == before.errors);
+
+    printf("\ndescriptor store (H2C AXI-MM, %u segments of %u)\n",
+           (unsigned)NUM_SEGMENTS, (unsigned)SEGMENT_CAPACITY);
+    printf("%12s %10s %10s %10s %8s\n", "descriptors", "segments", "completed", "fetches", "check");
+    printf("%12lu %10lu %10u %10lu %8s\n", (unsigned long)list.count, (unsigned long)list.segments,
+           completed, (unsigned long)(after.descFetches - before.descFetches), ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+typedef struct BENCH_GATHER_T {
+    const UINT8* data;          // buffer contents in buffer order
+    const XDMA_DESC_PACKET* packets;
+    ULONG numPackets;
+    ULONG packet;               // index of the packet being received
+    size_t offset;              // bytes received of it
+    ULONG mismatches;           // wrong bytes, packets split or merged
+} BENCH_GATHER;
+
+static void GatherSink(void* ctx, UINT32 channel, const void* src, UINT32 numBytes, BOOLEAN eop) {
+    BENCH_GATHER* gather = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    if (gather->packet >= gather->numPackets) {
+        gather->mismatches++;
+        return;
+    }
+    const XDMA_DESC_PACKET* packet = &gather->packets[gather->packet];
+    if (gather->offset + numBytes > packet->length ||
+        memcmp(src, gather->data + packet->offset + gather->offset, numBytes) != 0) {
+        gather->mismatches++;
+    }
+    gather->offset += numBytes;
+    if (eop) {
+        if (gather->offset != packet->length) {
+            gather->mismatches++;
+        }
+        gather->packet++;
+        gather->offset = 0;
+    }
+}
+
+// Gather a table of packets (short ones, ones crossing pages, repeated and overlapping ones) from a
+// scatter gather list of pairs of contiguous pages into one list over several segments, the way
+// IoSendPackets() does, and check every packet arrives whole and separately
+static int CheckGatherSend(void) {
+    enum { NUM_SEGMENTS = 4, SEGMENT_CAPACITY = 256, NUM_PAGES = 64, NUM_PACKETS = 800 };
+    const size_t bufferLength = NUM_PAGES * PAGE_SIZE;
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.streaming = TRUE;
+    config.numC2H = 0;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    // pairs of contiguous pages in reverse order - coalesced within a pair only
+    UINT8* pages = AllocPages(bufferLength);
+    UINT8* data = malloc(bufferLength);
+    SCATTER_GATHER_ELEMENT elements[NUM_PAGES / 2];
+    for (ULONG i = 0; i < NUM_PAGES / 2; i++) {
+        UINT8* pair = pages + (NUM_PAGES / 2 - 1 - i) * 2 * PAGE_SIZE;
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)pair;
+        elements[i].Length = 2 * PAGE_SIZE;
+        for (size_t b = 0; b < 2 * PAGE_SIZE; b++) {
+            data[i * 2 * PAGE_SIZE + b] = (UINT8)(b * 7 + i * 3 + b / 251);
+            pair[b] = data[i * 2 * PAGE_SIZE + b];
+        }
+    }
+
+    static XDMA_DESC_PACKET packets[NUM_PACKETS];
+    UINT64 random = 0x9E3779B97F4A7C15ULL;
+    for (ULONG p = 0; p < NUM_PACKETS; p++) {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        const UINT32 r = (UINT32)(random >> 33);
+        if (p > 0 && r % 16 == 0) { // same packet again
+            packets[p] = packets[p - 1];
+            continue;
+        }
+        const size_t length = (r % 8 == 0) ? 1 + r % (3 * PAGE_SIZE) : 1 + r % 256;
+        packets[p].offset = (UINT32)((r / 7) % (bufferLength - length + 1));
+        packets[p].length = (UINT32)length;
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+    const UINT32 lastControl = XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT | XDMA_DESC_EOP_BIT;
+
+    XDMA_DESC_LIST list;
+    const UINT64 start = NowNs();
+    const ULONG appended = DescStoreBuildPackets(&store, &params, elements, NUM_PAGES / 2,
+                                                 packets, NUM_PACKETS, lastControl, &list, NULL);
+    const UINT64 buildNs = NowNs() - start;
+
+    // a store too small for the table takes the packets that fit and nothing of the next one
+    XDMA_DESC_LIST partialList;
+    const XDMA_DESC_STORE partialStore = { 1, 16, segments, segmentLA };
+    const ULONG partial = DescStoreBuildPackets(&partialStore, &params, elements, NUM_PAGES / 2,
+                                                packets, NUM_PACKETS, lastControl, &partialList,
+                                                NULL);
+    ULONG partialEnds = 0;
+    for (ULONG d = 0; d < partialList.count; d++) {
+        partialEnds += (segments[0][d].control & XDMA_DESC_EOP_BIT) != 0;
+    }
+    const BOOLEAN partialOk = (partial < NUM_PACKETS) && (partialList.count <= 16) &&
+                              (partialEnds == partial);
+
+    // rebuild the full list, the partial one overwrote the first segment
+    DescStoreBuildPackets(&store, &params, elements, NUM_PAGES / 2, packets, NUM_PACKETS,
+                          lastControl, &list, NULL);
+
+    BENCH_GATHER gather = { data, packets, NUM_PACKETS, 0, 0, 0 };
+    XDMA_ModelSetCallbacks(model, NULL, GatherSink, NULL, &gather);
+
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0, completedDescCount));
+    StopEngine(model, XDMA_MODEL_H2C);
+
+    const BOOLEAN ok = partialOk && (appended == NUM_PACKETS) && (list.segments > 1) &&
+        (gather.packet == NUM_PACKETS) && (gather.mismatches == 0) &&
+        (after.packets - before.packets == NUM_PACKETS) && (completed == list.count) &&
+        (after.errors == before.errors);
+
+    printf("\ngather send (H2C AXI-ST, %u packets, %u segments of %u)\n",
+           (unsigned)NUM_PACKETS, (unsigned)NUM_SEGMENTS, (unsigned)SEGMENT_CAPACITY);
+    printf("%12s %10s %10s %10s %10s %8s\n", "descriptors", "segments", "desc/pkt", "ns/pkt",
+           "partial", "check");
+    printf("%12lu %10lu %10.2f %10.1f %10lu %8s\n", (unsigned long)list.count,
+           (unsigned long)list.segments, (double)list.count / NUM_PACKETS,
+           (double)buildNs / NUM_PACKETS, (unsigned long)partial, ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(data);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+// Scatter pieces of a buffer described by pairs of contiguous pages to card addresses in one
+// vectored H2C run, gather them back into a packed buffer in one C2H run and check the card memory
+// and the data read back. Compare building one list for all vectors with one list per vector, i.e.
+// one request per piece.
+static int CheckVectors(void) {
+    enum { NUM_SEGMENTS = 4, SEGMENT_CAPACITY = 256, NUM_PAGES = 64, NUM_VECTORS = 400,
+           CARD_STRIDE = 4 * PAGE_SIZE };
+    const size_t bufferLength = NUM_PAGES * PAGE_SIZE;
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = (UINT64)NUM_VECTORS * CARD_STRIDE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    // pairs of contiguous pages in reverse order, for the source and for the packed destination
+    UINT8* pages = AllocPages(bufferLength);
+    UINT8* packedPages = AllocPages(NUM_VECTORS * 3 * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT elements[NUM_PAGES / 2];
+    SCATTER_GATHER_ELEMENT packedElements[NUM_VECTORS * 3 / 2];
+    for (ULONG i = 0; i < NUM_PAGES / 2; i++) {
+        UINT8* pair = pages + (NUM_PAGES / 2 - 1 - i) * 2 * PAGE_SIZE;
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)pair;
+        elements[i].Length = 2 * PAGE_SIZE;
+        for (size_t b = 0; b < 2 * PAGE_SIZE; b++) {
+            pair[b] = (UINT8)(b * 13 + i * 5 + b / 253);
+        }
+    }
+    for (ULONG i = 0; i < NUM_VECTORS * 3 / 2; i++) {
+        UINT8* pair = packedPages + (NUM_VECTORS * 3 / 2 - 1 - i) * 2 * PAGE_SIZE;
+        packedElements[i].Address.QuadPart = (LONGLONG)(uintptr_t)pair;
+        packedElements[i].Length = 2 * PAGE_SIZE;
+    }
+
+    // pieces anywhere in the buffer, repeated and overlapping ones included, each to its own card
+    // slot; read back packed one after the other
+    static XDMA_DESC_VECTOR writes[NUM_VECTORS];
+    static XDMA_DESC_VECTOR reads[NUM_VECTORS];
+    UINT64 random = 0xD1B54A32D192ED03ULL;
+    UINT32 packed = 0;
+    for (ULONG v = 0; v < NUM_VECTORS; v++) {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        const UINT32 r = (UINT32)(random >> 33);
+        if (v > 0 && r % 16 == 0) { // same piece again
+            writes[v] = writes[v - 1];
+        } else {
+            const size_t length = (r % 4 == 0) ? 1 + r % (3 * PAGE_SIZE) : 1 + r % 512;
+            writes[v].offset = (UINT32)((r / 5) % (bufferLength - length + 1));
+            writes[v].length = (UINT32)length;
+        }
+        writes[v].deviceAddr = (UINT64)v * CARD_STRIDE + (r / 3) % (CARD_STRIDE - 3 * PAGE_SIZE);
+        reads[v].offset = packed;
+        reads[v].length = writes[v].length;
+        reads[v].deviceAddr = writes[v].deviceAddr;
+        packed += writes[v].length;
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+    const UINT32 lastControl = XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT;
+
+    // one list per piece, the way a request per piece would build them
+    XDMA_DESC_LIST list;
+    UINT64 start = NowNs();
+    for (ULONG v = 0; v < NUM_VECTORS; v++) {
+        DescStoreBuildVectors(&store, &params, H2C, elements, NUM_PAGES / 2, &writes[v], 1,
+                              lastControl, &list);
+    }
+    const UINT64 perPieceNs = NowNs() - start;
+
+    start = NowNs();
+    const ULONG written = DescStoreBuildVectors(&store, &params, H2C, elements, NUM_PAGES / 2,
+                                                writes, NUM_VECTORS, lastControl, &list);
+    const UINT64 buildNs = NowNs() - start;
+    const ULONG writeDescriptors = list.count;
+    const ULONG writeSegments = list.segments;
+
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    const UINT32 writeCompleted = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0,
+                                                                     completedDescCount));
+    StopEngine(model, XDMA_MODEL_H2C);
+    BOOLEAN ok = (written == NUM_VECTORS) && (writeCompleted == list.count) &&
+                 (after.bytes - before.bytes == packed) && (after.errors == before.errors);
+
+    ULONG mismatches = 0;
+    for (ULONG v = 0; v < NUM_VECTORS; v++) {
+        for (UINT32 b = 0; b < writes[v].length; b++) {
+            const size_t offset = writes[v].offset + b;
+            const size_t element = offset / (2 * PAGE_SIZE);
+            const UINT8* src = (const UINT8*)(uintptr_t)elements[element].Address.QuadPart;
+            mismatches += model->cardMem[writes[v].deviceAddr + b] != src[offset % (2 * PAGE_SIZE)];
+        }
+    }
+
+    const ULONG read = DescStoreBuildVectors(&store, &params, C2H, packedElements,
+                                             NUM_VECTORS * 3 / 2, reads, NUM_VECTORS, lastControl,
+                                             &list);
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &before);
+    StartChain(model, XDMA_MODEL_C2H, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &after);
+    const UINT32 readCompleted = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_C2H, 0,
+                                                                    completedDescCount));
+    StopEngine(model, XDMA_MODEL_C2H);
+    ok = ok && (read == NUM_VECTORS) && (readCompleted == list.count) &&
+         (after.bytes - before.bytes == packed) && (after.errors == before.errors);
+
+    for (ULONG v = 0; v < NUM_VECTORS; v++) {
+        for (UINT32 b = 0; b < reads[v].length; b++) {
+            const size_t offset = reads[v].offset + b;
+            const size_t element = offset / (2 * PAGE_SIZE);
+            const UINT8* dst = (const UINT8*)(uintptr_t)packedElements[element].Address.QuadPart;
+            mismatches += dst[offset % (2 * PAGE_SIZE)] != model->cardMem[reads[v].deviceAddr + b];
+        }
+    }
+
+    // a store too small for the table takes the vectors that fit and nothing of the next one
+    const XDMA_DESC_STORE partialStore = { 1, 16, segments, segmentLA };
+    const ULONG partial = DescStoreBuildVectors(&partialStore, &params, H2C, elements,
+                                                NUM_PAGES / 2, writes, NUM_VECTORS, lastControl,
+                                                &list);
+    ok = ok && (mismatches == 0) && (partial < NUM_VECTORS) && (list.count <= 16);
+
+    printf("\nvectored transfers (AXI-MM, %u vectors, %u bytes, %u segments of %u)\n",
+           (unsigned)NUM_VECTORS, (unsigned)packed, (unsigned)NUM_SEGMENTS,
+           (unsigned)SEGMENT_CAPACITY);
+    printf("%12s %10s %10s %12s %12s %10s %8s\n", "descriptors", "segments", "desc/vec",
+           "ns/vec one", "ns/vec each", "partial", "check");
+    printf("%12lu %10lu %10.2f %12.1f %12.1f %10lu %8s\n", (unsigned long)writeDescriptors,
+           (unsigned long)writeSegments, (double)writeDescriptors / NUM_VECTORS,
+           (double)buildNs / NUM_VECTORS, (double)perPieceNs / NUM_VECTORS,
+           (unsigned long)partial, ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(packedPages);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+// Byte 'b' of the host buffer described by a scatter gather list of equal elements
+static UINT8* ElementByte(const SCATTER_GATHER_ELEMENT* elements, size_t elementLength, size_t b) {
+    return (UINT8*)(uintptr_t)elements[b / elementLength].Address.QuadPart + b % elementLength;
+}
+
+// Write a tile with a host pitch other than its card pitch in one strided H2C run and read it back
+// with yet another host pitch in one C2H run, checking the card memory and the data read back.
+// Compare building one list for all rows with one list per row, i.e. one request per row. Densely
+// packed rows must be merged into a descriptor per physically contiguous piece.
+static int CheckStrided(void) {
+    enum { NUM_SEGMENTS = 4, SEGMENT_CAPACITY = 256, NUM_PAGES = 128, ROWS = 300, ROW_BYTES = 700,
+           HOST_PITCH = 1000, READ_PITCH = 768, CARD_PITCH = 4096 };
+    const size_t bufferLength = NUM_PAGES * PAGE_SIZE;
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = (UINT64)(ROWS + 1) * CARD_PITCH;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    // pairs of contiguous pages in reverse order, for the source and for the data read back
+    UINT8* pages = AllocPages(bufferLength);
+    UINT8* readPages = AllocPages(bufferLength);
+    SCATTER_GATHER_ELEMENT elements[NUM_PAGES / 2];
+    SCATTER_GATHER_ELEMENT readElements[NUM_PAGES / 2];
+    for (ULONG i = 0; i < NUM_PAGES / 2; i++) {
+        UINT8* pair = pages + (NUM_PAGES / 2 - 1 - i) * 2 * PAGE_SIZE;
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)pair;
+        elements[i].Length = 2 * PAGE_SIZE;
+        readElements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(readPages +
+                                           (NUM_PAGES / 2 - 1 - i) * 2 * PAGE_SIZE);
+        readElements[i].Length = 2 * PAGE_SIZE;
+        for (size_t b = 0; b < 2 * PAGE_SIZE; b++) {
+            pair[b] = (UINT8)(b * 11 + i * 7 + b / 241);
+        }
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+    const UINT32 lastControl = XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT;
+
+    const XDMA_DESC_STRIDE writeTile = { 100, HOST_PITCH, ROWS, ROW_BYTES, 64, CARD_PITCH };
+    const XDMA_DESC_STRIDE readTile = { 0, READ_PITCH, ROWS, ROW_BYTES, 64, CARD_PITCH };
+
+    // one list per row, the way a request per row would build them
+    XDMA_DESC_LIST list;
+    UINT64 start = NowNs();
+    for (ULONG r = 0; r < ROWS; r++) {
+        const XDMA_DESC_STRIDE row = { writeTile.offset + r * HOST_PITCH, 0, 1, ROW_BYTES,
+                                       writeTile.deviceAddr + (UINT64)r * CARD_PITCH, 0 };
+        DescStoreBuildStrided(&store, &params, H2C, elements, NUM_PAGES / 2, &row, lastControl,
+                              &list);
+    }
+    const UINT64 perRowNs = NowNs() - start;
+
+    start = NowNs();
+    const ULONG written = DescStoreBuildStrided(&store, &params, H2C, elements, NUM_PAGES / 2,
+                                                &writeTile, lastControl, &list);
+    const UINT64 buildNs = NowNs() - start;
+    const ULONG writeDescriptors = list.count;
+
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    StopEngine(model, XDMA_MODEL_H2C);
+    BOOLEAN ok = (written == ROWS) && (after.descriptors - before.descriptors == list.count) &&
+                 (after.bytes - before.bytes == ROWS * ROW_BYTES) && (after.errors == before.errors);
+
+    const ULONG readRows = DescStoreBuildStrided(&store, &params, C2H, readElements, NUM_PAGES / 2,
+                                             &readTile, lastControl, &list);
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &before);
+    StartChain(model, XDMA_MODEL_C2H, &first, list.firstAdj);
+    XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, list.count + 1);
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &after);
+    StopEngine(model, XDMA_MODEL_C2H);
+    ok = ok && (readRows == ROWS) && (after.bytes - before.bytes == ROWS * ROW_BYTES) &&
+         (after.errors == before.errors);
+
+    ULONG mismatches = 0;
+    for (ULONG r = 0; r < ROWS; r++) {
+        const UINT8* card = model->cardMem + writeTile.deviceAddr + (UINT64)r * CARD_PITCH;
+        for (size_t b = 0; b < ROW_BYTES; b++) {
+            mismatches += card[b] != *ElementByte(elements, 2 * PAGE_SIZE,
+                                                  writeTile.offset + r * HOST_PITCH + b);
+            mismatches += card[b] != *ElementByte(readElements, 2 * PAGE_SIZE, r * READ_PITCH + b);
+        }
+        mismatches += card[ROW_BYTES] != 0; // nothing between the rows
+    }
+
+    // densely packed rows are one range: a descriptor per pair of pages
+    const XDMA_DESC_STRIDE dense = { 0, 512, (UINT32)(bufferLength / 512), 512, 0, 512 };
+    const ULONG denseRows = DescStoreBuildStrided(&store, &params, H2C, elements, NUM_PAGES / 2,
+                                                  &dense, lastControl, &list);
+    ok = ok && (mismatches == 0) && (denseRows == dense.rows) && (list.count == NUM_PAGES / 2);
+
+    printf("\nstrided transfers (AXI-MM, %u rows of %u bytes, pitch %u/%u to %u)\n",
+           (unsigned)ROWS, (unsigned)ROW_BYTES, (unsigned)HOST_PITCH, (unsigned)READ_PITCH,
+           (unsigned)CARD_PITCH);
+    printf("%12s %10s %12s %12s %12s %8s\n", "descriptors", "desc/row", "ns/row one",
+           "ns/row each", "dense desc", "check");
+    printf("%12lu %10.2f %12.1f %12.1f %12lu %8s\n", (unsigned long)writeDescriptors,
+           (double)writeDescriptors / ROWS, (double)buildNs / ROWS, (double)perRowNs / ROWS,
+           (unsigned long)list.count, ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(readPages);
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+// Fill a range of card memory with copies of a one page pattern that is split over two
+// non-contiguous pages, in stages of a small descriptor store the way EngineRetireTransfer() runs a
+// long fill, and check the pattern stays in phase across the stages and nothing outside the range
+// is touched
+static int CheckFill(void) {
+    enum { NUM_SEGMENTS = 2, SEGMENT_CAPACITY = 64, PATTERN_START = 1000 };
+    const UINT64 fillAddr = PAGE_SIZE + 64;
+    const UINT64 fillBytes = 3 * 1024 * 1024 + 777;
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.cardMemSize = fillAddr + fillBytes + PAGE_SIZE;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    // a page of pattern starting within one page and ending in another one, lower in memory
+    UINT8* pages = AllocPages(3 * PAGE_SIZE);
+    UINT8 pattern[PAGE_SIZE];
+    SCATTER_GATHER_ELEMENT elements[2];
+    elements[0].Address.QuadPart = (LONGLONG)(uintptr_t)(pages + 2 * PAGE_SIZE + PATTERN_START);
+    elements[0].Length = PAGE_SIZE - PATTERN_START;
+    elements[1].Address.QuadPart = (LONGLONG)(uintptr_t)pages;
+    elements[1].Length = PATTERN_START;
+    for (size_t b = 0; b < PAGE_SIZE; b++) {
+        pattern[b] = (UINT8)(b * 29 + b / 255 + 1);
+        UINT8* host = (b < elements[0].Length) ?
+            (UINT8*)(uintptr_t)elements[0].Address.QuadPart + b :
+            (UINT8*)(uintptr_t)elements[1].Address.QuadPart + (b - elements[0].Length);
+        *host = pattern[b];
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+
+    XDMA_MODEL_STATS before, after;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &before);
+    UINT64 deviceAddr = fillAddr;
+    UINT64 remaining = fillBytes;
+    ULONG stages = 0;
+    ULONG descriptors = 0;
+    UINT64 buildNs = 0;
+    BOOLEAN ok = TRUE;
+    while (ok && (remaining > 0)) {
+        XDMA_DESC_LIST list;
+        const UINT64 start = NowNs();
+        const UINT64 covered = DescStoreBuildFill(&store, &params, elements, 2, deviceAddr,
+                                                  remaining,
+                                                  XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT,
+                                                  &list);
+        buildNs += NowNs() - start;
+        // whole copies only, unless it is the end of the fill
+        ok = (covered > 0) && ((covered % PAGE_SIZE == 0) || (covered == remaining)) &&
+             (list.count <= NUM_SEGMENTS * SEGMENT_CAPACITY);
+
+        StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, list.count + 1);
+        const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0,
+                                                                    completedDescCount));
+        StopEngine(model, XDMA_MODEL_H2C);
+        ok = ok && (completed == list.count);
+
+        deviceAddr += covered;
+        remaining -= covered;
+        descriptors += list.count;
+        stages++;
+    }
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &after);
+    ok = ok && (after.bytes - before.bytes == fillBytes) && (after.errors == before.errors);
+
+    ULONG mismatches = 0;
+    for (UINT64 a = 0; a < config.cardMemSize; a++) {
+        const BOOLEAN inside = (a >= fillAddr) && (a < fillAddr + fillBytes);
+        mismatches += model->cardMem[a] != (inside ? pattern[(a - fillAddr) % PAGE_SIZE] : 0);
+    }
+    ok = ok && (mismatches == 0);
+
+    printf("\ncard memory fill (H2C AXI-MM, %llu bytes from a %u byte pattern, store of %u)\n",
+           (unsigned long long)fillBytes, (unsigned)PAGE_SIZE,
+           (unsigned)(NUM_SEGMENTS * SEGMENT_CAPACITY));
+    printf("%12s %10s %10s %12s %8s\n", "descriptors", "stages", "desc/MB", "ns/stage", "check");
+    printf("%12lu %10lu %10.1f %12.1f %8s\n", (unsigned long)descriptors, (unsigned long)stages,
+           (double)descriptors * 1024 * 1024 / (double)fillBytes, (double)buildNs / stages,
+           ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+typedef struct BENCH_LOOP_T {
+    const XDMA_DESC_PACKET* slots;
+    ULONG numSlots;
+    BOOLEAN updated;            // each slot number has its own content, else each slot of a lap
+    UINT64 packet;              // slot number of the packet being received
+    size_t offset;              // bytes received of it
+    ULONG mismatches;
+} BENCH_LOOP;
+
+// content of slot number n
+static UINT8 LoopPattern(UINT64 n, size_t offset) {
+    return (UINT8)(n * 31 + offset * 7 + offset / 97);
+}
+
+static void LoopSink(void* ctx, UINT32 channel, const void* src, UINT32 numBytes, BOOLEAN eop) {
+    BENCH_LOOP* loop = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    const XDMA_DESC_PACKET* slot = &loop->slots[loop->packet % loop->numSlots];
+    const UINT64 version = loop->updated ? loop->packet : loop->packet % loop->numSlots;
+    if (loop->offset + numBytes > slot->length) {
+        loop->mismatches++;
+        return;
+    }
+    for (UINT32 i = 0; i < numBytes; i++) {
+        if (((const UINT8*)src)[i] != LoopPattern(version, loop->offset + i)) {
+            loop->mismatches++;
+            break;
+        }
+    }
+    loop->offset += numBytes;
+    if (eop) {
+        loop->mismatches += loop->offset != slot->length;
+        loop->packet++;
+        loop->offset = 0;
+    }
+}
+
+// write the content of slot number n into its place in a buffer of pairs of pages in reverse order
+static void LoopWriteSlot(const SCATTER_GATHER_ELEMENT* elements, const XDMA_DESC_PACKET* slot,
+                          UINT64 n) {
+    for (size_t i = 0; i < slot->length; i++) {
+        const size_t offset = slot->offset + i;
+        UINT8* pair = (UINT8*)(uintptr_t)elements[offset / (2 * PAGE_SIZE)].Address.QuadPart;
+        pair[offset % (2 * PAGE_SIZE)] = LoopPattern(n, i);
+    }
+}
+
+// Link a slot table into a circle across several segments the way XDMA_EngineProgramDma() does for
+// IOCTL_XDMA_SEND_LOOP. It must run lap after lap without interrupts, then in credit mode send
+// exactly the slots granted by EngineLoopCredit(), with their content updated in place in between.
+static int CheckSendLoop(void) {
+    enum { NUM_SEGMENTS = 4, SEGMENT_CAPACITY = 16, NUM_PAGES = 16, NUM_SLOTS = 24, LAPS = 5,
+           CREDIT_ROUNDS = 300 };
+
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.streaming = TRUE;
+    config.numC2H = 0;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    UINT8* pages = AllocPages(NUM_PAGES * PAGE_SIZE);
+    SCATTER_GATHER_ELEMENT elements[NUM_PAGES / 2];
+    for (ULONG i = 0; i < NUM_PAGES / 2; i++) {
+        elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages +
+                                       (NUM_PAGES / 2 - 1 - i) * 2 * PAGE_SIZE);
+        elements[i].Length = 2 * PAGE_SIZE;
+    }
+
+    // slots of various lengths, some crossing pages or pairs of pages
+    XDMA_DESC_PACKET slots[NUM_SLOTS];
+    for (ULONG i = 0; i < NUM_SLOTS; i++) {
+        slots[i].offset = i * 2700;
+        slots[i].length = 1 + (i * 977) % 2700;
+        LoopWriteSlot(elements, &slots[i], i);
+    }
+
+    DMA_DESCRIPTOR* segments[NUM_SEGMENTS];
+    UINT64 segmentLA[NUM_SEGMENTS];
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        segments[s] = AllocPages(SEGMENT_CAPACITY * sizeof(DMA_DESCRIPTOR));
+        segmentLA[s] = (UINT64)(uintptr_t)segments[s];
+    }
+    const XDMA_DESC_STORE store = { NUM_SEGMENTS, SEGMENT_CAPACITY, segments, segmentLA };
+
+    XDMA_DESC_LIST list;
+    ULONG slotEnds[NUM_SLOTS];
+    const ULONG appended = DescStoreBuildPackets(&store, &params, elements, NUM_PAGES / 2, slots,
+                                                 NUM_SLOTS, XDMA_DESC_EOP_BIT, &list, slotEnds);
+    DescLink(list.last, segmentLA[0], list.firstAdj);
+    const ULONG lap = slotEnds[NUM_SLOTS - 1];
+
+    XDMA_DESC_CHAIN first;
+    DescChainInit(&first, &params, segments[0], segmentLA[0], SEGMENT_CAPACITY);
+    BENCH_LOOP loop = { slots, NUM_SLOTS, FALSE, 0, 0, 0 };
+    XDMA_ModelSetCallbacks(model, NULL, LoopSink, NULL, &loop);
+
+    // free running: the engine is still busy after several laps and part of the next one
+    const UINT32 runDescriptors = LAPS * lap + lap / 2;
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+    const UINT32 ran = XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, runDescriptors);
+    const UINT32 busy = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0, status)) & XDMA_BUSY_BIT;
+    const UINT32 count = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0, completedDescCount));
+    StopEngine(model, XDMA_MODEL_H2C);
+
+    XDMA_MODEL_STATS stats;
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &stats);
+    const BOOLEAN freeOk = (appended == NUM_SLOTS) && (list.count == lap) && (list.segments > 1) &&
+        (ran == runDescriptors) && busy && (count == runDescriptors) &&
+        (LoopSlotsDone(slotEnds, NUM_SLOTS, count) == loop.packet) &&
+        (loop.packet >= (UINT64)LAPS * NUM_SLOTS) && (loop.mismatches == 0) &&
+        (stats.interrupts == 0) && (stats.errors == 0);
+
+    // credit mode: grant a few slots at a time, updating them in place first
+    XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0));
+    loop.updated = TRUE;
+    loop.packet = 0;
+    loop.offset = 0;
+    for (ULONG i = 0; i < NUM_SLOTS; i++) {
+        LoopWriteSlot(elements, &slots[i], i);
+    }
+    StartChain(model, XDMA_MODEL_H2C, &first, list.firstAdj);
+
+    UINT64 random = 0x853C49E6748FEA9BULL;
+    UINT64 granted = 0;
+    UINT64 descDone = 0;
+    UINT32 lastCount = 0;
+    ULONG creditFailures = 0;
+    for (ULONG round = 0; round < CREDIT_ROUNDS; round++) {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        const UINT64 sent = LoopSlotsDone(slotEnds, NUM_SLOTS, descDone);
+        const UINT64 room = sent + NUM_SLOTS - granted;
+        const ULONG numSlots = (ULONG)(1 + (random >> 33) % room);
+
+        // a slot may be rewritten once it has been sent in the previous lap
+        for (UINT64 n = granted; n < granted + numSlots; n++) {
+            if (n >= NUM_SLOTS) {
+                LoopWriteSlot(elements, &slots[n % NUM_SLOTS], n);
+            }
+        }
+        UINT64 credits = LoopSlotStart(slotEnds, NUM_SLOTS, granted + numSlots) -
+            LoopSlotStart(slotEnds, NUM_SLOTS, granted);
+        granted += numSlots;
+        while (credits > 0) {
+            const UINT32 grant = (UINT32)(credits < 1023 ? credits : 1023);
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_H2C, 0, descCredits), grant);
+            credits -= grant;
+        }
+
+        // send some of them, then all - the engine stalls at the last slot granted
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, (UINT32)((random >> 20) % lap));
+        const UINT32 partialCount = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0,
+                                                                       completedDescCount));
+        creditFailures += LoopSlotsDone(slotEnds, NUM_SLOTS,
+                                        descDone + ((partialCount - lastCount) & XDMA_WB_COUNT_MASK)) !=
+                          loop.packet;
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_H2C, 0, 2 * lap);
+        const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_H2C, 0,
+                                                                    completedDescCount));
+        descDone += (completed - lastCount) & XDMA_WB_COUNT_MASK;
+        lastCount = completed;
+        creditFailures += (LoopSlotsDone(slotEnds, NUM_SLOTS, descDone) != granted) ||
+                          (loop.packet != granted) ||
+                          (descDone != LoopSlotStart(slotEnds, NUM_SLOTS, granted));
+    }
+    StopEngine(model, XDMA_MODEL_H2C);
+    XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1C), BIT_N(0));
+
+    XDMA_ModelGetStats(model, XDMA_MODEL_H2C, 0, &stats);
+    const BOOLEAN creditOk = (creditFailures == 0) && (loop.mismatches == 0) &&
+        (granted > 4 * NUM_SLOTS) && (stats.interrupts == 0) && (stats.errors == 0);
+    const BOOLEAN ok = freeOk && creditOk;
+
+    printf("\nsend loop (H2C AXI-ST, %u slots, %u segments of %u)\n",
+           (unsigned)NUM_SLOTS, (unsigned)NUM_SEGMENTS, (unsigned)SEGMENT_CAPACITY);
+    printf("%12s %10s %10s %10s %10s %8s\n", "desc/lap", "segments", "free laps", "credited",
+           "stalls", "check");
+    printf("%12lu %10lu %10.2f %10llu %10llu %8s\n", (unsigned long)lap,
+           (unsigned long)list.segments, (double)runDescriptors / lap, (unsigned long long)granted,
+           (unsigned long long)stats.stallsNoCredit, ok ? "ok" : "FAIL");
+
+    for (ULONG s = 0; s < NUM_SEGMENTS; s++) {
+        free(segments[s]);
+    }
+    free(pages);
+    XDMA_ModelDestroy(model);
+    return !ok;
+}
+
+// ========================= hybrid completion ====================================================
+
+// Feed the spin estimate with runs of a device taking 1us + 0.25ns/B (4 GB/s) and check which
+// run lengths end up spinning with a max spin of 50us
+static int CheckSpinBudget(void) {
+    static const UINT64 sizes[] = { 4096, 65536, 1024 * 1024, 8 * 1024 * 1024 };
+    enum { NUM_SIZES = sizeof(sizes) / sizeof(sizes[0]), NUM_RUNS = 256 };
+    const UINT64 maxSpinNs = 50000;
+    int failures = 0;
+
+    printf("\nhybrid completion spin budget (1us + 0.25ns/B, max spin %lluus)\n",
+           (unsigned long long)(maxSpinNs / 1000));
+    printf("%10s %12s %12s %8s %8s\n", "bytes", "actual ns", "budget ns", "spins", "check");
+    for (ULONG i = 0; i < NUM_SIZES; i++) {
+        XDMA_SPIN_ESTIMATE est;
+        SpinEstimateInit(&est, maxSpinNs);
+
+        const UINT64 actual = 1000 + sizes[i] / 4;
+        UINT64 budget = 0;
+        ULONG spins = 0;
+        for (ULONG r = 0; r < NUM_RUNS; r++) {
+            budget = SpinBudgetNs(&est, sizes[i]);
+            if (budget == 0) {
+                continue; // interrupt
+            }
+            spins++;
+            SpinEstimateUpdate(&est, sizes[i], actual < budget ? actual : budget, actual < budget);
+        }
+
+        // runs completing within the max spin keep spinning, longer ones learn that and then only
+        // probe once in a while
+        const BOOLEAN ok = (actual < maxSpinNs) ? (spins == NUM_RUNS) && (budget >= actual) :
+                           (spins < NUM_RUNS / 8) && (budget == 0);
+        failures += !ok;
+        printf("%10llu %12llu %12llu %8lu %8s\n", (unsigned long long)sizes[i],
+               (unsigned long long)actual, (unsigned long long)budget, (unsigned long)spins,
+               ok ? "ok" : "FAIL");
+    }
+    return failures;
+}
+
+// ========================= ring consumption =====================================================
+
+typedef struct BENCH_RING_T {
+    UINT8* blocks;          // ring data blocks
+    UINT8* output;          // consumer destination
+    size_t blockSize;
+    UINT8 sequence;         // fill pattern of the next produced block
+    UINT64 checksum;        // keeps the in place consumption from being optimized away
+} BENCH_RING;
+
+static UINT32 RingSource(void* ctx, UINT32 channel, void* dst, UINT32 maxBytes, BOOLEAN* eop) {
+    BENCH_RING* ring = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    memset(dst, ring->sequence++, maxBytes);
+    *eop = TRUE;
+    return maxBytes;
+}
+
+static NTSTATUS RingCopyMemcpy(PVOID ctx, size_t offset, UINT block, size_t numBytes) {
+    BENCH_RING* ring = ctx;
+    memcpy(ring->output + offset, ring->blocks + (size_t)block * ring->blockSize, numBytes);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS RingCopyNone(PVOID ctx, size_t offset, UINT block, size_t numBytes) {
+    UNREFERENCED_PARAMETER(ctx);
+    UNREFERENCED_PARAMETER(offset);
+    UNREFERENCED_PARAMETER(block);
+    UNREFERENCED_PARAMETER(numBytes);
+    return STATUS_SUCCESS;
+}
+
+// the producer side of EngineRingReceive(): one read of the completed descriptor count, then the
+// results of exactly the blocks it advanced by
+static UINT RingReceive(XDMA_MODEL* model, DMA_RESULT* results, UINT numBlocks, UINT* tail,
+                        UINT32* completedCount) {
+    const UINT32 completed = XDMA_ModelRead32(model, ENGINE_REG(XDMA_MODEL_C2H, 0, completedDescCount));
+    return RingProcessResults(results, numBlocks, tail, RingCompletedBlocks(completedCount, completed));
+}
+
+// Run several laps of circular chains of various geometries and descriptor buffer placements
+// (crossing 4K boundaries at different positions) through the model. The model rejects fetch blocks
+// which violate the adjacency rules; after the first lap every lap takes the same fetches.
+static int CheckRingWrap(void) {
+    static const UINT geometries[] = { 2, 3, 17, 127, 258, BENCH_RING_MAX_BLOCKS };
+    static const size_t offsets[] = { 0, 0x20, 0x7E0, 0xFE0 };
+    int failures = 0;
+
+    printf("\nring wrap-around (C2H AXI-ST, %u laps)\n", BENCH_RING_LAPS);
+    printf("%10s %10s %12s %12s %8s\n", "blocks", "offset", "fetches/lap", "first lap", "check");
+
+    for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+        for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+            const UINT ringBlocks = geometries[g];
+            XDMA_MODEL_CONFIG config;
+            XDMA_ModelDefaultConfig(&config);
+            config.streaming = TRUE;
+            config.numH2C = 0;
+
+            XDMA_MODEL* model = XDMA_ModelCreate(&config);
+            if (!model) {
+                fprintf(stderr, "XDMA_ModelCreate failed\n");
+                return failures + 1;
+            }
+
+            XDMA_DESC_PARAMS params;
+            ParamsFromModel(&config, &params);
+
+            BENCH_RING ring = { 0 };
+            ring.blockSize = BENCH_RING_BLOCK_SIZE;
+            ring.blocks = AllocPages(ringBlocks * BENCH_RING_BLOCK_SIZE);
+            DMA_RESULT* results = AllocPages(ringBlocks * sizeof(DMA_RESULT));
+            UINT8* descMem = AllocPages(offsets[o] + ringBlocks * sizeof(DMA_DESCRIPTOR));
+            DMA_DESCRIPTOR* descBuffer = (DMA_DESCRIPTOR*)(descMem + offsets[o]);
+            XDMA_ModelSetCallbacks(model, RingSource, NULL, NULL, &ring);
+
+            XDMA_DESC_CHAIN chain;
+            DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, ringBlocks);
+            for (UINT i = 0; i < ringBlocks; i++) {
+                DescChainAppend(&chain, C2H,
+                                (UINT64)(uintptr_t)(ring.blocks + i * BENCH_RING_BLOCK_SIZE),
+                                (UINT64)(uintptr_t)&results[i], BENCH_RING_BLOCK_SIZE,
+                                XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+            }
+            DescChainMakeCircular(&chain);
+            const UINT32 firstAdj = DescChainOptimize(&chain);
+
+            XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), ringBlocks - 1);
+            StartChain(model, XDMA_MODEL_C2H, &chain, firstAdj);
+
+            // produce and consume a lap in steps of half the ring
+            UINT head = 0;
+            UINT tail = 0;
+            UINT32 completedCount = 0;
+            UINT64 fetches[BENCH_RING_LAPS] = { 0 };
+            BOOLEAN ok = TRUE;
+            for (UINT lap = 0; lap < BENCH_RING_LAPS; lap++) {
+                XDMA_MODEL_STATS before;
+                XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &before);
+                UINT produced = 0;
+                while (ok && (produced < ringBlocks)) {
+                    UINT step = (ringBlocks + 1) / 2;
+                    if (step > ringBlocks - produced) {
+                        step = ringBlocks - produced;
+                    }
+                    const UINT32 done = XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, step);
+                    RingReceive(model, results, ringBlocks, &tail, &completedCount);
+                    size_t bytesCopied = 0;
+                    UINT32 consumed = 0;
+                    NTSTATUS status = RingCopyBlocks(results, ringBlocks, &head, tail,
+                                                     (size_t)step * BENCH_RING_BLOCK_SIZE,
+                                                     RingCopyNone, &ring, &bytesCopied, &consumed);
+                    ok = NT_SUCCESS(status) && (done == step) && (consumed == step);
+                    XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), consumed);
+                    produced += step;
+                }
+                XDMA_MODEL_STATS after;
+                XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &after);
+                ok = ok && (after.errors == 0);
+                fetches[lap] = after.descFetches - before.descFetches;
+            }
+            for (UINT lap = 2; lap < BENCH_RING_LAPS; lap++) {
+                ok = ok && (fetches[lap] == fetches[1]);
+            }
+            failures += !ok;
+
+            printf("%10u %#10lx %12llu %12llu %8s\n", ringBlocks, (unsigned long)offsets[o],
+                   (unsigned long long)fetches[1], (unsigned long long)fetches[0],
+                   ok ? "ok" : "FAIL");
+
+            StopEngine(model, XDMA_MODEL_C2H);
+            free(descMem);
+            free(results);
+            free(ring.blocks);
+            XDMA_ModelDestroy(model);
+        }
+    }
+    return failures;
+}
+
+static int BenchRing(UINT64 work, UINT ringBlocks, size_t blockSize, PFN_XDMA_RING_COPY copy,
+                     const char* name) {
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.streaming = TRUE;
+    config.numH2C = 0;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return 1;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    BENCH_RING ring = { 0 };
+    ring.blockSize = blockSize;
+    ring.blocks = AllocPages(ringBlocks * blockSize);
+    ring.output = AllocPages(ringBlocks * blockSize);
+    DMA_RESULT* results = AllocPages(ringBlocks * sizeof(DMA_RESULT));
+    DMA_DESCRIPTOR* descBuffer = AllocPages(ringBlocks * sizeof(DMA_DESCRIPTOR));
+    XDMA_ModelSetCallbacks(model, RingSource, NULL, NULL, &ring);
+
+    // same chain as EngineRingProgramDma()
+    XDMA_DESC_CHAIN chain;
+    DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, ringBlocks);
+    for (UINT i = 0; i < ringBlocks; i++) {
+        DescChainAppend(&chain, C2H, (UINT64)(uintptr_t)(ring.blocks + i * blockSize),
+                        (UINT64)(uintptr_t)&results[i], (UINT32)blockSize,
+                        XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    }
+    DescChainMakeCircular(&chain);
+    const UINT32 firstAdj = DescChainOptimize(&chain);
+
+    XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+    XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), ringBlocks - 1);
+    StartChain(model, XDMA_MODEL_C2H, &chain, firstAdj);
+
+    static const UINT sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    UINT head = 0;
+    UINT tail = 0;
+    UINT32 completedCount = 0;
+    int failures = 0;
+
+    printf("\nring consumption (C2H AXI-ST, %u blocks of %luB, copy=%s)\n",
+           ringBlocks, (unsigned long)blockSize, name);
+    printf("%10s %12s %12s %8s\n", "blocks", "ns/block", "rounds", "check");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const UINT numBlocks = sizes[s];
+        if (numBlocks >= ringBlocks) {
+            break;
+        }
+        const UINT64 rounds = work / numBlocks ? work / numBlocks : 1;
+        const size_t length = (size_t)numBlocks * blockSize;
+        UINT64 elapsed = 0;
+        BOOLEAN ok = TRUE;
+
+        for (UINT64 r = 0; r < rounds; r++) {
+            // produce (not timed)
+            XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, numBlocks);
+
+            // consume: what EngineProcessRing() and EngineRingCopyBytesToMemory() do
+            const UINT64 start = NowNs();
+            const UINT eopCount = RingReceive(model, results, ringBlocks, &tail, &completedCount);
+            size_t bytesCopied = 0;
+            UINT32 consumed = 0;
+            NTSTATUS status = STATUS_SUCCESS;
+            if (copy != NULL) {
+                status = RingCopyBlocks(results, ringBlocks, &head, tail, length, copy, &ring,
+                                        &bytesCopied, &consumed);
+            } else {
+                // a process consuming the mapped ring in place: look at each received block, then
+                // hand them back through the consumer index (EngineRingReleaseConsumed())
+                UINT64 sum = 0;
+                for (UINT i = head; i != tail; RingAdvance(&i, ringBlocks)) {
+                    sum += ring.blocks[(size_t)i * blockSize];
+                    bytesCopied += results[i].length;
+                    ok = ok && (results[i].status & XDMA_RESULT_EOP_BIT);
+                }
+                ring.checksum += sum;
+                ok = ok && (RingReleaseBlocks(results, ringBlocks, &head, tail, tail + 1) == 0);
+                consumed = RingReleaseBlocks(results, ringBlocks, &head, tail, tail);
+            }
+            elapsed += NowNs() - start;
+
+            ok = ok && NT_SUCCESS(status) && (eopCount == numBlocks) && (consumed == numBlocks)
+                && (bytesCopied == length);
+
+            // return the credits
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), consumed);
+        }
+
+        XDMA_MODEL_STATS stats;
+        XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &stats);
+        ok = ok && (stats.errors == 0);
+        failures += !ok;
+
+        printf("%10u %12.2f %12lu %8s\n", numBlocks,
+               (double)elapsed / (double)(rounds * numBlocks), (unsigned long)rounds,
+               ok ? "ok" : "FAIL");
+    }
+
+    StopEngine(model, XDMA_MODEL_C2H);
+    free(descBuffer);
+    free(results);
+    free(ring.output);
+    free(ring.blocks);
+    XDMA_ModelDestroy(model);
+    return failures;
+}
+
+// ========================= ring credit return ===================================================
+
+typedef struct BENCH_CREDIT_RUN_T {
+    UINT64 blocks;          // blocks read
+    UINT64 writes;          // writes of the credit register
+    UINT64 stalls;          // model service attempts without credits
+    UINT peakOccupancy;
+    BOOLEAN ok;
+} BENCH_CREDIT_RUN;
+
+// Stream through a ring: each round the engine receives up to 'produce' blocks, the dpc looks at
+// the ring, then a read takes up to 'consume' blocks (both random). The credits go back with each
+// read, or in batches through RingCreditsTake() like EngineProcessRing() and
+// EngineRingCopyBytesToMemory() return them. Checks the order of the data and the accounting.
+static BENCH_CREDIT_RUN RunRingCredits(UINT ringBlocks, UINT produce, UINT consume, UINT rounds,
+                                       BOOLEAN batched) {
+    BENCH_CREDIT_RUN run = { 0 };
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.streaming = TRUE;
+    config.numH2C = 0;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return run;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    const size_t blockSize = 64; // only the fill pattern is checked
+    BENCH_RING ring = { 0 };
+    ring.blockSize = blockSize;
+    ring.blocks = AllocPages(ringBlocks * blockSize);
+    ring.output = AllocPages(ringBlocks * blockSize);
+    DMA_RESULT* results = AllocPages(ringBlocks * sizeof(DMA_RESULT));
+    DMA_DESCRIPTOR* descBuffer = AllocPages(ringBlocks * sizeof(DMA_DESCRIPTOR));
+    XDMA_ModelSetCallbacks(model, RingSource, NULL, NULL, &ring);
+
+    XDMA_DESC_CHAIN chain;
+    DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, ringBlocks);
+    for (UINT i = 0; i < ringBlocks; i++) {
+        DescChainAppend(&chain, C2H, (UINT64)(uintptr_t)(ring.blocks + i * blockSize),
+                        (UINT64)(uintptr_t)&results[i], (UINT32)blockSize,
+                        XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    }
+    DescChainMakeCircular(&chain);
+    const UINT32 firstAdj = DescChainOptimize(&chain);
+
+    XDMA_RING_CREDITS credits;
+    XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+    XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits),
+                      RingCreditsInit(&credits, ringBlocks));
+    StartChain(model, XDMA_MODEL_C2H, &chain, firstAdj);
+
+    UINT head = 0;
+    UINT tail = 0;
+    UINT32 completedCount = 0;
+    UINT8 expected = 0;
+    UINT64 random = 0xDA942042E4DD58B5ULL;
+    run.ok = TRUE;
+    for (UINT r = 0; run.ok && (r < rounds); r++) {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, 1 + (UINT32)((random >> 33) % produce));
+
+        // dpc
+        const UINT prevTail = tail;
+        RingReceive(model, results, ringBlocks, &tail, &completedCount);
+        RingCreditsReceived(&credits, (tail + ringBlocks - prevTail) % ringBlocks);
+        const UINT occupancy = (tail + ringBlocks - head) % ringBlocks;
+        if (occupancy > run.peakOccupancy) {
+            run.peakOccupancy = occupancy;
+        }
+        UINT32 grant = batched ? RingCreditsTake(&credits) : 0;
+        if (grant) {
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), grant);
+            run.writes++;
+        }
+
+        // read
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        const UINT length = (UINT)((random >> 33) % (consume + 1));
+        size_t bytesCopied = 0;
+        UINT32 consumed = 0;
+        NTSTATUS status = RingCopyBlocks(results, ringBlocks, &head, tail, length * blockSize,
+                                         RingCopyMemcpy, &ring, &bytesCopied, &consumed);
+        run.ok = NT_SUCCESS(status) && (bytesCopied == consumed * blockSize);
+        for (UINT32 i = 0; i < consumed; i++, expected++) {
+            run.ok = run.ok && (ring.output[i * blockSize] == expected)
+                && (ring.output[(i + 1) * blockSize - 1] == expected);
+        }
+        run.blocks += consumed;
+        if (batched) {
+            RingCreditsFreed(&credits, consumed);
+            grant = RingCreditsTake(&credits);
+        } else {
+            grant = consumed;
+        }
+        if (grant) {
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), grant);
+            run.writes++;
+        }
+
+        // every block is held by the engine, waits for a grant or has been received
+        UINT32 held, freed;
+        RingCreditsGet(&credits, &held, &freed);
+        run.ok = run.ok && (!batched || (held + freed + (tail + ringBlocks - head) % ringBlocks
+                                         == ringBlocks - 1));
+    }
+
+    XDMA_MODEL_STATS stats;
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &stats);
+    run.ok = run.ok && (stats.errors == 0);
+    run.stalls = stats.stallsNoCredit;
+
+    StopEngine(model, XDMA_MODEL_C2H);
+    free(descBuffer);
+    free(results);
+    free(ring.output);
+    free(ring.blocks);
+    XDMA_ModelDestroy(model);
+    return run;
+}
+
+// Batched credit return against a grant per read. Where the reader keeps up and the engine receives
+// less than the low water mark of the credits between two looks of the dpc, the batches may not
+// cost the engine a stall. A slow reader stalls the engine either way.
+static int CheckRingCredits(void) {
+    static const struct {
+        UINT ringBlocks;
+        UINT produce;
+        UINT consume;
+        BOOLEAN keepsUp;
+    } runs[] = {
+        { 3, 1, 2, TRUE },
+        { 258, 24, 64, TRUE },
+        { 258, 8, 4, FALSE },
+        { 258, 32, 32, FALSE },
+        { 1024, 96, 256, TRUE },
+        { 1024, 128, 120, FALSE },
+    };
+    const UINT rounds = 20000;
+    int failures = 0;
+
+    printf("\nring credit return (C2H AXI-ST, %u rounds)\n", rounds);
+    printf("%8s %8s %8s %10s %10s %10s %10s %10s %8s\n", "blocks", "produce", "consume",
+           "read", "writes", "per read", "stalls", "per read", "check");
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        const BENCH_CREDIT_RUN batched = RunRingCredits(runs[i].ringBlocks, runs[i].produce,
+                                                        runs[i].consume, rounds, TRUE);
+        const BENCH_CREDIT_RUN perRead = RunRingCredits(runs[i].ringBlocks, runs[i].produce,
+                                                        runs[i].consume, rounds, FALSE);
+        BOOLEAN ok = batched.ok && perRead.ok && (batched.writes <= perRead.writes);
+        if (runs[i].keepsUp) {
+            ok = ok && (batched.stalls <= perRead.stalls);
+        }
+        failures += !ok;
+
+        printf("%8u %8u %8u %10llu %10llu %10llu %10llu %10llu %8s\n", runs[i].ringBlocks,
+               runs[i].produce, runs[i].consume, (unsigned long long)batched.blocks,
+               (unsigned long long)batched.writes, (unsigned long long)perRead.writes,
+               (unsigned long long)batched.stalls, (unsigned long long)perRead.stalls,
+               ok ? "ok" : "FAIL");
+    }
+    return failures;
+}
+
+// ========================= ring copy ============================================================
+
+// Copy throughput out of ring blocks: memcpy against the streaming load kernel which reads
+// write-combined rings (RingCopyStreaming()). A user process cannot map non-cached or
+// write-combined memory, so both read cached memory here - the numbers show the cost of the kernel
+// itself, its gain on write-combined memory only shows on the target. Odd lengths and destination
+// offsets are checked against the source.
+static int BenchRingCopy(UINT64 work) {
+    static const size_t sizes[] = { 4096, 65536, 1024 * 1024 };
+    static const size_t lengths[] = { 1, 15, 16, 17, 63, 64, 67, 4095 };
+    static const size_t offsets[] = { 0, 1, 8, 13 };
+    const BOOLEAN streaming = RingStreamingCopySupported();
+    int failures = 0;
+
+    printf("\nring copy (C2H AXI-ST, %s)\n",
+           streaming ? "streaming loads" : "no streaming loads - not measured");
+    printf("%10s %12s %12s %8s\n", "block", "memcpy GB/s", "stream GB/s", "check");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const size_t blockSize = sizes[s];
+        UINT8* src = AllocPages(blockSize);
+        UINT8* dst = AllocPages(blockSize + 64);
+        for (size_t i = 0; i < blockSize; i++) {
+            src[i] = (UINT8)(i * 7 + s);
+        }
+        const UINT64 rounds = (work * PAGE_SIZE) / blockSize ? (work * PAGE_SIZE) / blockSize : 1;
+
+        UINT64 start = NowNs();
+        for (UINT64 r = 0; r < rounds; r++) {
+            memcpy(dst, src, blockSize);
+            __asm__ __volatile__("" : : "r"(dst) : "memory"); // keep the copies
+        }
+        const UINT64 memcpyNs = NowNs() - start;
+
+        UINT64 streamNs = 0;
+        BOOLEAN ok = TRUE;
+        if (streaming) {
+            start = NowNs();
+            for (UINT64 r = 0; r < rounds; r++) {
+                RingCopyStreaming(dst, src, blockSize);
+                __asm__ __volatile__("" : : "r"(dst) : "memory");
+            }
+            streamNs = NowNs() - start;
+
+            ok = memcmp(dst, src, blockSize) == 0;
+            for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+                for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+                    const size_t length = lengths[l] < blockSize ? lengths[l] : blockSize;
+                    memset(dst, 0xEE, blockSize + 64);
+                    RingCopyStreaming(dst + offsets[o], src, length);
+                    ok = ok && (memcmp(dst + offsets[o], src, length) == 0)
+                        && (dst[offsets[o] + length] == 0xEE)
+                        && ((offsets[o] == 0) || (dst[offsets[o] - 1] == 0xEE));
+                }
+            }
+        }
+        failures += !ok;
+
+        const double bytes = (double)rounds * (double)blockSize;
+        printf("%10lu %12.2f %12.2f %8s\n", (unsigned long)blockSize, bytes / (double)memcpyNs,
+               streaming ? bytes / (double)streamNs : 0.0, ok ? "ok" : "FAIL");
+
+        free(dst);
+        free(src);
+    }
+    return failures;
+}
+
+// ========================= ring index handoff ===================================================
+
+typedef struct BENCH_SPSC_T {
+    UINT numBlocks;
+    UINT8* blocks;
+    DMA_RESULT* results;
+    UINT64 numTotal;                // blocks to stream
+    BOOLEAN locked;                 // hand the indices over under the lock, like the driver did
+    pthread_spinlock_t lock;
+    UINT64 locks;                   // lock acquisitions
+    UINT pool;                      // credits the engine took from the register, left at the end
+    UINT64 expected;                // sequence number of the next block - consumer
+    UINT64 errors;
+
+    // same layout as XDMA_RING
+    DECLSPEC_CACHEALIGN volatile UINT head;
+    DECLSPEC_CACHEALIGN volatile UINT tail;
+    XDMA_RING_CREDITS credits;
+    DECLSPEC_CACHEALIGN volatile UINT engineCredits; // the credit register - each write adds
+} BENCH_SPSC;
+
+#define BENCH_SPSC_BLOCK_SIZE       (64U)
+#define BENCH_SPSC_BURST            (32U)
+
+static void SpscGrant(BENCH_SPSC* spsc, UINT32 grant) {
+    if (grant) {
+        __atomic_fetch_add(&spsc->engineCredits, grant, __ATOMIC_RELEASE);
+    }
+}
+
+// the engine and EngineProcessRing()
+static void* SpscProducer(void* ctx) {
+    BENCH_SPSC* spsc = ctx;
+    const UINT numBlocks = spsc->numBlocks;
+    UINT next = 0;
+    UINT pool = 0;
+    UINT tail = 0;
+    UINT32 completed = 0;           // the completed descriptor count of the engine
+    UINT32 completedCount = 0;
+    UINT64 sequence = 0;
+
+    while (sequence < spsc->numTotal) {
+        // engine: receive a burst into the blocks it holds credits for
+        pool += __atomic_exchange_n(&spsc->engineCredits, 0, __ATOMIC_ACQUIRE);
+        const UINT burst = 1 + (UINT)(sequence % BENCH_SPSC_BURST);
+        for (UINT n = 0; (n < burst) && (pool > 0) && (sequence < spsc->numTotal); n++) {
+            UINT64* block = (UINT64*)(spsc->blocks + (size_t)next * BENCH_SPSC_BLOCK_SIZE);
+            block[0] = sequence;
+            block[BENCH_SPSC_BLOCK_SIZE / sizeof(UINT64) - 1] = ~sequence;
+            spsc->results[next].length = BENCH_SPSC_BLOCK_SIZE;
+            spsc->results[next].status = XDMA_RESULT_MAGIC | XDMA_RESULT_EOP_BIT;
+            RingAdvance(&next, numBlocks);
+            pool--;
+            sequence++;
+            completed++;
+        }
+
+        // dpc
+        UINT32 grant;
+        if (spsc->locked) {
+            pthread_spin_lock(&spsc->lock);
+            tail = spsc->tail;
+            pthread_spin_unlock(&spsc->lock);
+        }
+        const UINT prevTail = tail;
+        RingProcessResults(spsc->results, numBlocks, &tail,
+                           RingCompletedBlocks(&completedCount, completed));
+        if (spsc->locked) {
+            pthread_spin_lock(&spsc->lock);
+            spsc->tail = tail;
+            RingCreditsReceived(&spsc->credits, (tail + numBlocks - prevTail) % numBlocks);
+            grant = RingCreditsTake(&spsc->credits);
+            pthread_spin_unlock(&spsc->lock);
+            __atomic_fetch_add(&spsc->locks, 2, __ATOMIC_RELAXED);
+        } else {
+            RingWriteRelease(&spsc->tail, tail);
+            RingCreditsReceived(&spsc->credits, (tail + numBlocks - prevTail) % numBlocks);
+            grant = RingCreditsTake(&spsc->credits);
+        }
+        SpscGrant(spsc, grant);
+        if (tail == prevTail) {
+            sched_yield();
+        }
+    }
+    spsc->pool = pool;
+    return NULL;
+}
+
+static NTSTATUS SpscCheckBlock(PVOID ctx, size_t offset, UINT block, size_t numBytes) {
+    BENCH_SPSC* spsc = ctx;
+    const UINT64* data = (const UINT64*)(spsc->blocks + (size_t)block * BENCH_SPSC_BLOCK_SIZE);
+    UNREFERENCED_PARAMETER(offset);
+    if ((numBytes != BENCH_SPSC_BLOCK_SIZE) || (data[0] != spsc->expected)
+        || (data[BENCH_SPSC_BLOCK_SIZE / sizeof(UINT64) - 1] != ~spsc->expected)) {
+        spsc->errors++;
+    }
+    spsc->expected++;
+    return STATUS_SUCCESS;
+}
+
+// EngineRingCopyBytesToMemory()
+static void* SpscConsumer(void* ctx) {
+    BENCH_SPSC* spsc = ctx;
+    UINT head = 0;
+
+    while (spsc->expected < spsc->numTotal) {
+        UINT tail;
+        if (spsc->locked) {
+            pthread_spin_lock(&spsc->lock);
+            head = spsc->head;
+            tail = spsc->tail;
+            pthread_spin_unlock(&spsc->lock);
+        } else {
+            tail = RingReadAcquire(&spsc->tail);
+        }
+        if (tail == head) {
+            sched_yield();
+            continue;
+        }
+
+        size_t bytesCopied = 0;
+        UINT32 consumed = 0;
+        RingCopyBlocks(spsc->results, spsc->numBlocks, &head, tail, SIZE_MAX, SpscCheckBlock, spsc,
+                       &bytesCopied, &consumed);
+
+        UINT32 grant;
+        if (spsc->locked) {
+            pthread_spin_lock(&spsc->lock);
+            spsc->head = head;
+            RingCreditsFreed(&spsc->credits, consumed);
+            grant = RingCreditsTake(&spsc->credits);
+            pthread_spin_unlock(&spsc->lock);
+            __atomic_fetch_add(&spsc->locks, 2, __ATOMIC_RELAXED);
+        } else {
+            RingWriteRelease(&spsc->head, head);
+            RingCreditsFreed(&spsc->credits, consumed);
+            grant = RingCreditsTake(&spsc->credits);
+        }
+        SpscGrant(spsc, grant);
+    }
+    return NULL;
+}
+
+// Stream blocks from an engine/dpc thread to a reader thread through a ring, with the indices
+// handed over under a spin lock (as the driver did) or lock-free. The reader checks the sequence
+// of every block; at the end all credits must be back with the engine.
+static int BenchRingHandoff(UINT64 work) {
+    static const UINT geometries[] = { 3, 17, 258, BENCH_RING_MAX_BLOCKS };
+    int failures = 0;
+
+    printf("\nring index handoff (C2H AXI-ST, %llu blocks, engine/dpc and reader thread)\n",
+           (unsigned long long)work);
+    printf("%10s %10s %10s %12s %8s\n", "blocks", "lock", "ns/block", "locks/block", "check");
+
+    for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+        for (int locked = 1; locked >= 0; locked--) {
+            BENCH_SPSC* spsc = AllocPages(sizeof(BENCH_SPSC));
+            memset(spsc, 0, sizeof(*spsc));
+            spsc->numBlocks = geometries[g];
+            spsc->blocks = AllocPages((size_t)spsc->numBlocks * BENCH_SPSC_BLOCK_SIZE);
+            spsc->results = AllocPages(spsc->numBlocks * sizeof(DMA_RESULT));
+            memset(spsc->results, 0, spsc->numBlocks * sizeof(DMA_RESULT));
+            spsc->numTotal = work;
+            spsc->locked = (BOOLEAN)locked;
+            pthread_spin_init(&spsc->lock, PTHREAD_PROCESS_PRIVATE);
+            spsc->engineCredits = RingCreditsInit(&spsc->credits, spsc->numBlocks);
+
+            const UINT64 start = NowNs();
+            pthread_t producer, consumer;
+            BOOLEAN ok = (pthread_create(&producer, NULL, SpscProducer, spsc) == 0);
+            ok = ok && (pthread_create(&consumer, NULL, SpscConsumer, spsc) == 0);
+            if (ok) {
+                pthread_join(producer, NULL);
+                pthread_join(consumer, NULL);
+            }
+            const UINT64 elapsed = NowNs() - start;
+
+            UINT32 held, freed;
+            RingCreditsGet(&spsc->credits, &held, &freed);
+            ok = ok && (spsc->errors == 0) && (spsc->expected == work) && (spsc->head == spsc->tail)
+                && (held + freed == spsc->numBlocks - 1)
+                && (held == spsc->pool + spsc->engineCredits);
+            failures += !ok;
+
+            printf("%10u %10s %10.2f %12.2f %8s\n", spsc->numBlocks, locked ? "spin" : "none",
+                   (double)elapsed / (double)work, (double)spsc->locks / (double)work,
+                   ok ? "ok" : "FAIL");
+
+            pthread_spin_destroy(&spsc->lock);
+            free(spsc->results);
+            free(spsc->blocks);
+            free(spsc);
+        }
+    }
+    return failures;
+}
+
+typedef struct BENCH_PACKETS_T {
+    UINT64 random;          // state of the packet length generator
+    UINT32 numBlocks;       // of the ring
+    UINT32 sequence;        // of the packet being sent
+    size_t length;          // of the packet being sent
+    size_t offset;          // bytes sent of it
+    UINT8* blocks;          // ring data
+    UINT8* output;          // batch
+} BENCH_PACKETS;
+
+// content of a packet byte - changes with every packet and every block of a packet
+static UINT8 PacketPattern(UINT32 sequence, size_t offset) {
+    return (UINT8)(sequence * 13 + offset / BENCH_RING_BLOCK_SIZE);
+}
+
+// mostly short packets, some over several blocks and a few larger than the ring
+static size_t PacketLength(BENCH_PACKETS* packets) {
+    packets->random = packets->random * 6364136223846793005ULL + 1442695040888963407ULL;
+    const UINT32 r = (UINT32)(packets->random >> 33);
+    if (r % 64 == 0) {
+        return (size_t)packets->numBlocks * BENCH_RING_BLOCK_SIZE + r % 10000;
+    } else if (r % 8 == 0) {
+        return 1 + r % (3 * BENCH_RING_BLOCK_SIZE);
+    }
+    return 1 + r % 256;
+}
+
+static UINT32 PacketSource(void* ctx, UINT32 channel, void* dst, UINT32 maxBytes, BOOLEAN* eop) {
+    BENCH_PACKETS* packets = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    if (packets->offset == packets->length) {
+        packets->sequence++;
+        packets->length = PacketLength(packets);
+        packets->offset = 0;
+    }
+    UINT32 numBytes = maxBytes;
+    if (numBytes > packets->length - packets->offset) {
+        numBytes = (UINT32)(packets->length - packets->offset);
+    }
+    for (UINT32 i = 0; i < numBytes; i++) {
+        ((UINT8*)dst)[i] = PacketPattern(packets->sequence, packets->offset + i);
+    }
+    packets->offset += numBytes;
+    *eop = packets->offset == packets->length;
+    return numBytes;
+}
+
+static NTSTATUS PacketCopy(PVOID ctx, size_t offset, UINT block, size_t numBytes) {
+    BENCH_PACKETS* packets = ctx;
+    memcpy(packets->output + offset, packets->blocks + (size_t)block * BENCH_RING_BLOCK_SIZE,
+           numBytes);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS PacketStore(PVOID ctx, size_t offset, const VOID* src, size_t numBytes) {
+    BENCH_PACKETS* packets = ctx;
+    memcpy(packets->output + offset, src, numBytes);
+    return STATUS_SUCCESS;
+}
+
+// Stream packets of random lengths through the ring and read them back as batches into buffers of
+// various sizes, the way EngineProcessRing() and EngineRingCopyBytesToMemory() do in packet mode.
+// Every packet must come back whole and in order, except where the buffer could not even hold it
+// alone (truncated) or it did not fit the ring (in pieces). With timestamps the blocks are stamped
+// with the number of the read they were received before; an entry must carry the stamp of its last
+// block.
+static int CheckPacketBatch(void) {
+    static const UINT geometries[] = { 2, 17, 258 };
+    static const size_t lengths[] = { 16, 100, 4096, 65536, 1 << 20 };
+    int failures = 0;
+
+    printf("\npacket batches (C2H AXI-ST, %u packets)\n", BENCH_BATCH_PACKETS);
+    printf("%10s %10s %10s %10s %10s %10s %8s\n", "blocks", "stamps", "reads", "truncated",
+           "overflows", "packets/rd", "check");
+
+    for (size_t g = 0; g < 2 * sizeof(geometries) / sizeof(geometries[0]); g++) {
+        const UINT ringBlocks = geometries[g / 2];
+        const BOOLEAN stamped = g % 2;
+        const size_t entrySize = stamped ? sizeof(XDMA_RING_PACKET_TS) : sizeof(XDMA_RING_PACKET);
+        XDMA_MODEL_CONFIG config;
+        XDMA_ModelDefaultConfig(&config);
+        config.streaming = TRUE;
+        config.numH2C = 0;
+
+        XDMA_MODEL* model = XDMA_ModelCreate(&config);
+        if (!model) {
+            fprintf(stderr, "XDMA_ModelCreate failed\n");
+            return failures + 1;
+        }
+
+        XDMA_DESC_PARAMS params;
+        ParamsFromModel(&config, &params);
+
+        BENCH_PACKETS packets = { 0 };
+        packets.random = 0x2545F4914F6CDD1DULL + ringBlocks;
+        packets.numBlocks = ringBlocks;
+        packets.blocks = AllocPages(ringBlocks * BENCH_RING_BLOCK_SIZE);
+        packets.output = AllocPages(lengths[sizeof(lengths) / sizeof(lengths[0]) - 1]);
+        DMA_RESULT* results = AllocPages(ringBlocks * sizeof(DMA_RESULT));
+        UINT64* timestamps = stamped ? AllocPages(ringBlocks * sizeof(UINT64)) : NULL;
+        DMA_DESCRIPTOR* descBuffer = AllocPages(ringBlocks * sizeof(DMA_DESCRIPTOR));
+        XDMA_ModelSetCallbacks(model, PacketSource, NULL, NULL, &packets);
+
+        XDMA_DESC_CHAIN chain;
+        DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, ringBlocks);
+        for (UINT i = 0; i < ringBlocks; i++) {
+            DescChainAppend(&chain, C2H,
+                            (UINT64)(uintptr_t)(packets.blocks + i * BENCH_RING_BLOCK_SIZE),
+                            (UINT64)(uintptr_t)&results[i], BENCH_RING_BLOCK_SIZE,
+                            XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        }
+        DescChainMakeCircular(&chain);
+        const UINT32 firstAdj = DescChainOptimize(&chain);
+
+        XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+        XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), ringBlocks - 1);
+        StartChain(model, XDMA_MODEL_C2H, &chain, firstAdj);
+
+        // the receiver's view of the packet stream
+        BENCH_PACKETS expected = packets;
+        expected.sequence = 1;
+        expected.length = PacketLength(&expected);
+        size_t expectedOffset = 0;
+
+        UINT head = 0;
+        UINT tail = 0;
+        UINT32 completedCount = 0;
+        UINT64 reads = 0;
+        UINT64 numEntries = 0;
+        UINT64 truncated = 0;
+        UINT64 overflows = 0;
+        UINT64 lastStamp = 0;
+        UINT idle = 0;
+        BOOLEAN ok = TRUE;
+
+        while (ok && (expected.sequence <= BENCH_BATCH_PACKETS) && (idle < 2)) {
+            XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, ringBlocks);
+            UINT index = tail;
+            RingReceive(model, results, ringBlocks, &tail, &completedCount);
+            for (; stamped && (index != tail); RingAdvance(&index, ringBlocks)) {
+                timestamps[index] = reads + 1;
+            }
+
+            size_t length = lengths[reads % (sizeof(lengths) / sizeof(lengths[0]))];
+            if (stamped && (length < 2 * sizeof(XDMA_RING_PACKET_TS))) {
+                length = 2 * sizeof(XDMA_RING_PACKET_TS); // header padded to the table alignment
+            }
+            size_t bytesWritten = 0;
+            UINT32 numPackets = 0;
+            UINT32 consumed = 0;
+            BOOLEAN more = FALSE;
+            NTSTATUS status = RingCopyPackets(results, ringBlocks, &head, tail, length, 0,
+                                              timestamps, PacketCopy, PacketStore, &packets, &bytesWritten, &numPackets,
+                                              &consumed, &more);
+            ok = NT_SUCCESS(status) && (bytesWritten <= length);
+            reads++;
+            idle = consumed ? 0 : idle + 1;
+
+            const XDMA_RING_BATCH* batch = (const XDMA_RING_BATCH*)packets.output;
+            ok = ok && (batch->numPackets == numPackets) && (batch->tableOffset % entrySize == 0)
+                && (bytesWritten == batch->tableOffset + numPackets * entrySize);
+            size_t offset = sizeof(XDMA_RING_BATCH);
+            for (UINT32 n = 0; ok && (n < numPackets); n++) {
+                const XDMA_RING_PACKET_TS* entry = (const XDMA_RING_PACKET_TS*)
+                    (packets.output + batch->tableOffset + n * entrySize);
+                const UINT8* data = packets.output + offset;
+                for (UINT32 i = 0; ok && (i < entry->length); i++) {
+                    ok = data[i] == PacketPattern(expected.sequence, expectedOffset + i);
+                }
+                offset += entry->length;
+
+                // received before this read, not before the last block of the previous entry
+                if (stamped) {
+                    ok = ok && (entry->timestamp <= reads) && (entry->timestamp >= lastStamp)
+                        && (entry->timestamp > 0);
+                    lastStamp = entry->timestamp;
+                }
+
+                // a piece spans the whole ring, the rest of a truncated one is dropped
+                const BOOLEAN isEop = (entry->flags & XDMA_RING_PACKET_EOP) != 0;
+                const BOOLEAN isPiece = (entry->flags & XDMA_RING_PACKET_OVERFLOW) != 0;
+                const BOOLEAN isTruncated = (entry->flags & XDMA_RING_PACKET_TRUNCATED) != 0;
+                size_t taken = entry->length;
+                if (isPiece) {
+                    taken = (size_t)(ringBlocks - 1) * BENCH_RING_BLOCK_SIZE;
+                } else if (isTruncated) {
+                    taken = expected.length - expectedOffset;
+                }
+                overflows += isPiece;
+                truncated += isTruncated;
+                ok = ok && (entry->length <= taken) && (isTruncated == (entry->length < taken))
+                    && (isEop == !isPiece) && (expectedOffset + taken <= expected.length);
+                expectedOffset += taken;
+                if (entry->flags & XDMA_RING_PACKET_EOP) {
+                    ok = ok && (expectedOffset == expected.length);
+                    expected.sequence++;
+                    expected.length = PacketLength(&expected);
+                    expectedOffset = 0;
+                }
+            }
+            ok = ok && (offset <= batch->tableOffset);
+            numEntries += numPackets;
+
+            // more is only set when a packet was left for lack of space
+            ok = ok && (!more || (numPackets > 0));
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), consumed);
+        }
+
+        XDMA_MODEL_STATS stats;
+        XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &stats);
+        ok = ok && (stats.errors == 0) && (expected.sequence > BENCH_BATCH_PACKETS);
+        failures += !ok;
+
+        printf("%10u %10s %10llu %10llu %10llu %10.1f %8s\n", ringBlocks, stamped ? "yes" : "no",
+               (unsigned long long)reads,
+               (unsigned long long)truncated, (unsigned long long)overflows,
+               (double)numEntries / (double)reads, ok ? "ok" : "FAIL");
+
+        StopEngine(model, XDMA_MODEL_C2H);
+        free(descBuffer);
+        free(timestamps);
+        free(results);
+        free(packets.output);
+        free(packets.blocks);
+        XDMA_ModelDestroy(model);
+    }
+    return failures;
+}
+
+// ========================= ring overrun =========================================================
+
+#define BENCH_OVERRUN_PACKET        (2 * BENCH_RING_BLOCK_SIZE + 1000) // three blocks per packet
+
+typedef struct BENCH_OVERRUN_T {
+    UINT32 sequence;        // of the packet being sent
+    size_t offset;          // bytes sent of it
+    UINT64 produced;        // bytes sent in total
+} BENCH_OVERRUN;
+
+// content of a packet byte - each block starts with the packet sequence and the block index, so a
+// reader can tell where it resumes after blocks were dropped
+static UINT8 OverrunPattern(UINT32 sequence, size_t offset) {
+    const size_t inBlock = offset % BENCH_RING_BLOCK_SIZE;
+    if (inBlock < sizeof(sequence)) {
+        return (UINT8)(sequence >> (8 * inBlock));
+    } else if (inBlock == sizeof(sequence)) {
+        return (UINT8)(offset / BENCH_RING_BLOCK_SIZE);
+    }
+    return (UINT8)(sequence * 7 + offset);
+}
+
+static UINT32 OverrunSource(void* ctx, UINT32 channel, void* dst, UINT32 maxBytes, BOOLEAN* eop) {
+    BENCH_OVERRUN* source = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    if (source->offset == BENCH_OVERRUN_PACKET) {
+        source->sequence++;
+        source->offset = 0;
+    }
+    UINT32 numBytes = maxBytes;
+    if (numBytes > BENCH_OVERRUN_PACKET - source->offset) {
+        numBytes = (UINT32)(BENCH_OVERRUN_PACKET - source->offset);
+    }
+    for (UINT32 i = 0; i < numBytes; i++) {
+        ((UINT8*)dst)[i] = OverrunPattern(source->sequence, source->offset + i);
+    }
+    source->offset += numBytes;
+    source->produced += numBytes;
+    *eop = source->offset == BENCH_OVERRUN_PACKET;
+    return numBytes;
+}
+
+// RingDropBlocks() on a hand made ring: the drop extends to the end of a received packet, never
+// beyond the tail, and wraps around the ring
+static BOOLEAN CheckDropBlocks(void) {
+    DMA_RESULT results[8];
+    memset(results, 0, sizeof(results));
+    for (UINT i = 0; i < 8; i++) {
+        results[i].status = XDMA_RESULT_MAGIC;
+        results[i].length = 100 + i;
+    }
+    results[1].status |= XDMA_RESULT_EOP_BIT;  // packets 0-1, 2-4 and 5-...
+    results[4].status |= XDMA_RESULT_EOP_BIT;
+
+    UINT head = 0;
+    UINT64 numBytes = 0;
+    BOOLEAN ok = (RingDropBlocks(results, 8, &head, 6, 1, &numBytes) == 2) && (head == 2)
+        && (numBytes == 201) && (results[0].status == 0) && (results[1].length == 0);
+    ok = ok && (RingDropBlocks(results, 8, &head, 6, 2, &numBytes) == 3) && (head == 5);
+    ok = ok && (RingDropBlocks(results, 8, &head, 6, 1, &numBytes) == 1) && (head == 6);
+    ok = ok && (RingDropBlocks(results, 8, &head, 6, 1, &numBytes) == 0) && (head == 6);
+    ok = ok && (numBytes == 201 + 309 + 105);
+
+    // blocks 6, 7 and 0 (end of packet), 1 without an end
+    results[6].status = results[7].status = XDMA_RESULT_MAGIC;
+    results[0].status = XDMA_RESULT_MAGIC | XDMA_RESULT_EOP_BIT;
+    results[1].status = XDMA_RESULT_MAGIC;
+    results[6].length = results[7].length = results[0].length = results[1].length = 10;
+    numBytes = 0;
+    ok = ok && (RingDropBlocks(results, 8, &head, 2, 1, &numBytes) == 3) && (head == 1)
+        && (numBytes == 30) && (results[1].status != 0);
+    ok = ok && (RingDropBlocks(results, 8, &head, 2, 5, &numBytes) == 1) && (head == 2);
+    return ok;
+}
+
+typedef struct BENCH_OVERRUN_RUN_T {
+    UINT64 overruns;
+    UINT64 droppedBlocks;
+    UINT64 droppedBytes;
+    UINT64 discontinuities; // batches starting with XDMA_RING_PACKET_DISCONTINUITY
+    UINT64 midPacket;       // of them, resumed in the middle of a packet
+    UINT64 stalls;          // model service attempts without credits
+    BOOLEAN ok;
+} BENCH_OVERRUN_RUN;
+
+// Stream packets into a ring whose reader only reads every 'readEvery' rounds, the dpc dropping the
+// oldest blocks like EngineRingDropOldest() (drop) or leaving the engine without credits. Checks
+// that dropping keeps the engine receiving, that packets come back whole and in order except right
+// after a flagged discontinuity, and that every byte sent is read, dropped or left in the ring.
+static BENCH_OVERRUN_RUN RunRingOverrun(UINT ringBlocks, UINT readEvery, UINT rounds,
+                                        BOOLEAN drop) {
+    BENCH_OVERRUN_RUN run = { 0 };
+    XDMA_MODEL_CONFIG config;
+    XDMA_ModelDefaultConfig(&config);
+    config.streaming = TRUE;
+    config.numH2C = 0;
+
+    XDMA_MODEL* model = XDMA_ModelCreate(&config);
+    if (!model) {
+        fprintf(stderr, "XDMA_ModelCreate failed\n");
+        return run;
+    }
+
+    XDMA_DESC_PARAMS params;
+    ParamsFromModel(&config, &params);
+
+    const size_t outputSize = 1 << 20;
+    BENCH_OVERRUN source = { 1, 0, 0 };
+    BENCH_PACKETS packets = { 0 }; // blocks and output for PacketCopy() and PacketStore()
+    packets.blocks = AllocPages(ringBlocks * BENCH_RING_BLOCK_SIZE);
+    packets.output = AllocPages(outputSize);
+    DMA_RESULT* results = AllocPages(ringBlocks * sizeof(DMA_RESULT));
+    DMA_DESCRIPTOR* descBuffer = AllocPages(ringBlocks * sizeof(DMA_DESCRIPTOR));
+    XDMA_ModelSetCallbacks(model, OverrunSource, NULL, NULL, &source);
+
+    XDMA_DESC_CHAIN chain;
+    DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, ringBlocks);
+    for (UINT i = 0; i < ringBlocks; i++) {
+        DescChainAppend(&chain, C2H,
+                        (UINT64)(uintptr_t)(packets.blocks + i * BENCH_RING_BLOCK_SIZE),
+                        (UINT64)(uintptr_t)&results[i], BENCH_RING_BLOCK_SIZE,
+                        XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    }
+    DescChainMakeCircular(&chain);
+    const UINT32 firstAdj = DescChainOptimize(&chain);
+
+    XDMA_RING_CREDITS credits;
+    XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+    XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits),
+                      RingCreditsInit(&credits, ringBlocks));
+    StartChain(model, XDMA_MODEL_C2H, &chain, firstAdj);
+
+    // the engine holds at least this many credits after each look of the dpc
+    const UINT headroom = credits.lowWater + 1;
+    UINT head = 0;
+    UINT tail = 0;
+    UINT32 completedCount = 0;
+    UINT32 lastSequence = 0;
+    UINT64 bytesRead = 0;
+    BOOLEAN gap = FALSE;
+    UINT64 random = 0x9E3779B97F4A7C15ULL + ringBlocks;
+    UINT idle = 0;
+    run.ok = TRUE;
+    for (UINT r = 0; run.ok && ((r < rounds) || (idle < 2)); r++) {
+        if (r < rounds) {
+            random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+            XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0,
+                                    1 + (UINT32)((random >> 33) % headroom));
+        }
+
+        // dpc
+        const UINT prevTail = tail;
+        RingReceive(model, results, ringBlocks, &tail, &completedCount);
+        RingCreditsReceived(&credits, (tail + ringBlocks - prevTail) % ringBlocks);
+        const UINT occupancy = (tail + ringBlocks - head) % ringBlocks;
+        if (drop && (occupancy + headroom > ringBlocks - 1)) {
+            UINT64 numBytes = 0;
+            const UINT32 dropped = RingDropBlocks(results, ringBlocks, &head, tail,
+                                                  occupancy + headroom - (ringBlocks - 1),
+                                                  &numBytes);
+            RingCreditsFreed(&credits, dropped);
+            gap = TRUE;
+            run.overruns++;
+            run.droppedBlocks += dropped;
+            run.droppedBytes += numBytes;
+        }
+        UINT32 grant = RingCreditsTake(&credits);
+        if (grant) {
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), grant);
+        }
+
+        // read, every round once the source stopped
+        if ((r % readEvery != 0) && (r < rounds)) {
+            continue;
+        }
+        size_t bytesWritten = 0;
+        UINT32 numPackets = 0;
+        UINT32 consumed = 0;
+        BOOLEAN more = FALSE;
+        NTSTATUS status = RingCopyPackets(results, ringBlocks, &head, tail, outputSize,
+                                          gap ? XDMA_RING_PACKET_DISCONTINUITY : 0, NULL,
+                                          PacketCopy, PacketStore, &packets, &bytesWritten, &numPackets,
+                                          &consumed, &more);
+        run.ok = NT_SUCCESS(status);
+        idle = consumed ? 0 : idle + 1;
+        if (numPackets > 0) {
+            gap = FALSE;
+        }
+
+        const XDMA_RING_BATCH* batch = (const XDMA_RING_BATCH*)packets.output;
+        const XDMA_RING_PACKET* table = (const XDMA_RING_PACKET*)(packets.output + batch->tableOffset);
+        size_t offset = sizeof(XDMA_RING_BATCH);
+        for (UINT32 n = 0; run.ok && (n < numPackets); n++) {
+            // each entry starts at a block of a packet and ends the packet
+            const UINT8* data = packets.output + offset;
+            UINT32 sequence;
+            memcpy(&sequence, data, sizeof(sequence));
+            const size_t start = (size_t)data[sizeof(sequence)] * BENCH_RING_BLOCK_SIZE;
+            run.ok = (table[n].length == BENCH_OVERRUN_PACKET - start)
+                && (table[n].flags & XDMA_RING_PACKET_EOP);
+            for (UINT32 i = 0; run.ok && (i < table[n].length); i++) {
+                run.ok = data[i] == OverrunPattern(sequence, start + i);
+            }
+
+            // only the first entry after a drop may skip data
+            if (table[n].flags & XDMA_RING_PACKET_DISCONTINUITY) {
+                run.ok = run.ok && (n == 0) && ((sequence > lastSequence + 1)
+                                                || ((sequence == lastSequence + 1) && start));
+                run.discontinuities++;
+                run.midPacket += start != 0;
+            } else {
+                run.ok = run.ok && (sequence == lastSequence + 1) && (start == 0);
+            }
+            lastSequence = sequence;
+            bytesRead += table[n].length;
+            offset += table[n].length;
+        }
+
+        RingCreditsFreed(&credits, consumed);
+        grant = RingCreditsTake(&credits);
+        if (grant) {
+            XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), grant);
+        }
+
+        // every block is held by the engine, waits for a grant or has been received
+        UINT32 held, freed;
+        RingCreditsGet(&credits, &held, &freed);
+        run.ok = run.ok && (held + freed + (tail + ringBlocks - head) % ringBlocks
+                            == ringBlocks - 1);
+    }
+
+    XDMA_MODEL_STATS stats;
+    XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &stats);
+    run.stalls = stats.stallsNoCredit;
+
+    // the last packet may still be in the ring, without its end
+    const UINT64 left = (tail + ringBlocks - head) % ringBlocks;
+    run.ok = run.ok && (stats.errors == 0) && (left < 3)
+        && (bytesRead + run.droppedBytes + source.offset % BENCH_OVERRUN_PACKET == source.produced)
+        && (drop ? (run.stalls == 0) : (run.overruns == 0) && (run.discontinuities == 0));
+
+    StopEngine(model, XDMA_MODEL_C2H);
+    free(descBuffer);
+    free(results);
+    free(packets.output);
+    free(packets.blocks);
+    XDMA_ModelDestroy(model);
+    return run;
+}
+
+// Drop-oldest overrun policy against backpressure with a reader that keeps up and with slow ones
+static int CheckRingOverrun(void) {
+    static const struct {
+        UINT ringBlocks;
+        UINT readEvery;
+    } runs[] = {
+        { 17, 1 },
+        { 17, 8 },
+        { 258, 2 },
+        { 258, 32 },
+    };
+    const UINT rounds = 20000;
+    int failures = 0;
+
+    printf("\nring overrun (C2H AXI-ST, %u rounds)\n", rounds);
+    const BOOLEAN dropOk = CheckDropBlocks();
+    failures += !dropOk;
+    printf("drop blocks %s\n", dropOk ? "ok" : "FAIL");
+    printf("%8s %8s %12s %10s %10s %10s %10s %10s %8s\n", "blocks", "read", "policy", "overruns",
+           "dropped", "gaps", "mid-pkt", "stalls", "check");
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        for (int drop = 0; drop <= 1; drop++) {
+            const BENCH_OVERRUN_RUN run = RunRingOverrun(runs[i].ringBlocks, runs[i].readEvery,
+                                                         rounds, (BOOLEAN)drop);
+            failures += !run.ok;
+            printf("%8u %8u %12s %10llu %10llu %10llu %10llu %10llu %8s\n", runs[i].ringBlocks,
+                   runs[i].readEvery, drop ? "drop-oldest" : "backpressure",
+                   (unsigned long long)run.overruns, (unsigned long long)run.droppedBlocks,
+                   (unsigned long long)run.discontinuities, (unsigned long long)run.midPacket,
+                   (unsigned long long)run.stalls, run.ok ? "ok" : "FAIL");
+        }
+    }
+    return failures;
+}
+
+// ========================= posted receive =======================================================
+
+typedef struct BENCH_RX_T {
+    UINT32 packetSize;
+    UINT32 left;            // bytes left of the current packet
+    UINT8 sequence;         // fill pattern of the current packet
+} BENCH_RX;
+
+static UINT32 RxSource(void* ctx, UINT32 channel, void* dst, UINT32 maxBytes, BOOLEAN* eop) {
+    BENCH_RX* rx = ctx;
+    UNREFERENCED_PARAMETER(channel);
+    if (rx->left == 0) {
+        rx->left = rx->packetSize;
+        rx->sequence++;
+    }
+    const UINT32 numBytes = rx->left < maxBytes ? rx->left : maxBytes;
+    memset(dst, rx->sequence, numBytes);
+    rx->left -= numBytes;
+    *eop = rx->left == 0;
+    return numBytes;
+}
+
+// Post user buffers (one non-contiguous page per scatter gather element) to a ring of slots the way
+// EngineRxFill() does, let the model stream packets into them and collect them the way
+// EngineRxCollect() does. Every buffer must come back with the bytes and the end-of-packet flag of
+// the slots it got, in the order it was posted - across wrap-arounds and while buffers wait for
+// slots. The timing covers posting and collecting only.
+static int CheckPostedReceive(void) {
+    static const struct {
+        UINT slots;
+        ULONG bufferPages;
+        UINT32 packetSize;
+    } cases[] = {
+        { 3, 2, 2 * PAGE_SIZE },            // one buffer at a time, the others wait
+        { 17, 3, 3 * PAGE_SIZE - 100 },     // a packet per buffer, ends inside the last page
+        { 17, 1, 3 * PAGE_SIZE },           // a packet across three buffers
+        { 258, 5, 2 * PAGE_SIZE + 8 },      // packets not aligned to the buffers
+        { 130, 64, 64 * PAGE_SIZE },        // two buffers fit, the other two wait
+        { BENCH_RING_MAX_BLOCKS, 256, 16 * PAGE_SIZE },
+    };
+    int failures = 0;
+
+    printf("\nposted receive (C2H AXI-ST, %u buffers, depth %u)\n", BENCH_RX_BUFFERS, BENCH_RX_DEPTH);
+    printf("%8s %8s %10s %10s %10s %8s\n", "slots", "pages", "packet", "ns/slot", "waits", "check");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const UINT numSlots = cases[c].slots;
+        const ULONG bufferPages = cases[c].bufferPages;
+        XDMA_MODEL_CONFIG config;
+        XDMA_ModelDefaultConfig(&config);
+        config.streaming = TRUE;
+        config.numH2C = 0;
+
+        XDMA_MODEL* model = XDMA_ModelCreate(&config);
+        if (!model) {
+            fprintf(stderr, "XDMA_ModelCreate failed\n");
+            return failures + 1;
+        }
+
+        XDMA_DESC_PARAMS params;
+        ParamsFromModel(&config, &params);
+
+        BENCH_RX source = { 0 };
+        source.packetSize = cases[c].packetSize;
+        XDMA_ModelSetCallbacks(model, RxSource, NULL, NULL, &source);
+
+        // the buffers of the posted requests, their pages handed out in reverse order
+        const ULONG numPages = BENCH_RX_DEPTH * bufferPages;
+        UINT8* pages = AllocPages((size_t)numPages * PAGE_SIZE);
+        SCATTER_GATHER_ELEMENT* elements = calloc(numPages, sizeof(SCATTER_GATHER_ELEMENT));
+        for (ULONG i = 0; i < numPages; i++) {
+            elements[i].Address.QuadPart = (LONGLONG)(uintptr_t)(pages + (numPages - 1 - i) * PAGE_SIZE);
+            elements[i].Length = PAGE_SIZE;
+        }
+
+        // same circle of empty slots as EngineRxStart()
+        DMA_RESULT* results = AllocPages(numSlots * sizeof(DMA_RESULT));
+        DMA_DESCRIPTOR* descBuffer = AllocPages(numSlots * sizeof(DMA_DESCRIPTOR));
+        XDMA_DESC_CHAIN chain;
+        DescChainInit(&chain, &params, descBuffer, (UINT64)(uintptr_t)descBuffer, numSlots);
+        for (UINT i = 0; i < numSlots; i++) {
+            DescChainAppend(&chain, C2H, 0, (UINT64)(uintptr_t)&results[i], 0,
+                            XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        }
+        DescChainMakeCircular(&chain);
+        XDMA_ModelWrite32(model, SGDMA_COMMON_REG(creditModeEnableW1S), BIT_N(0) << 16);
+        StartChain(model, XDMA_MODEL_C2H, &chain, 0);
+
+        UINT postSlots[BENCH_RX_DEPTH];     // slots of the posts in flight, oldest first
+        UINT slotsDone = 0;                 // of the oldest post
+        size_t numBytes = 0;
+        BOOLEAN eop = FALSE;
+        UINT numPosted = 0;
+        UINT numCompleted = 0;
+        UINT next = 0;
+        UINT tail = 0;
+        UINT freeSlots = numSlots;
+        UINT64 waits = 0;
+        UINT64 slots = 0;
+        UINT64 elapsed = 0;
+
+        // what the slots of the oldest buffer must have received
+        UINT32 refLeft = 0;
+        UINT8 refSequence = 0;
+        BOOLEAN ok = TRUE;
+
+        while (ok && (numCompleted < BENCH_RX_BUFFERS)) {
+            // post: a buffer which does not fit waits for the slots of the older ones
+            UINT64 start = NowNs();
+            while ((numPosted - numCompleted < BENCH_RX_DEPTH) && (numPosted < BENCH_RX_BUFFERS)) {
+                const SCATTER_GATHER_ELEMENT* buffer = &elements[(numPosted % BENCH_RX_DEPTH) * bufferPages];
+                const UINT n = RingPostSg(descBuffer, numSlots, &next, freeSlots, buffer, bufferPages,
+                                          XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+                if (n == 0) {
+                    waits++;
+                    break;
+                }
+                freeSlots -= n;
+                postSlots[numPosted % BENCH_RX_DEPTH] = n;
+                numPosted++;
+                XDMA_ModelWrite32(model, SGDMA_REG(XDMA_MODEL_C2H, 0, descCredits), n);
+            }
+            elapsed += NowNs() - start;
+
+            XDMA_ModelServiceEngine(model, XDMA_MODEL_C2H, 0, numSlots);
+
+            // collect
+            start = NowNs();
+            UINT completedNow = 0;
+            UINT firstCompleted = numCompleted;
+            while (numCompleted < numPosted) {
+                const UINT postIndex = numCompleted % BENCH_RX_DEPTH;
+                BOOLEAN lastEop;
+                const UINT n = RingCollectResults(results, numSlots, &tail,
+                                                  postSlots[postIndex] - slotsDone, &numBytes, &lastEop);
+                if (n == 0) {
+                    break;
+                }
+                slotsDone += n;
+                eop = lastEop;
+                freeSlots += n;
+                if (slotsDone < postSlots[postIndex]) {
+                    break;
+                }
+                completedNow++;
+                numCompleted++;
+                slotsDone = 0;
+
+                // not timed: the same accounting as the model, slot by slot, and the data
+                const UINT64 pause = NowNs();
+                const UINT8* buffer = pages + (numPages - 1 - postIndex * bufferPages) * PAGE_SIZE;
+                size_t refBytes = 0;
+                BOOLEAN refEop = FALSE;
+                for (UINT i = 0; i < postSlots[postIndex]; i++) {
+                    if (refLeft == 0) {
+                        refLeft = source.packetSize;
+                        refSequence++;
+                    }
+                    const UINT32 chunk = refLeft < PAGE_SIZE ? refLeft : PAGE_SIZE;
+                    ok = ok && (buffer[-(ptrdiff_t)i * (ptrdiff_t)PAGE_SIZE] == refSequence);
+                    refLeft -= chunk;
+                    refBytes += chunk;
+                    refEop = refLeft == 0;
+                }
+                ok = ok && (numBytes == refBytes) && (eop == refEop);
+                slots += postSlots[postIndex];
+                numBytes = 0;
+                eop = FALSE;
+                start += NowNs() - pause;
+            }
+            elapsed += NowNs() - start;
+
+            // progress: something was posted or is still in flight
+            ok = ok && ((completedNow > 0) || (numPosted > firstCompleted));
+        }
+
+        XDMA_MODEL_STATS stats;
+        XDMA_ModelGetStats(model, XDMA_MODEL_C2H, 0, &stats);
+        ok = ok && (stats.errors == 0) && (numCompleted == BENCH_RX_BUFFERS) && (freeSlots == numSlots);
+        failures += !ok;
+
+        printf("%8u %8lu %10lu %10.2f %10llu %8s\n", numSlots, (unsigned long)bufferPages,
+               (unsigned long)source.packetSize, slots ? (double)elapsed / (double)slots : 0.0,
+               (unsigned long long)waits, ok ? "ok" : "FAIL");
+
+        StopEngine(model, XDMA_MODEL_C2H);
+        free(descBuffer);
+        free(results);
+        free(elements);
+        free(pages);
+        XDMA_ModelDestroy(model);
+    }
+    return failures;
+}
+
+// ========================= main =================================================================
+
+int main(int argc, char* argv[]) {
+    UINT64 work = BENCH_DEFAULT_WORK;
+    if (argc > 1) {
+        work = strtoull(argv[1], NULL, 0);
+        if (work == 0) {
+            fprintf(stderr, "usage: %s [descriptors per data point]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int failures = BenchDescriptors(work);
+    failures += CheckCoalesce();
+    failures += CheckLinkedRun();
+    failures += CheckStore();
+    failures += CheckGatherSend();
+    failures += CheckVectors();
+    failures += CheckStrided();
+    failures += CheckFill();
+    failures += CheckSendLoop();
+    failures += CheckSpinBudget();
+    failures += CheckRingWrap();
+    failures += CheckRingCredits();
+    failures += CheckPacketBatch();
+    failures += CheckRingOverrun();
+    failures += CheckPostedReceive();
+    failures += BenchRing(work / 8, BENCH_RING_NUM_BLOCKS, BENCH_RING_BLOCK_SIZE, RingCopyNone,
+                          "none");
+    failures += BenchRing(work / 8, BENCH_RING_NUM_BLOCKS, BENCH_RING_BLOCK_SIZE, RingCopyMemcpy,
+                          "memcpy");
+    failures += BenchRing(work / 8, BENCH_RING_NUM_BLOCKS, BENCH_RING_BLOCK_SIZE, NULL, "in place");
+    failures += BenchRing(work / 8 / 16, BENCH_RING_MAX_BLOCKS, 16 * BENCH_RING_BLOCK_SIZE,
+                          RingCopyMemcpy, "memcpy");
+    failures += BenchRingCopy(work);
+    failures += BenchRingHandoff(work);
+
+    if (failures) {
+        printf("\n%d check(s) FAILED\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,481 @@
+/*
+* XDMA IP Behavioral Model
+* ===============================
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_model.h"
+
+// ========================= constants ============================================================
+
+#define MODEL_STAT_READ_ERROR       (BIT_N(9))
+#define MODEL_STAT_WRITE_ERROR      (BIT_N(14))
+#define MODEL_STAT_DESC_ERROR       (BIT_N(19))
+#define MODEL_IRQ_SOURCES           (XDMA_CTRL_IE_ALL | XDMA_CTRL_IE_IDLE_STOPPED)
+#define MODEL_4K_MASK               (0xFFFULL)
+
+#define REG_OFFSET(type, field)     ((UINT32)offsetof(type, field))
+
+// ========================= static helpers =======================================================
+
+static void* ModelHostPtr(UINT64 busAddr) {
+    return (void*)(uintptr_t)busAddr;
+}
+
+static UINT64 ModelAddr(UINT32 hi, UINT32 lo) {
+    return ((UINT64)hi << 32) | lo;
+}
+
+static void ModelApplyW1(volatile UINT32* reg, volatile UINT32* w1s, volatile UINT32* w1c) {
+    if (*w1s) {
+        *reg |= *w1s;
+        *w1s = 0;
+    }
+    if (*w1c) {
+        *reg &= ~*w1c;
+        *w1c = 0;
+    }
+}
+
+static void ModelUpdateIrq(XDMA_MODEL* model) {
+    volatile XDMA_IRQ_REGS* irq = model->irqRegs;
+    UINT32 oldChannel = irq->channelIntPending;
+    UINT32 oldUser = irq->userIntPending;
+
+    irq->channelIntPending = irq->channelIntRequest & irq->channelIntEnable;
+    irq->userIntPending = irq->userIntRequest & irq->userIntEnable;
+
+    // notify on newly pending interrupts only - this is what an MSI/MSI-X message would signal
+    BOOLEAN newChannel = (irq->channelIntPending & ~oldChannel) != 0;
+    BOOLEAN newUser = (irq->userIntPending & ~oldUser) != 0;
+    if ((newChannel || newUser) && model->irq) {
+        model->irq(model->callbackCtx, irq->channelIntPending, irq->userIntPending);
+    }
+}
+
+static void ModelEngineRaise(XDMA_MODEL* model, XDMA_MODEL_ENGINE* eng, UINT32 events) {
+    if (events & eng->regs->control & eng->regs->intEnableMask & MODEL_IRQ_SOURCES) {
+        model->irqRegs->channelIntRequest |= eng->irqBit;
+        eng->stats.interrupts++;
+        ModelUpdateIrq(model);
+    }
+}
+
+static void ModelEngineHalt(XDMA_MODEL_ENGINE* eng) {
+    eng->running = FALSE;
+    eng->regs->status &= ~XDMA_BUSY_BIT;
+}
+
+static void ModelEngineError(XDMA_MODEL* model, XDMA_MODEL_ENGINE* eng, UINT32 statusBits) {
+    eng->regs->status |= statusBits;
+    eng->stats.errors++;
+    ModelEngineHalt(eng);
+    ModelEngineRaise(model, eng, statusBits);
+}
+
+static void ModelEngineControlChanged(XDMA_MODEL_ENGINE* eng) {
+    UINT32 control = eng->regs->control;
+    BOOLEAN wasRunning = (eng->lastControl & XDMA_CTRL_RUN_BIT) != 0;
+    BOOLEAN isRunning = (control & XDMA_CTRL_RUN_BIT) != 0;
+    eng->lastControl = control;
+
+    if (!wasRunning && isRunning) { // rising edge - load first descriptor and reset count
+        eng->running = TRUE;
+        eng->fetchAddr = ModelAddr(eng->sgdma->firstDescHi, eng->sgdma->firstDescLo);
+        eng->fetchAdj = eng->sgdma->firstDescAdj & (XDMA_DESC_ADJ_MASK >> XDMA_DESC_ADJ_SHIFT);
+        eng->blockCount = 0;
+        eng->blockIndex = 0;
+        eng->regs->completedDescCount = 0;
+        eng->regs->status |= XDMA_BUSY_BIT;
+    } else if (wasRunning && !isRunning) {
+        ModelEngineHalt(eng);
+    }
+}
+
+static BOOLEAN ModelCreditModeEnabled(const XDMA_MODEL* model, const XDMA_MODEL_ENGINE* eng) {
+    return (model->sgdmaRegs->creditModeEnable & (BIT_N(eng->channel) << (16 * eng->dir))) != 0;
+}
+
+static BOOLEAN ModelIsReadOnly(UINT32 offset) {
+    if (offset < IRQ_BLOCK_OFFSET) {
+        UINT32 reg = offset & (ENGINE_OFFSET - 1);
+        return (reg == REG_OFFSET(XDMA_ENGINE_REGS, identifier))
+            || (reg == REG_OFFSET(XDMA_ENGINE_REGS, status))
+            || (reg == REG_OFFSET(XDMA_ENGINE_REGS, statusRC))
+            || (reg == REG_OFFSET(XDMA_ENGINE_REGS, completedDescCount))
+            || (reg == REG_OFFSET(XDMA_ENGINE_REGS, alignments));
+    } else if (offset < CONFIG_BLOCK_OFFSET) {
+        UINT32 reg = offset - IRQ_BLOCK_OFFSET;
+        return (reg == REG_OFFSET(XDMA_IRQ_REGS, identifier))
+            || (reg == REG_OFFSET(XDMA_IRQ_REGS, userIntRequest))
+            || (reg == REG_OFFSET(XDMA_IRQ_REGS, channelIntRequest))
+            || (reg == REG_OFFSET(XDMA_IRQ_REGS, userIntPending))
+            || (reg == REG_OFFSET(XDMA_IRQ_REGS, channelIntPending));
+    } else if (offset < SGDMA_BLOCK_OFFSET) {
+        return offset == CONFIG_BLOCK_OFFSET; // only identifier - pcie settings are sampled once
+    } else if (offset < SGDMA_COMMON_BLOCK_OFFSET) {
+        return (offset & (ENGINE_OFFSET - 1)) == REG_OFFSET(XDMA_SGDMA_REGS, identifier);
+    }
+    return offset == SGDMA_COMMON_BLOCK_OFFSET;
+}
+
+// Fetch the next block of adjacent descriptors. Enforces the same constraints as the IP: a block
+// must not cross a 4K boundary and must fit in a single read request.
+static BOOLEAN ModelEngineFetch(XDMA_MODEL* model, XDMA_MODEL_ENGINE* eng) {
+    const UINT32 count = eng->fetchAdj + 1;
+    const UINT64 mrrsBytes = 1ULL << (model->config.pcieMRRS + 7);
+
+    if ((eng->fetchAddr == 0)
+        || (((eng->fetchAddr & MODEL_4K_MASK) + (UINT64)count * sizeof(DMA_DESCRIPTOR)) > 0x1000)
+        || (((UINT64)count * sizeof(DMA_DESCRIPTOR)) > mrrsBytes)) {
+        ModelEngineError(model, eng, MODEL_STAT_DESC_ERROR);
+        return FALSE;
+    }
+
+    eng->blockAddr = eng->fetchAddr;
+    eng->blockCount = count;
+    eng->blockIndex = 0;
+    eng->stats.descFetches++;
+    return TRUE;
+}
+
+// Move data between host memory and the card memory for an AXI-MM descriptor
+static BOOLEAN ModelEngineMemoryMapped(XDMA_MODEL* model, XDMA_MODEL_ENGINE* eng,
+                                       const DMA_DESCRIPTOR* desc) {
+    const BOOLEAN fixed = (eng->regs->control & XDMA_CTRL_NON_INCR_ADDR) != 0;
+    const UINT32 beat = (1U << (6 + model->config.pcieWidth)) / 8;
+    const UINT64 devAddr = (eng->dir == XDMA_MODEL_H2C) ? ModelAddr(desc->dstAddrHi, desc->dstAddrLo)
+                                                        : ModelAddr(desc->srcAddrHi, desc->srcAddrLo);
+    const UINT64 span = fixed ? (desc->numBytes < beat ? desc->numBytes : beat) : desc->numBytes;
+
+    if ((devAddr > model->config.cardMemSize) || (span > model->config.cardMemSize - devAddr)) {
+        ModelEngineError(model, eng, (eng->dir == XDMA_MODEL_H2C) ? MODEL_STAT_WRITE_ERROR
+                                                                  : MODEL_STAT_READ_ERROR);
+        return FALSE;
+    }
+
+    UINT8* card = model->cardMem + devAddr;
+    if (eng->dir == XDMA_MODEL_H2C) {
+        const UINT8* host = ModelHostPtr(ModelAddr(desc->srcAddrHi, desc->srcAddrLo));
+        if (fixed) { // non-incremental - every beat lands on the same device address
+            for (UINT32 off = 0; off < desc->numBytes; off += beat) {
+                UINT32 n = desc->numBytes - off < beat ? desc->numBytes - off : beat;
+                memcpy(card, host + off, n);
+            }
+        } else {
+            memcpy(card, host, desc->numBytes);
+        }
+    } else {
+        UINT8* host = ModelHostPtr(ModelAddr(desc->dstAddrHi, desc->dstAddrLo));
+        if (fixed) {
+            for (UINT32 off = 0; off < desc->numBytes; off += beat) {
+                UINT32 n = desc->numBytes - off < beat ? desc->numBytes - off : beat;
+                memcpy(host + off, card, n);
+            }
+        } else {
+            memcpy(host, card, desc->numBytes);
+        }
+    }
+    eng->stats.bytes += desc->numBytes;
+    return TRUE;
+}
+
+// Process the next descriptor of an engine. Returns FALSE if the engine is stopped or stalled.
+static BOOLEAN ModelEngineStep(XDMA_MODEL* model, XDMA_MODEL_ENGINE* eng) {
+    if (!eng->running) {
+        return FALSE;
+    }
+    if ((eng->blockIndex == eng->blockCount) && !ModelEngineFetch(model, eng)) {
+        return FALSE;
+    }
+
+    const UINT64 descAddr = eng->blockAddr + (UINT64)eng->blockIndex * sizeof(DMA_DESCRIPTOR);
+    const DMA_DESCRIPTOR* desc = ModelHostPtr(descAddr);
+    const UINT32 control = desc->control;
+
+    if ((control & XDMA_DESC_MAGIC_MASK) != XDMA_DESC_MAGIC) {
+        ModelEngineError(model, eng, XDMA_MAGIC_STOPPED_BIT);
+        return FALSE;
+    }
+
+    const BOOLEAN creditMode = ModelCreditModeEnabled(model, eng);
+    if (creditMode && (eng->credits == 0)) {
+        eng->stats.stallsNoCredit++;
+        return FALSE;
+    }
+
+    if (!model->config.streaming) {
+        if (!ModelEngineMemoryMapped(model, eng, desc)) {
+            return FALSE;
+        }
+    } else if (eng->dir == XDMA_MODEL_H2C) {
+        const BOOLEAN eop = (control & XDMA_DESC_EOP_BIT) != 0;
+        if (model->sink) {
+            model->sink(model->callbackCtx, eng->channel,
+                        ModelHostPtr(ModelAddr(desc->srcAddrHi, desc->srcAddrLo)),
+                        desc->numBytes, eop);
+        }
+        eng->stats.bytes += desc->numBytes;
+        eng->stats.packets += eop;
+    } else { // AXI-ST C2H - source address points to the dma result of this descriptor
+        BOOLEAN eop = FALSE;
+        UINT32 received = 0;
+        if (model->source) {
+            received = model->source(model->callbackCtx, eng->channel,
+                                     ModelHostPtr(ModelAddr(desc->dstAddrHi, desc->dstAddrLo)),
+                                     desc->numBytes, &eop);
+        }
+        if ((received == 0) && !eop) {
+            eng->stats.stallsNoData++;
+            return FALSE;
+        }
+        DMA_RESULT* result = ModelHostPtr(ModelAddr(desc->srcAddrHi, desc->srcAddrLo));
+        result->length = received;
+        result->status = XDMA_RESULT_MAGIC | (eop ? XDMA_RESULT_EOP_BIT : 0);
+        eng->stats.bytes += received;
+        eng->stats.packets += eop;
+    }
+
+    if (creditMode) {
+        eng->credits--;
+    }
+
+    // completion accounting and poll mode writeback
+    UINT32 completed = (eng->regs->completedDescCount + 1) & XDMA_WB_COUNT_MASK;
+    eng->regs->completedDescCount = completed;
+    if (eng->regs->control & XDMA_CTRL_POLL_MODE) {
+        XDMA_POLL_WB* wb = ModelHostPtr(ModelAddr(eng->regs->pollModeWbHi, eng->regs->pollModeWbLo));
+        if (wb) {
+            wb->completedDescCount = completed;
+        }
+    }
+    eng->stats.descriptors++;
+
+    UINT32 events = 0;
+    if (control & XDMA_DESC_COMPLETED_BIT) {
+        events |= XDMA_DESCRIPTOR_COMPLETED_BIT;
+    }
+
+    // advance within the fetched block or follow the next pointer of the block's last descriptor
+    const UINT64 next = ModelAddr(desc->nextHi, desc->nextLo);
+    eng->blockIndex++;
+    if (control & XDMA_DESC_STOP_BIT) {
+        events |= XDMA_DESCRIPTOR_STOPPED_BIT;
+        eng->regs->status |= events;
+        ModelEngineHalt(eng);
+    } else if (eng->blockIndex == eng->blockCount) {
+        eng->fetchAddr = next;
+        eng->fetchAdj = (control & XDMA_DESC_ADJ_MASK) >> XDMA_DESC_ADJ_SHIFT;
+        eng->regs->status |= events;
+    } else if (next != descAddr + sizeof(DMA_DESCRIPTOR)) {
+        // nextAdj promised an adjacent descriptor, but the chain continues elsewhere
+        eng->regs->status |= events;
+        ModelEngineError(model, eng, MODEL_STAT_DESC_ERROR);
+        return TRUE;
+    } else {
+        eng->regs->status |= events;
+    }
+
+    ModelEngineRaise(model, eng, events);
+    return TRUE;
+}
+
+// ========================= API functions ========================================================
+
+void XDMA_ModelDefaultConfig(XDMA_MODEL_CONFIG* config) {
+    memset(config, 0, sizeof(*config));
+    config->numH2C = 1;
+    config->numC2H = 1;
+    config->streaming = FALSE;
+    config->pcieMRRS = 2;               // 512 bytes
+    config->pcieWidth = 2;              // 256 bit
+    config->alignments = 0x00010140;    // 1 byte address/length alignment, 64 address bits
+    config->cardMemSize = 16ULL * 1024ULL * 1024ULL;
+}
+
+XDMA_MODEL* XDMA_ModelCreate(const XDMA_MODEL_CONFIG* config) {
+    XDMA_MODEL* model = calloc(1, sizeof(XDMA_MODEL));
+    if (!model) {
+        return NULL;
+    }
+    model->config = *config;
+    model->bar = aligned_alloc(0x1000, XDMA_MODEL_BAR_SIZE);
+    model->cardMem = config->cardMemSize ? calloc(1, (size_t)config->cardMemSize) : NULL;
+    if (!model->bar || (config->cardMemSize && !model->cardMem)) {
+        XDMA_ModelDestroy(model);
+        return NULL;
+    }
+    memset(model->bar, 0, XDMA_MODEL_BAR_SIZE);
+
+    UINT8* bar = (UINT8*)model->bar;
+    model->irqRegs = (XDMA_IRQ_REGS*)(bar + IRQ_BLOCK_OFFSET);
+    model->configRegs = (XDMA_CONFIG_REGS*)(bar + CONFIG_BLOCK_OFFSET);
+    model->sgdmaRegs = (XDMA_SGDMA_COMMON_REGS*)(bar + SGDMA_COMMON_BLOCK_OFFSET);
+
+    model->irqRegs->identifier = IRQ_BLOCK_ID | XDMA_MODEL_IP_VERSION;
+    model->configRegs->identifier = CONFIG_BLOCK_ID | XDMA_MODEL_IP_VERSION;
+    model->configRegs->pcieMRRS = config->pcieMRRS;
+    model->configRegs->pcieWidth = config->pcieWidth;
+    model->sgdmaRegs->identifier = XDMA_ID | (SGDMA_COMMON_BLOCK_OFFSET << 4) | XDMA_MODEL_IP_VERSION;
+
+    // interrupt bits are assigned to present engines in order H2C 0-3, then C2H 0-3
+    UINT32 irqIndex = 0;
+    for (UINT32 dir = 0; dir < XDMA_MODEL_NUM_DIRECTIONS; dir++) {
+        const UINT32 numEngines = dir == XDMA_MODEL_H2C ? config->numH2C : config->numC2H;
+        for (UINT32 ch = 0; ch < XDMA_MODEL_MAX_CHANNELS; ch++) {
+            XDMA_MODEL_ENGINE* eng = &model->engines[ch][dir];
+            const UINT32 offset = (dir * BLOCK_OFFSET) + (ch * ENGINE_OFFSET);
+            eng->channel = ch;
+            eng->dir = dir;
+            eng->regs = (XDMA_ENGINE_REGS*)(bar + offset);
+            eng->sgdma = (XDMA_SGDMA_REGS*)(bar + offset + SGDMA_BLOCK_OFFSET);
+            if (ch >= numEngines) {
+                continue;
+            }
+            eng->present = TRUE;
+            eng->irqBit = BIT_N(irqIndex++);
+            eng->regs->identifier = XDMA_ID | (dir << 16) | (ch << 8) | XDMA_MODEL_IP_VERSION
+                | (config->streaming ? XDMA_ID_ST_BIT : 0);
+            eng->regs->alignments = config->alignments;
+            eng->sgdma->identifier = XDMA_ID | ((dir + 4) << 16) | (ch << 8) | XDMA_MODEL_IP_VERSION;
+        }
+    }
+    return model;
+}
+
+void XDMA_ModelDestroy(XDMA_MODEL* model) {
+    if (model) {
+        free(model->bar);
+        free(model->cardMem);
+        free(model);
+    }
+}
+
+void XDMA_ModelSetCallbacks(XDMA_MODEL* model, PFN_XDMA_MODEL_SOURCE source,
+                            PFN_XDMA_MODEL_SINK sink, PFN_XDMA_MODEL_IRQ irq, void* ctx) {
+    model->source = source;
+    model->sink = sink;
+    model->irq = irq;
+    model->callbackCtx = ctx;
+}
+
+void* XDMA_ModelGetBar(XDMA_MODEL* model) {
+    return model->bar;
+}
+
+UINT32 XDMA_ModelRead32(XDMA_MODEL* model, UINT32 offset) {
+    volatile UINT32* reg = &model->bar[(offset % XDMA_MODEL_BAR_SIZE) / sizeof(UINT32)];
+
+    // engine status read-to-clear also retracts the engine's interrupt request
+    if ((offset < IRQ_BLOCK_OFFSET)
+        && ((offset & (ENGINE_OFFSET - 1)) == REG_OFFSET(XDMA_ENGINE_REGS, statusRC))) {
+        const UINT32 ch = (offset >> 8) & 0xF;
+        if ((ch >= XDMA_MODEL_MAX_CHANNELS) || !model->engines[ch][offset >> 12].present) {
+            return 0;
+        }
+        XDMA_MODEL_ENGINE* eng = &model->engines[ch][offset >> 12];
+        UINT32 status = eng->regs->status;
+        eng->regs->status &= XDMA_BUSY_BIT;
+        model->irqRegs->channelIntRequest &= ~eng->irqBit;
+        ModelUpdateIrq(model);
+        return status;
+    }
+    return *reg;
+}
+
+void XDMA_ModelWrite32(XDMA_MODEL* model, UINT32 offset, UINT32 value) {
+    offset %= XDMA_MODEL_BAR_SIZE;
+    if (ModelIsReadOnly(offset)) {
+        return;
+    }
+    model->bar[offset / sizeof(UINT32)] = value;
+    XDMA_ModelSync(model);
+}
+
+void XDMA_ModelSync(XDMA_MODEL* model) {
+    volatile XDMA_IRQ_REGS* irq = model->irqRegs;
+    volatile XDMA_SGDMA_COMMON_REGS* common = model->sgdmaRegs;
+
+    ModelApplyW1(&irq->userIntEnable, &irq->userIntEnableW1S, &irq->userIntEnableW1C);
+    ModelApplyW1(&irq->channelIntEnable, &irq->channelIntEnableW1S, &irq->channelIntEnableW1C);
+    ModelApplyW1(&common->control, &common->controlW1S, &common->controlW1C);
+    ModelApplyW1(&common->creditModeEnable, &common->creditModeEnableW1S,
+                 &common->creditModeEnableW1C);
+
+    for (UINT32 dir = 0; dir < XDMA_MODEL_NUM_DIRECTIONS; dir++) {
+        for (UINT32 ch = 0; ch < XDMA_MODEL_MAX_CHANNELS; ch++) {
+            XDMA_MODEL_ENGINE* eng = &model->engines[ch][dir];
+            if (!eng->present) {
+                continue;
+            }
+            ModelApplyW1(&eng->regs->control, &eng->regs->controlW1S, &eng->regs->controlW1C);
+            ModelApplyW1(&eng->regs->intEnableMask, &eng->regs->intEnableMaskW1S,
+                         &eng->regs->intEnableMaskW1C);
+            if (eng->regs->control != eng->lastControl) {
+                ModelEngineControlChanged(eng);
+            }
+
+            // writes to the credit register add to the credits of the channel
+            if (eng->sgdma->descCredits) {
+                eng->credits += eng->sgdma->descCredits;
+                eng->sgdma->descCredits = 0;
+            }
+        }
+    }
+    ModelUpdateIrq(model);
+}
+
+UINT32 XDMA_ModelServiceEngine(XDMA_MODEL* model, UINT32 dir, UINT32 channel,
+                               UINT32 maxDescriptors) {
+    XDMA_ModelSync(model);
+    XDMA_MODEL_ENGINE* eng = &model->engines[channel][dir];
+    UINT32 processed = 0;
+    while ((processed < maxDescriptors) && ModelEngineStep(model, eng)) {
+        processed++;
+    }
+    return processed;
+}
+
+UINT32 XDMA_ModelService(XDMA_MODEL* model, UINT32 maxDescriptors) {
+    XDMA_ModelSync(model);
+    UINT32 processed = 0;
+    BOOLEAN progress = TRUE;
+    while (progress && (processed < maxDescriptors)) {
+        progress = FALSE;
+        for (UINT32 dir = 0; dir < XDMA_MODEL_NUM_DIRECTIONS; dir++) {
+            for (UINT32 ch = 0; (ch < XDMA_MODEL_MAX_CHANNELS) && (processed < maxDescriptors); ch++) {
+                XDMA_MODEL_ENGINE* eng = &model->engines[ch][dir];
+                if (eng->present && ModelEngineStep(model, eng)) {
+                    processed++;
+                    progress = TRUE;
+                }
+            }
+        }
+    }
+    return processed;
+}
+
+void XDMA_ModelSetUserIrq(XDMA_MODEL* model, UINT32 eventId, BOOLEAN asserted) {
+    if (eventId >= 16) {
+        return;
+    }
+    if (asserted) {
+        model->irqRegs->userIntRequest |= BIT_N(eventId);
+    } else {
+        model->irqRegs->userIntRequest &= ~BIT_N(eventId);
+    }
+    XDMA_ModelSync(model);
+}
+
+void XDMA_ModelGetStats(const XDMA_MODEL* model, UINT32 dir, UINT32 channel,
+                        XDMA_MODEL_STATS* stats) {
+    *stats = model->engines[channel][dir].stats;
+}
@@ -0,0 +1,155 @@
+/*
+* XDMA IP Behavioral Model
+* ===============================
+*
+* Memory-backed software model of the XDMA config BAR and its SGDMA engines. It allows the
+* descriptor, ring and poll logic of libxdma to be exercised and benchmarked on a host without an
+* XDMA card.
+*
+* The model owns a plain memory image of the config BAR laid out exactly as described in reg.h.
+* Register side effects (W1S/W1C mirrors, read-to-clear status, run bit edges, descriptor credits)
+* are applied either immediately by XDMA_ModelRead32()/XDMA_ModelWrite32(), or lazily by
+* XDMA_ModelSync() for code that accesses the register structs directly. Direct writes to the same
+* W1S/W1C mirror between two syncs coalesce, and read-to-clear semantics are only available through
+* XDMA_ModelRead32().
+*
+* Host memory is identity mapped: the bus addresses found in descriptors, dma results and the poll
+* mode writeback registers are host virtual addresses.
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_platform.h" // built with XDMA_PORTABLE, see Makefile
+#include "reg.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_MODEL_BAR_SIZE         (0x10000UL)
+#define XDMA_MODEL_MAX_CHANNELS     (4)
+#define XDMA_MODEL_NUM_DIRECTIONS   (2)
+#define XDMA_MODEL_IP_VERSION       (6) // v2017_1
+#define XDMA_MODEL_H2C              (0)
+#define XDMA_MODEL_C2H              (1)
+
+// ========================= type declarations ====================================================
+
+/// Produce AXI-ST C2H data. Returns the number of bytes written to dst (at most maxBytes) and sets
+/// *eop if the block ends a packet. Returning 0 without eop means no data is available yet.
+typedef UINT32(*PFN_XDMA_MODEL_SOURCE)(void* ctx, UINT32 channel, void* dst, UINT32 maxBytes,
+                                       BOOLEAN* eop);
+
+/// Consume AXI-ST H2C data.
+typedef void(*PFN_XDMA_MODEL_SINK)(void* ctx, UINT32 channel, const void* src, UINT32 numBytes,
+                                   BOOLEAN eop);
+
+/// Called whenever a channel or user interrupt becomes pending (requested and enabled).
+typedef void(*PFN_XDMA_MODEL_IRQ)(void* ctx, UINT32 channelIrqPending, UINT32 userIrqPending);
+
+/// Static configuration of the modelled IP core
+typedef struct XDMA_MODEL_CONFIG_T {
+    UINT32 numH2C;          // number of H2C engines present (0-4)
+    UINT32 numC2H;          // number of C2H engines present (0-4)
+    BOOLEAN streaming;      // AXI-ST instead of AXI-MM user interface
+    UINT32 pcieMRRS;        // max read request size as encoded in the config block (0=128B)
+    UINT32 pcieWidth;       // data path width as encoded in the config block (0=64bit)
+    UINT32 alignments;      // raw value of the engine alignments register
+    UINT64 cardMemSize;     // bytes of card memory behind the AXI-MM interface
+} XDMA_MODEL_CONFIG;
+
+/// Per-engine statistics gathered by the model
+typedef struct XDMA_MODEL_STATS_T {
+    UINT64 descriptors;     // descriptors processed
+    UINT64 descFetches;     // descriptor fetch requests (one per adjacent block)
+    UINT64 bytes;           // payload bytes moved
+    UINT64 packets;         // AXI-ST packets (descriptors/results with EOP)
+    UINT64 stallsNoCredit;  // service attempts blocked by missing descriptor credits
+    UINT64 stallsNoData;    // service attempts blocked by an empty AXI-ST source
+    UINT64 interrupts;      // channel interrupt requests raised
+    UINT64 errors;          // descriptor, magic or address errors
+} XDMA_MODEL_STATS;
+
+/// Modelled state of a single SGDMA engine
+typedef struct XDMA_MODEL_ENGINE_T {
+    BOOLEAN present;
+    BOOLEAN running;
+    UINT32 channel;
+    UINT32 dir;                     // 0=H2C, 1=C2H
+    UINT32 irqBit;                  // bit in channelIntRequest
+    volatile XDMA_ENGINE_REGS* regs;
+    volatile XDMA_SGDMA_REGS* sgdma;
+    UINT32 lastControl;             // control value seen on the previous sync (run bit edges)
+
+    // descriptor fetch state
+    UINT64 fetchAddr;               // bus address of the next descriptor fetch
+    UINT32 fetchAdj;                // adjacent descriptors of the next fetch
+    UINT64 blockAddr;               // bus address of the current fetched block
+    UINT32 blockCount;              // descriptors in the current fetched block
+    UINT32 blockIndex;              // next descriptor to process within the block
+
+    UINT32 credits;                 // descriptor credits (AXI-ST C2H credit mode)
+    XDMA_MODEL_STATS stats;
+} XDMA_MODEL_ENGINE;
+
+/// The modelled XDMA IP core
+typedef struct XDMA_MODEL_T {
+    XDMA_MODEL_CONFIG config;
+    UINT32* bar;                    // config BAR image
+    volatile XDMA_IRQ_REGS* irqRegs;
+    volatile XDMA_CONFIG_REGS* configRegs;
+    volatile XDMA_SGDMA_COMMON_REGS* sgdmaRegs;
+    XDMA_MODEL_ENGINE engines[XDMA_MODEL_MAX_CHANNELS][XDMA_MODEL_NUM_DIRECTIONS];
+    UINT8* cardMem;
+
+    PFN_XDMA_MODEL_SOURCE source;
+    PFN_XDMA_MODEL_SINK sink;
+    PFN_XDMA_MODEL_IRQ irq;
+    void* callbackCtx;
+} XDMA_MODEL;
+
+// ========================= function declarations ================================================
+
+/// Fill in a default configuration: 1 H2C + 1 C2H AXI-MM engine, 512B MRRS, 256bit data path
+void XDMA_ModelDefaultConfig(XDMA_MODEL_CONFIG* config);
+
+/// Allocate and reset a model. Returns NULL on allocation failure.
+XDMA_MODEL* XDMA_ModelCreate(const XDMA_MODEL_CONFIG* config);
+
+/// Free all model resources
+void XDMA_ModelDestroy(XDMA_MODEL* model);
+
+/// Install the AXI-ST source/sink and interrupt callbacks. Any of them may be NULL.
+void XDMA_ModelSetCallbacks(XDMA_MODEL* model, PFN_XDMA_MODEL_SOURCE source,
+                            PFN_XDMA_MODEL_SINK sink, PFN_XDMA_MODEL_IRQ irq, void* ctx);
+
+/// Base address of the config BAR image, i.e. what MmMapIoSpace would return for the config BAR
+void* XDMA_ModelGetBar(XDMA_MODEL* model);
+
+/// Register read with read-to-clear semantics
+UINT32 XDMA_ModelRead32(XDMA_MODEL* model, UINT32 offset);
+
+/// Register write with W1S/W1C, run bit and credit semantics
+void XDMA_ModelWrite32(XDMA_MODEL* model, UINT32 offset, UINT32 value);
+
+/// Apply side effects of writes made directly to the BAR image
+void XDMA_ModelSync(XDMA_MODEL* model);
+
+/// Process up to maxDescriptors descriptors on a single engine. Returns the number processed.
+UINT32 XDMA_ModelServiceEngine(XDMA_MODEL* model, UINT32 dir, UINT32 channel,
+                               UINT32 maxDescriptors);
+
+/// Sync and then process descriptors round-robin on all running engines until every engine is
+/// stopped or stalled, or maxDescriptors have been processed. Returns the number processed.
+UINT32 XDMA_ModelService(XDMA_MODEL* model, UINT32 maxDescriptors);
+
+/// Assert or deassert a user interrupt request line (0-15)
+void XDMA_ModelSetUserIrq(XDMA_MODEL* model, UINT32 eventId, BOOLEAN asserted);
+
+/// Get the statistics of one engine
+void XDMA_ModelGetStats(const XDMA_MODEL* model, UINT32 dir, UINT32 channel,
+                        XDMA_MODEL_STATS* stats);
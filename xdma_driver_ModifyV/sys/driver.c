@@ -21,18 +21,19 @@
 
 // ========================= include dependencies =================================================
 
+#include <ntstrsafe.h>
 #include "driver.h"
 #include "file_io.h"
 #include "trace.h"
 
 #ifdef DBG
-// "#include xx.tmh"WPP_CONTROL_GUIDS궨֮ڶ wpp κε֮ǰ
+// "#include xx.tmh"语句必须出现在WPP_CONTROL_GUIDS宏定义之后、在对 wpp 宏的任何调用之前。
 #include "driver.tmh"
 #endif
 
 // ========================= declarations ================================================= 
 
-// Щ͵ıǺָ룬ָʵʵʵֺȻṹǲ
+// 这些类型的变量是函数指针，指向实际的实现函数，虽然看着像结构体变量但是不是
 DRIVER_INITIALIZE DriverEntry;
 DRIVER_UNLOAD DriverUnload;
 
@@ -43,7 +44,7 @@ EVT_WDF_DEVICE_RELEASE_HARDWARE     EvtDeviceReleaseHardware;
 
 static NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queue);
 
-// ЩΪɷҳ
+// 将这些函数标记为可分页代码
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
 #pragma alloc_text (PAGE, DriverUnload)
@@ -53,46 +54,107 @@ static NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEU
 #pragma alloc_text (PAGE, EngineCreateQueue)
 #endif
 
-// =========================  =================================================
+// ========================= 定义日期 =================================================
 
 const char * const dateTimeStr = "Built " __DATE__ ", " __TIME__ ".";
 
-// WindowsעлȡΪ POLL_MODE Ĳֵ洢 pollMode С 
-static NTSTATUS GetPollModeParameter(IN PULONG pollMode) {
-    // ȡǰ WDFDRIVER 󣬸ö
-    WDFDRIVER driver = WdfGetDriver();
-    WDFKEY key;
-    // ڵע,STANDARD_RIGHTS_ALL ʾԼȫȨ
-    NTSTATUS status = WdfDriverOpenParametersRegistryKey(driver, STANDARD_RIGHTS_ALL,
-                                                         WDF_NO_OBJECT_ATTRIBUTES, &key);
-    ULONG tracepollmode;
-    
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
-        WdfRegistryClose(key);
-        return status;
+// Query an optional ULONG parameter. With an engine given, name applies to all engines and is
+// overridden by name_<H2C|C2H>_<channel>. value keeps its default if neither is set.
+static VOID QueryEngineULong(IN WDFKEY key, IN PCWSTR name, IN XDMA_ENGINE* engine,
+                             IN OUT PULONG value) {
+    UNICODE_STRING valueName;
+    RtlInitUnicodeString(&valueName, name);
+    WdfRegistryQueryULong(key, &valueName, value);
+    if (engine == NULL) {
+        return;
     }
 
-    // һ Unicode ַΪ valueNameΪ "POLL_MODE"
+    DECLARE_UNICODE_STRING_SIZE(engineValueName, 32);
+    NTSTATUS status = RtlUnicodeStringPrintf(&engineValueName, L"%ws_%hs_%u", name,
+                                             DirectionToString(engine->dir), engine->channel);
+    if (NT_SUCCESS(status)) {
+        WdfRegistryQueryULong(key, &engineValueName, value);
+    }
+}
+
+// 从Windows注册表中获取名为 POLL_MODE 的参数值，并将其存储在 pollMode 输出参数中。 
+static NTSTATUS GetPollModeParameter(IN WDFKEY key, IN PULONG pollMode) {
+    ULONG tracepollmode;
+
+    // 声明一个常量的 Unicode 字符串，名字为 valueName，内容为 "POLL_MODE"。
     DECLARE_CONST_UNICODE_STRING(valueName, L"POLL_MODE");
 
-    // ѯעе POLL_MODE ֵ
-    status = WdfRegistryQueryULong(key, &valueName, pollMode);
+    // 查询注册表中的 POLL_MODE 值
+    NTSTATUS status = WdfRegistryQueryULong(key, &valueName, pollMode);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "WdfRegistryQueryULong failed: %!STATUS!", status);
-        WdfRegistryClose(key);
         return status;
     }
 
     tracepollmode = *pollMode;
     TraceVerbose(DBG_INIT, "pollMode=%u", tracepollmode);
-
-    // رע
-    WdfRegistryClose(key);
     return status;
 }
 
-// main entry point - װʱ
+// Read the optional max spin per run of the hybrid completion mode (POLL_MODE=2) from the registry.
+static ULONG GetSpinParameter(IN WDFKEY key) {
+    ULONG spinUs = XDMA_DEFAULT_SPIN_US;
+    QueryEngineULong(key, L"SPIN_US", NULL, &spinUs);
+    TraceVerbose(DBG_INIT, "spinUs=%u", spinUs);
+    return spinUs;
+}
+
+// Read the optional poller thread parameters from the registry. Returns TRUE if POLL_THREAD is set.
+static BOOLEAN GetPollThreadParameters(IN WDFKEY key, OUT PULONG affinity, OUT PULONG idleSpinUs,
+                                       OUT PULONG idleWaitUs) {
+    ULONG enable = 0;
+    *affinity = 0;
+    *idleSpinUs = XDMA_DEFAULT_POLLER_IDLE_SPIN_US;
+    *idleWaitUs = XDMA_DEFAULT_POLLER_IDLE_WAIT_US;
+
+    QueryEngineULong(key, L"POLL_THREAD", NULL, &enable);
+    QueryEngineULong(key, L"POLL_THREAD_AFFINITY", NULL, affinity);
+    QueryEngineULong(key, L"POLL_THREAD_IDLE_SPIN_US", NULL, idleSpinUs);
+    QueryEngineULong(key, L"POLL_THREAD_IDLE_WAIT_US", NULL, idleWaitUs);
+    TraceVerbose(DBG_INIT, "pollThread=%u, affinity=0x%x, idleSpinUs=%u, idleWaitUs=%u",
+                 enable, *affinity, *idleSpinUs, *idleWaitUs);
+    return enable != 0;
+}
+
+// Read the number of requests in flight for an engine from the registry.
+// QUEUE_DEPTH applies to all engines and is overridden by QUEUE_DEPTH_<H2C|C2H>_<channel>.
+static ULONG GetQueueDepthParameter(IN WDFKEY key, IN XDMA_ENGINE* engine) {
+    ULONG depth = XDMA_DEFAULT_QUEUE_DEPTH;
+    QueryEngineULong(key, L"QUEUE_DEPTH", engine, &depth);
+    TraceVerbose(DBG_INIT, "%s_%u queueDepth=%u",
+                 DirectionToString(engine->dir), engine->channel, depth);
+    return depth;
+}
+
+// Read the geometry and the memory type of the AXI-ST C2H ring of an engine from the registry.
+// RING_BLOCKS, RING_BLOCK_SIZE and RING_MEMORY apply to all engines and are overridden by
+// RING_BLOCKS_C2H_<channel>, RING_BLOCK_SIZE_C2H_<channel> and RING_MEMORY_C2H_<channel>.
+static VOID GetRingGeometryParameters(IN WDFKEY key, IN XDMA_ENGINE* engine, OUT PULONG numBlocks,
+                                      OUT PULONG blockSize, OUT PULONG memory) {
+    *numBlocks = XDMA_RING_NUM_BLOCKS;
+    *blockSize = XDMA_RING_BLOCK_SIZE;
+    *memory = XDMA_RING_MEMORY_NONCACHED;
+    QueryEngineULong(key, L"RING_BLOCKS", engine, numBlocks);
+    QueryEngineULong(key, L"RING_BLOCK_SIZE", engine, blockSize);
+    QueryEngineULong(key, L"RING_MEMORY", engine, memory);
+    TraceVerbose(DBG_INIT, "%s_%u ringBlocks=%u, ringBlockSize=%u, ringMemory=%u",
+                 DirectionToString(engine->dir), engine->channel, *numBlocks, *blockSize, *memory);
+}
+
+// Read the optional max dma transfer length from the registry. 0 selects the library default.
+static ULONG GetMaxTransferSizeParameter(IN WDFKEY key) {
+    ULONG maxTransferSize = 0;
+    QueryEngineULong(key, L"MAX_TRANSFER_SIZE", NULL, &maxTransferSize);
+    TraceVerbose(DBG_INIT, "maxTransferSize=%u", maxTransferSize);
+    return maxTransferSize;
+}
+
+// main entry point - 安装驱动程序时调用
 NTSTATUS DriverEntry(IN PDRIVER_OBJECT driverObject, IN PUNICODE_STRING registryPath) {
     NTSTATUS			status = STATUS_SUCCESS;
     WDF_DRIVER_CONFIG	DriverConfig;
@@ -115,7 +177,7 @@ NTSTATUS DriverEntry(IN PDRIVER_OBJECT driverObject, IN PUNICODE_STRING registry
         return status;
     }
 
-    // ͨڳɹжغȷʱһЧжش
+    // 通常在成功创建驱动程序对象后设置卸载函数。这确保了在驱动程序正常运行时，有一个有效的卸载处理函数
     driverObject->DriverUnload = DriverUnload;
 
     return status;
@@ -140,13 +202,13 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     TraceVerbose(DBG_INIT, "(Driver=0x%p)", Driver);
 
     /*
-    豸Ķȡдеݻķ
-    豸ʹֱ I/O (Direct I/O) ģʽ,
-    δǸ豸 I/O ʱʹֱ I/O ʽЧʣݾܻ˻ص I/O
+    设置驱动程序访问设备的读取和写入请求中的数据缓冲区的方法
+    设置设备使用直接 I/O (Direct I/O) 模式,
+    这段代码是告诉设备在 I/O 操作时优先使用直接 I/O 方式来提高效率，但根据具体情况可能会退回到缓冲 I/O。
     */
     WdfDeviceInitSetIoType(DeviceInit, WdfDeviceIoDirect);
 
-    // ΪҪκκûصûûصܽвȡĬϲ
+    // 为我们需要的任何函数设置回调。如果没有设置回调，框架将自行采取默认操作。
     WDF_PNPPOWER_EVENT_CALLBACKS PnpPowerCallbacks;
     WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&PnpPowerCallbacks);
     PnpPowerCallbacks.EvtDevicePrepareHardware = EvtDevicePrepareHardware;
@@ -157,7 +219,7 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     WDF_POWER_POLICY_EVENT_CALLBACKS_INIT(&powerPolicyCallbacks);
     WdfDeviceInitSetPowerPolicyEventCallbacks(DeviceInit, &powerPolicyCallbacks);
 
-    // עļص
+    // 注册文件对象回调
     WDF_OBJECT_ATTRIBUTES fileAttributes;
     WDF_FILEOBJECT_CONFIG fileConfig;
     WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, EvtDeviceFileCreate, EvtFileClose, EvtFileCleanup);
@@ -166,12 +228,15 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
     WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, &fileAttributes);
 
-    // ָҪ豸ͺʹС
+    // IOCTL_XDMA_RING_MAP has to be handled in the context of the calling process
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, EvtIoInCallerContext);
+
+    // 指定我们要创建的设备的上下文类型和大小。
     WDF_OBJECT_ATTRIBUTES deviceAttributes;
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DeviceContext);
     /*
-    ɾ豸ʱContextCleanupˣڴ豸
-    EvtDeviceAddκδƳͷŷصκԴ
+    框架在删除设备时将调用ContextCleanup。因此，在创建设备后，
+    如果EvtDeviceAdd返回任何错误，您可以推迟释放分配给清理回调的任何资源。
     */
     deviceAttributes.EvtCleanupCallback = EvtDeviceCleanup;
     WDFDEVICE device;
@@ -181,7 +246,7 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
         return status;
     }
 
-    // Ϊָ豸(GUID)豸ӿ
+    // 为指定设备(GUID)创建设备接口
     status = WdfDeviceCreateDeviceInterface(device, (LPGUID)&GUID_DEVINTERFACE_XDMA, NULL);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "WdfDeviceCreateDeviceInterface failed %!STATUS!", status);
@@ -189,7 +254,7 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     }
 
     /*
-    I/O󵽴ʱĬ϶нܶеI/OЩ˳
+    在所有I/O请求到达时创建默认队列接受多个并行运行的I/O请求，这些请求随后被顺序化
     */
     WDF_IO_QUEUE_CONFIG queueConfig;
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchParallel);
@@ -203,18 +268,37 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
         return status;
     }
 
+    // requests longer than the descriptor stores hold wait here until a work item has grown them
+    DeviceContext* ctx = GetDeviceContext(device);
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+    status = WdfIoQueueCreate(device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &ctx->storeQueue);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
+    WDF_WORKITEM_CONFIG workItemConfig;
+    WDF_WORKITEM_CONFIG_INIT(&workItemConfig, EvtWorkItemGrowStores);
+    WDF_OBJECT_ATTRIBUTES workItemAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&workItemAttributes);
+    workItemAttributes.ParentObject = device;
+    status = WdfWorkItemCreate(&workItemConfig, &workItemAttributes, &ctx->storeWorkItem);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfWorkItemCreate failed: %!STATUS!", status);
+        return status;
+    }
+
     TraceVerbose(DBG_INIT, "returns %!STATUS!", status);
     return status;
 }
 
-// κض豸 - TODO 豸ã
+// 任何特定于设备的清理 - TODO 设备重置？
 VOID EvtDeviceCleanup(IN WDFOBJECT device) {
     UNREFERENCED_PARAMETER(device);
     TraceInfo(DBG_INIT, "%!FUNC!");
 }
 
-// ʼ豸Ӳ
-// ɼ弴ùã豸׼ʹӲԴ֮ǰõĻصͨ豸ʼʱʹãӲ
+// 初始化设备硬件和主机缓冲区。
+// 由即插即用管理器调用，在设备准备好使用硬件资源之前调用的回调函数。通常在设备初始化时使用，以配置硬件。
 NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources,
                                   IN WDFCMRESLIST ResourcesTranslated) {
     PAGED_CODE();
@@ -223,54 +307,102 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
 
     DeviceContext* ctx = GetDeviceContext(device);
     PXDMA_DEVICE xdma = &(ctx->xdma);
-    NTSTATUS status = XDMA_DeviceOpen(device, xdma, Resources, ResourcesTranslated);
+
+    // the driver parameters are read from one open key, see QueryEngineULong()
+    WDFKEY key;
+    NTSTATUS status = WdfDriverOpenParametersRegistryKey(WdfGetDriver(), STANDARD_RIGHTS_ALL,
+                                                         WDF_NO_OBJECT_ATTRIBUTES, &key);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "XDMA_DeviceOpen failed: %!STATUS!", status);
+        TraceError(DBG_INIT, "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
         return status;
     }
 
-    // ȡѯģʽҪʱΪѯģʽ
+    status = XDMA_DeviceOpen(device, xdma, Resources, ResourcesTranslated,
+                             GetMaxTransferSizeParameter(key));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "XDMA_DeviceOpen failed: %!STATUS!", status);
+        goto Exit;
+    }
+
+    // 获取轮询模式参数，并在需要时将引擎配置为轮询模式
     ULONG pollMode = 0;
-    status = GetPollModeParameter(&pollMode);
+    status = GetPollModeParameter(key, &pollMode);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "GetPollModeParameter failed: %!STATUS!", status);
-        return status;
+        goto Exit;
     }
+    if (pollMode > XDMA_COMPLETION_MODE_HYBRID) { // any other non-zero value used to mean polling
+        pollMode = XDMA_COMPLETION_MODE_POLL;
+    }
+    const ULONG spinUs = GetSpinParameter(key);
     for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
             XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
-            XDMA_EngineSetPollMode(engine, (BOOLEAN)pollMode);
+            status = XDMA_EngineSetCompletionMode(engine, pollMode, spinUs);
+            if (status == STATUS_NOT_SUPPORTED) { // hybrid mode on an AXI-ST C2H engine
+                TraceWarning(DBG_INIT, "%s_%u completion mode %u not supported, using interrupts",
+                             DirectionToString(engine->dir), engine->channel, pollMode);
+                status = XDMA_EngineSetCompletionMode(engine, XDMA_COMPLETION_MODE_INTERRUPT, spinUs);
+            }
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_INIT, "XDMA_EngineSetCompletionMode failed: %!STATUS!", status);
+                goto Exit;
+            }
+        }
+    }
+
+    // optionally service all engines in poll mode from a single thread
+    ULONG pollThreadAffinity, idleSpinUs, idleWaitUs;
+    if (GetPollThreadParameters(key, &pollThreadAffinity, &idleSpinUs, &idleWaitUs)) {
+        status = XDMA_PollerStart(xdma, (KAFFINITY)pollThreadAffinity, idleSpinUs, idleWaitUs);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "XDMA_PollerStart failed: %!STATUS!", status);
+            goto Exit;
         }
     }
 
-    // Ϊÿ洴һ
+    // 为每个引擎创建一个队列
     for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
             XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
             if (engine->enabled == TRUE) {
+                ULONG ringBlocks, ringBlockSize, ringMemory;
+                GetRingGeometryParameters(key, engine, &ringBlocks, &ringBlockSize, &ringMemory);
+                status = XDMA_EngineSetRingGeometry(engine, ringBlocks, ringBlockSize, ringMemory);
+                if (!NT_SUCCESS(status)) {
+                    TraceError(DBG_INIT, "XDMA_EngineSetRingGeometry() failed: %!STATUS!", status);
+                    goto Exit;
+                }
+                status = XDMA_EngineSetQueueDepth(engine, GetQueueDepthParameter(key, engine));
+                if (!NT_SUCCESS(status)) {
+                    TraceError(DBG_INIT, "XDMA_EngineSetQueueDepth() failed: %!STATUS!", status);
+                    goto Exit;
+                }
                 status = EngineCreateQueue(device, engine, &(ctx->engineQueue[dir][ch]));
                 if (!NT_SUCCESS(status)) {
                     TraceError(DBG_INIT, "EngineCreateQueue() failed: %!STATUS!", status);
-                    return status;
+                    goto Exit;
                 }
             }
         }
     }
 
-    // ѭ XDMA_MAX_USER_IRQΪÿûжϳʼһ¼
+    // 循环遍历 XDMA_MAX_USER_IRQ，为每个用户中断初始化一个事件对象
     for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
-        // ʼ¼NotificationEvent ʾһ֪ͨ¼FALSE ʾ¼ʼ״̬Ϊź״̬
+        // 初始化事件，NotificationEvent 表示这是一个通知事件，FALSE 表示事件初始状态为非信号状态。
         KeInitializeEvent(&ctx->eventSignals[i], NotificationEvent, FALSE);
         
-        // עжϷ̣ISRжϷʱ HandleUserEvent Ӧ¼󴫵ݸ
+        // 注册中断服务例程（ISR）。在中断发生时，会调用 HandleUserEvent 函数，并将对应的事件对象传递给它。
         XDMA_UserIsrRegister(xdma, i, HandleUserEvent, &ctx->eventSignals[i]);
     }
 
+Exit:
+    WdfRegistryClose(key);
     TraceVerbose(DBG_INIT, "<--Exit returning %!STATUS!", status);
     return status;
 }
 
-// ȡӳPCIeԴ
+// 取消映射PCIe资源
 NTSTATUS EvtDeviceReleaseHardware(IN WDFDEVICE Device, IN WDFCMRESLIST ResourcesTranslated) {
 
     PAGED_CODE();
@@ -287,9 +419,9 @@ NTSTATUS EvtDeviceReleaseHardware(IN WDFDEVICE Device, IN WDFCMRESLIST Resources
 }
 
 /*
-úΪDMA洴һ˳ȵWDF IOУ
-DMA䷽öӦĻصд
-صݣ XDMA_ENGINE ָ룩浽еС
+该函数的作用是为DMA引擎创建一个顺序调度的WDF IO队列，
+并根据DMA传输方向配置对应的回调函数。队列创建后，
+相关的上下文数据（即 XDMA_ENGINE 指针）被保存到队列的上下文中。
 */
 NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queue)
 {
@@ -300,10 +432,18 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
 
     PAGED_CODE();
 
-    // ʼIOãΪ˳ģʽ WdfIoQueueDispatchSequentialIO˳ŶִС
-    WDF_IO_QUEUE_CONFIG_INIT(&config, WdfIoQueueDispatchSequential);
+    // 初始化IO队列配置，并设置为并行调度模式 WdfIoQueueDispatchParallel，即多个IO请求可同时交给引擎。
+    // engines with a request pipeline get up to queue depth requests presented in parallel, the
+    // AXI-ST C2H ring up to the number of buffers which may be posted to it. Ring reads still run
+    // one at a time, the queue callbacks are serialized (see SynchronizationScope below).
+    WDF_IO_QUEUE_CONFIG_INIT(&config, WdfIoQueueDispatchParallel);
+    if ((engine->type == EngineType_ST) && (engine->dir == C2H)) {
+        config.Settings.Parallel.NumberOfPresentedRequests = engine->rx.depth;
+    } else {
+        config.Settings.Parallel.NumberOfPresentedRequests = engine->pipeline.depth;
+    }
 
-    // DMAķ engine->dirжϵǰǴ豸C2HǴ豸H2CĴ
+    // 根据DMA引擎的方向 engine->dir，判断当前是从设备到主机（C2H）还是从主机到设备（H2C）的传输
     ASSERTMSG("direction is neither H2C nor C2H!", (engine->dir == C2H) || (engine->dir == H2C));
 
     if (engine->dir == H2C) 
@@ -311,6 +451,8 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
         // callback handler for write requests
         config.EvtIoWrite = EvtIoWriteDma;
         TraceInfo(DBG_INIT, "EvtIoWrite=EvtIoWriteDma");
+        // gather sends, loops and vectored writes forwarded by EvtIoDeviceControl()
+        config.EvtIoDeviceControl = EvtIoEngineControl;
     } else if (engine->dir == C2H) 
     { 
         // callback handler for read requests
@@ -321,23 +463,25 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
         } else {
             config.EvtIoRead = EvtIoReadDma;
             TraceInfo(DBG_INIT, "EvtIoRead=EvtIoReadDma");
+            // vectored reads forwarded by EvtIoDeviceControl()
+            config.EvtIoDeviceControl = EvtIoEngineControl;
         }
     }
 
-    // ʼ attribsͬΧΪ WdfSynchronizationScopeQueueʾöصĻصᱻл
+    // 初始化 attribs，并将同步范围设置为 WdfSynchronizationScopeQueue，表示所有与该队列相关的回调会被序列化
     WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
     attribs.SynchronizationScope = WdfSynchronizationScopeQueue;
-    // öΪ QUEUE_CONTEXTԱ洢صݡ
+    // 设置队列上下文类型为 QUEUE_CONTEXT，以便存储与队列相关的上下文数据。
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&attribs, QUEUE_CONTEXT);
 
-    // IOУ豸󡢶áԴݸĶо洢 queue С
+    // 创建IO队列，将设备对象、队列配置、队列属性传递给它，并将创建的队列句柄存储在 queue 中。
     status = WdfIoQueueCreate(device, &config, &attribs, queue);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "WdfIoQueueCreate failed %d", status);
         return status;
     }
 
-    // ȡеģ engine 洢УڴʱʶӦDMA档
+    // 获取队列的上下文，并将 engine 对象存储到上下文中，这样可以在处理队列时访问对应的DMA引擎。
     context = GetQueueContext(*queue);
     context->engine = engine;
 
@@ -6,15 +6,15 @@
 * Copyright 2010-2012 Sidebranch
 * Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
 *
-* ά:
+* 维护者:
 * -----------
 * Alexander Hornburg <alexander.hornburg@xilinx.com>
 *
-* :
+* 描述:
 * ------------
-* Xilinx˾ġPCIe 3.0(XDMA) IPDMA/Žϵͳʾ
+* 这是Xilinx公司的“PCIe 3.0版(XDMA) IP的DMA/桥接子系统”的示例驱动程序。
 *
-* ο:
+* 参考:
 * -----------
 *	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v3.0 - Product Guide
 */
@@ -26,6 +26,8 @@
 typedef struct DeviceContext_t {
     XDMA_DEVICE xdma;
     WDFQUEUE engineQueue[2][XDMA_MAX_NUM_CHANNELS];
+    WDFQUEUE storeQueue;        // requests waiting for larger descriptor stores
+    WDFWORKITEM storeWorkItem;  // grows the stores and sends the requests back
     KEVENT eventSignals[XDMA_MAX_USER_IRQ];
 
 }DeviceContext;
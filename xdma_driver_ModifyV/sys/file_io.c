@@ -1,28 +1,34 @@
 /*
-* ڹAPIXDMA豸ļӿ
+* 用于公共API的XDMA设备文件接口
 * ===============================
 *
 * Copyright 2017 Xilinx Inc.
 * Copyright 2010-2012 Sidebranch
 * Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
 *
-* ά:
+* 维护者:
 * -----------
 * Alexander Hornburg <alexande@xilinx.com>
 *
-* IOͼ:
+* IO请求流程图:
 * ------------------------
-* û (e.g. ReadFile())
+* 用户操作 (e.g. ReadFile())
 * |
-* |->  IO    -> EvtIoRead()--> ReadBarToRequest()                   // PCI BAR
-*               |            |---> EvtIoReadDma()                       // dma c2h
-*               |            |---> EvtIoReadEngineRing()                // ʽӿ
-*               |            |---> CopyDescriptorsToRequestMemory()     // dmaȡûռ
-*               |            |---> ServiceUserEvent()                   // ȴûж
+* |->  IO请求    -> EvtIoRead()--> ReadBarToRequest()                   // PCI BAR访问
+*               |            |---> EvtIoReadDma()                       // 正常dma c2h传输
+*               |            |---> EvtIoReadEngineRing()                // 用于流式接口
+*               |            |---> CopyDescriptorsToRequestMemory()     // 将dma描述符获取到用户空间
+*               |            |---> ServiceUserEvent()                   // 等待用户中断
 *               |
-*               |-> EvtIoWrite()-> WriteBarFromRequest()                // PCI BAR
-*                             |--> EvtIoWriteDma()                      // DMA H2C
-*                             |--> WriteBypassDescriptor()              // ûռдƹBAR
+*               |-> EvtIoWrite()-> WriteBarFromRequest()                // PCI BAR访问
+*               |             |--> EvtIoWriteDma()                      // 正常DMA H2C传输
+*               |             |--> WriteBypassDescriptor()              // 从用户空间写入描述符以绕过BAR
+*               |
+*               |-> EvtIoDeviceControl()-> EvtIoEngineControl()-> IoSendPackets()       // AXI-ST H2C gather send and loop
+*                                                              |--> IoTransferVectors() // AXI-MM vectored transfers
+*                                                              |--> IoTransferStrided() // AXI-MM strided (2D) transfers
+*                                                              |--> IoFill()            // AXI-MM card memory fill
+*                                                              |--> IoTransferRegistered() // AXI-MM registered buffers
 */
 
 // ========================= include dependencies =================================================
@@ -35,17 +41,18 @@
 #include "trace.h"
 #ifdef DBG
 /*
-κ WPP ֮ǰͶ WPP_CONTROL_GUIDS ꣨ trace.h ж壩֮
-뽫Ϣͷ (.tmh) ļԴļС trace.h
+在任何 WPP 宏调用之前和定义 WPP_CONTROL_GUIDS 宏（在 trace.h 中定义）之后，
+必须将跟踪消息标头 (.tmh) 文件包含在源文件中。请参阅 trace.h
 */
 #include "file_io.tmh"
 #endif
 
 EVT_WDF_REQUEST_CANCEL      EvtCancelDma;
+EVT_WDF_REQUEST_CANCEL      EvtCancelRxPost;
 
-// ====================== 豸ļڵ =======================================================
-// ̬ṹ FileNameLUT
-// дڲұlookup tableԸ豸ͿҵӦļͨţںĲ
+// ====================== 设备文件节点 =======================================================
+// 静态常量结构体数组 FileNameLUT
+// 这种写法常用于查找表（lookup table），可以根据设备类型快速找到对应的文件名和通道号，便于后续的操作。
 const static struct {
     DEVNODE_TYPE devType;
     const wchar_t *wstr;
@@ -80,12 +87,12 @@ const static struct {
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_15,     15 },
 };
 
-// ļתΪ豸ڵ
+// 从文件名转换为设备节点
 static VOID GetDevNodeType(PUNICODE_STRING fileName, PFILE_CONTEXT file, ULONG* index)
 {
     for (UINT i = 0; i < sizeof(FileNameLUT) / sizeof(FileNameLUT[0]); ++i) {
         if (!wcscmp(fileName->Buffer, FileNameLUT[i].wstr)) {
-            // ˵fileName->BufferFileNameLUT[i].wstr
+            // 进到这里说明fileName->Buffer等于FileNameLUT[i].wstr
             file->devType = FileNameLUT[i].devType;
             *index = FileNameLUT[i].channel;
             return;
@@ -102,14 +109,14 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
     PFILE_CONTEXT devNode = GetFileContext(WdfFile);
     NTSTATUS status = STATUS_SUCCESS;
 
-    // ûиļ
+    // 没有给出文件名？
     if (fileName == NULL) {
         TraceError(DBG_IO, "Error: no filename given.");
         status = STATUS_INVALID_PARAMETER;
         goto ErrExit;
     }
 
-    // 豸ڵĳΪ㣿
+    // 设备节点的长度为零？
     ASSERTMSG("fileName is empty string", fileName->Length != 0);
     ULONG index = 0;
     GetDevNodeType(fileName, devNode, &index);
@@ -119,7 +126,7 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
         goto ErrExit;
     }
 
-    // 豸ͽж/
+    // 根据设备类型进行额外检查/设置
     switch (devNode->devType) {
     case DEVNODE_TYPE_CONTROL:
         devNode->u.bar = xdma->bar[xdma->configBarIdx];
@@ -190,26 +197,38 @@ VOID EvtFileCleanup(IN WDFFILEOBJECT FileObject) {
     PFILE_CONTEXT file = GetFileContext(FileObject);
     if (file->devType == DEVNODE_TYPE_C2H) {
         if (file->u.engine->type == EngineType_ST) {
+            EngineRingUnmap(file->u.engine, FileObject);
+            EngineRxStop(file->u.engine);
+            EngineRingSetOverrun(file->u.engine, XDMA_RING_OVERRUN_BACKPRESSURE);
             EngineRingTeardown(file->u.engine);
         }
+    } else if (file->devType == DEVNODE_TYPE_H2C) {
+        if (file->u.engine->type == EngineType_ST) {
+            EngineLoopStop(file->u.engine, FileObject);
+        }
+    }
+    if (((file->devType == DEVNODE_TYPE_H2C) || (file->devType == DEVNODE_TYPE_C2H)) &&
+        (file->u.engine->type == EngineType_MM)) {
+        EngineProgramDeleteAll(file->u.engine, FileObject);
+        EngineUnregisterBuffers(file->u.engine, FileObject);
     }
     TraceVerbose(DBG_IO, "Cleanup %wZ", fileName);
 }
 
-// ֤Bar
+// 验证Bar参数
 static NTSTATUS ValidateBarParams(IN PXDMA_DEVICE xdma, ULONG nBar, size_t offset, size_t length) {
     if (length == 0) {
         TraceError(DBG_IO, "Error: attempting to read 0 bytes");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    // BAR Ч
+    // BAR 索引无效？
     if (nBar >= xdma->numBars) {
         TraceError(DBG_IO, "Error: attempting to read BAR %u but only 2 exist", nBar);
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    // Ч BAR ַΧ֮⣿
+    // 访问有效 BAR 地址范围之外？
     if (offset + length >= xdma->barLength[nBar]) {
         TraceError(DBG_IO, "Error: attempting to read BAR %u offset=%llu size=%llu",
                    nBar, offset, length);
@@ -219,7 +238,7 @@ static NTSTATUS ValidateBarParams(IN PXDMA_DEVICE xdma, ULONG nBar, size_t offse
 }
 
 static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
-//  PCIe mmap ڴȡ IO 
+// 从 PCIe mmap 内存读取到 IO 请求中
 {
     WDF_REQUEST_PARAMETERS params;
     WDF_REQUEST_PARAMETERS_INIT(&params);
@@ -227,17 +246,17 @@ static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
     size_t offset = (size_t)params.Parameters.Read.DeviceOffset;
     size_t length = params.Parameters.Read.Length;
 
-    // ̬֤򲻹ܣ޷ ValidateBarParams м鳤
-    // ҲҪ
+    // 静态驱动程序验证程序不够智能，无法看到在 ValidateBarParams 中检查长度
+    // 因此我们也需要在这里检查
     if (length == 0) {
         TraceError(DBG_IO, "Error: attempting to read 0 bytes");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    //  mmap  BAR λõַ
+    // 计算 mmap 的 BAR 位置的虚拟地址
     PUCHAR readAddr = (PUCHAR)bar + offset;
 
-    // ȡIOڴľڴ潫ȡ
+    // 获取IO请求内存的句柄，该内存将保存读取的数据
     WDFMEMORY requestMemory;
     NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
@@ -245,7 +264,7 @@ static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
         return status;
     }
 
-    // ȡrequestMemoryָ
+    // 获取缓冲区requestMemory的指针
     PVOID reqBuffer = WdfMemoryGetBuffer(requestMemory, NULL);
 
     // read to BAR
@@ -261,7 +280,7 @@ static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
 }
 
 static NTSTATUS WriteBarFromRequest(WDFREQUEST request, PVOID bar)
-//  IO д PCIe mmap ڴ
+// 将 IO 请求写入 PCIe mmap 内存
 {
     WDF_REQUEST_PARAMETERS params;
     WDF_REQUEST_PARAMETERS_INIT(&params);
@@ -269,25 +288,25 @@ static NTSTATUS WriteBarFromRequest(WDFREQUEST request, PVOID bar)
     size_t offset = (size_t)params.Parameters.Read.DeviceOffset;
     size_t length = params.Parameters.Read.Length;
 
-    // ̬֤򲻹ܣ޷ ValidateBarParams м鳤
-    // ҲҪ
+    // 静态驱动程序验证程序不够智能，无法看到在 ValidateBarParams 中检查长度
+    // 因此我们也需要在这里检查
     if (length == 0) {
         TraceError(DBG_IO, "Error: attempting to read 0 bytes");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    //  mmap  BAR λõַ
+    // 计算 mmap 的 BAR 位置的虚拟地址
     PUCHAR writeAddr = (PUCHAR)bar + offset;
 
     WDFMEMORY requestMemory;
-    //ȡIOڴľڴ汣Ҫд
+    //获取IO请求内存的句柄，该内存保存要写入的数据
     NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
         return status;
     }
 
-    // ȡrequestMemoryָ
+    // 获取缓冲区requestMemory的指针
     PVOID reqBuffer = WdfMemoryGetBuffer(requestMemory, NULL);
 
     // write to BAR
@@ -304,12 +323,12 @@ static NTSTATUS WriteBarFromRequest(WDFREQUEST request, PVOID bar)
 }
 
 VOID EvtIoRead(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
-// 豸ڵ ReadFile ϵĻص
+// 设备节点 ReadFile 上的回调函数
 {
     NTSTATUS status = STATUS_SUCCESS;
     PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
 
-    UNREFERENCED_PARAMETER(length); // ȿԴȡ
+    UNREFERENCED_PARAMETER(length); // 长度可以从请求中提取
 
     TraceVerbose(DBG_IO, "(Queue=%p, Request=%p, Length=%llu)", queue, request, length);
     TraceVerbose(DBG_IO, "devNodeType %d", file->devType);
@@ -319,23 +338,23 @@ VOID EvtIoRead(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
     case DEVNODE_TYPE_CONTROL:
     case DEVNODE_TYPE_BYPASS:
         ASSERTMSG("no BAR ptr attached to file context", file->u.bar != NULL);
-        // ﴦת -  PCIe BAR ȡڴ
+        // 在这里处理请求而不转发 - 从 PCIe BAR 读取到请求内存中
         status = ReadBarToRequest(request, file->u.bar);
         if (NT_SUCCESS(status)) {
-            //  - ȡֽ requestMemory 
+            // 完成请求 - 读取的字节在 requestMemory 中
             WdfRequestCompleteWithInformation(request, status, length);
         }
         break;
     case DEVNODE_TYPE_EVENTS:
         ASSERTMSG("no event attached to file context", file->u.event != NULL);
-        // ת-Ժ EvtIoReadDma 
+        // 将请求转发到引擎队列-稍后由 EvtIoReadDma 完成
         status = EvtReadUserEvent(request, length);
         break;
     case DEVNODE_TYPE_C2H:
     {
         ASSERTMSG("no engine attached to file context", file->u.engine != NULL);
 
-        // ת-Ժ EvtIoReadDma 
+        // 将请求转发到引擎队列-稍后由 EvtIoReadDma 完成
         status = WdfRequestForwardToIoQueue(request, file->queue);
         break;
     }
@@ -350,16 +369,16 @@ VOID EvtIoRead(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
         WdfRequestComplete(request, status);
     }
 
-    return; // ֱɻת
+    return; // 请求已直接完成或转发到队列
 }
 
 VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
-// 豸ڵдĻص
+// 设备节点写操作的回调函数
 {
     NTSTATUS status = STATUS_SUCCESS;
     PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
 
-    UNREFERENCED_PARAMETER(length); // Դȡ
+    UNREFERENCED_PARAMETER(length); // 可以从请求中提取长度
 
     TraceVerbose(DBG_IO, "(Queue=%p, Request=%p)", queue, request);
     TraceVerbose(DBG_IO, "DevNodeID %d", file->devType);
@@ -369,7 +388,7 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
     case DEVNODE_TYPE_CONTROL:
     case DEVNODE_TYPE_BYPASS:
         ASSERTMSG("no BAR ptr attached to file context", file->u.bar != NULL);
-        // ڴ˴תڴд PCIe BAR
+        // 在此处理请求而不转发。从请求内存写入 PCIe BAR
         status = WriteBarFromRequest(request, file->u.bar);
         if (NT_SUCCESS(status)) {
             WdfRequestCompleteWithInformation(request, status, length);  // complete the request        }
@@ -378,7 +397,7 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
     case DEVNODE_TYPE_H2C:
         ASSERTMSG("no engine attached to file context", file->u.engine != NULL);
 
-        // תдУԺ EvtIoWriteDma()
+        // 将请求转发到写引擎队列，稍后它会进入 EvtIoWriteDma()
         status = WdfRequestForwardToIoQueue(request, file->queue);
         break;
     case DEVNODE_TYPE_C2H:
@@ -392,7 +411,7 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
         TraceInfo(DBG_IO, "Error Request 0x%p: %!STATUS!", request, status);
     }
 
-    return; // ֱɻת
+    return; // 请求已直接完成或转发到队列
 }
 
 static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
@@ -401,7 +420,7 @@ static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
     XDMA_PERF_DATA perfData = { 0 };
     EngineGetPerf(engine, &perfData);
 
-    // ȡȡݵ IO ڴľ
+    // 获取保存读取数据的 IO 请求内存的句柄
     WDFMEMORY requestMemory;
     NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
@@ -409,7 +428,7 @@ static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
         return status;
     }
 
-    //  perfData Ƶڴ
+    // 从 perfData 复制到请求内存中
     status = WdfMemoryCopyFromBuffer(requestMemory, 0, &perfData, sizeof(perfData));
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
@@ -425,7 +444,7 @@ static NTSTATUS IoctlGetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
     ULONG addrMode = (engine->regs->control & XDMA_CTRL_NON_INCR_ADDR) != 0; // 0 = inc, 1=non-inc
     TraceVerbose(DBG_IO, "addrMode=%u", addrMode);
 
-    // ȡIOڴľڴ潫ȡ
+    // 获取IO请求内存的句柄，该内存将保存读取的数据
     WDFMEMORY requestMemory;
     NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
@@ -433,7 +452,7 @@ static NTSTATUS IoctlGetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
         return status;
     }
 
-    // perfDataƵڴ
+    // 从perfData复制到请求内存中
     status = WdfMemoryCopyFromBuffer(requestMemory, 0, &addrMode, sizeof(addrMode));
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
@@ -447,7 +466,7 @@ static NTSTATUS IoctlSetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
 
     ASSERT(engine != NULL);
 
-    // ȡȡݵ IO ڴľ
+    // 获取保存读取数据的 IO 请求内存的句柄
     WDFMEMORY requestMemory;
     NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
@@ -456,7 +475,7 @@ static NTSTATUS IoctlSetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
     }
     ULONG addrMode = 0;
 
-    //  perfData Ƶڴ
+    // 从 perfData 复制到请求内存中
     status = WdfMemoryCopyToBuffer(requestMemory, 0, &addrMode, sizeof(addrMode));
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
@@ -475,210 +494,1395 @@ static NTSTATUS IoctlSetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
     return status;
 }
 
-// Ϊ SGDMA ܷ ioctl 
-VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t OutputBufferLength,
-                        IN size_t InputBufferLength, IN ULONG IoControlCode) {
+static NTSTATUS IoctlGetCompletion(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
 
-    UNREFERENCED_PARAMETER(Queue);
-    UNREFERENCED_PARAMETER(OutputBufferLength);
-    UNREFERENCED_PARAMETER(InputBufferLength);
+    ASSERT(engine != NULL);
+    XDMA_COMPLETION_INFO info = { 0 };
+    info.config.mode = engine->completionMode;
+    info.config.maxSpinUs = (ULONG)(engine->spin.maxSpinNs / 1000);
+    info.spinCompletions = engine->stats.spinCompletions;
+    info.interruptCompletions = engine->stats.interruptCompletions;
+    info.spinTimeouts = engine->stats.spinTimeouts;
 
-    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    PQUEUE_CONTEXT queue = GetQueueContext(file->queue);
-    NTSTATUS status = STATUS_NOT_SUPPORTED;
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
 
-    ASSERT(queue != NULL);
-    if (queue->engine == NULL) {
-        TraceError(DBG_IO, "IOCTL only supported on DMA files (hc2_* or c2h_* devices)");
-        status = STATUS_INVALID_PARAMETER;
-        goto exit;
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &info, sizeof(info));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
     }
 
-    // xdma_public.h ж ioctl 
+    return status;
+}
 
-    switch (IoControlCode) {
-    case IOCTL_XDMA_PERF_START:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_START",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        EngineStartPerf(queue->engine);
-        status = STATUS_SUCCESS;
-        WdfRequestComplete(request, status);
-        break;
-    case IOCTL_XDMA_PERF_GET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_GET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlGetPerf(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PERF_DATA));
-        }
-        break;
-    case IOCTL_XDMA_ADDRMODE_GET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_GET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlGetAddrMode(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
-        }
-        break;
-    case IOCTL_XDMA_ADDRMODE_SET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_SET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlSetAddrMode(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestComplete(request, STATUS_SUCCESS);
-        }
-        break;
-    default:
-        TraceError(DBG_IO, "Unknown IOCTL code!");
-        status = STATUS_NOT_SUPPORTED;
-        break;
+static NTSTATUS IoctlSetCompletion(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_COMPLETION_CONFIG config = { 0 };
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &config, sizeof(config));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
     }
 
-exit:
+    status = XDMA_EngineSetCompletionMode(engine, config.mode, config.maxSpinUs);
     if (!NT_SUCCESS(status)) {
-        WdfRequestComplete(request, status);
+        TraceError(DBG_IO, "XDMA_EngineSetCompletionMode failed: %!STATUS!", status);
+        return status;
     }
-    TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
-}
 
-VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
-// д I/O  SGDMA дʱĻص
-{
+    // same as on open - hybrid mode arms the interrupt when it stops spinning
+    if (engine->poll) {
+        EngineDisableInterrupt(engine);
+    } else {
+        EngineEnableInterrupt(engine);
+    }
 
-    UNREFERENCED_PARAMETER(length);
-    NTSTATUS status = STATUS_INTERNAL_ERROR;
-    PQUEUE_CONTEXT  queue = GetQueueContext(wdfQueue);
+    TraceVerbose(DBG_IO, "mode=%u, maxSpinUs=%u", config.mode, config.maxSpinUs);
 
-    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+    return status;
+}
 
-    XDMA_ENGINE* engine = queue->engine;
-    TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
-              DirectionToString(engine->dir), engine->channel, length);
+static NTSTATUS IoctlGetRxMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_RX_MODE_GET only supported on AXI-ST c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    ULONG mode = XDMA_RX_MODE_RING;
+    if (engine->rx.enabled) {
+        mode = XDMA_RX_MODE_POSTED;
+    } else if (engine->ring.timestamps) {
+        mode = XDMA_RX_MODE_PACKETS_TIMESTAMPS;
+    } else if (engine->ring.packetMode) {
+        mode = XDMA_RX_MODE_PACKETS;
+    }
 
-    // ʼ DMA  
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
-                                                     XDMA_EngineProgramDma,
-                                                     WdfDmaDirectionWriteToDevice);
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
     }
-    status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &mode, sizeof(mode));
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    TraceVerbose(DBG_IO, "rxMode=%u", mode);
+    return status;
+}
+
+static NTSTATUS IoctlGetRingStats(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_RING_STATS only supported on AXI-ST c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
     }
+    XDMA_RING_STATS stats;
+    EngineRingGetStats(engine, &stats);
 
-    // supply the Queue as context for EvtProgramDma 
-    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
     }
 
-    if (queue->engine->poll) {
-        status = EnginePollTransfer(queue->engine);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
-            // EnginePollTransfer ڷʱ/ת ErrExit
-        }
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
     }
 
-    return; // success
-ErrExit:
-    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
-    WdfRequestComplete(Request, status);
-    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+    TraceVerbose(DBG_IO, "occupancy=%u, credits=%u, stalls=%llu", stats.occupancy,
+                 stats.creditsHeld, stats.stalls);
+    return status;
 }
 
-VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
-// 
-{
-    UNREFERENCED_PARAMETER(length);
-    NTSTATUS status = STATUS_INTERNAL_ERROR;
-    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
-
-    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+static NTSTATUS IoctlSetRxMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
 
-    XDMA_ENGINE* engine = queue->engine;
-    TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
-              DirectionToString(engine->dir), engine->channel, length);
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_RX_MODE_SET only supported on AXI-ST c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
 
-    // ʼDMA
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
-                                                     XDMA_EngineProgramDma,
-                                                     WdfDmaDirectionReadFromDevice);
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!",
-                   status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
     }
-    status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+    ULONG mode = 0;
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &mode, sizeof(mode));
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
     }
 
-    // supply the Queue as context for EvtProgramDma
-    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+    status = EngineRxSetMode(engine, mode);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "EngineRxSetMode failed: %!STATUS!", status);
+        return status;
     }
 
-    if (queue->engine->poll) {
-        status = EnginePollTransfer(queue->engine);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
-            // EnginePollTransfer ڷʱ/ת ErrExit
-        }
+    TraceVerbose(DBG_IO, "rxMode=%u", mode);
+    return status;
+}
+
+static NTSTATUS IoctlSetRingOverrun(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_RING_OVERRUN only supported on AXI-ST c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    return; // success
-ErrExit:
-    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
-    WdfRequestComplete(Request, status);
-    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG policy = 0;
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &policy, sizeof(policy));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = EngineRingSetOverrun(engine, policy);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineRingSetOverrun failed: %!STATUS!", status);
+        return status;
+    }
+
+    TraceVerbose(DBG_IO, "overrunPolicy=%u", policy);
+    return status;
 }
 
-VOID EvtIoReadEngineRing(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length) {
-    NTSTATUS status = STATUS_UNSUCCESSFUL;
-    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
-    XDMA_ENGINE* engine = queue->engine;
+static NTSTATUS IoctlLoopCredit(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
 
-    // ȡ
-    WDFMEMORY outputMem;
-    status = WdfRequestRetrieveOutputMemory(Request, &outputMem);
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != H2C)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_LOOP_CREDIT only supported on AXI-ST h2c_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    // the number of slots to grant is optional - read it before the output overwrites it
+    ULONG numSlots = 0;
+    ULONG* input;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*input), (PVOID*)&input, NULL);
+    if (NT_SUCCESS(status)) {
+        numSlots = *input;
+    }
+
+    XDMA_TX_LOOP_STATUS* loopStatus;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(*loopStatus), (PVOID*)&loopStatus, NULL);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
-        WdfRequestCompleteWithInformation(Request, status, 0);
-        return;
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
     }
 
-    TraceInfo(DBG_IO, "%s_%u requesting %llu bytes from ring buffer",
-              DirectionToString(engine->dir), engine->channel, length);
+    status = EngineLoopCredit(engine, numSlots, loopStatus);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineLoopCredit failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
+}
 
-    LARGE_INTEGER timeout;
-    timeout.QuadPart = -3 * 10000000; // 3 second timeout
-    size_t numBytes = 0;
-    status = EngineRingCopyBytesToMemory(engine, outputMem, length, timeout, &numBytes);
+static NTSTATUS IoctlRingMap(IN WDFREQUEST request) {
 
-    WdfRequestCompleteWithInformation(Request, status, numBytes);
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    PFILE_CONTEXT file = GetFileContext(fileObject);
+    if ((file->devType != DEVNODE_TYPE_C2H) || (file->u.engine->type != EngineType_ST)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_RING_MAP only supported on AXI-ST c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    XDMA_RING_MAPPING* mapping;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(*mapping), (PVOID*)&mapping,
+                                                     NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = EngineRingMap(file->u.engine, fileObject, mapping);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineRingMap failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
 }
 
-VOID EvtCancelDma(IN WDFREQUEST request) {
-    PQUEUE_CONTEXT queue = GetQueueContext(WdfRequestGetIoQueue(request));
-    TraceInfo(DBG_IO, "Request 0x%p from Queue 0x%p", request, queue);
-    EngineStop(queue->engine);
-    NTSTATUS status = WdfRequestUnmarkCancelable(request);
+static NTSTATUS IoctlBufferRegister(IN WDFREQUEST request) {
+
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    PFILE_CONTEXT file = GetFileContext(fileObject);
+    if (((file->devType != DEVNODE_TYPE_H2C) && (file->devType != DEVNODE_TYPE_C2H)) ||
+        (file->u.engine->type != EngineType_MM)) {
+        TraceError(DBG_IO, "IOCTL_XDMA_BUFFER_REGISTER only supported on AXI-MM h2c_* and c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    XDMA_BUFFER_REGISTRATION* registration;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*registration),
+                                                    (PVOID*)&registration, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG* handle;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(*handle), (PVOID*)&handle, NULL);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestUnmarkCancelable failed: %!STATUS!", status);
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (registration->length > (UINT64)MAXSIZE_T) {
+        TraceError(DBG_IO, "buffer of %llu bytes too large", registration->length);
+        return STATUS_INVALID_PARAMETER;
     }
-    status = WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+
+    status = EngineRegisterBuffer(file->u.engine, fileObject, registration->address,
+                                  (size_t)registration->length, handle);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionRelease failed: %!STATUS!", status);
+        TraceError(DBG_IO, "EngineRegisterBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
+}
+
+static NTSTATUS CheckRegisteredVector(IN XDMA_ENGINE* engine, IN XDMA_REGISTERED_BUFFER* buffer,
+                                      IN const XDMA_IO_VECTOR* vector)
+// the vector within the buffer and the card address space, its descriptors (at most one per page
+// touched) within the descriptor store of a transfer
+{
+    const ULONG64 maxDescriptors =
+        (ULONG64)XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize) * XDMA_DESC_SEGMENT_CAPACITY;
+    if ((vector->length == 0) || (vector->offset > buffer->length) ||
+        (vector->length > buffer->length - vector->offset) ||
+        (vector->cardAddress + vector->length < vector->cardAddress) ||
+        (ADDRESS_AND_SIZE_TO_SPAN_PAGES((PUCHAR)MmGetMdlVirtualAddress(buffer->mdl) + vector->offset,
+                                        vector->length) > maxDescriptors)) {
+        TraceError(DBG_IO, "vector (offset=%u, length=%u, card address=0x%llx) invalid for a buffer of %u bytes",
+                   vector->offset, vector->length, vector->cardAddress, buffer->length);
+        return STATUS_INVALID_PARAMETER;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS IoctlProgramCreate(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    if (engine->type != EngineType_MM) {
+        TraceError(DBG_IO, "IOCTL_XDMA_PROGRAM_CREATE only supported on AXI-MM h2c_* and c2h_* devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
     }
-    WdfRequestComplete(request, STATUS_CANCELLED);
+
+    XDMA_REGISTERED_IO* io;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*io), (PVOID*)&io, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG* id;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(*id), (PVOID*)&id, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    XDMA_REGISTERED_BUFFER* buffer;
+    status = EngineReferenceBuffer(engine, fileObject, io->handle, &buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "buffer %u not registered: %!STATUS!", io->handle, status);
+        return status;
+    }
+    status = CheckRegisteredVector(engine, buffer, &io->vector);
+    if (!NT_SUCCESS(status)) {
+        EngineReleaseBuffer(engine, buffer);
+        return status;
+    }
+
+    // the program keeps the reference
+    status = EngineProgramCreate(engine, fileObject, buffer, &io->vector, id);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineProgramCreate failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
+}
+
+static NTSTATUS IoctlProgramRun(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ULONG* id;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*id), (PVOID*)&id, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = EngineProgramRun(engine, WdfRequestGetFileObject(request), *id);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineProgramRun failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the run is not waited for, but in poll mode nobody else picks its completion up
+    if (engine->poll) {
+        status = EnginePollTransfer(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
+            return status;
+        }
+    }
+    return status;
+}
+
+static NTSTATUS IoctlProgramBind(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    XDMA_PROGRAM_BINDING* binding;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*binding), (PVOID*)&binding,
+                                                    NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = EngineProgramBind(engine, WdfRequestGetFileObject(request), binding->program,
+                               binding->eventId);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineProgramBind failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
+}
+
+static NTSTATUS IoctlProgramWait(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    XDMA_PROGRAM_WAIT* wait;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(*wait), (PVOID*)&wait, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_PROGRAM_STATUS* programStatus;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(*programStatus),
+                                            (PVOID*)&programStatus, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the input buffer is the output buffer - copy the parameters first
+    const ULONG id = wait->program;
+    const UINT64 runs = wait->runs;
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = -3 * 10000000; // 3 second timeout, same as a read
+    status = EngineProgramWait(engine, WdfRequestGetFileObject(request), id, runs, timeout,
+                               programStatus);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineProgramWait failed: %!STATUS!", status);
+        return status;
+    }
+    return status;
+}
+
+// the ring is mapped into the address space of the process which asks for it and a registered
+// buffer is locked in it, so IOCTL_XDMA_RING_MAP and IOCTL_XDMA_BUFFER_REGISTER are handled before
+// the request is queued - everything else goes on to the queues
+VOID EvtIoInCallerContext(IN WDFDEVICE device, IN WDFREQUEST request) {
+
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+
+    NTSTATUS status;
+    if ((params.Type == WdfRequestTypeDeviceControl) &&
+        (params.Parameters.DeviceIoControl.IoControlCode == IOCTL_XDMA_RING_MAP)) {
+        status = IoctlRingMap(request);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_RING_MAPPING));
+        } else {
+            WdfRequestComplete(request, status);
+        }
+        return;
+    }
+    if ((params.Type == WdfRequestTypeDeviceControl) &&
+        (params.Parameters.DeviceIoControl.IoControlCode == IOCTL_XDMA_BUFFER_REGISTER)) {
+        status = IoctlBufferRegister(request);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
+        } else {
+            WdfRequestComplete(request, status);
+        }
+        return;
+    }
+
+    status = WdfDeviceEnqueueRequest(device, request);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDeviceEnqueueRequest failed: %!STATUS!", status);
+        WdfRequestComplete(request, status);
+    }
+}
+
+// 待办事项：为 SGDMA 和其他功能分离 ioctl 函数？
+VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t OutputBufferLength,
+                        IN size_t InputBufferLength, IN ULONG IoControlCode) {
+
+    UNREFERENCED_PARAMETER(Queue);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+    PQUEUE_CONTEXT queue = GetQueueContext(file->queue);
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+
+    ASSERT(queue != NULL);
+    if (queue->engine == NULL) {
+        TraceError(DBG_IO, "IOCTL only supported on DMA files (hc2_* or c2h_* devices)");
+        status = STATUS_INVALID_PARAMETER;
+        goto exit;
+    }
+
+    // xdma_public.h 中定义的 ioctl 代码
+
+    switch (IoControlCode) {
+    case IOCTL_XDMA_PERF_START:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_START",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        EngineStartPerf(queue->engine);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        break;
+    case IOCTL_XDMA_PERF_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetPerf(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PERF_DATA));
+        }
+        break;
+    case IOCTL_XDMA_ADDRMODE_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetAddrMode(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
+        }
+        break;
+    case IOCTL_XDMA_ADDRMODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetAddrMode(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_COMPLETION_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_COMPLETION_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetCompletion(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_COMPLETION_INFO));
+        }
+        break;
+    case IOCTL_XDMA_COMPLETION_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_COMPLETION_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetCompletion(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_RING_RELEASE:
+    {
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_RING_RELEASE",
+                     queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = -3 * 10000000; // 3 second timeout, same as a read
+        status = EngineRingRelease(queue->engine, timeout);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    }
+    case IOCTL_XDMA_RX_MODE_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_RX_MODE_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetRxMode(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
+        }
+        break;
+    case IOCTL_XDMA_RX_MODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_RX_MODE_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetRxMode(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_RING_OVERRUN:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_RING_OVERRUN",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetRingOverrun(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_RING_STATS:
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_RING_STATS",
+                     queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetRingStats(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_RING_STATS));
+        }
+        break;
+    case IOCTL_XDMA_SEND_PACKETS:
+    case IOCTL_XDMA_SEND_LOOP:
+        TraceVerbose(DBG_IO, "%s_%u %s", queue->engine->dir == H2C ? "H2C" : "C2H",
+                     queue->engine->channel, (IoControlCode == IOCTL_XDMA_SEND_LOOP) ?
+                     "IOCTL_XDMA_SEND_LOOP" : "IOCTL_XDMA_SEND_PACKETS");
+        if ((queue->engine->type != EngineType_ST) || (queue->engine->dir != H2C)) {
+            TraceError(DBG_IO, "packet sends only supported on AXI-ST h2c_* devices");
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+        // runs on the engine queue like a write, see EvtIoEngineControl()
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_WRITEV:
+    case IOCTL_XDMA_READV:
+        TraceVerbose(DBG_IO, "%s_%u %s", queue->engine->dir == H2C ? "H2C" : "C2H",
+                     queue->engine->channel, (IoControlCode == IOCTL_XDMA_WRITEV) ?
+                     "IOCTL_XDMA_WRITEV" : "IOCTL_XDMA_READV");
+        if ((queue->engine->type != EngineType_MM) ||
+            (queue->engine->dir != ((IoControlCode == IOCTL_XDMA_WRITEV) ? H2C : C2H))) {
+            TraceError(DBG_IO, "vectored writes only supported on AXI-MM h2c_*, reads on c2h_* devices");
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+        // runs on the engine queue like a read or write, see EvtIoEngineControl()
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_WRITE_2D:
+    case IOCTL_XDMA_READ_2D:
+        TraceVerbose(DBG_IO, "%s_%u %s", queue->engine->dir == H2C ? "H2C" : "C2H",
+                     queue->engine->channel, (IoControlCode == IOCTL_XDMA_WRITE_2D) ?
+                     "IOCTL_XDMA_WRITE_2D" : "IOCTL_XDMA_READ_2D");
+        if ((queue->engine->type != EngineType_MM) ||
+            (queue->engine->dir != ((IoControlCode == IOCTL_XDMA_WRITE_2D) ? H2C : C2H))) {
+            TraceError(DBG_IO, "strided writes only supported on AXI-MM h2c_*, reads on c2h_* devices");
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+        // runs on the engine queue like a read or write, see EvtIoEngineControl()
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_FILL:
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_FILL", queue->engine->dir == H2C ? "H2C" : "C2H",
+                     queue->engine->channel);
+        if ((queue->engine->type != EngineType_MM) || (queue->engine->dir != H2C)) {
+            TraceError(DBG_IO, "fills only supported on AXI-MM h2c_* devices");
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+        // runs on the engine queue like a write, see EvtIoEngineControl()
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_BUFFER_UNREGISTER:
+    {
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_BUFFER_UNREGISTER",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        ULONG* handle;
+        status = WdfRequestRetrieveInputBuffer(request, sizeof(*handle), (PVOID*)&handle, NULL);
+        if (NT_SUCCESS(status)) {
+            status = EngineUnregisterBuffer(queue->engine, WdfRequestGetFileObject(request), *handle);
+        }
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    }
+    case IOCTL_XDMA_WRITE_REGISTERED:
+    case IOCTL_XDMA_READ_REGISTERED:
+        TraceVerbose(DBG_IO, "%s_%u %s", queue->engine->dir == H2C ? "H2C" : "C2H",
+                     queue->engine->channel, (IoControlCode == IOCTL_XDMA_WRITE_REGISTERED) ?
+                     "IOCTL_XDMA_WRITE_REGISTERED" : "IOCTL_XDMA_READ_REGISTERED");
+        if ((queue->engine->type != EngineType_MM) ||
+            (queue->engine->dir != ((IoControlCode == IOCTL_XDMA_WRITE_REGISTERED) ? H2C : C2H))) {
+            TraceError(DBG_IO, "registered writes only supported on AXI-MM h2c_*, reads on c2h_* devices");
+            status = STATUS_INVALID_DEVICE_REQUEST;
+            break;
+        }
+        // runs on the engine queue like a read or write, see EvtIoEngineControl()
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_PROGRAM_CREATE:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_CREATE",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlProgramCreate(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
+        }
+        break;
+    case IOCTL_XDMA_PROGRAM_DELETE:
+    {
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_DELETE",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        ULONG* id;
+        status = WdfRequestRetrieveInputBuffer(request, sizeof(*id), (PVOID*)&id, NULL);
+        if (NT_SUCCESS(status)) {
+            status = EngineProgramDelete(queue->engine, WdfRequestGetFileObject(request), *id);
+        }
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    }
+    case IOCTL_XDMA_PROGRAM_RUN:
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_RUN",
+                     queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlProgramRun(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    case IOCTL_XDMA_PROGRAM_BIND:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_BIND",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlProgramBind(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    case IOCTL_XDMA_PROGRAM_WAIT:
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_WAIT",
+                     queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlProgramWait(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PROGRAM_STATUS));
+        }
+        break;
+    case IOCTL_XDMA_LOOP_CREDIT:
+        TraceVerbose(DBG_IO, "%s_%u IOCTL_XDMA_LOOP_CREDIT",
+                     queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlLoopCredit(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_TX_LOOP_STATUS));
+        }
+        break;
+    default:
+        TraceError(DBG_IO, "Unknown IOCTL code!");
+        status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+exit:
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(request, status);
+    }
+    TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
+}
+
+// what a request transfers besides a plain read or write of its buffer, see ExecuteDmaRequest()
+typedef struct DMA_REQUEST_SPEC_T {
+    const XDMA_DESC_PACKET* packets;    // packet table of a gather send
+    const XDMA_DESC_VECTOR* vectors;    // vector table of a vectored transfer
+    const XDMA_DESC_STRIDE* stride;     // rows of a strided transfer
+    const XDMA_IO_FILL* fill;           // range of a fill
+    XDMA_REGISTERED_BUFFER* registered; // buffer of the vector instead of the request buffer,
+                                        // referenced for the transfer
+    ULONG numPackets;                   // entries (rows) of the table
+    size_t packetBytes;                 // bytes of the table
+    const XDMA_TX_LOOP* loop;           // header of a cyclic send of the packets
+} DMA_REQUEST_SPEC;
+
+static BOOLEAN ParkForDescriptors(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                                  IN ULONG64 numDescriptors)
+// the descriptor stores of the engine start with one segment and grow when a request first needs
+// more. Common buffers are allocated at PASSIVE_LEVEL, so the request waits in the store queue
+// until EvtWorkItemGrowStores() has grown them and sends it back to the engine queue. Returns TRUE
+// if the request has been taken over.
+{
+    if (!EngineStoreTooSmall(engine, numDescriptors)) {
+        return FALSE;
+    }
+
+    DeviceContext* ctx = GetDeviceContext(engine->parentDevice->wdfDevice);
+    NTSTATUS status = WdfRequestForwardToIoQueue(Request, ctx->storeQueue);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+        return TRUE;
+    }
+    WdfWorkItemEnqueue(ctx->storeWorkItem);
+
+    TraceInfo(DBG_IO, "%s_%u request 0x%p waits for a descriptor store of %llu descriptors",
+              DirectionToString(engine->dir), engine->channel, Request, numDescriptors);
+    return TRUE;
+}
+
+VOID EvtWorkItemGrowStores(IN WDFWORKITEM workItem) {
+    DeviceContext* ctx = GetDeviceContext(WdfWorkItemGetParentObject(workItem));
+
+    WDFREQUEST request;
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(ctx->storeQueue, &request))) {
+        PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+        NTSTATUS status = EngineGrowStores(file->u.engine);
+        if (NT_SUCCESS(status)) { // presented again - it fits now
+            status = WdfRequestForwardToIoQueue(request, file->queue);
+        }
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "request 0x%p failed: %!STATUS!", request, status);
+            WdfRequestComplete(request, status);
+        }
+    }
+}
+
+static ULONG64 BufferDescriptors(IN XDMA_ENGINE* engine, IN PMDL mdl, IN size_t length)
+// descriptors of a read or write: at most one per page touched, of no more than the max transfer
+// size at a time (the framework splits longer requests)
+{
+    const ULONG64 numPages = ADDRESS_AND_SIZE_TO_SPAN_PAGES(MmGetMdlVirtualAddress(mdl), length);
+    return min(numPages, engine->parentDevice->maxTransferSize / PAGE_SIZE + 2);
+}
+
+static VOID ExecuteDmaRequest(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                              IN WDF_DMA_DIRECTION direction, IN const DMA_REQUEST_SPEC* spec)
+// start the dma transaction of a request on a transfer of the engine pipeline. spec is NULL for
+// plain reads and writes. A request on a registered buffer goes straight to its descriptors, it
+// has no dma transaction.
+{
+    static const DMA_REQUEST_SPEC plain = { 0 };
+    NTSTATUS status = STATUS_INTERNAL_ERROR;
+
+    if (spec == NULL) {
+        spec = &plain;
+    }
+
+    XDMA_TRANSFER* transfer = NULL;
+    if (spec->loop != NULL) {
+        status = EngineLoopAcquire(engine, Request, spec->numPackets,
+                                   (spec->loop->flags & XDMA_TX_LOOP_CREDITS) != 0, &transfer);
+    } else {
+        // the queue presents no more requests than the pipeline depth, unless a loop runs
+        transfer = EngineAcquireTransfer(engine, Request);
+        status = (transfer != NULL) ? STATUS_SUCCESS : STATUS_DEVICE_BUSY;
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "%s_%u no transfer available: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, status);
+        if (spec->registered != NULL) {
+            EngineReleaseBuffer(engine, spec->registered);
+        }
+        WdfRequestComplete(Request, status);
+        return;
+    }
+    transfer->packets = spec->packets;
+    transfer->vectors = spec->vectors;
+    transfer->stride = spec->stride;
+    if (spec->fill != NULL) {
+        transfer->fill.deviceAddr = spec->fill->cardAddress;
+        transfer->fill.numBytes = spec->fill->length;
+    }
+    transfer->registered = spec->registered;
+    transfer->numPackets = spec->numPackets;
+    transfer->packetBytes = spec->packetBytes;
+
+    if (transfer->registered != NULL) { // mapped at registration - no transaction to set up
+        status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
+            EngineReleaseBuffer(engine, transfer->registered);
+            transfer->registered = NULL;
+            goto ErrExit;
+        }
+        EngineProgramRegistered(engine, transfer);
+    } else {
+        // 根据请求初始化 DMA 事务
+        status = WdfDmaTransactionInitializeUsingRequest(transfer->dmaTransaction, Request,
+                                                         XDMA_EngineProgramDma, direction);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
+            goto ErrExit;
+        }
+        status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
+            WdfDmaTransactionRelease(transfer->dmaTransaction);
+            goto ErrExit;
+        }
+
+        // supply the transfer as context for EvtProgramDma
+        status = WdfDmaTransactionExecute(transfer->dmaTransaction, transfer);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
+            // the request is cancelable by now - release and complete it via the engine
+            EngineCompleteTransfer(engine, transfer, status);
+            return;
+        }
+    }
+
+    if (spec->loop != NULL) { // runs until cancelled - nothing to wait for
+        EngineLoopStarted(engine, transfer);
+        return;
+    }
+
+    if (engine->poll) {
+        status = EnginePollTransfer(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
+            // EnginePollTransfer 在发生错误时清理/完成请求，因此无需转到 ErrExit
+        }
+    }
+
+    return; // success
+ErrExit:
+    EngineReleaseTransfer(engine, transfer);
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
+// 写入 I/O 请求进入 SGDMA 写队列时的回调
+{
+    PQUEUE_CONTEXT  queue = GetQueueContext(wdfQueue);
+
+    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+
+    XDMA_ENGINE* engine = queue->engine;
+    TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
+              DirectionToString(engine->dir), engine->channel, length);
+
+    PMDL mdl;
+    if (NT_SUCCESS(WdfRequestRetrieveInputWdmMdl(Request, &mdl)) &&
+        ParkForDescriptors(engine, Request, BufferDescriptors(engine, mdl, length))) {
+        return;
+    }
+    ExecuteDmaRequest(engine, Request, WdfDmaDirectionWriteToDevice, NULL);
+}
+
+static VOID IoSendPackets(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                          IN size_t OutputBufferLength, IN ULONG IoControlCode)
+// gather send on the AXI-ST H2C engine queue: all packets of the table go out in one run of the
+// engine - or, for IOCTL_XDMA_SEND_LOOP, in a circle of runs until the request is cancelled
+{
+    NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
+
+    // the packet table of a loop follows its header
+    const size_t headerLength =
+        (IoControlCode == IOCTL_XDMA_SEND_LOOP) ? sizeof(XDMA_TX_LOOP) : 0;
+    PUCHAR input;
+    size_t inputLength;
+    status = WdfRequestRetrieveInputBuffer(Request, headerLength + sizeof(XDMA_TX_PACKET),
+                                           (PVOID*)&input, &inputLength);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    const XDMA_TX_LOOP* loop = (headerLength > 0) ? (const XDMA_TX_LOOP*)input : NULL;
+    XDMA_TX_PACKET* packets = (XDMA_TX_PACKET*)(input + headerLength);
+    const size_t tableLength = inputLength - headerLength;
+    if ((loop != NULL) && (loop->flags & ~XDMA_TX_LOOP_CREDITS)) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "invalid loop flags 0x%x: %!STATUS!", loop->flags, status);
+        goto ErrExit;
+    }
+    PMDL mdl;
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputWdmMdl failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // the buffer goes to the engine as a single dma transfer
+    if (OutputBufferLength > engine->parentDevice->maxTransferSize) {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        TraceError(DBG_IO, "%s_%u buffer of %llu bytes exceeds the max transfer size: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, OutputBufferLength, status);
+        goto ErrExit;
+    }
+
+    // every packet within the buffer, their descriptors (at most one per page touched) within the
+    // descriptor store of a transfer
+    const ULONG numPackets = (ULONG)(tableLength / sizeof(XDMA_TX_PACKET));
+    const ULONG64 maxDescriptors =
+        (ULONG64)XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize) * XDMA_DESC_SEGMENT_CAPACITY;
+    PUCHAR bufferVA = (PUCHAR)MmGetMdlVirtualAddress(mdl);
+    ULONG64 numDescriptors = 0;
+    size_t packetBytes = 0;
+    for (ULONG i = 0; i < numPackets; ++i) {
+        if ((packets[i].length == 0) || (packets[i].offset > OutputBufferLength) ||
+            (packets[i].length > OutputBufferLength - packets[i].offset)) {
+            status = STATUS_INVALID_PARAMETER;
+            TraceError(DBG_IO, "packet %u (offset=%u, length=%u) outside of the buffer: %!STATUS!",
+                       i, packets[i].offset, packets[i].length, status);
+            goto ErrExit;
+        }
+        numDescriptors += ADDRESS_AND_SIZE_TO_SPAN_PAGES(bufferVA + packets[i].offset,
+                                                         packets[i].length);
+        packetBytes += packets[i].length;
+    }
+    if (numDescriptors > maxDescriptors) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "%u packets need up to %llu descriptors, max %llu: %!STATUS!",
+                   numPackets, numDescriptors, maxDescriptors, status);
+        goto ErrExit;
+    }
+    if (ParkForDescriptors(engine, Request, numDescriptors)) {
+        return;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u sending %u packets, %llu bytes%s",
+              DirectionToString(engine->dir), engine->channel, numPackets, packetBytes,
+              (loop != NULL) ? " in a loop" : "");
+
+    DMA_REQUEST_SPEC spec = { 0 };
+    spec.packets = (const XDMA_DESC_PACKET*)packets;
+    spec.numPackets = numPackets;
+    spec.packetBytes = packetBytes;
+    spec.loop = loop;
+    ExecuteDmaRequest(engine, Request, WdfDmaDirectionWriteToDevice, &spec);
+    return;
+
+ErrExit:
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+static VOID IoTransferVectors(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                              IN size_t OutputBufferLength, IN ULONG IoControlCode)
+// vectored transfer on an AXI-MM engine queue: all vectors of the table go to (IOCTL_XDMA_WRITEV)
+// or come from (IOCTL_XDMA_READV) their card addresses in one run of the engine
+{
+    const WDF_DMA_DIRECTION direction = (IoControlCode == IOCTL_XDMA_WRITEV) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+
+    XDMA_IO_VECTOR* vectors;
+    size_t tableLength;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(Request, sizeof(XDMA_IO_VECTOR),
+                                                    (PVOID*)&vectors, &tableLength);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    PMDL mdl;
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputWdmMdl failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // the buffer goes to the engine as a single dma transfer
+    if (OutputBufferLength > engine->parentDevice->maxTransferSize) {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        TraceError(DBG_IO, "%s_%u buffer of %llu bytes exceeds the max transfer size: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, OutputBufferLength, status);
+        goto ErrExit;
+    }
+
+    // every vector within the buffer and the card address space, their descriptors (at most one
+    // per page touched) within the descriptor store of a transfer
+    const ULONG numVectors = (ULONG)(tableLength / sizeof(XDMA_IO_VECTOR));
+    const ULONG64 maxDescriptors =
+        (ULONG64)XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize) * XDMA_DESC_SEGMENT_CAPACITY;
+    PUCHAR bufferVA = (PUCHAR)MmGetMdlVirtualAddress(mdl);
+    ULONG64 numDescriptors = 0;
+    size_t vectorBytes = 0;
+    for (ULONG i = 0; i < numVectors; ++i) {
+        if ((vectors[i].length == 0) || (vectors[i].offset > OutputBufferLength) ||
+            (vectors[i].length > OutputBufferLength - vectors[i].offset) ||
+            (vectors[i].cardAddress + vectors[i].length < vectors[i].cardAddress)) {
+            status = STATUS_INVALID_PARAMETER;
+            TraceError(DBG_IO, "vector %u (offset=%u, length=%u, card address=0x%llx) invalid: %!STATUS!",
+                       i, vectors[i].offset, vectors[i].length, vectors[i].cardAddress, status);
+            goto ErrExit;
+        }
+        numDescriptors += ADDRESS_AND_SIZE_TO_SPAN_PAGES(bufferVA + vectors[i].offset,
+                                                         vectors[i].length);
+        vectorBytes += vectors[i].length;
+    }
+    if (numDescriptors > maxDescriptors) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "%u vectors need up to %llu descriptors, max %llu: %!STATUS!",
+                   numVectors, numDescriptors, maxDescriptors, status);
+        goto ErrExit;
+    }
+    if (ParkForDescriptors(engine, Request, numDescriptors)) {
+        return;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u %s %u vectors, %llu bytes", DirectionToString(engine->dir),
+              engine->channel, (direction == WdfDmaDirectionWriteToDevice) ? "writing" : "reading",
+              numVectors, vectorBytes);
+
+    DMA_REQUEST_SPEC spec = { 0 };
+    spec.vectors = (const XDMA_DESC_VECTOR*)vectors;
+    spec.numPackets = numVectors;
+    spec.packetBytes = vectorBytes;
+    ExecuteDmaRequest(engine, Request, direction, &spec);
+    return;
+
+ErrExit:
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+static VOID IoTransferStrided(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                              IN size_t OutputBufferLength, IN ULONG IoControlCode)
+// strided transfer on an AXI-MM engine queue: all rows of the rectangle go to (IOCTL_XDMA_WRITE_2D)
+// or come from (IOCTL_XDMA_READ_2D) card memory in one run of the engine
+{
+    const WDF_DMA_DIRECTION direction = (IoControlCode == IOCTL_XDMA_WRITE_2D) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+
+    XDMA_IO_STRIDE* stride;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(Request, sizeof(XDMA_IO_STRIDE),
+                                                    (PVOID*)&stride, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    PMDL mdl;
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputWdmMdl failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // the buffer goes to the engine as a single dma transfer
+    if (OutputBufferLength > engine->parentDevice->maxTransferSize) {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        TraceError(DBG_IO, "%s_%u buffer of %llu bytes exceeds the max transfer size: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, OutputBufferLength, status);
+        goto ErrExit;
+    }
+
+    // every row within the buffer and the card address space
+    const ULONG64 lastOffset = stride->offset + (ULONG64)(stride->rows - 1) * stride->hostPitch;
+    if ((stride->rows == 0) || (stride->rowBytes == 0) || (lastOffset > OutputBufferLength) ||
+        (stride->rowBytes > OutputBufferLength - lastOffset) ||
+        (stride->cardAddress + stride->rowBytes < stride->cardAddress) ||
+        ((stride->cardPitch != 0) && (stride->rows - 1 >
+            (MAXULONG64 - stride->cardAddress - stride->rowBytes) / stride->cardPitch))) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "%u rows of %u bytes (offset=%u, pitch=%u, card address=0x%llx, "
+                   "pitch=%llu) invalid: %!STATUS!", stride->rows, stride->rowBytes,
+                   stride->offset, stride->hostPitch, stride->cardAddress, stride->cardPitch,
+                   status);
+        goto ErrExit;
+    }
+
+    // their descriptors (at most one per page touched, densely packed rows are one range) within
+    // the descriptor store of a transfer
+    const ULONG64 maxDescriptors =
+        (ULONG64)XDMA_DESC_SEGMENTS(engine->parentDevice->maxTransferSize) * XDMA_DESC_SEGMENT_CAPACITY;
+    const ULONG64 numBytes = (ULONG64)stride->rows * stride->rowBytes;
+    PUCHAR bufferVA = (PUCHAR)MmGetMdlVirtualAddress(mdl) + stride->offset;
+    ULONG64 numDescriptors = 0;
+    if ((stride->hostPitch == stride->rowBytes) && (stride->cardPitch == stride->rowBytes)) {
+        numDescriptors = ADDRESS_AND_SIZE_TO_SPAN_PAGES(bufferVA, numBytes);
+    } else {
+        for (ULONG row = 0; (row < stride->rows) && (numDescriptors <= maxDescriptors); ++row) {
+            numDescriptors += ADDRESS_AND_SIZE_TO_SPAN_PAGES(bufferVA + (SIZE_T)row * stride->hostPitch,
+                                                             stride->rowBytes);
+        }
+    }
+    if (numDescriptors > maxDescriptors) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "%u rows need more than %llu descriptors: %!STATUS!",
+                   stride->rows, maxDescriptors, status);
+        goto ErrExit;
+    }
+    if (ParkForDescriptors(engine, Request, numDescriptors)) {
+        return;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u %s %u rows, %llu bytes", DirectionToString(engine->dir),
+              engine->channel, (direction == WdfDmaDirectionWriteToDevice) ? "writing" : "reading",
+              stride->rows, numBytes);
+
+    DMA_REQUEST_SPEC spec = { 0 };
+    spec.stride = (const XDMA_DESC_STRIDE*)stride;
+    spec.numPackets = stride->rows;
+    spec.packetBytes = (size_t)numBytes;
+    ExecuteDmaRequest(engine, Request, direction, &spec);
+    return;
+
+ErrExit:
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+static VOID IoFill(IN XDMA_ENGINE* engine, IN WDFREQUEST Request, IN size_t OutputBufferLength)
+// card memory fill on an AXI-MM H2C engine queue: the pattern is the only host memory, every
+// descriptor sources it. Long fills run in stages of a descriptor store each.
+{
+    XDMA_IO_FILL* fill;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(Request, sizeof(XDMA_IO_FILL), (PVOID*)&fill,
+                                                    NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // a pattern of up to a page spans two pages at most, see XDMA_FILL
+    if ((OutputBufferLength == 0) || (OutputBufferLength > PAGE_SIZE) || (fill->length == 0) ||
+        (fill->cardAddress + fill->length < fill->cardAddress) ||
+        (fill->length > (ULONG64)MAXSIZE_T)) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "fill of %llu bytes at 0x%llx with a pattern of %llu bytes invalid: %!STATUS!",
+                   fill->length, fill->cardAddress, OutputBufferLength, status);
+        goto ErrExit;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u filling %llu bytes at 0x%llx with a pattern of %llu bytes",
+              DirectionToString(engine->dir), engine->channel, fill->length, fill->cardAddress,
+              OutputBufferLength);
+
+    DMA_REQUEST_SPEC spec = { 0 };
+    spec.fill = fill;
+    ExecuteDmaRequest(engine, Request, WdfDmaDirectionWriteToDevice, &spec);
+    return;
+
+ErrExit:
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+static VOID IoTransferRegistered(IN XDMA_ENGINE* engine, IN WDFREQUEST Request,
+                                 IN ULONG IoControlCode)
+// transfer on a registered buffer on an AXI-MM engine queue: the buffer has been locked and mapped
+// by IOCTL_XDMA_BUFFER_REGISTER, so the vector goes straight to the descriptors of a transfer
+{
+    const WDF_DMA_DIRECTION direction = (IoControlCode == IOCTL_XDMA_WRITE_REGISTERED) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+
+    XDMA_REGISTERED_BUFFER* buffer = NULL;
+    XDMA_REGISTERED_IO* io;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(Request, sizeof(XDMA_REGISTERED_IO),
+                                                    (PVOID*)&io, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // the buffer stays mapped while the transfer holds a reference of it
+    status = EngineReferenceBuffer(engine, WdfRequestGetFileObject(Request), io->handle, &buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "%s_%u buffer %u not registered: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, io->handle, status);
+        goto ErrExit;
+    }
+    const XDMA_IO_VECTOR* vector = &io->vector;
+    status = CheckRegisteredVector(engine, buffer, vector);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    if (ParkForDescriptors(engine, Request,
+                           ADDRESS_AND_SIZE_TO_SPAN_PAGES((PUCHAR)MmGetMdlVirtualAddress(buffer->mdl) +
+                                                          vector->offset, vector->length))) {
+        EngineReleaseBuffer(engine, buffer); // referenced again when the request comes back
+        return;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u %s %u bytes of buffer %u", DirectionToString(engine->dir),
+              engine->channel, (direction == WdfDmaDirectionWriteToDevice) ? "writing" : "reading",
+              vector->length, io->handle);
+
+    DMA_REQUEST_SPEC spec = { 0 };
+    spec.vectors = (const XDMA_DESC_VECTOR*)vector;
+    spec.registered = buffer;
+    spec.numPackets = 1;
+    spec.packetBytes = vector->length;
+    ExecuteDmaRequest(engine, Request, direction, &spec);
+    return;
+
+ErrExit:
+    if (buffer != NULL) {
+        EngineReleaseBuffer(engine, buffer);
+    }
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+VOID EvtIoEngineControl(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request,
+                        IN size_t OutputBufferLength, IN size_t InputBufferLength,
+                        IN ULONG IoControlCode)
+// transfers forwarded to the engine queue by EvtIoDeviceControl() - they run in the pipeline of
+// the engine like reads and writes
+{
+    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    switch (IoControlCode) {
+    case IOCTL_XDMA_SEND_PACKETS:
+    case IOCTL_XDMA_SEND_LOOP:
+        IoSendPackets(queue->engine, Request, OutputBufferLength, IoControlCode);
+        break;
+    case IOCTL_XDMA_WRITEV:
+    case IOCTL_XDMA_READV:
+        IoTransferVectors(queue->engine, Request, OutputBufferLength, IoControlCode);
+        break;
+    case IOCTL_XDMA_WRITE_2D:
+    case IOCTL_XDMA_READ_2D:
+        IoTransferStrided(queue->engine, Request, OutputBufferLength, IoControlCode);
+        break;
+    case IOCTL_XDMA_FILL:
+        IoFill(queue->engine, Request, OutputBufferLength);
+        break;
+    case IOCTL_XDMA_WRITE_REGISTERED:
+    case IOCTL_XDMA_READ_REGISTERED:
+        IoTransferRegistered(queue->engine, Request, IoControlCode);
+        break;
+    default:
+        TraceError(DBG_IO, "Unknown IOCTL code!");
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        break;
+    }
+}
+
+VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
+// 
+{
+    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+
+    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+
+    XDMA_ENGINE* engine = queue->engine;
+    TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
+              DirectionToString(engine->dir), engine->channel, length);
+
+    PMDL mdl;
+    if (NT_SUCCESS(WdfRequestRetrieveOutputWdmMdl(Request, &mdl)) &&
+        ParkForDescriptors(engine, Request, BufferDescriptors(engine, mdl, length))) {
+        return;
+    }
+    ExecuteDmaRequest(engine, Request, WdfDmaDirectionReadFromDevice, NULL);
+}
+
+static VOID PostReceiveRequest(IN XDMA_ENGINE* engine, IN WDFREQUEST Request, IN size_t length)
+// post the buffer of a read request to the AXI-ST C2H ring - completed once the engine filled it
+{
+    NTSTATUS status = STATUS_INTERNAL_ERROR;
+
+    // the buffer goes to the engine in one piece: a single dma transfer and no more ring slots
+    // than the ring has
+    PMDL mdl;
+    status = WdfRequestRetrieveOutputWdmMdl(Request, &mdl);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputWdmMdl failed: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+    if ((length > engine->parentDevice->maxTransferSize) ||
+        (ADDRESS_AND_SIZE_TO_SPAN_PAGES(MmGetMdlVirtualAddress(mdl), length) > engine->ring.numBlocks)) {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        TraceError(DBG_IO, "%s_%u buffer of %llu bytes too large to post: %!STATUS!",
+                   DirectionToString(engine->dir), engine->channel, length, status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    XDMA_RX_POST* post = EngineRxAcquire(engine, Request);
+    if (post == NULL) { // the queue presents no more requests than the depth
+        status = STATUS_DEVICE_BUSY;
+        TraceError(DBG_IO, "EngineRxAcquire failed: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    status = WdfDmaTransactionInitializeUsingRequest(post->dmaTransaction, Request,
+                                                     XDMA_EngineProgramRxPost,
+                                                     WdfDmaDirectionReadFromDevice);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    status = WdfRequestMarkCancelableEx(Request, EvtCancelRxPost);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
+        WdfDmaTransactionRelease(post->dmaTransaction);
+        goto ErrExit;
+    }
+
+    // supply the post as context for EvtProgramDma
+    status = WdfDmaTransactionExecute(post->dmaTransaction, post);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
+        // the request is cancelable by now - release and complete it via the engine
+        EngineRxComplete(engine, post, status);
+    }
+    return;
+
+ErrExit:
+    EngineRxRelease(engine, post);
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+VOID EvtIoReadEngineRing(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length) {
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
+    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+    XDMA_ENGINE* engine = queue->engine;
+
+    if (engine->rx.enabled) { // the buffer of the request becomes part of the ring
+        PostReceiveRequest(engine, Request, length);
+        return;
+    }
+
+    // 获取输出缓冲区
+    WDFMEMORY outputMem;
+    status = WdfRequestRetrieveOutputMemory(Request, &outputMem);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        WdfRequestCompleteWithInformation(Request, status, 0);
+        return;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u requesting %llu bytes from ring buffer",
+              DirectionToString(engine->dir), engine->channel, length);
+
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = -3 * 10000000; // 3 second timeout
+    size_t numBytes = 0;
+    status = EngineRingCopyBytesToMemory(engine, outputMem, length, timeout, &numBytes);
+
+    WdfRequestCompleteWithInformation(Request, status, numBytes);
+}
+
+VOID EvtCancelDma(IN WDFREQUEST request) {
+    PQUEUE_CONTEXT queue = GetQueueContext(WdfRequestGetIoQueue(request));
+    TraceInfo(DBG_IO, "Request 0x%p from Queue 0x%p", request, queue);
+    EngineCancelTransfer(queue->engine, request);
+}
+
+VOID EvtCancelRxPost(IN WDFREQUEST request) {
+    PQUEUE_CONTEXT queue = GetQueueContext(WdfRequestGetIoQueue(request));
+    TraceInfo(DBG_IO, "Request 0x%p from Queue 0x%p", request, queue);
+    EngineRxCancel(queue->engine, request);
 }
 
 VOID EvtCancelReadUserEvent(IN WDFREQUEST request) {
@@ -710,7 +1914,7 @@ NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length) {
     //    goto Exit;
     //}
 
-    // ȴ¼ - ʱش
+    // 等待事件发生 - 超时返回错误
     PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
     KEVENT* event = (KEVENT*)file->u.event->userData;
     KeClearEvent(event);
@@ -738,7 +1942,7 @@ NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length) {
         goto Exit;
     }
 
-    // ûж¼ǵڲƵ WdfMemory
+    // 将用户中断事件从我们的内部缓冲区复制到 WdfMemory
     status = WdfMemoryCopyFromBuffer(outputMem, 0, &eventValue, bufSize);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
@@ -760,8 +1964,8 @@ VOID HandleUserEvent(ULONG eventId, void* userData) {
 
     TraceInfo(DBG_IO, "event_%u signaling completion", eventId);
     /*
-    KePulseEvent ¼źš֪ͨȴ¼̣߳
-    ʾ¼ѷIO_NO_INCREMENT ʾ¼ļFALSE ʾ¼Ϊź״̬
+    KePulseEvent 函数对事件对象进行脉冲信号。这会通知等待该事件的线程，
+    表示事件已发生。IO_NO_INCREMENT 参数表示不增加事件的计数，FALSE 表示不设置事件为信号状态。
     */
     KePulseEvent(event, IO_NO_INCREMENT, FALSE);
 }
@@ -32,7 +32,7 @@ typedef enum {
     ID_DEVNODE_UNKNOWN = 255,
 } DEVNODE_TYPE;
 
-// ļ
+// 文件上下文数据
 typedef struct _FILE_CONTEXT {
     DEVNODE_TYPE devType;
     union {
@@ -54,13 +54,16 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext)
 EVT_WDF_DEVICE_FILE_CREATE          EvtDeviceFileCreate;
 EVT_WDF_FILE_CLOSE                  EvtFileClose;
 EVT_WDF_FILE_CLEANUP                EvtFileCleanup;
+EVT_WDF_IO_IN_CALLER_CONTEXT        EvtIoInCallerContext;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  EvtIoDeviceControl;
 EVT_WDF_IO_QUEUE_IO_READ			EvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE			EvtIoWrite;
 
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadDma;
 EVT_WDF_IO_QUEUE_IO_WRITE   EvtIoWriteDma;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EvtIoEngineControl;
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadEngineRing;
+EVT_WDF_WORKITEM            EvtWorkItemGrowStores;
 
 NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length);
 VOID HandleUserEvent(ULONG eventId, void* userData);
\ No newline at end of file
@@ -63,7 +63,7 @@
 // end_wpp
 //
 
-// WPP ڷбá˴ͺ
+// WPP 跟踪在发布配置中被禁用。因此存根定义和函数
 #ifndef DBG
 #define WPP_INIT_TRACING(...)  (__VA_ARGS__)
 #define WPP_CLEANUP(...)       (__VA_ARGS__)